@@ -1,6 +1,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
 #include <alsa/asoundlib.h>
 #include "alsa.h"
 #include "util.h"
@@ -12,15 +15,34 @@ struct alsa_enc_info {
 	int bytes, prec, can_dither;
 	void (*write_func)(sample_t *, char *, ssize_t);
 	void (*read_func)(char *, sample_t *, ssize_t);
+	void (*out_func)(struct out_stage *, sample_t *, char *, ssize_t);
+};
+
+#define ALSA_FILL_BINS  10
+#define ALSA_XRUN_TIMES 8
+
+struct alsa_stats {
+	long xruns, wakeups;
+	snd_pcm_uframes_t min_fill;
+	long fill_hist[ALSA_FILL_BINS];  /* buffer fill when frames were transferred */
+	double xrun_times[ALSA_XRUN_TIMES];  /* seconds since the first transfer; ring buffer */
+	int started;
+	struct timespec start;
 };
 
 struct alsa_state {
 	snd_pcm_t *dev;
 	struct alsa_enc_info *enc_info;
 	snd_pcm_sframes_t delay;
+	snd_pcm_uframes_t buf_frames, period_frames, start_frames, avail_min;
+	struct pollfd *pfds;
+	int n_pfds, is_playback;
+	struct alsa_stats stats;
+	char *retry_buf;  /* for alsa_mmap_write(); holds one period */
 };
 
 static const char codec_name[] = "alsa";
+static const char mmap_type[] = "alsa_mmap";
 
 static int alsa_prepare_device(struct alsa_state *state)
 {
@@ -30,6 +52,97 @@ static int alsa_prepare_device(struct alsa_state *state)
 	return err;
 }
 
+static void alsa_stats_start(struct alsa_stats *stats)
+{
+	if (!stats->started) {
+		clock_gettime(CLOCK_MONOTONIC, &stats->start);
+		stats->started = 1;
+	}
+}
+
+static double alsa_stats_elapsed(struct alsa_stats *stats)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - stats->start.tv_sec) + (now.tv_nsec - stats->start.tv_nsec) / 1e9;
+}
+
+/* Counts the xrun if err is -EPIPE and tries to recover from err. Returns a
+   negative error code if recovery failed. */
+static int alsa_recover(struct alsa_state *state, int err)
+{
+	struct alsa_stats *stats = &state->stats;
+	if (err == -EPIPE) {
+		stats->xrun_times[stats->xruns % ALSA_XRUN_TIMES] = alsa_stats_elapsed(stats);
+		++stats->xruns;
+		LOG_FMT(LL_ERROR, "%s: warning: %s occurred at %.3fs (%ld total)", codec_name,
+			(state->is_playback) ? "underrun" : "overrun", alsa_stats_elapsed(stats), stats->xruns);
+	}
+	if ((err = snd_pcm_recover(state->dev, err, 1)) < 0)
+		LOG_FMT(LL_ERROR, "%s: error: %s failed: %s", codec_name, (state->is_playback) ? "write" : "read", snd_strerror(err));
+	return err;
+}
+
+/* Sleeps in poll() until the device signals that at least avail_min frames
+   can be written */
+static int alsa_poll(struct alsa_state *state)
+{
+	int err;
+	unsigned short revents;
+	for (;;) {
+		if (poll(state->pfds, state->n_pfds, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		if ((err = snd_pcm_poll_descriptors_revents(state->dev, state->pfds, state->n_pfds, &revents)) < 0)
+			return err;
+		if (revents & POLLERR)
+			return (snd_pcm_state(state->dev) == SND_PCM_STATE_SUSPENDED) ? -ESTRPIPE : -EPIPE;
+		if (revents & POLLOUT) {
+			++state->stats.wakeups;
+			return 0;
+		}
+	}
+}
+
+/* Returns the number of frames (at most frames) that can be written without
+   blocking. If the device is running and fewer than both frames and
+   avail_min frames are free, waits for the next wakeup first. */
+static snd_pcm_sframes_t alsa_wait_avail(struct alsa_state *state, snd_pcm_uframes_t frames)
+{
+	int err;
+	snd_pcm_sframes_t avail;
+	snd_pcm_uframes_t fill;
+	struct alsa_stats *stats = &state->stats;
+	for (;;) {
+		if ((avail = snd_pcm_avail_update(state->dev)) < 0)
+			return avail;
+		switch (snd_pcm_state(state->dev)) {
+		case SND_PCM_STATE_XRUN:
+			return -EPIPE;
+		case SND_PCM_STATE_SUSPENDED:
+			return -ESTRPIPE;
+		case SND_PCM_STATE_RUNNING:
+			if ((snd_pcm_uframes_t) avail < frames && (snd_pcm_uframes_t) avail < state->avail_min) {
+				if ((err = alsa_poll(state)) < 0)
+					return err;
+				continue;
+			}
+			fill = ((snd_pcm_uframes_t) avail < state->buf_frames) ? state->buf_frames - avail : 0;
+			stats->min_fill = MINIMUM(stats->min_fill, fill);
+			++stats->fill_hist[MINIMUM(fill * ALSA_FILL_BINS / state->buf_frames, ALSA_FILL_BINS - 1)];
+			return MINIMUM((snd_pcm_uframes_t) avail, frames);
+		default:
+			/* the device starts by itself once start_frames are queued */
+			if (avail > 0)
+				return MINIMUM((snd_pcm_uframes_t) avail, frames);
+			if ((err = snd_pcm_start(state->dev)) < 0)
+				return err;
+		}
+	}
+}
+
 ssize_t alsa_read(struct codec *c, sample_t *buf, ssize_t frames)
 {
 	ssize_t n;
@@ -37,17 +150,13 @@ ssize_t alsa_read(struct codec *c, sample_t *buf, ssize_t frames)
 
 	if (snd_pcm_state(state->dev) == SND_PCM_STATE_SETUP && alsa_prepare_device(state) < 0)
 		return 0;
+	alsa_stats_start(&state->stats);
 
 	try_again:
 	n = snd_pcm_readi(state->dev, (char *) buf, frames);
 	if (n < 0) {
-		if (n == -EPIPE)
-			LOG_FMT(LL_ERROR, "%s: warning: overrun occurred", codec_name);
-		n = snd_pcm_recover(state->dev, n, 1);
-		if (n < 0) {
-			LOG_FMT(LL_ERROR, "%s: error: read failed", codec_name);
+		if (alsa_recover(state, n) < 0)
 			return 0;
-		}
 		else
 			goto try_again;
 	}
@@ -57,27 +166,91 @@ ssize_t alsa_read(struct codec *c, sample_t *buf, ssize_t frames)
 
 ssize_t alsa_write(struct codec *c, sample_t *buf, ssize_t frames)
 {
-	ssize_t n;
+	ssize_t written = 0;
+	snd_pcm_sframes_t n;
 	struct alsa_state *state = (struct alsa_state *) c->data;
+	const size_t frame_bytes = state->enc_info->bytes * c->channels;
 
 	if (snd_pcm_state(state->dev) == SND_PCM_STATE_SETUP && alsa_prepare_device(state) < 0)
 		return 0;
+	alsa_stats_start(&state->stats);
 
-	state->enc_info->write_func(buf, (char * ) buf, frames * c->channels);
-	try_again:
-	n = snd_pcm_writei(state->dev, buf, frames);
-	if (n < 0) {
-		if (n == -EPIPE)
-			LOG_FMT(LL_ERROR, "%s: warning: underrun occurred", codec_name);
-		n = snd_pcm_recover(state->dev, n, 1);
-		if (n < 0) {
-			LOG_FMT(LL_ERROR, "%s: error: write failed", codec_name);
-			return 0;
+	if (c->out_stage != NULL)
+		state->enc_info->out_func(c->out_stage, buf, (char *) buf, frames * c->channels);
+	else
+		state->enc_info->write_func(buf, (char *) buf, frames * c->channels);
+	while (written < frames) {
+		if ((n = alsa_wait_avail(state, frames - written)) >= 0
+				&& (n = snd_pcm_writei(state->dev, (char *) buf + written * frame_bytes, n)) >= 0)
+			written += n;
+		else if (alsa_recover(state, n) < 0)
+			return written;
+	}
+	return written;
+}
+
+/* Encodes directly into the mmap area of the device, one period-aligned
+   chunk at a time, so the samples are not copied again by the driver. The
+   output stage has state and quantizes in place, so a chunk must be encoded
+   only once: if the commit fails, the encoded chunk is saved and copied in
+   again after recovery. */
+ssize_t alsa_mmap_write(struct codec *c, sample_t *buf, ssize_t frames)
+{
+	int err;
+	ssize_t written = 0, retry_frames = 0;
+	snd_pcm_sframes_t n;
+	snd_pcm_uframes_t offset, chunk, done;
+	const snd_pcm_channel_area_t *areas;
+	char *dest;
+	struct alsa_state *state = (struct alsa_state *) c->data;
+	const size_t frame_bytes = state->enc_info->bytes * c->channels;
+
+	if (snd_pcm_state(state->dev) == SND_PCM_STATE_SETUP && alsa_prepare_device(state) < 0)
+		return 0;
+	alsa_stats_start(&state->stats);
+
+	while (written < frames) {
+		if ((n = alsa_wait_avail(state, frames - written)) < 0)
+			goto xrun;
+		chunk = n;
+		if ((err = snd_pcm_mmap_begin(state->dev, &areas, &offset, &chunk)) < 0) {
+			n = err;
+			goto xrun;
 		}
+		/* don't cross a period boundary */
+		chunk = MINIMUM(chunk, state->period_frames - offset % state->period_frames);
+		/* the frames are interleaved, so areas[0] covers every channel */
+		dest = (char *) areas[0].addr + (areas[0].first + offset * areas[0].step) / 8;
+		if (retry_frames > 0) {
+			chunk = MINIMUM(chunk, (snd_pcm_uframes_t) retry_frames);
+			memcpy(dest, state->retry_buf, chunk * frame_bytes);
+		}
+		else if (c->out_stage != NULL)
+			state->enc_info->out_func(c->out_stage, &buf[written * c->channels], dest, chunk * c->channels);
 		else
-			goto try_again;
+			state->enc_info->write_func(&buf[written * c->channels], dest, chunk * c->channels);
+		n = snd_pcm_mmap_commit(state->dev, offset, chunk);
+		done = (n > 0) ? MINIMUM((snd_pcm_uframes_t) n, chunk) : 0;
+		written += done;
+		if (retry_frames > 0) {
+			retry_frames -= done;
+			memmove(state->retry_buf, state->retry_buf + done * frame_bytes, retry_frames * frame_bytes);
+		}
+		if (done != chunk) {
+			if (retry_frames == 0) {
+				memcpy(state->retry_buf, dest + done * frame_bytes, (chunk - done) * frame_bytes);
+				retry_frames = chunk - done;
+			}
+			n = (n < 0) ? n : -EPIPE;
+			goto xrun;
+		}
+		continue;
+
+		xrun:
+		if (alsa_recover(state, n) < 0)
+			return written;
 	}
-	return n;
+	return written;
 }
 
 ssize_t alsa_seek(struct codec *c, ssize_t pos)
@@ -109,24 +282,76 @@ void alsa_pause(struct codec *c, int p)
 	snd_pcm_pause(state->dev, p);
 }
 
+void alsa_print_progress(struct codec *c, int verbose)
+{
+	struct alsa_state *state = (struct alsa_state *) c->data;
+	if (verbose || state->stats.xruns != 0)
+		fprintf(stderr, "xrun:%ld  ", state->stats.xruns);
+	if (verbose && state->is_playback && state->stats.started)
+		fprintf(stderr, "minfill:%.2fms  ", (double) state->stats.min_fill / c->fs * 1000.0);
+}
+
+static void alsa_log_stats(struct codec *c)
+{
+	int i, k;
+	long total = 0;
+	char hist[ALSA_FILL_BINS * 16], *h = hist;
+	struct alsa_state *state = (struct alsa_state *) c->data;
+	struct alsa_stats *stats = &state->stats;
+
+	if (!stats->started)
+		return;
+	if (!LOGLEVEL(LL_VERBOSE)) {
+		if (stats->xruns != 0)
+			LOG_FMT(LL_NORMAL, "%s: %s: %ld %s", codec_name, c->path, stats->xruns, (state->is_playback) ? "underrun(s)" : "overrun(s)");
+		return;
+	}
+	LOG_FMT(LL_VERBOSE, "%s: info: %s: xruns=%ld wakeups=%ld runtime=%.3fs", codec_name, c->path,
+		stats->xruns, stats->wakeups, alsa_stats_elapsed(stats));
+	if (stats->xruns != 0) {
+		k = MINIMUM(stats->xruns, ALSA_XRUN_TIMES);
+		for (i = 0; i < k; ++i)
+			h += sprintf(h, " %.3fs", stats->xrun_times[(stats->xruns - k + i) % ALSA_XRUN_TIMES]);
+		LOG_FMT(LL_VERBOSE, "%s: info: %s: last xruns at:%s", codec_name, c->path, hist);
+	}
+	if (!state->is_playback)
+		return;
+	for (i = 0; i < ALSA_FILL_BINS; ++i)
+		total += stats->fill_hist[i];
+	if (total == 0)
+		return;
+	h = hist;
+	for (i = 0; i < ALSA_FILL_BINS; ++i)
+		h += sprintf(h, " %d%%:%.1f%%", i * 100 / ALSA_FILL_BINS, (double) stats->fill_hist[i] / total * 100.0);
+	LOG_FMT(LL_VERBOSE, "%s: info: %s: min fill=%lu/%lu frames (%.2fms); fill histogram:%s", codec_name, c->path,
+		stats->min_fill, state->buf_frames, (double) stats->min_fill / c->fs * 1000.0, hist);
+}
+
 void alsa_destroy(struct codec *c)
 {
 	struct alsa_state *state = (struct alsa_state *) c->data;
-	if (snd_pcm_state(state->dev) == SND_PCM_STATE_RUNNING)
+	snd_pcm_state_t s = snd_pcm_state(state->dev);
+	/* a prepared stream may hold fewer frames than the start threshold */
+	if (s == SND_PCM_STATE_RUNNING || (s == SND_PCM_STATE_PREPARED && state->is_playback))
 		snd_pcm_drain(state->dev);
+	alsa_log_stats(c);
 	snd_pcm_close(state->dev);
+	free(state->pfds);
+	free(state->retry_buf);
 	free(state);
 }
 
 static struct alsa_enc_info encodings[] = {
-	{ "s16",    SND_PCM_FORMAT_S16,     2, 16, 1, write_buf_s16,    read_buf_s16 },
-	{ "u8",     SND_PCM_FORMAT_U8,      1, 8,  1, write_buf_u8,     read_buf_u8 },
-	{ "s8",     SND_PCM_FORMAT_S8,      1, 8,  1, write_buf_s8,     read_buf_s8 },
-	{ "s24",    SND_PCM_FORMAT_S24,     4, 24, 1, write_buf_s24,    read_buf_s24 },
-	{ "s24_3",  SND_PCM_FORMAT_S24_3LE, 3, 24, 1, write_buf_s24_3,  read_buf_s24_3 },
-	{ "s32",    SND_PCM_FORMAT_S32,     4, 32, 1, write_buf_s32,    read_buf_s32 },
-	{ "float",  SND_PCM_FORMAT_FLOAT,   4, 24, 0, write_buf_float,  read_buf_float },
-	{ "double", SND_PCM_FORMAT_FLOAT64, 8, 53, 0, write_buf_double, read_buf_double },
+	{ "s16",    SND_PCM_FORMAT_S16,     2, 16, 1, write_buf_s16,    read_buf_s16, out_stage_s16 },
+	{ "u8",     SND_PCM_FORMAT_U8,      1, 8,  1, write_buf_u8,     read_buf_u8, out_stage_u8 },
+	{ "s8",     SND_PCM_FORMAT_S8,      1, 8,  1, write_buf_s8,     read_buf_s8, out_stage_s8 },
+	{ "s24",    SND_PCM_FORMAT_S24,     4, 24, 1, write_buf_s24,    read_buf_s24, out_stage_s24 },
+	{ "s24_3",  SND_PCM_FORMAT_S24_3LE, 3, 24, 1, write_buf_s24_3,  read_buf_s24_3, out_stage_s24_3 },
+	{ "s32",    SND_PCM_FORMAT_S32,     4, 32, 1, write_buf_s32,    read_buf_s32, out_stage_s32 },
+	{ "float",  SND_PCM_FORMAT_FLOAT,   4, 24, 0, write_buf_float,  read_buf_float, out_stage_float },
+#ifndef SINGLE_PRECISION
+	{ "double", SND_PCM_FORMAT_FLOAT64, 8, 53, 0, write_buf_double, read_buf_double, out_stage_double },
+#endif
 };
 
 static struct alsa_enc_info * alsa_get_enc_info(const char *enc)
@@ -142,13 +367,17 @@ static struct alsa_enc_info * alsa_get_enc_info(const char *enc)
 
 struct codec * alsa_codec_init(const char *path, const char *type, const char *enc, int fs, int channels, int endian, int mode)
 {
-	int err;
+	int err, n_pfds;
 	snd_pcm_t *dev = NULL;
 	snd_pcm_hw_params_t *p = NULL;
+	snd_pcm_sw_params_t *sw = NULL;
+	struct pollfd *pfds = NULL;
+	unsigned int periods;
 	struct codec *c = NULL;
 	struct alsa_state *state = NULL;
-	snd_pcm_uframes_t buf_frames;
+	snd_pcm_uframes_t buf_frames, period_frames, start_frames;
 	struct alsa_enc_info *enc_info;
+	const int use_mmap = (strcmp(type, mmap_type) == 0);
 
 	if ((err = snd_pcm_open(&dev, path, (mode == CODEC_MODE_WRITE) ? SND_PCM_STREAM_PLAYBACK : SND_PCM_STREAM_CAPTURE, 0)) < 0) {
 		LOG_FMT(LL_OPEN_ERROR, "%s: error: failed to open device: %s", codec_name, snd_strerror(err));
@@ -166,7 +395,7 @@ struct codec * alsa_codec_init(const char *path, const char *type, const char *e
 		LOG_FMT(LL_ERROR, "%s: error: failed to initialize hw params: %s", codec_name, snd_strerror(err));
 		goto fail;
 	}
-	if ((err = snd_pcm_hw_params_set_access(dev, p, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) {
+	if ((err = snd_pcm_hw_params_set_access(dev, p, (use_mmap) ? SND_PCM_ACCESS_MMAP_INTERLEAVED : SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) {
 		LOG_FMT(LL_ERROR, "%s: error: failed to set access: %s", codec_name, snd_strerror(err));
 		goto fail;
 	}
@@ -182,25 +411,92 @@ struct codec * alsa_codec_init(const char *path, const char *type, const char *e
 		LOG_FMT(LL_ERROR, "%s: error: failed to set channels: %s", codec_name, snd_strerror(err));
 		goto fail;
 	}
-	buf_frames = dsp_globals.buf_frames;
-	if ((err = snd_pcm_hw_params_set_buffer_size_min(dev, p, &buf_frames)) < 0) {
-		LOG_FMT(LL_ERROR, "%s: error: failed to set buffer size minimum: %s", codec_name, snd_strerror(err));
-		goto fail;
+	if (dsp_globals.dev_period_frames > 0) {
+		period_frames = dsp_globals.dev_period_frames;
+		if ((err = snd_pcm_hw_params_set_period_size_near(dev, p, &period_frames, NULL)) < 0) {
+			LOG_FMT(LL_ERROR, "%s: error: failed to set period size: %s", codec_name, snd_strerror(err));
+			goto fail;
+		}
+		periods = dsp_globals.dev_periods;
+		if ((err = snd_pcm_hw_params_set_periods_near(dev, p, &periods, NULL)) < 0) {
+			LOG_FMT(LL_ERROR, "%s: error: failed to set number of periods: %s", codec_name, snd_strerror(err));
+			goto fail;
+		}
 	}
-	buf_frames = dsp_globals.buf_frames * dsp_globals.max_buf_ratio;
-	if ((err = snd_pcm_hw_params_set_buffer_size_max(dev, p, &buf_frames)) < 0) {
-		LOG_FMT(LL_ERROR, "%s: error: failed to set buffer size maximum: %s", codec_name, snd_strerror(err));
-		goto fail;
+	else {
+		buf_frames = dsp_globals.buf_frames;
+		if ((err = snd_pcm_hw_params_set_buffer_size_min(dev, p, &buf_frames)) < 0) {
+			LOG_FMT(LL_ERROR, "%s: error: failed to set buffer size minimum: %s", codec_name, snd_strerror(err));
+			goto fail;
+		}
+		buf_frames = dsp_globals.buf_frames * dsp_globals.max_buf_ratio;
+		if ((err = snd_pcm_hw_params_set_buffer_size_max(dev, p, &buf_frames)) < 0) {
+			LOG_FMT(LL_ERROR, "%s: error: failed to set buffer size maximum: %s", codec_name, snd_strerror(err));
+			goto fail;
+		}
 	}
 	if ((err = snd_pcm_hw_params(dev, p)) < 0) {
 		LOG_FMT(LL_ERROR, "%s: error: failed to set params: %s", codec_name, snd_strerror(err));
 		goto fail;
 	}
+	if ((err = snd_pcm_hw_params_get_period_size(p, &period_frames, NULL)) < 0) {
+		LOG_FMT(LL_ERROR, "%s: error: failed to get period size: %s", codec_name, snd_strerror(err));
+		goto fail;
+	}
+	if ((err = snd_pcm_hw_params_get_buffer_size(p, &buf_frames)) < 0) {
+		LOG_FMT(LL_ERROR, "%s: error: failed to get buffer size: %s", codec_name, snd_strerror(err));
+		goto fail;
+	}
+
+	/* playback starts once start_frames are queued; the writer is woken
+	   once per period */
+	start_frames = (mode == CODEC_MODE_WRITE && dsp_globals.dev_start_frames > 0) ? MINIMUM((snd_pcm_uframes_t) dsp_globals.dev_start_frames, buf_frames) : 1;
+	if ((err = snd_pcm_sw_params_malloc(&sw)) < 0) {
+		LOG_FMT(LL_ERROR, "%s: error: failed to allocate sw params: %s", codec_name, snd_strerror(err));
+		goto fail;
+	}
+	if ((err = snd_pcm_sw_params_current(dev, sw)) < 0) {
+		LOG_FMT(LL_ERROR, "%s: error: failed to get sw params: %s", codec_name, snd_strerror(err));
+		goto fail;
+	}
+	if ((err = snd_pcm_sw_params_set_start_threshold(dev, sw, start_frames)) < 0) {
+		LOG_FMT(LL_ERROR, "%s: error: failed to set start threshold: %s", codec_name, snd_strerror(err));
+		goto fail;
+	}
+	if ((err = snd_pcm_sw_params_set_avail_min(dev, sw, period_frames)) < 0) {
+		LOG_FMT(LL_ERROR, "%s: error: failed to set avail_min: %s", codec_name, snd_strerror(err));
+		goto fail;
+	}
+	if ((err = snd_pcm_sw_params(dev, sw)) < 0) {
+		LOG_FMT(LL_ERROR, "%s: error: failed to set sw params: %s", codec_name, snd_strerror(err));
+		goto fail;
+	}
+	if ((n_pfds = snd_pcm_poll_descriptors_count(dev)) <= 0) {
+		LOG_FMT(LL_ERROR, "%s: error: failed to get poll descriptors", codec_name);
+		goto fail;
+	}
+	pfds = calloc(n_pfds, sizeof(struct pollfd));
+	if ((err = snd_pcm_poll_descriptors(dev, pfds, n_pfds)) < 0) {
+		LOG_FMT(LL_ERROR, "%s: error: failed to get poll descriptors: %s", codec_name, snd_strerror(err));
+		goto fail;
+	}
+	LOG_FMT(LL_VERBOSE, "%s: info: %s: buffer=%lu period=%lu start=%lu frames (%.2fms buffer latency)", codec_name, path,
+		buf_frames, period_frames, start_frames, (double) buf_frames / fs * 1000.0);
 
 	state = calloc(1, sizeof(struct alsa_state));
 	state->dev = dev;
 	state->enc_info = enc_info;
 	state->delay = 0;
+	state->buf_frames = buf_frames;
+	state->period_frames = period_frames;
+	state->start_frames = start_frames;
+	state->avail_min = period_frames;
+	state->pfds = pfds;
+	state->n_pfds = n_pfds;
+	state->is_playback = (mode == CODEC_MODE_WRITE);
+	state->stats.min_fill = buf_frames;
+	if (use_mmap)
+		state->retry_buf = calloc(period_frames, enc_info->bytes * channels);
 
 	c = calloc(1, sizeof(struct codec));
 	c->path = path;
@@ -211,23 +507,29 @@ struct codec * alsa_codec_init(const char *path, const char *type, const char *e
 	c->prec = enc_info->prec;
 	c->can_dither = enc_info->can_dither;
 	c->interactive = (mode == CODEC_MODE_WRITE) ? 1 : 0;
+	c->has_out_stage = 1;
 	c->frames = -1;
 	c->read = alsa_read;
-	c->write = alsa_write;
+	c->write = (use_mmap) ? alsa_mmap_write : alsa_write;
 	c->seek = alsa_seek;
 	c->delay = alsa_delay;
 	c->drop = alsa_drop;
 	c->pause = alsa_pause;
 	c->destroy = alsa_destroy;
+	c->print_progress = alsa_print_progress;
 	c->data = state;
 
 	snd_pcm_hw_params_free(p);
+	snd_pcm_sw_params_free(sw);
 
 	return c;
 
 	fail:
+	free(pfds);
 	if (p != NULL)
 		snd_pcm_hw_params_free(p);
+	if (sw != NULL)
+		snd_pcm_sw_params_free(sw);
 	if (dev != NULL)
 		snd_pcm_close(dev);
 	return NULL;
@@ -15,15 +15,16 @@ struct ao_enc_info {
 	const char *name;
 	int bytes, prec;
 	void (*write_func)(sample_t *, char *, ssize_t);
+	void (*out_func)(struct out_stage *, sample_t *, char *, ssize_t);
 };
 
 static const char codec_name[] = "ao";
 static int ao_open_count = 0;
 
 static struct ao_enc_info encodings[] = {
-	{ "s16", 2, 16, write_buf_s16 },
-	{ "u8",  1, 8,  write_buf_u8 },
-	{ "s32", 4, 32, write_buf_s32 },
+	{ "s16", 2, 16, write_buf_s16, out_stage_s16 },
+	{ "u8",  1, 8,  write_buf_u8, out_stage_u8 },
+	{ "s32", 4, 32, write_buf_s32, out_stage_s32 },
 };
 
 static struct ao_enc_info * ao_get_enc_info(const char *enc)
@@ -46,7 +47,10 @@ ssize_t ao_write(struct codec *c, sample_t *buf, ssize_t frames)
 {
 	struct ao_state *state = (struct ao_state *) c->data;
 
-	state->enc_info->write_func(buf, (char *) buf, frames * c->channels);
+	if (c->out_stage != NULL)
+		state->enc_info->out_func(c->out_stage, buf, (char *) buf, frames * c->channels);
+	else
+		state->enc_info->write_func(buf, (char *) buf, frames * c->channels);
 	if (ao_play(state->dev, (char *) buf, frames * c->channels * state->enc_info->bytes) == 0) {
 		LOG_FMT(LL_ERROR, "%s: ao_play(): write failed", codec_name);
 		return 0;
@@ -126,6 +130,7 @@ struct codec * ao_codec_init(const char *path, const char *type, const char *enc
 	c->prec = enc_info->prec;
 	c->can_dither = 1;  /* all formats are fixed-point LPCM */
 	c->interactive = 1;
+	c->has_out_stage = 1;
 	c->frames = -1;
 	c->read = ao_read;
 	c->write = ao_write;
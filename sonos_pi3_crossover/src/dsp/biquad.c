@@ -58,6 +58,26 @@ void biquad_reset(struct biquad_state *state)
 #endif
 }
 
+void biquad_ramp_init(struct biquad_ramp *ramp, const struct biquad_state *cur, const struct biquad_state *target, ssize_t frames)
+{
+	ramp->target = *target;
+	ramp->frames = MAXIMUM(frames, 1);
+	ramp->d0 = (target->c0 - cur->c0) / ramp->frames;
+	ramp->d1 = (target->c1 - cur->c1) / ramp->frames;
+	ramp->d2 = (target->c2 - cur->c2) / ramp->frames;
+	ramp->d3 = (target->c3 - cur->c3) / ramp->frames;
+	ramp->d4 = (target->c4 - cur->c4) / ramp->frames;
+}
+
+void biquad_ramp_finish(struct biquad_ramp *ramp, struct biquad_state *state)
+{
+	state->c0 = ramp->target.c0;
+	state->c1 = ramp->target.c1;
+	state->c2 = ramp->target.c2;
+	state->c3 = ramp->target.c3;
+	state->c4 = ramp->target.c4;
+}
+
 void biquad_init_using_type(struct biquad_state *b, int type, double fs, double arg0, double arg1, double arg2, double arg3, int width_type)
 {
 	double b0, b1, b2, a0, a1, a2;
@@ -227,10 +247,59 @@ void biquad_init_using_type(struct biquad_state *b, int type, double fs, double
 	biquad_init(b, b0, b1, b2, a0, a1, a2);
 }
 
+/* Runtime control of the filter parameters. Until the effect is merged, the
+   control updates the per-channel states; afterwards, it updates its section
+   of the cascade. New coefficients are reached with a biquad_ramp. */
+
+/* Coefficient changes made through a control are ramped over this long */
+#define BIQUAD_CTL_RAMP_MS 20
+
+struct biquad_ctl {
+	int type, width_type, fs, channels;
+	struct biquad_state **state;    /* NULL once merged */
+	struct biquad_ramp ramp;        /* used until merged */
+	struct cascade_state *cascade;
+	int section;
+};
+
+/* Returns the coefficient ramp in progress, or NULL. An unmerged biquad
+   effect has at most one control. */
+static struct biquad_ramp * biquad_effect_ramp(struct effect *e)
+{
+	struct biquad_ctl *bc;
+	if (e->ctl == NULL)
+		return NULL;
+	bc = (struct biquad_ctl *) e->ctl->data;
+	return (bc->ramp.frames > 0) ? &bc->ramp : NULL;
+}
+
+/* Sample (frame f) is at buf[f * stride] */
+static void biquad_ramp_run(struct biquad_state *state, const struct biquad_ramp *ramp, ssize_t frames, sample_t *buf, ssize_t stride)
+{
+	ssize_t i;
+	for (i = 0; i < frames; ++i) {
+		biquad_ramp_step(state, ramp, i);
+		buf[i * stride] = biquad(state, buf[i * stride]);
+	}
+}
+
+static void biquad_ramp_advance(struct biquad_ramp *ramp, ssize_t frames)
+{
+	ramp->frames = (frames >= ramp->frames) ? 0 : ramp->frames - frames;
+}
+
 sample_t * biquad_effect_run(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf)
 {
 	ssize_t samples = *frames * e->ostream.channels, i, k;
 	struct biquad_state **state = (struct biquad_state **) e->data;
+	struct biquad_ramp *ramp = biquad_effect_ramp(e);
+	if (ramp != NULL) {
+		for (k = 0; k < e->ostream.channels; ++k)
+			if (state[k])
+				biquad_ramp_run(state[k], ramp, *frames, &ibuf[k], e->ostream.channels);
+		biquad_ramp_advance(ramp, *frames);
+		return ibuf;
+	}
 	for (i = 0; i < samples; i += e->ostream.channels)
 		for (k = 0; k < e->ostream.channels; ++k)
 			if (state[k])
@@ -238,19 +307,83 @@ sample_t * biquad_effect_run(struct effect *e, ssize_t *frames, sample_t *ibuf,
 	return ibuf;
 }
 
+sample_t * biquad_effect_run_ch(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf, int start, int end)
+{
+	ssize_t samples = *frames * e->ostream.channels, i;
+	int k;
+	struct biquad_state **state = (struct biquad_state **) e->data;
+	struct biquad_ramp *ramp = biquad_effect_ramp(e);
+	for (k = start; k < end; ++k) {
+		if (state[k]) {
+			if (ramp != NULL)
+				biquad_ramp_run(state[k], ramp, *frames, &ibuf[k], e->ostream.channels);
+			else
+				for (i = k; i < samples; i += e->ostream.channels)
+					ibuf[i] = biquad(state[k], ibuf[i]);
+		}
+	}
+	return ibuf;
+}
+
+void biquad_effect_run_ch_commit(struct effect *e, ssize_t frames)
+{
+	struct biquad_ramp *ramp = biquad_effect_ramp(e);
+	if (ramp != NULL)
+		biquad_ramp_advance(ramp, frames);
+}
+
+sample_t * biquad_effect_run_planar(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf)
+{
+	ssize_t i;
+	int k;
+	sample_t *buf;
+	struct biquad_state **state = (struct biquad_state **) e->data;
+	struct biquad_ramp *ramp = biquad_effect_ramp(e);
+	for (k = 0; k < e->ostream.channels; ++k) {
+		if (state[k]) {
+			buf = &ibuf[k * *frames];
+			if (ramp != NULL)
+				biquad_ramp_run(state[k], ramp, *frames, buf, 1);
+			else
+				for (i = 0; i < *frames; ++i)
+					buf[i] = biquad(state[k], buf[i]);
+		}
+	}
+	if (ramp != NULL)
+		biquad_ramp_advance(ramp, *frames);
+	return ibuf;
+}
+
 void biquad_effect_reset(struct effect *e)
 {
 	int i;
 	struct biquad_state **state = (struct biquad_state **) e->data;
-	for (i = 0; i < e->ostream.channels; ++i)
-		if (state[i])
+	struct biquad_ramp *ramp = biquad_effect_ramp(e);
+	for (i = 0; i < e->ostream.channels; ++i) {
+		if (state[i]) {
+			if (ramp != NULL)
+				biquad_ramp_finish(ramp, state[i]);
 			biquad_reset(state[i]);
+		}
+	}
+	if (ramp != NULL)
+		ramp->frames = 0;
+}
+
+static void print_biquad_response(const char *c, int i)
+{
+	printf(
+		"20*log10(sqrt((%s0*%s0+%s1*%s1+%s2*%s2+2.*(%s0*%s1+%s1*%s2)*cos(f*o%d)+2.*(%s0*%s2)*cos(2.*f*o%d))/(1.+%s3*%s3+%s4*%s4+2.*(%s3+%s3*%s4)*cos(f*o%d)+2.*%s4*cos(2.*f*o%d))))",
+		c, c, c, c, c, c, c, c, c, c, i, c, c, i, c, c, c, c, c, c, c, i, c, i
+	);
 }
 
 void biquad_effect_plot(struct effect *e, int i)
 {
 	struct biquad_state **state = (struct biquad_state **) e->data;
 	int k, header_printed = 0;
+	char c[16];
+	snprintf(c, sizeof(c), "c%d", i);
 	for (k = 0; k < e->ostream.channels; ++k) {
 		if (state[k]) {
 			if (!header_printed) {
@@ -261,10 +394,9 @@ void biquad_effect_plot(struct effect *e, int i)
 				);
 				header_printed = 1;
 			}
-			printf(
-				"H%d_%d(f)=20*log10(sqrt((c%d0*c%d0+c%d1*c%d1+c%d2*c%d2+2.*(c%d0*c%d1+c%d1*c%d2)*cos(f*o%d)+2.*(c%d0*c%d2)*cos(2.*f*o%d))/(1.+c%d3*c%d3+c%d4*c%d4+2.*(c%d3+c%d3*c%d4)*cos(f*o%d)+2.*c%d4*cos(2.*f*o%d))))\n",
-				k, i, i, i, i, i, i, i, i, i, i, i, i, i, i, i, i, i, i, i, i, i, i, i, i, i
-			);
+			printf("H%d_%d(f)=", k, i);
+			print_biquad_response(c, i);
+			putchar('\n');
 		}
 		else
 			printf("H%d_%d(f)=0\n", k, i);
@@ -280,6 +412,505 @@ void biquad_effect_destroy(struct effect *e)
 	free(state);
 }
 
+/* Consecutive biquad effects with the same channel selector are merged into a
+   cascade which runs every section on a frame before moving on to the next
+   one. The selected channels are packed into groups of CASCADE_LANES so that
+   each group is filtered with vector arithmetic. */
+
+struct cascade_group {
+	int n_lanes, channel[CASCADE_LANES];
+	struct cascade_section *s;
+};
+
+struct cascade_state {
+	int n_sections, n_groups;
+	struct cascade_group *groups;
+	struct biquad_ramp *ramp;  /* per section */
+	int n_ramps;               /* sections with a ramp in progress */
+};
+
+/* Same as cascade_biquad(), but for a single lane */
+static __inline__ cascade_sample_t cascade_biquad_lane(struct cascade_section *s, int l, cascade_sample_t x)
+{
+#if BIQUAD_USE_TDF_2
+	cascade_sample_t r = (s->c0[l] * x) + s->m0[l];
+	s->m0[l] = s->m1[l] + (s->c1[l] * x) - (s->c3[l] * r);
+	s->m1[l] = (s->c2[l] * x) - (s->c4[l] * r);
+#else
+	cascade_sample_t r = (s->c0[l] * x) + (s->c1[l] * s->i0[l]) + (s->c2[l] * s->i1[l]) - (s->c3[l] * s->o0[l]) - (s->c4[l] * s->o1[l]);
+
+	s->i1[l] = s->i0[l];
+	s->i0[l] = x;
+
+	s->o1[l] = s->o0[l];
+	s->o0[l] = r;
+#endif
+	return r;
+}
+
+/* The separate biquad effects store each filter's output in a sample_t
+   buffer, so round to sample_t between sections as well to give the same
+   output */
+static __inline__ cascade_vec_t cascade_round(cascade_vec_t x)
+{
+#if BIQUAD_DOUBLE_STATE && defined(SINGLE_PRECISION) && !defined(BIQUAD_FLOAT_CASCADE)
+	int l;
+	for (l = 0; l < CASCADE_LANES; ++l)
+		x[l] = (sample_t) x[l];
+#endif
+	return x;
+}
+
+/* Same as biquad_ramp_step(), but for every lane of a section */
+static __inline__ void cascade_ramp_step(struct cascade_section *s, const struct biquad_ramp *ramp, ssize_t i)
+{
+	const cascade_vec_t zero = { 0 };
+	if (i < ramp->frames - 1) {
+		s->c0 += (cascade_sample_t) ramp->d0;
+		s->c1 += (cascade_sample_t) ramp->d1;
+		s->c2 += (cascade_sample_t) ramp->d2;
+		s->c3 += (cascade_sample_t) ramp->d3;
+		s->c4 += (cascade_sample_t) ramp->d4;
+	}
+	else if (i == ramp->frames - 1) {
+		s->c0 = zero + (cascade_sample_t) ramp->target.c0;
+		s->c1 = zero + (cascade_sample_t) ramp->target.c1;
+		s->c2 = zero + (cascade_sample_t) ramp->target.c2;
+		s->c3 = zero + (cascade_sample_t) ramp->target.c3;
+		s->c4 = zero + (cascade_sample_t) ramp->target.c4;
+	}
+}
+
+/* Sample (frame f, channel k) is at buf[f * frame_stride + k * channel_stride].
+   ramp is the per-section ramp array if any ramp is in progress, or NULL. */
+static void cascade_group_run(struct cascade_group *g, const struct biquad_ramp *ramp, int n_sections, ssize_t frames, sample_t *buf, ssize_t frame_stride, ssize_t channel_stride)
+{
+	ssize_t i, f, offset[CASCADE_LANES];
+	int j, l;
+	cascade_vec_t x = { 0 };
+	for (l = 0; l < g->n_lanes; ++l)
+		offset[l] = g->channel[l] * channel_stride;
+	if (ramp != NULL) {
+		for (i = 0, f = 0; f < frames; i += frame_stride, ++f) {
+			for (l = 0; l < g->n_lanes; ++l)
+				x[l] = buf[i + offset[l]];
+			for (j = 0; j < n_sections; ++j) {
+				cascade_ramp_step(&g->s[j], &ramp[j], f);
+				x = cascade_round(cascade_biquad(&g->s[j], x));
+			}
+			for (l = 0; l < g->n_lanes; ++l)
+				buf[i + offset[l]] = x[l];
+		}
+		return;
+	}
+	for (i = 0; i < frames * frame_stride; i += frame_stride) {
+		for (l = 0; l < g->n_lanes; ++l)
+			x[l] = buf[i + offset[l]];
+		for (j = 0; j < n_sections; ++j)
+			x = cascade_round(cascade_biquad(&g->s[j], x));
+		for (l = 0; l < g->n_lanes; ++l)
+			buf[i + offset[l]] = x[l];
+	}
+}
+
+static void cascade_lane_run(struct cascade_group *g, int l, const struct biquad_ramp *ramp, int n_sections, ssize_t frames, sample_t *buf, ssize_t frame_stride, ssize_t channel_stride)
+{
+	ssize_t i, f;
+	int j;
+	cascade_sample_t x;
+	buf += g->channel[l] * channel_stride;
+	for (i = 0, f = 0; f < frames; i += frame_stride, ++f) {
+		x = buf[i];
+		for (j = 0; j < n_sections; ++j) {
+			if (ramp != NULL)
+				cascade_ramp_step_lane(&g->s[j], l, &ramp[j], f);
+			x = (sample_t) cascade_biquad_lane(&g->s[j], l, x);
+		}
+		buf[i] = x;
+	}
+}
+
+static struct biquad_ramp * cascade_ramps(struct cascade_state *state)
+{
+	return (state->n_ramps > 0) ? state->ramp : NULL;
+}
+
+static void cascade_ramps_advance(struct cascade_state *state, ssize_t frames)
+{
+	int j;
+	for (j = 0; j < state->n_sections; ++j) {
+		if (state->ramp[j].frames > 0) {
+			biquad_ramp_advance(&state->ramp[j], frames);
+			if (state->ramp[j].frames == 0)
+				--state->n_ramps;
+		}
+	}
+}
+
+sample_t * biquad_cascade_effect_run(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf)
+{
+	int i;
+	struct cascade_state *state = (struct cascade_state *) e->data;
+	for (i = 0; i < state->n_groups; ++i)
+		cascade_group_run(&state->groups[i], cascade_ramps(state), state->n_sections, *frames, ibuf, e->ostream.channels, 1);
+	if (state->n_ramps > 0)
+		cascade_ramps_advance(state, *frames);
+	return ibuf;
+}
+
+sample_t * biquad_cascade_effect_run_planar(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf)
+{
+	int i;
+	struct cascade_state *state = (struct cascade_state *) e->data;
+	for (i = 0; i < state->n_groups; ++i)
+		cascade_group_run(&state->groups[i], cascade_ramps(state), state->n_sections, *frames, ibuf, 1, *frames);
+	if (state->n_ramps > 0)
+		cascade_ramps_advance(state, *frames);
+	return ibuf;
+}
+
+sample_t * biquad_cascade_effect_run_ch(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf, int start, int end)
+{
+	int i, l;
+	struct cascade_group *g;
+	struct cascade_state *state = (struct cascade_state *) e->data;
+	for (i = 0; i < state->n_groups; ++i) {
+		g = &state->groups[i];
+		if (g->channel[0] >= start && g->channel[g->n_lanes - 1] < end)
+			cascade_group_run(g, cascade_ramps(state), state->n_sections, *frames, ibuf, e->ostream.channels, 1);
+		else {
+			for (l = 0; l < g->n_lanes; ++l)
+				if (g->channel[l] >= start && g->channel[l] < end)
+					cascade_lane_run(g, l, cascade_ramps(state), state->n_sections, *frames, ibuf, e->ostream.channels, 1);
+		}
+	}
+	return ibuf;
+}
+
+void biquad_cascade_effect_run_ch_commit(struct effect *e, ssize_t frames)
+{
+	struct cascade_state *state = (struct cascade_state *) e->data;
+	if (state->n_ramps > 0)
+		cascade_ramps_advance(state, frames);
+}
+
+/* Sets the coefficients of a section to the target of its ramp */
+static void cascade_ramp_finish(struct cascade_state *state, int section)
+{
+	int i;
+	for (i = 0; i < state->n_groups; ++i)
+		cascade_ramp_step(&state->groups[i].s[section], &state->ramp[section], state->ramp[section].frames - 1);
+	state->ramp[section].frames = 0;
+	--state->n_ramps;
+}
+
+void biquad_cascade_effect_reset(struct effect *e)
+{
+	int i, j;
+	struct cascade_section *s;
+	struct cascade_state *state = (struct cascade_state *) e->data;
+	const cascade_vec_t zero = { 0 };
+	for (j = 0; j < state->n_sections; ++j)
+		if (state->ramp[j].frames > 0)
+			cascade_ramp_finish(state, j);
+	for (i = 0; i < state->n_groups; ++i) {
+		for (j = 0; j < state->n_sections; ++j) {
+			s = &state->groups[i].s[j];
+#if BIQUAD_USE_TDF_2
+			s->m0 = s->m1 = zero;
+#else
+			s->i0 = s->i1 = s->o0 = s->o1 = zero;
+#endif
+		}
+	}
+}
+
+static struct cascade_group * cascade_find_channel(struct cascade_state *state, int k, int *lane)
+{
+	int i, l;
+	for (i = 0; i < state->n_groups; ++i) {
+		for (l = 0; l < state->groups[i].n_lanes; ++l) {
+			if (state->groups[i].channel[l] == k) {
+				*lane = l;
+				return &state->groups[i];
+			}
+		}
+	}
+	return NULL;
+}
+
+void biquad_cascade_effect_plot(struct effect *e, int i)
+{
+	int j, k, l;
+	char c[32];
+	struct cascade_section *s;
+	struct cascade_state *state = (struct cascade_state *) e->data;
+	printf("o%d=2*pi/%d\n", i, e->ostream.fs);
+	for (j = 0; j < state->n_sections; ++j) {
+		s = &state->groups[0].s[j];
+		printf(
+			"c%d_%d0=%.15e; c%d_%d1=%.15e; c%d_%d2=%.15e; c%d_%d3=%.15e; c%d_%d4=%.15e\n",
+			i, j, s->c0[0], i, j, s->c1[0], i, j, s->c2[0], i, j, s->c3[0], i, j, s->c4[0]
+		);
+	}
+	for (k = 0; k < e->ostream.channels; ++k) {
+		if (cascade_find_channel(state, k, &l)) {
+			printf("H%d_%d(f)=", k, i);
+			for (j = 0; j < state->n_sections; ++j) {
+				if (j > 0) putchar('+');
+				snprintf(c, sizeof(c), "c%d_%d", i, j);
+				print_biquad_response(c, i);
+			}
+			putchar('\n');
+		}
+		else
+			printf("H%d_%d(f)=0\n", k, i);
+	}
+}
+
+void biquad_cascade_effect_destroy(struct effect *e)
+{
+	int i;
+	struct cascade_state *state = (struct cascade_state *) e->data;
+	for (i = 0; i < state->n_groups; ++i)
+		free(state->groups[i].s);
+	free(state->groups);
+	free(state->ramp);
+	free(state);
+}
+
+struct cascade_section * cascade_alloc_sections(int n)
+{
+	void *p;
+	if (posix_memalign(&p, CASCADE_VEC_SIZE, n * sizeof(struct cascade_section)) != 0)
+		return NULL;
+	memset(p, 0, n * sizeof(struct cascade_section));
+	return (struct cascade_section *) p;
+}
+
+static int cascade_append(struct cascade_state *state, struct biquad_state **b)
+{
+	int i, l;
+	struct cascade_group *g;
+	struct cascade_section *s;
+	struct biquad_ramp *ramp = realloc(state->ramp, (state->n_sections + 1) * sizeof(struct biquad_ramp));
+	if (ramp == NULL)
+		return 1;
+	memset(&ramp[state->n_sections], 0, sizeof(struct biquad_ramp));
+	state->ramp = ramp;
+	for (i = 0; i < state->n_groups; ++i) {
+		g = &state->groups[i];
+		if ((s = cascade_alloc_sections(state->n_sections + 1)) == NULL)
+			return 1;
+		if (g->s != NULL)
+			memcpy(s, g->s, state->n_sections * sizeof(struct cascade_section));
+		for (l = 0; l < g->n_lanes; ++l)
+			cascade_set_lane(&s[state->n_sections], l, b[g->channel[l]]);
+		free(g->s);
+		g->s = s;
+	}
+	++state->n_sections;
+	return 0;
+}
+
+static struct cascade_state * cascade_init(struct biquad_state **b, int channels)
+{
+	int k, n = 0;
+	struct cascade_group *g;
+	struct cascade_state *state;
+	for (k = 0; k < channels; ++k)
+		if (b[k]) ++n;
+	if (n == 0)
+		return NULL;
+	state = calloc(1, sizeof(struct cascade_state));
+	state->n_groups = (n + CASCADE_LANES - 1) / CASCADE_LANES;
+	state->groups = calloc(state->n_groups, sizeof(struct cascade_group));
+	for (k = 0, n = 0; k < channels; ++k) {
+		if (b[k]) {
+			g = &state->groups[n / CASCADE_LANES];
+			g->channel[g->n_lanes++] = k;
+			++n;
+		}
+	}
+	if (cascade_append(state, b)) {
+		for (k = 0; k < state->n_groups; ++k)
+			free(state->groups[k].s);
+		free(state->groups);
+		free(state->ramp);
+		free(state);
+		return NULL;
+	}
+	return state;
+}
+
+#define BIQUAD_CTL_MAX_FREQ(fs) ((fs) * 0.49)
+#define BIQUAD_CTL_MIN_WIDTH    0.01
+#define BIQUAD_CTL_MAX_WIDTH    100.0
+#define BIQUAD_CTL_MAX_GAIN     60.0
+
+struct biquad_ctl_update {
+	struct effect_ctl_update u;
+	struct biquad_state b;
+};
+
+static struct effect_ctl_update * biquad_ctl_prepare(struct effect_ctl *c, const double *values)
+{
+	int i;
+	double arg[4] = { 0.0, 0.0, 0.0, 0.0 };
+	struct biquad_ctl *bc = (struct biquad_ctl *) c->data;
+	struct biquad_ctl_update *u = calloc(1, sizeof(struct biquad_ctl_update));
+	for (i = 0; i < c->n_params; ++i)
+		arg[i] = values[i];
+	biquad_init_using_type(&u->b, bc->type, bc->fs, arg[0], arg[1], arg[2], arg[3], bc->width_type);
+	return &u->u;
+}
+
+/* The coefficients are ramped to the new values; the filter state is kept */
+static void biquad_ctl_apply(struct effect_ctl *c, struct effect_ctl_update *update)
+{
+	int i;
+	struct biquad_state cur;
+	struct cascade_section *s;
+	struct biquad_ctl *bc = (struct biquad_ctl *) c->data;
+	struct biquad_state *b = &((struct biquad_ctl_update *) update)->b;
+	ssize_t frames = (ssize_t) bc->fs * BIQUAD_CTL_RAMP_MS / 1000;
+	if (bc->state != NULL) {
+		for (i = 0; i < bc->channels; ++i) {
+			if (bc->state[i]) {
+				biquad_ramp_init(&bc->ramp, bc->state[i], b, frames);
+				break;
+			}
+		}
+	}
+	else {
+		s = &bc->cascade->groups[0].s[bc->section];
+		cur.c0 = s->c0[0];
+		cur.c1 = s->c1[0];
+		cur.c2 = s->c2[0];
+		cur.c3 = s->c3[0];
+		cur.c4 = s->c4[0];
+		if (bc->cascade->ramp[bc->section].frames == 0)
+			++bc->cascade->n_ramps;
+		biquad_ramp_init(&bc->cascade->ramp[bc->section], &cur, b, frames);
+	}
+}
+
+static void biquad_ctl_destroy(struct effect_ctl *c)
+{
+	free(c->data);
+}
+
+static void biquad_ctl_set_param(struct effect_ctl *c, int i, const char *name, double value, double min, double max)
+{
+	c->params[i].name = name;
+	c->params[i].value = value;
+	c->params[i].min = min;
+	c->params[i].max = max;
+}
+
+static void biquad_add_ctl(struct effect *e, struct effect_info *ei, int type, int width_type, double arg0, double arg1, double arg2, double arg3)
+{
+	struct effect_ctl *c;
+	struct biquad_ctl *bc;
+	double max_freq = BIQUAD_CTL_MAX_FREQ(e->ostream.fs);
+	double max_width = (width_type == BIQUAD_WIDTH_BW_HZ) ? max_freq : BIQUAD_CTL_MAX_WIDTH;
+
+	switch (ei->effect_number) {
+	case BIQUAD_LOWPASS_1:
+	case BIQUAD_HIGHPASS_1:
+		c = add_effect_ctl(e, ei->name, 1);
+		biquad_ctl_set_param(c, 0, "f0", arg0, 1.0, max_freq);
+		break;
+	case BIQUAD_LOWPASS:
+	case BIQUAD_HIGHPASS:
+	case BIQUAD_BANDPASS_SKIRT:
+	case BIQUAD_BANDPASS_PEAK:
+	case BIQUAD_NOTCH:
+	case BIQUAD_ALLPASS:
+		c = add_effect_ctl(e, ei->name, 2);
+		biquad_ctl_set_param(c, 0, "f0", arg0, 1.0, max_freq);
+		biquad_ctl_set_param(c, 1, "width", arg1, BIQUAD_CTL_MIN_WIDTH, max_width);
+		break;
+	case BIQUAD_PEAK:
+	case BIQUAD_LOWSHELF:
+	case BIQUAD_HIGHSHELF:
+		c = add_effect_ctl(e, ei->name, 3);
+		biquad_ctl_set_param(c, 0, "f0", arg0, 1.0, max_freq);
+		biquad_ctl_set_param(c, 1, "width", arg1, BIQUAD_CTL_MIN_WIDTH, max_width);
+		biquad_ctl_set_param(c, 2, "gain", arg2, -BIQUAD_CTL_MAX_GAIN, BIQUAD_CTL_MAX_GAIN);
+		break;
+	case BIQUAD_LINKWITZ_TRANSFORM:
+		c = add_effect_ctl(e, ei->name, 4);
+		biquad_ctl_set_param(c, 0, "fz", arg0, 1.0, max_freq);
+		biquad_ctl_set_param(c, 1, "qz", arg1, BIQUAD_CTL_MIN_WIDTH, BIQUAD_CTL_MAX_WIDTH);
+		biquad_ctl_set_param(c, 2, "fp", arg2, 1.0, max_freq);
+		biquad_ctl_set_param(c, 3, "qp", arg3, BIQUAD_CTL_MIN_WIDTH, BIQUAD_CTL_MAX_WIDTH);
+		break;
+	default:
+		return;  /* deemph and biquad have no parameters to control */
+	}
+	bc = calloc(1, sizeof(struct biquad_ctl));
+	bc->type = type;
+	bc->width_type = width_type;
+	bc->fs = e->ostream.fs;
+	bc->channels = e->ostream.channels;
+	bc->state = (struct biquad_state **) e->data;
+	c->prepare = biquad_ctl_prepare;
+	c->apply = biquad_ctl_apply;
+	c->destroy = biquad_ctl_destroy;
+	c->data = bc;
+}
+
+static void biquad_ctl_move_to_cascade(struct effect_ctl *c, struct cascade_state *state, int section)
+{
+	struct biquad_ctl *bc;
+	for (; c != NULL; c = c->next) {
+		bc = (struct biquad_ctl *) c->data;
+		bc->state = NULL;
+		bc->ramp.frames = 0;
+		bc->cascade = state;
+		bc->section = section;
+	}
+}
+
+int biquad_effect_merge(struct effect *e, struct effect *src)
+{
+	int k, l;
+	struct cascade_state *state;
+	struct biquad_state **b = (struct biquad_state **) src->data;
+
+	if (src->run != biquad_effect_run || src->istream.channels != e->ostream.channels || src->istream.fs != e->ostream.fs)
+		return 0;
+	if (e->run == biquad_effect_run) {
+		for (k = 0; k < e->ostream.channels; ++k)
+			if (!((struct biquad_state **) e->data)[k] != !b[k])
+				return 0;
+		if ((state = cascade_init((struct biquad_state **) e->data, e->ostream.channels)) == NULL)
+			return 0;
+		biquad_effect_destroy(e);
+		e->name = "biquad_cascade";
+		e->run = biquad_cascade_effect_run;
+		e->run_planar = biquad_cascade_effect_run_planar;
+		e->run_ch = biquad_cascade_effect_run_ch;
+		e->run_ch_commit = biquad_cascade_effect_run_ch_commit;
+		e->reset = biquad_cascade_effect_reset;
+		e->plot = biquad_cascade_effect_plot;
+		e->destroy = biquad_cascade_effect_destroy;
+		e->data = state;
+		biquad_ctl_move_to_cascade(e->ctl, state, 0);
+	}
+	else {
+		state = (struct cascade_state *) e->data;
+		for (k = 0; k < e->ostream.channels; ++k)
+			if (!cascade_find_channel(state, k, &l) != !b[k])
+				return 0;
+	}
+	if (cascade_append(state, b))
+		return 0;
+	biquad_ctl_move_to_cascade(src->ctl, state, state->n_sections - 1);
+	return 1;
+}
+
 #define GET_ARG(v, str, name) \
 	do { \
 		v = strtod(str, &endptr); \
@@ -398,8 +1029,12 @@ struct effect * biquad_effect_init(struct effect_info *ei, struct stream_info *i
 	e->istream.fs = e->ostream.fs = istream->fs;
 	e->istream.channels = e->ostream.channels = istream->channels;
 	e->run = biquad_effect_run;
+	e->run_planar = biquad_effect_run_planar;
+	e->run_ch = biquad_effect_run_ch;
+	e->run_ch_commit = biquad_effect_run_ch_commit;
 	e->reset = biquad_effect_reset;
 	e->plot = biquad_effect_plot;
+	e->merge = biquad_effect_merge;
 	e->destroy = biquad_effect_destroy;
 	state = calloc(istream->channels, sizeof(struct biquad_state *));
 	for (i = 0; i < istream->channels; ++i) {
@@ -412,5 +1047,6 @@ struct effect * biquad_effect_init(struct effect_info *ei, struct stream_info *i
 		}
 	}
 	e->data = state;
+	biquad_add_ctl(e, ei, type, width_type, arg0, arg1, arg2, arg3);
 	return e;
 }
@@ -9,6 +9,17 @@
 /* Use the transposed direct form 2 implementation instead of the direct form 1 implementation */
 #define BIQUAD_USE_TDF_2 1
 
+/* Keep the coefficients and state in double precision even if sample_t is
+   float. Unless BIQUAD_FLOAT_CASCADE is defined, this includes the lanes of
+   merged cascades, so they give the same output as separate biquads. */
+#define BIQUAD_DOUBLE_STATE 1
+
+#if BIQUAD_DOUBLE_STATE
+typedef double biquad_sample_t;
+#else
+typedef sample_t biquad_sample_t;
+#endif
+
 enum {
 	/* For biquad_init_using_type() and effect_info->effect_number */
 	BIQUAD_LOWPASS_1,
@@ -37,27 +48,41 @@ enum {
 };
 
 struct biquad_state {
-	sample_t c0, c1, c2, c3, c4;
+	biquad_sample_t c0, c1, c2, c3, c4;
 #if BIQUAD_USE_TDF_2
-	sample_t m0, m1;
+	biquad_sample_t m0, m1;
 #else
-	sample_t i0, i1, o0, o1;
+	biquad_sample_t i0, i1, o0, o1;
 #endif
 };
 
+/* A linear ramp of the coefficients towards a target. The filter state is
+   kept, and since the coefficients move by a small step each frame, the state
+   variables never see a sudden change. Every point on the line between two
+   stable filters is stable (the stable region of c3 and c4 is a triangle). */
+struct biquad_ramp {
+	biquad_sample_t d0, d1, d2, d3, d4;  /* step per frame */
+	struct biquad_state target;          /* only the coefficients are used */
+	ssize_t frames;                      /* frames left; 0 if not ramping */
+};
+
 void biquad_init(struct biquad_state *, double, double, double, double, double, double);
 void biquad_reset(struct biquad_state *);
 void biquad_init_using_type(struct biquad_state *, int, double, double, double, double, double, int);
+/* args: ramp, current coefficients, target coefficients, length in frames */
+void biquad_ramp_init(struct biquad_ramp *, const struct biquad_state *, const struct biquad_state *, ssize_t);
+/* Sets the coefficients of state to the target */
+void biquad_ramp_finish(struct biquad_ramp *, struct biquad_state *);
 struct effect * biquad_effect_init(struct effect_info *, struct stream_info *, char *, const char *, int, char **);
 
-static __inline__ sample_t biquad(struct biquad_state *state, sample_t s)
+static __inline__ sample_t biquad(struct biquad_state *state, biquad_sample_t s)
 {
 #if BIQUAD_USE_TDF_2
-	sample_t r = (state->c0 * s) + state->m0;
+	biquad_sample_t r = (state->c0 * s) + state->m0;
 	state->m0 = state->m1 + (state->c1 * s) - (state->c3 * r);
 	state->m1 = (state->c2 * s) - (state->c4 * r);
 #else
-	sample_t r = (state->c0 * s) + (state->c1 * state->i0) + (state->c2 * state->i1) - (state->c3 * state->o0) - (state->c4 * state->o1);
+	biquad_sample_t r = (state->c0 * s) + (state->c1 * state->i0) + (state->c2 * state->i1) - (state->c3 * state->o0) - (state->c4 * state->o1);
 
 	state->i1 = state->i0;
 	state->i0 = s;
@@ -68,4 +93,116 @@ static __inline__ sample_t biquad(struct biquad_state *state, sample_t s)
 	return r;
 }
 
+/* Moves the coefficients of state to where the ramp is at frame i of the
+   block (counting from 0). The ramp itself is not changed, so it may be
+   shared by several channels; subtract the block length from ramp->frames
+   once every channel has been run. */
+static __inline__ void biquad_ramp_step(struct biquad_state *state, const struct biquad_ramp *ramp, ssize_t i)
+{
+	if (i < ramp->frames - 1) {
+		state->c0 += ramp->d0;
+		state->c1 += ramp->d1;
+		state->c2 += ramp->d2;
+		state->c3 += ramp->d3;
+		state->c4 += ramp->d4;
+	}
+	else if (i == ramp->frames - 1) {
+		state->c0 = ramp->target.c0;
+		state->c1 = ramp->target.c1;
+		state->c2 = ramp->target.c2;
+		state->c3 = ramp->target.c3;
+		state->c4 = ramp->target.c4;
+	}
+}
+
+/* A biquad section with one set of coefficients and state per lane, for
+   running several filters at once with vector arithmetic. With
+   BIQUAD_DOUBLE_STATE, there are 2 double lanes per vector in either
+   precision. That maps onto SSE2 and AArch64 NEON, but 32-bit NEON has no
+   double precision arithmetic, so there GCC splits each operation into
+   scalar VFP instructions. In a single precision build, BIQUAD_FLOAT_CASCADE
+   (configure --enable-float-cascade) gives 4 float lanes instead, which
+   32-bit NEON runs natively. The output then differs slightly from that of
+   separate biquads. */
+
+#if defined(SINGLE_PRECISION) && defined(BIQUAD_FLOAT_CASCADE)
+typedef sample_t cascade_sample_t;
+#else
+typedef biquad_sample_t cascade_sample_t;
+#endif
+
+#define CASCADE_VEC_SIZE 16
+#define CASCADE_LANES ((int) (CASCADE_VEC_SIZE / sizeof(cascade_sample_t)))
+
+typedef cascade_sample_t cascade_vec_t __attribute__((vector_size(CASCADE_VEC_SIZE)));
+
+struct cascade_section {
+	cascade_vec_t c0, c1, c2, c3, c4;
+#if BIQUAD_USE_TDF_2
+	cascade_vec_t m0, m1;
+#else
+	cascade_vec_t i0, i1, o0, o1;
+#endif
+};
+
+/* Returns n zeroed sections, aligned for vector access (which malloc() does
+   not guarantee), or NULL on failure. Free with free(). */
+struct cascade_section * cascade_alloc_sections(int);
+
+static __inline__ cascade_vec_t cascade_biquad(struct cascade_section *s, cascade_vec_t x)
+{
+#if BIQUAD_USE_TDF_2
+	cascade_vec_t r = (s->c0 * x) + s->m0;
+	s->m0 = s->m1 + (s->c1 * x) - (s->c3 * r);
+	s->m1 = (s->c2 * x) - (s->c4 * r);
+#else
+	cascade_vec_t r = (s->c0 * x) + (s->c1 * s->i0) + (s->c2 * s->i1) - (s->c3 * s->o0) - (s->c4 * s->o1);
+
+	s->i1 = s->i0;
+	s->i0 = x;
+
+	s->o1 = s->o0;
+	s->o0 = r;
+#endif
+	return r;
+}
+
+/* Sets lane l of a section to the coefficients and state of b */
+static __inline__ void cascade_set_lane(struct cascade_section *s, int l, struct biquad_state *b)
+{
+	s->c0[l] = b->c0;
+	s->c1[l] = b->c1;
+	s->c2[l] = b->c2;
+	s->c3[l] = b->c3;
+	s->c4[l] = b->c4;
+#if BIQUAD_USE_TDF_2
+	s->m0[l] = b->m0;
+	s->m1[l] = b->m1;
+#else
+	s->i0[l] = b->i0;
+	s->i1[l] = b->i1;
+	s->o0[l] = b->o0;
+	s->o1[l] = b->o1;
+#endif
+}
+
+/* Same as biquad_ramp_step(), but for a single lane */
+static __inline__ void cascade_ramp_step_lane(struct cascade_section *s, int l, const struct biquad_ramp *ramp, ssize_t i)
+{
+	if (i < ramp->frames - 1) {
+		s->c0[l] += ramp->d0;
+		s->c1[l] += ramp->d1;
+		s->c2[l] += ramp->d2;
+		s->c3[l] += ramp->d3;
+		s->c4[l] += ramp->d4;
+	}
+	else if (i == ramp->frames - 1) {
+		s->c0[l] = ramp->target.c0;
+		s->c1[l] = ramp->target.c1;
+		s->c2[l] = ramp->target.c2;
+		s->c3[l] = ramp->target.c3;
+		s->c4[l] = ramp->target.c4;
+	}
+}
+
 #endif
@@ -92,6 +92,7 @@ struct codec_info codecs[] = {
 #endif
 #ifdef HAVE_ALSA
 	{ "alsa",    NULL,      CODEC_MODE_READ|CODEC_MODE_WRITE, alsa_codec_init,    alsa_codec_print_encodings },
+	{ "alsa_mmap", NULL,                    CODEC_MODE_WRITE, alsa_codec_init,    alsa_codec_print_encodings },
 #endif
 #ifdef HAVE_AO
 	{ "ao",      NULL,                      CODEC_MODE_WRITE, ao_codec_init,      ao_codec_print_encodings },
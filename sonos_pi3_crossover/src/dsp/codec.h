@@ -3,6 +3,8 @@
 
 #include "dsp.h"
 
+struct out_stage;
+
 enum {
 	CODEC_MODE_READ  = 1 << 0,
 	CODEC_MODE_WRITE = 1 << 1,
@@ -18,7 +20,7 @@ enum {
 struct codec {
 	struct codec *next;
 	const char *path, *type, *enc;
-	int fs, channels, prec, can_dither, interactive;
+	int fs, channels, prec, can_dither, interactive, has_out_stage;
 	ssize_t frames;
 	ssize_t (*read)(struct codec *, sample_t *, ssize_t);
 	ssize_t (*write)(struct codec *, sample_t *, ssize_t);
@@ -27,6 +29,10 @@ struct codec {
 	void (*drop)(struct codec *);  /* drop pending frames */
 	void (*pause)(struct codec *, int);
 	void (*destroy)(struct codec *);
+	void (*print_progress)(struct codec *, int);  /* optional; args: verbose */
+	/* If has_out_stage is nonzero and out_stage is set, write() dithers,
+	   clips, and tracks the peak while encoding (see sampleconv.h) */
+	struct out_stage *out_stage;
 	void *data;
 };
 
@@ -0,0 +1,347 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include "control.h"
+#include "rt.h"
+#include "util.h"
+
+/* How often the background thread looks for new values */
+#define CONTROL_POLL_MS 10
+/* How many names control_new() tries before giving up */
+#define CONTROL_MAX_NAMES 64
+
+struct control {
+	char *name;
+	int fd, has_thread, owner;
+	int stop;  /* set with atomics */
+	struct control_block *block;
+	pthread_t thread;
+	pthread_mutex_t lock;  /* held while cur and the block are used */
+	struct effects_ctls *cur, *next;  /* next is exchanged with atomics */
+	uint64_t seq;
+	double *values;
+	char touched[CONTROL_MAX_PARAMS];  /* the controller has changed the value */
+};
+
+/* The range in the block is only informational, since a controller can
+   overwrite it. Values are clamped to the range of the effect parameter. */
+static double clamp_value(const struct effect_param *p, double v, double fallback)
+{
+	if (!isfinite(v))
+		return fallback;
+	return MAXIMUM(MINIMUM(v, p->max), p->min);
+}
+
+static void set_ctl(struct effect_ctl *ctl, int n, const double *values)
+{
+	if (effect_ctl_set(ctl, values))
+		LOG_FMT(LL_ERROR, "control: warning: failed to update effect %d (%s)", n, ctl->name);
+}
+
+static void fill_param(struct control_param *p, struct effect_ctl *ctl, int i, int j)
+{
+	memset(p->name, 0, CONTROL_NAME_LEN);
+	snprintf(p->name, CONTROL_NAME_LEN, "%d.%s.%s", i, ctl->name, ctl->params[j].name);
+	p->min = ctl->params[j].min;
+	p->max = ctl->params[j].max;
+	p->value = ctl->params[j].value;
+}
+
+/* Returns the index of the entry with the same name as p if the controller
+   has changed its value, or -1 */
+static int find_touched(const struct control_param *p, const struct control_param *params, const char *touched, int n)
+{
+	int k;
+	for (k = 0; k < n; ++k)
+		if (touched[k] && strncmp(params[k].name, p->name, CONTROL_NAME_LEN) == 0)
+			return k;
+	return -1;
+}
+
+static int max_ctl_params(struct effects_ctls *ctls)
+{
+	int i, n = 1;
+	struct effect_ctl *ctl;
+	for (i = 0; ctls != NULL && (ctl = get_effects_ctl(ctls, i)) != NULL; ++i)
+		n = MAXIMUM(n, ctl->n_params);
+	return n;
+}
+
+/* Fills in the entries for the parameters of c->cur. Values that the
+   controller has set through the previous entries are kept if the name is the
+   same. c->lock must be held. */
+static void write_layout(struct control *c)
+{
+	int i, j, k, n = 0, n_old = c->block->n_params, changed;
+	struct control_param *old = NULL, *p;
+	char old_touched[CONTROL_MAX_PARAMS];
+	struct effect_ctl *ctl;
+
+	if (n_old > 0) {
+		old = malloc(n_old * sizeof(struct control_param));
+		memcpy(old, c->block->params, n_old * sizeof(struct control_param));
+		memcpy(old_touched, c->touched, n_old);
+	}
+	__atomic_add_fetch(&c->block->layout, 1, __ATOMIC_RELEASE);
+	c->values = realloc(c->values, max_ctl_params(c->cur) * sizeof(double));
+	for (i = 0; c->cur != NULL && (ctl = get_effects_ctl(c->cur, i)) != NULL; ++i) {
+		if (n + ctl->n_params > CONTROL_MAX_PARAMS) {
+			LOG_FMT(LL_ERROR, "control: warning: too many parameters; effects from %d (%s) on are not controllable", i, ctl->name);
+			break;
+		}
+		changed = 0;
+		for (j = 0; j < ctl->n_params; ++j, ++n) {
+			p = &c->block->params[n];
+			fill_param(p, ctl, i, j);
+			c->values[j] = p->value;
+			c->touched[n] = 0;
+			if ((k = find_touched(p, old, old_touched, n_old)) >= 0) {
+				c->values[j] = p->value = clamp_value(&ctl->params[j], old[k].value, p->value);
+				c->touched[n] = 1;
+				if (c->values[j] != ctl->params[j].value) changed = 1;
+			}
+		}
+		if (changed)
+			set_ctl(ctl, i, c->values);
+	}
+	c->block->n_params = n;
+	__atomic_add_fetch(&c->block->layout, 1, __ATOMIC_RELEASE);
+	free(old);
+	LOG_FMT(LL_VERBOSE, "control: info: %d parameter%s", n, (n == 1) ? "" : "s");
+}
+
+/* c->lock must be held */
+static void take_next(struct control *c)
+{
+	struct effects_ctls *next;
+	if (__atomic_load_n(&c->next, __ATOMIC_RELAXED) == NULL
+			|| (next = __atomic_exchange_n(&c->next, NULL, __ATOMIC_ACQUIRE)) == NULL)
+		return;
+	c->cur = next;
+	write_layout(c);
+}
+
+/* c->lock must be held */
+static void read_values(struct control *c)
+{
+	int i, j, n = 0, changed;
+	struct effect_ctl *ctl;
+	struct control_param *p;
+	for (i = 0; c->cur != NULL && (ctl = get_effects_ctl(c->cur, i)) != NULL; ++i) {
+		if (n + ctl->n_params > c->block->n_params)
+			break;
+		changed = 0;
+		for (j = 0; j < ctl->n_params; ++j, ++n) {
+			p = &c->block->params[n];
+			c->values[j] = clamp_value(&ctl->params[j], p->value, ctl->params[j].value);
+			if (c->values[j] != ctl->params[j].value) {
+				changed = 1;
+				c->touched[n] = 1;
+			}
+		}
+		if (changed) {
+			if (LOGLEVEL(LL_VERBOSE)) {
+				fprintf(stderr, "%s: control: info: %d.%s:", dsp_globals.prog_name, i, ctl->name);
+				for (j = 0; j < ctl->n_params; ++j)
+					fprintf(stderr, " %s=%g", ctl->params[j].name, c->values[j]);
+				fputc('\n', stderr);
+			}
+			set_ctl(ctl, i, c->values);
+		}
+	}
+}
+
+static void * control_thread(void *arg)
+{
+	uint64_t seq;
+	struct control *c = (struct control *) arg;
+	const struct timespec interval = { 0, CONTROL_POLL_MS * 1000000 };
+
+	rt_thread_init(RT_THREAD_CONTROL);
+	while (!__atomic_load_n(&c->stop, __ATOMIC_ACQUIRE)) {
+		nanosleep(&interval, NULL);
+		pthread_mutex_lock(&c->lock);
+		take_next(c);
+		seq = __atomic_load_n(&c->block->seq, __ATOMIC_ACQUIRE);
+		if (seq != c->seq) {
+			c->seq = seq;
+			read_values(c);
+		}
+		pthread_mutex_unlock(&c->lock);
+	}
+	return NULL;
+}
+
+/* Opens the object with the name c->name and takes the lock that marks it as
+   used. Returns 0 on success, 1 if another instance (in this or another
+   process) uses it, or -1 on error. */
+static int open_object(struct control *c)
+{
+	int created;
+	struct stat st;
+	for (;;) {
+		created = 1;
+		c->fd = shm_open(c->name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+		if (c->fd == -1 && errno == EEXIST) {
+			/* in use, or left behind by an instance that crashed */
+			created = 0;
+			if ((c->fd = shm_open(c->name, O_RDWR | O_CLOEXEC, 0600)) == -1 && errno == ENOENT)
+				continue;  /* the owner removed it in the meantime */
+		}
+		if (c->fd == -1) {
+			LOG_FMT(LL_ERROR, "control: error: shm_open() failed: %s: %s", c->name, strerror(errno));
+			return -1;
+		}
+		if (flock(c->fd, LOCK_EX | LOCK_NB) == -1) {
+			if (errno == EWOULDBLOCK) {
+				close(c->fd);
+				c->fd = -1;
+				return 1;
+			}
+			LOG_FMT(LL_ERROR, "control: error: flock() failed: %s: %s", c->name, strerror(errno));
+			return -1;
+		}
+		if (fstat(c->fd, &st) == -1) {
+			LOG_FMT(LL_ERROR, "control: error: fstat() failed: %s: %s", c->name, strerror(errno));
+			return -1;
+		}
+		if (st.st_nlink > 0)
+			break;
+		/* the owner removed it between shm_open() and flock() */
+		close(c->fd);
+		c->fd = -1;
+	}
+	c->owner = 1;
+	/* an object left behind by an older version may be world-writable */
+	if (!created && fchmod(c->fd, 0600) == -1) {
+		LOG_FMT(LL_ERROR, "control: error: fchmod() failed: %s: %s", c->name, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+struct control * control_new(const char *name, struct effects_ctls *ctls)
+{
+	int err, i, r = 1;
+	sigset_t set, old_set;
+	struct control *c = calloc(1, sizeof(struct control));
+
+	c->fd = -1;
+	c->name = calloc(strlen(name) + 16, sizeof(char));
+	pthread_mutex_init(&c->lock, NULL);
+	for (i = 0; i < CONTROL_MAX_NAMES && r == 1; ++i) {
+		if (i == 0) strcpy(c->name, name);
+		else sprintf(c->name, "%s.%d", name, i);
+		r = open_object(c);
+	}
+	if (r == 1)
+		LOG_FMT(LL_ERROR, "control: error: %s and %s.1 to %s.%d are all in use", name, name, name, CONTROL_MAX_NAMES - 1);
+	if (r != 0)
+		goto fail;
+	if (ftruncate(c->fd, sizeof(struct control_block)) == -1) {
+		LOG_FMT(LL_ERROR, "control: error: ftruncate() failed: %s", strerror(errno));
+		goto fail;
+	}
+	c->block = mmap(NULL, sizeof(struct control_block), PROT_READ | PROT_WRITE, MAP_SHARED, c->fd, 0);
+	if (c->block == MAP_FAILED) {
+		c->block = NULL;
+		LOG_FMT(LL_ERROR, "control: error: mmap() failed: %s", strerror(errno));
+		goto fail;
+	}
+	memset(c->block, 0, sizeof(struct control_block));
+	c->block->magic = CONTROL_MAGIC;
+	c->block->version = CONTROL_VERSION;
+	c->cur = ctls;
+	write_layout(c);
+
+	/* signals are handled by the main thread */
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &old_set);
+	err = pthread_create(&c->thread, NULL, control_thread, c);
+	pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+	if (err != 0) {
+		LOG_FMT(LL_ERROR, "control: error: failed to create thread: %s", strerror(err));
+		goto fail;
+	}
+	c->has_thread = 1;
+	LOG_FMT((i > 1) ? LL_NORMAL : LL_VERBOSE, "control: info: parameters are in shared memory object %s", c->name);
+	return c;
+
+	fail:
+	control_destroy(c);
+	return NULL;
+}
+
+void control_init_ctls(struct control *c, struct effects_ctls *ctls)
+{
+	int i, j, k, changed;
+	double *values = calloc(max_ctl_params(ctls), sizeof(double));
+	struct control_param p;
+	struct effect_ctl *ctl;
+	pthread_mutex_lock(&c->lock);
+	for (i = 0; (ctl = get_effects_ctl(ctls, i)) != NULL; ++i) {
+		changed = 0;
+		for (j = 0; j < ctl->n_params; ++j) {
+			fill_param(&p, ctl, i, j);
+			values[j] = p.value;
+			if ((k = find_touched(&p, c->block->params, c->touched, c->block->n_params)) >= 0) {
+				values[j] = clamp_value(&ctl->params[j], c->block->params[k].value, p.value);
+				if (values[j] != p.value) changed = 1;
+			}
+		}
+		if (changed)
+			set_ctl(ctl, i, values);
+	}
+	pthread_mutex_unlock(&c->lock);
+	free(values);
+}
+
+void control_switch(struct control *c, struct effects_ctls *ctls)
+{
+	__atomic_store_n(&c->next, ctls, __ATOMIC_RELEASE);
+}
+
+void control_release(struct control *c, struct effects_ctls *ctls)
+{
+	struct effects_ctls *expected = ctls;
+	pthread_mutex_lock(&c->lock);
+	/* if the thread has not taken them yet, they are simply dropped */
+	__atomic_compare_exchange_n(&c->next, &expected, NULL, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+	take_next(c);
+	if (c->cur == ctls) {
+		c->cur = NULL;
+		write_layout(c);
+	}
+	pthread_mutex_unlock(&c->lock);
+}
+
+void control_destroy(struct control *c)
+{
+	if (c == NULL)
+		return;
+	if (c->has_thread) {
+		__atomic_store_n(&c->stop, 1, __ATOMIC_RELEASE);
+		pthread_join(c->thread, NULL);
+	}
+	if (c->block != NULL)
+		munmap(c->block, sizeof(struct control_block));
+	/* unlink before closing, which drops the lock */
+	if (c->owner)
+		shm_unlink(c->name);
+	if (c->fd != -1)
+		close(c->fd);
+	pthread_mutex_destroy(&c->lock);
+	free(c->values);
+	free(c->name);
+	free(c);
+}
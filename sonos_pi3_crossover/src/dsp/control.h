@@ -0,0 +1,67 @@
+#ifndef _CONTROL_H
+#define _CONTROL_H
+
+#include <stdint.h>
+#include "effect.h"
+
+/* Runtime control of effect parameters through a POSIX shared memory object.
+   The object holds a control_block. Each parameter of each controllable
+   effect gets an entry named "n.effect.param", where n is the index of the
+   effect among the controllable effects in the chain (for example,
+   "0.gain.gain" or "2.eq.f0").
+
+   A controller writes the new values into the value members and then
+   increments seq. A background thread polls seq, clamps the values to the
+   range of the parameter (min and max in the block are a copy for the
+   controller; changing them has no effect), computes the updates and hands
+   them to the effects, which apply them at their next block boundary.
+   Nothing is locked, so the audio thread never waits for a controller.
+
+   When the parameter list changes (after a hot reload), layout is odd while
+   the entries are rewritten. Values that the controller has changed are kept
+   for parameters whose names did not change; the others take the values
+   from the new chain. */
+
+#define CONTROL_MAGIC      0x4c544344  /* "DCTL" */
+#define CONTROL_VERSION    1
+#define CONTROL_MAX_PARAMS 256
+#define CONTROL_NAME_LEN   64
+
+struct control_param {
+	char name[CONTROL_NAME_LEN];
+	double min, max;
+	double value;  /* written by the controller */
+};
+
+struct control_block {
+	uint32_t magic, version;
+	uint32_t layout;    /* incremented before and after the entries are rewritten */
+	uint32_t n_params;
+	uint64_t seq;       /* incremented by the controller after writing values */
+	struct control_param params[CONTROL_MAX_PARAMS];
+};
+
+struct control;
+
+/* Creates the shared memory object (the name is as for shm_open()), fills in
+   the parameters of the given controls and starts the background thread. If
+   another instance, in this or another process, uses the name, the first free
+   one of name.1, name.2, ... is used instead. The object is locked with
+   flock() while it is used, so an object left behind by an instance that
+   crashed is taken over. Returns NULL on failure. */
+struct control * control_new(const char *, struct effects_ctls *);
+/* Sets the values that the controller has changed on the controls of a new
+   chain (matching by name) before the chain is used. The updates are
+   pending; see apply_effects_chain_ctls(). Not for the audio thread. */
+void control_init_ctls(struct control *, struct effects_ctls *);
+/* Hands the controls of a new chain to the background thread. Lock-free, so
+   it may be called by the audio thread (when swapping chains, for example). */
+void control_switch(struct control *, struct effects_ctls *);
+/* Waits until the background thread no longer uses the given controls, which
+   may then be destroyed. Not for the audio thread. */
+void control_release(struct control *, struct effects_ctls *);
+/* Stops the background thread and removes the shared memory object, which
+   frees the name */
+void control_destroy(struct control *);
+
+#endif
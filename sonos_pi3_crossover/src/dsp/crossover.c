@@ -0,0 +1,547 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "crossover.h"
+#include "biquad.h"
+#include "util.h"
+
+/* Each selected channel is split into bands by a chain of Linkwitz-Riley
+   crossovers: the first split divides the input at f0, the second divides the
+   high side of the first at f1, and so on. Each split is a cascade of biquads
+   run on a vector with the lowpass in lane 0 and the highpass in lane 1, so
+   both sides cost about as much as one.
+
+   An LR filter of order n is a Butterworth filter of order n/2 applied twice.
+   The lowpass and highpass sum to the all-pass D(-s)/D(s), where D(s) is the
+   Butterworth denominator, if the highpass is inverted when n/2 is odd. The
+   bands below a split do not go through it, so with alignment enabled they
+   get that all-pass instead and all of the bands sum to an all-pass. */
+
+#define CROSSOVER_MAX_BANDS 8
+#define CROSSOVER_MAX_ORDER 16
+
+/* Changes made through a control: the filter coefficients and band gains are
+   ramped over CROSSOVER_CTL_RAMP_MS, and each band crossfades from a tap at
+   its old delay to one at the new delay over the same time. Band delays can
+   only be shortened from the value given in the effects chain. */
+#define CROSSOVER_CTL_RAMP_MS     20
+#define CROSSOVER_CTL_MAX_FREQ(fs) ((fs) * 0.49)
+#define CROSSOVER_CTL_MIN_GAIN    -120.0
+#define CROSSOVER_CTL_MAX_GAIN    40.0
+
+struct crossover_channel {
+	struct cascade_section *split;  /* n_sections per split */
+	struct biquad_state *ap;        /* all-pass sections for every band below the top two, in band order; NULL if not aligned */
+	sample_t **bufs;                /* delay line per band (len + 1 frames); NULL if the band is not delayed */
+};
+
+struct crossover_state {
+	int order, n_bands, n_sections, n_ap;  /* sections per split and all-pass sections per split */
+	struct crossover_channel *ch;   /* per input channel; split is NULL if the channel is passed through */
+	sample_t gain[CROSSOVER_MAX_BANDS];
+	ssize_t len[CROSSOVER_MAX_BANDS], p[CROSSOVER_MAX_BANDS], d[CROSSOVER_MAX_BANDS];  /* maximum delay, write position, and delay */
+	/* while ramping: gain is the gain at the start of the block */
+	sample_t gain_target[CROSSOVER_MAX_BANDS], gain_step[CROSSOVER_MAX_BANDS];
+	/* while ramping: the output of band b moves from the tap at d_old to the
+	   one at d; fade is the weight of the new tap at the start of the block */
+	ssize_t d_old[CROSSOVER_MAX_BANDS];
+	sample_t fade[CROSSOVER_MAX_BANDS], fade_step[CROSSOVER_MAX_BANDS];
+	struct biquad_ramp *split_ramp;  /* per split section and lane; shared by the channels */
+	struct biquad_ramp *ap_ramp;     /* laid out like crossover_channel.ap */
+	ssize_t ramp;                    /* frames left in the ramp */
+};
+
+/* What prepare() needs, copied from the effect so that the control thread
+   never touches the effect (which may already be freed after a reload) */
+struct crossover_ctl {
+	struct effect *e;  /* for apply() only */
+	int order, n_bands, fs;
+	ssize_t len[CROSSOVER_MAX_BANDS];
+};
+
+struct crossover_ctl_update {
+	struct effect_ctl_update u;
+	struct biquad_state split[CROSSOVER_MAX_BANDS - 1][CROSSOVER_MAX_ORDER / 2][2];
+	struct biquad_state ap[CROSSOVER_MAX_BANDS - 1][CROSSOVER_MAX_ORDER / 4];
+	sample_t gain[CROSSOVER_MAX_BANDS];
+	double delay[CROSSOVER_MAX_BANDS];  /* seconds */
+};
+
+static const char *const crossover_freq_names[CROSSOVER_MAX_BANDS - 1] = { "f0", "f1", "f2", "f3", "f4", "f5", "f6" };
+static const char *const crossover_gain_names[CROSSOVER_MAX_BANDS] = { "gain0", "gain1", "gain2", "gain3", "gain4", "gain5", "gain6", "gain7" };
+static const char *const crossover_delay_names[CROSSOVER_MAX_BANDS] = { "delay0", "delay1", "delay2", "delay3", "delay4", "delay5", "delay6", "delay7" };
+
+/* Moves the coefficients of a channel to where the ramp is at frame i of the block */
+static void crossover_ramp_step(struct crossover_state *state, struct crossover_channel *ch, ssize_t i)
+{
+	int j;
+	const int n_splits = state->n_bands - 1;
+	for (j = 0; j < n_splits * state->n_sections; ++j) {
+		cascade_ramp_step_lane(&ch->split[j], 0, &state->split_ramp[j * 2], i);
+		cascade_ramp_step_lane(&ch->split[j], 1, &state->split_ramp[j * 2 + 1], i);
+	}
+	if (ch->ap != NULL)
+		for (j = 0; j < n_splits * (n_splits - 1) / 2 * state->n_ap; ++j)
+			biquad_ramp_step(&ch->ap[j], &state->ap_ramp[j], i);
+}
+
+/* Moves the coefficients of every channel to the targets of the ramp */
+static void crossover_ramp_finish_channels(struct crossover_state *state, int channels)
+{
+	int k;
+	for (k = 0; k < channels; ++k)
+		if (state->ch[k].split != NULL)
+			crossover_ramp_step(state, &state->ch[k], state->ramp - 1);
+}
+
+static void crossover_ramp_advance(struct crossover_state *state, ssize_t frames)
+{
+	int j, b;
+	const int n_splits = state->n_bands - 1;
+	for (j = 0; j < n_splits * state->n_sections * 2; ++j)
+		state->split_ramp[j].frames = MAXIMUM(state->split_ramp[j].frames - frames, 0);
+	for (j = 0; j < n_splits * (n_splits - 1) / 2 * state->n_ap; ++j)
+		state->ap_ramp[j].frames = MAXIMUM(state->ap_ramp[j].frames - frames, 0);
+	for (b = 0; b < state->n_bands; ++b) {
+		state->gain[b] = (frames >= state->ramp) ? state->gain_target[b] : state->gain[b] + state->gain_step[b] * frames;
+		state->fade[b] = (frames >= state->ramp) ? 1.0 : state->fade[b] + state->fade_step[b] * frames;
+	}
+	state->ramp = MAXIMUM(state->ramp - frames, 0);
+}
+
+/* Runs frames [start, end) of the block. ramping is a constant in each caller,
+   so the ramp code drops out of the common path. */
+static __inline__ __attribute__((always_inline)) sample_t * crossover_run_frames(struct effect *e, ssize_t start, ssize_t end, sample_t *ibuf, sample_t *op, const int ramping)
+{
+	ssize_t i, r[CROSSOVER_MAX_BANDS], r_old[CROSSOVER_MAX_BANDS];
+	int k, j, b;
+	sample_t g[CROSSOVER_MAX_BANDS], w[CROSSOVER_MAX_BANDS], y;
+	biquad_sample_t x, band[CROSSOVER_MAX_BANDS];
+	cascade_vec_t v;
+	const cascade_vec_t zero = { 0 };
+	struct cascade_section *s;
+	struct biquad_state *ap;
+	struct crossover_channel *ch;
+	struct crossover_state *state = (struct crossover_state *) e->data;
+	const int n_splits = state->n_bands - 1;
+	for (b = 0; b < state->n_bands; ++b)
+		g[b] = state->gain_target[b];
+	for (i = start; i < end; ++i) {
+		for (b = 0; b < state->n_bands; ++b) {
+			if (ramping)
+				g[b] = state->gain[b] + state->gain_step[b] * (i + 1);
+			/* the sample is written before it is read, so a delay of 0 reads it back */
+			r[b] = state->p[b] - state->d[b];
+			if (r[b] < 0)
+				r[b] += state->len[b] + 1;
+			if (ramping) {
+				w[b] = state->fade[b] + state->fade_step[b] * (i + 1);
+				r_old[b] = state->p[b] - state->d_old[b];
+				if (r_old[b] < 0)
+					r_old[b] += state->len[b] + 1;
+			}
+		}
+		for (k = 0; k < e->istream.channels; ++k) {
+			ch = &state->ch[k];
+			x = ibuf[i * e->istream.channels + k];
+			if (ch->split == NULL) {
+				*op++ = x;
+				continue;
+			}
+			if (ramping)
+				crossover_ramp_step(state, ch, i);
+			for (j = 0, s = ch->split; j < n_splits; ++j) {
+				v = zero + (cascade_sample_t) x;
+				for (b = 0; b < state->n_sections; ++b)
+					v = cascade_biquad(s++, v);
+				band[j] = v[0];
+				x = v[1];
+			}
+			band[n_splits] = x;
+			if (ch->ap != NULL) {
+				for (b = 0, ap = ch->ap; b < n_splits - 1; ++b)
+					for (j = (n_splits - 1 - b) * state->n_ap; j > 0; --j)
+						band[b] = biquad(ap++, band[b]);
+			}
+			for (b = 0; b < state->n_bands; ++b) {
+				x = band[b] * g[b];
+				if (ch->bufs[b] != NULL) {
+					ch->bufs[b][state->p[b]] = x;
+					y = ch->bufs[b][r[b]];
+					if (ramping)
+						y = ch->bufs[b][r_old[b]] + (y - ch->bufs[b][r_old[b]]) * w[b];
+					*op++ = y;
+				}
+				else
+					*op++ = x;
+			}
+		}
+		for (b = 0; b < state->n_bands; ++b)
+			if (state->len[b] > 0)
+				state->p[b] = (state->p[b] + 1 > state->len[b]) ? 0 : state->p[b] + 1;
+	}
+	return op;
+}
+
+sample_t * crossover_effect_run(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf)
+{
+	struct crossover_state *state = (struct crossover_state *) e->data;
+	/* the last frame of the ramp lands exactly on the targets */
+	const ssize_t n = MINIMUM(state->ramp - 1, *frames);
+	sample_t *op = obuf;
+	if (n > 0)
+		op = crossover_run_frames(e, 0, n, ibuf, op, 1);
+	if (state->ramp > 0 && n < *frames)
+		crossover_ramp_finish_channels(state, e->istream.channels);
+	crossover_run_frames(e, MAXIMUM(n, 0), *frames, ibuf, op, 0);
+	if (state->ramp > 0)
+		crossover_ramp_advance(state, *frames);
+	return obuf;
+}
+
+void crossover_effect_reset(struct effect *e)
+{
+	int k, j, b;
+	struct crossover_channel *ch;
+	struct crossover_state *state = (struct crossover_state *) e->data;
+	const int n_splits = state->n_bands - 1;
+	const cascade_vec_t zero = { 0 };
+	for (k = 0; k < e->istream.channels; ++k) {
+		ch = &state->ch[k];
+		if (ch->split == NULL)
+			continue;
+		for (j = 0; j < n_splits * state->n_sections; ++j) {
+#if BIQUAD_USE_TDF_2
+			ch->split[j].m0 = ch->split[j].m1 = zero;
+#else
+			ch->split[j].i0 = ch->split[j].i1 = ch->split[j].o0 = ch->split[j].o1 = zero;
+#endif
+		}
+		if (ch->ap != NULL)
+			for (j = 0; j < n_splits * (n_splits - 1) / 2 * state->n_ap; ++j)
+				biquad_reset(&ch->ap[j]);
+		for (b = 0; b < state->n_bands; ++b)
+			if (ch->bufs[b] != NULL)
+				memset(ch->bufs[b], 0, (state->len[b] + 1) * sizeof(sample_t));
+	}
+	for (b = 0; b < state->n_bands; ++b)
+		state->p[b] = 0;
+	if (state->ramp > 0) {
+		crossover_ramp_finish_channels(state, e->istream.channels);
+		crossover_ramp_advance(state, state->ramp);
+	}
+}
+
+static void crossover_state_free(struct crossover_state *state, int channels)
+{
+	int k, b;
+	for (k = 0; k < channels; ++k) {
+		free(state->ch[k].split);
+		free(state->ch[k].ap);
+		if (state->ch[k].bufs != NULL)
+			for (b = 0; b < state->n_bands; ++b)
+				free(state->ch[k].bufs[b]);
+		free(state->ch[k].bufs);
+	}
+	free(state->ch);
+	free(state->split_ramp);
+	free(state->ap_ramp);
+	free(state);
+}
+
+void crossover_effect_destroy(struct effect *e)
+{
+	crossover_state_free((struct crossover_state *) e->data, e->istream.channels);
+}
+
+/* Q of the kth second-order section of a Butterworth filter of order n */
+static double butterworth_q(int n, int k)
+{
+	return 1.0 / (2.0 * sin(M_PI * (2 * k + 1) / (2 * n)));
+}
+
+/* Computes the lowpass and highpass sections of one split. The pole pairs of
+   the Butterworth filter each get two sections; if its order is odd, the two
+   first-order poles together make one more section with a Q of 0.5. */
+static void crossover_design_split(struct biquad_state (*s)[2], int order, double fs, double fc)
+{
+	int k, n = order / 2;
+	struct biquad_state *lp, *hp;
+	for (k = 0; k < n; ++k) {
+		const double q = (k / 2 < n / 2) ? butterworth_q(n, k / 2) : 0.5;
+		lp = &s[k][0];
+		hp = &s[k][1];
+		biquad_init_using_type(lp, BIQUAD_LOWPASS, fs, fc, q, 0.0, 0.0, BIQUAD_WIDTH_Q);
+		biquad_init_using_type(hp, BIQUAD_HIGHPASS, fs, fc, q, 0.0, 0.0, BIQUAD_WIDTH_Q);
+		if (k == 0 && n % 2 == 1) {
+			hp->c0 = -hp->c0;
+			hp->c1 = -hp->c1;
+			hp->c2 = -hp->c2;
+		}
+	}
+}
+
+/* Sets up the sections of one split, with the lowpass in lane 0 and the
+   highpass in lane 1 */
+static void crossover_init_split(struct cascade_section *s, int order, double fs, double fc)
+{
+	int k;
+	struct biquad_state b[CROSSOVER_MAX_ORDER / 2][2];
+	crossover_design_split(b, order, fs, fc);
+	for (k = 0; k < order / 2; ++k) {
+		cascade_set_lane(&s[k], 0, &b[k][0]);
+		cascade_set_lane(&s[k], 1, &b[k][1]);
+	}
+}
+
+/* Sets up the all-pass sections that match a split: one per pole pair, plus a
+   first-order section if the Butterworth order is odd */
+static void crossover_init_allpass(struct biquad_state *ap, int order, double fs, double fc)
+{
+	int k, n = order / 2;
+	const double t = tan(M_PI * fc / fs);
+	for (k = 0; k < n / 2; ++k)
+		biquad_init_using_type(&ap[k], BIQUAD_ALLPASS, fs, fc, butterworth_q(n, k), 0.0, 0.0, BIQUAD_WIDTH_Q);
+	if (n % 2 == 1)
+		biquad_init(&ap[k], t - 1.0, t + 1.0, 0.0, t + 1.0, t - 1.0, 0.0);
+}
+
+/* Parameter order: f0..., then gain0..., then delayN for every delayed band */
+static struct effect_ctl_update * crossover_ctl_prepare(struct effect_ctl *c, const double *values)
+{
+	int j, b, n;
+	struct crossover_ctl *xc = (struct crossover_ctl *) c->data;
+	struct crossover_ctl_update *u;
+	const int n_splits = xc->n_bands - 1;
+	for (j = 1; j < n_splits; ++j)
+		if (values[j] <= values[j - 1])
+			return NULL;  /* the frequencies must be increasing */
+	u = calloc(1, sizeof(struct crossover_ctl_update));
+	for (j = 0; j < n_splits; ++j) {
+		crossover_design_split(u->split[j], xc->order, xc->fs, values[j]);
+		crossover_init_allpass(u->ap[j], xc->order, xc->fs, values[j]);
+	}
+	for (b = 0, n = n_splits; b < xc->n_bands; ++b)
+		u->gain[b] = pow(10.0, values[n++] / 20.0);
+	for (b = 0; b < xc->n_bands; ++b)
+		if (xc->len[b] > 0)
+			u->delay[b] = values[n++];
+	return &u->u;
+}
+
+static void crossover_ctl_apply(struct effect_ctl *c, struct effect_ctl_update *update)
+{
+	int k, j, b, i, l;
+	struct biquad_state cur;
+	struct cascade_section *s;
+	struct effect *e = ((struct crossover_ctl *) c->data)->e;
+	struct crossover_state *state = (struct crossover_state *) e->data;
+	struct crossover_ctl_update *u = (struct crossover_ctl_update *) update;
+	struct crossover_channel *ch = NULL;
+	const int n_splits = state->n_bands - 1;
+	const ssize_t frames = MAXIMUM((ssize_t) e->istream.fs * CROSSOVER_CTL_RAMP_MS / 1000, 1);
+
+	/* every channel has the same coefficients, so any one gives the starting point */
+	for (k = 0; k < e->istream.channels && ch == NULL; ++k)
+		if (state->ch[k].split != NULL)
+			ch = &state->ch[k];
+	if (ch != NULL) {
+		for (j = 0; j < n_splits * state->n_sections; ++j) {
+			s = &ch->split[j];
+			for (l = 0; l < 2; ++l) {
+				cur.c0 = s->c0[l];
+				cur.c1 = s->c1[l];
+				cur.c2 = s->c2[l];
+				cur.c3 = s->c3[l];
+				cur.c4 = s->c4[l];
+				biquad_ramp_init(&state->split_ramp[j * 2 + l], &cur, &u->split[j / state->n_sections][j % state->n_sections][l], frames);
+			}
+		}
+		if (ch->ap != NULL)
+			for (b = 0, i = 0; b < n_splits - 1; ++b)
+				for (j = b + 1; j < n_splits; ++j)
+					for (l = 0; l < state->n_ap; ++l, ++i)
+						biquad_ramp_init(&state->ap_ramp[i], &ch->ap[i], &u->ap[j][l], frames);
+	}
+	for (b = 0; b < state->n_bands; ++b) {
+		state->gain_target[b] = u->gain[b];
+		state->gain_step[b] = (state->gain_target[b] - state->gain[b]) / frames;
+		if (state->len[b] > 0) {
+			/* a fade in progress starts again from whichever tap dominates */
+			if (state->fade[b] >= 0.5)
+				state->d_old[b] = state->d[b];
+			state->d[b] = MAXIMUM(MINIMUM(lround(u->delay[b] * e->istream.fs), state->len[b]), 0);
+			state->fade[b] = 0.0;
+			state->fade_step[b] = 1.0 / frames;
+		}
+	}
+	state->ramp = frames;
+}
+
+static void crossover_ctl_destroy(struct effect_ctl *c)
+{
+	free(c->data);
+}
+
+/* Parses a comma-separated list of up to n values into v. If fs is nonzero,
+   the values are lengths (see parse_len()) in frames. */
+static int crossover_parse_list(char **argv, const char *name, const char *list, double *v, int n, int fs)
+{
+	char *tmp = strdup(list), *s = tmp, *next, *endptr;
+	int i;
+	for (i = 0; *s != '\0'; ++i, s = next) {
+		next = isolate(s, ',');
+		if (i == n) {
+			LOG_FMT(LL_ERROR, "%s: error: too many values for %s", argv[0], name);
+			goto fail;
+		}
+		v[i] = (fs > 0) ? (double) parse_len(s, fs, &endptr) : strtod(s, &endptr);
+		CHECK_ENDPTR(s, endptr, name, goto fail);
+		if (fs > 0)
+			CHECK_RANGE(v[i] >= 0.0, name, goto fail);
+	}
+	free(tmp);
+	return 0;
+
+	fail:
+	free(tmp);
+	return 1;
+}
+
+struct effect * crossover_effect_init(struct effect_info *ei, struct stream_info *istream, char *channel_selector, const char *dir, int argc, char **argv)
+{
+	struct effect *e;
+	struct crossover_state *state;
+	struct crossover_channel *ch;
+	struct effect_ctl *c;
+	struct crossover_ctl *xc;
+	char *endptr;
+	const char *gain_arg = NULL, *delay_arg = NULL;
+	int i, k, j, b, order = 4, align = 0, n_freqs = 0, n_splits, n_ap_total, n_delays, out_channels = 0;
+	double freq[CROSSOVER_MAX_BANDS - 1], gain[CROSSOVER_MAX_BANDS] = { 0 }, delay[CROSSOVER_MAX_BANDS] = { 0 };
+
+	for (i = 1; i < argc; ++i) {
+		if (strncmp(argv[i], "lr", 2) == 0 && n_freqs == 0) {
+			order = strtol(&argv[i][2], &endptr, 10);
+			CHECK_ENDPTR(&argv[i][2], endptr, "order", return NULL);
+			CHECK_RANGE(order >= 2 && order <= CROSSOVER_MAX_ORDER && order % 2 == 0, "order", return NULL);
+		}
+		else if (strcmp(argv[i], "align") == 0)
+			align = 1;
+		else if (strncmp(argv[i], "gain=", 5) == 0)
+			gain_arg = &argv[i][5];
+		else if (strncmp(argv[i], "delay=", 6) == 0)
+			delay_arg = &argv[i][6];
+		else {
+			if (n_freqs == CROSSOVER_MAX_BANDS - 1) {
+				LOG_FMT(LL_ERROR, "%s: error: too many bands (max %d)", argv[0], CROSSOVER_MAX_BANDS);
+				return NULL;
+			}
+			freq[n_freqs] = parse_freq(argv[i], &endptr);
+			CHECK_ENDPTR(argv[i], endptr, "f0", return NULL);
+			CHECK_FREQ(freq[n_freqs], istream->fs, "f0", return NULL);
+			CHECK_RANGE(freq[n_freqs] > 0.0 && (n_freqs == 0 || freq[n_freqs] > freq[n_freqs - 1]), "f0", return NULL);
+			++n_freqs;
+		}
+	}
+	if (n_freqs == 0) {
+		LOG_FMT(LL_ERROR, "%s: usage: %s", argv[0], ei->usage);
+		return NULL;
+	}
+	n_splits = n_freqs;
+	if (gain_arg != NULL && crossover_parse_list(argv, "gain", gain_arg, gain, n_splits + 1, 0))
+		return NULL;
+	if (delay_arg != NULL && crossover_parse_list(argv, "delay", delay_arg, delay, n_splits + 1, istream->fs))
+		return NULL;
+
+	state = calloc(1, sizeof(struct crossover_state));
+	state->order = order;
+	state->n_bands = n_splits + 1;
+	state->n_sections = order / 2;
+	state->n_ap = (order / 2 + 1) / 2;
+	for (b = 0; b < state->n_bands; ++b) {
+		state->gain[b] = state->gain_target[b] = pow(10.0, gain[b] / 20.0);
+		state->len[b] = state->d[b] = state->d_old[b] = (ssize_t) delay[b];
+		state->fade[b] = 1.0;
+	}
+	n_ap_total = n_splits * (n_splits - 1) / 2 * state->n_ap;
+	state->split_ramp = calloc(n_splits * state->n_sections * 2, sizeof(struct biquad_ramp));
+	state->ap_ramp = calloc(MAXIMUM(n_ap_total, 1), sizeof(struct biquad_ramp));
+	state->ch = calloc(istream->channels, sizeof(struct crossover_channel));
+	for (k = 0; k < istream->channels; ++k) {
+		if (!GET_BIT(channel_selector, k)) {
+			++out_channels;
+			continue;
+		}
+		ch = &state->ch[k];
+		if ((ch->split = cascade_alloc_sections(n_splits * state->n_sections)) == NULL) {
+			LOG_FMT(LL_ERROR, "%s: error: failed to allocate memory", argv[0]);
+			goto fail;
+		}
+		for (j = 0; j < n_splits; ++j)
+			crossover_init_split(&ch->split[j * state->n_sections], order, istream->fs, freq[j]);
+		if (align && n_ap_total > 0) {
+			ch->ap = calloc(n_ap_total, sizeof(struct biquad_state));
+			for (b = 0, i = 0; b < n_splits - 1; ++b)
+				for (j = b + 1; j < n_splits; ++j, i += state->n_ap)
+					crossover_init_allpass(&ch->ap[i], order, istream->fs, freq[j]);
+		}
+		ch->bufs = calloc(state->n_bands, sizeof(sample_t *));
+		for (b = 0; b < state->n_bands; ++b)
+			if (state->len[b] > 0)
+				ch->bufs[b] = calloc(state->len[b] + 1, sizeof(sample_t));
+		out_channels += state->n_bands;
+	}
+	LOG_FMT(LL_VERBOSE, "%s: info: LR%d, %d bands, %d output channels", argv[0], order, state->n_bands, out_channels);
+
+	e = calloc(1, sizeof(struct effect));
+	e->name = ei->name;
+	e->istream.fs = e->ostream.fs = istream->fs;
+	e->istream.channels = istream->channels;
+	e->ostream.channels = out_channels;
+	e->run = crossover_effect_run;
+	e->reset = crossover_effect_reset;
+	e->destroy = crossover_effect_destroy;
+	e->data = state;
+	for (b = 0, n_delays = 0; b < state->n_bands; ++b)
+		if (state->len[b] > 0)
+			++n_delays;
+	c = add_effect_ctl(e, ei->name, n_splits + state->n_bands + n_delays);
+	for (j = 0, i = 0; j < n_splits; ++j, ++i) {
+		c->params[i].name = crossover_freq_names[j];
+		c->params[i].value = freq[j];
+		c->params[i].min = 1.0;
+		c->params[i].max = CROSSOVER_CTL_MAX_FREQ(istream->fs);
+	}
+	for (b = 0; b < state->n_bands; ++b, ++i) {
+		c->params[i].name = crossover_gain_names[b];
+		c->params[i].value = gain[b];
+		c->params[i].min = CROSSOVER_CTL_MIN_GAIN;
+		c->params[i].max = CROSSOVER_CTL_MAX_GAIN;
+	}
+	for (b = 0; b < state->n_bands; ++b) {
+		if (state->len[b] > 0) {
+			c->params[i].name = crossover_delay_names[b];
+			c->params[i].value = c->params[i].max = (double) state->len[b] / istream->fs;
+			c->params[i].min = 0.0;
+			++i;
+		}
+	}
+	xc = calloc(1, sizeof(struct crossover_ctl));
+	xc->e = e;
+	xc->order = order;
+	xc->n_bands = state->n_bands;
+	xc->fs = istream->fs;
+	for (b = 0; b < state->n_bands; ++b)
+		xc->len[b] = state->len[b];
+	c->prepare = crossover_ctl_prepare;
+	c->apply = crossover_ctl_apply;
+	c->destroy = crossover_ctl_destroy;
+	c->data = xc;
+	return e;
+
+	fail:
+	crossover_state_free(state, istream->channels);
+	return NULL;
+}
@@ -0,0 +1,9 @@
+#ifndef _CROSSOVER_H
+#define _CROSSOVER_H
+
+#include "dsp.h"
+#include "effect.h"
+
+struct effect * crossover_effect_init(struct effect_info *, struct stream_info *, char *, const char *, int, char **);
+
+#endif
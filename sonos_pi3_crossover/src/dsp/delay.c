@@ -5,29 +5,112 @@
 #include "delay.h"
 #include "util.h"
 
+/* Delay changes made through a control are crossfaded over this long */
+#define DELAY_CTL_FADE_MS 20
+
+/* The buffers hold len frames, which is the delay given in the effects chain.
+   A control can shorten the delay (d) to anything down to zero. While fading,
+   the output moves from a tap at the old delay (d_old) to one at d. */
 struct delay_state {
 	sample_t **bufs;
-	ssize_t len, p;
+	ssize_t len, p, d;
+	ssize_t d_old, fade, fade_pos;  /* fade_pos == fade when not fading */
 };
 
-sample_t * delay_effect_run(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf)
+struct delay_ctl_update {
+	struct effect_ctl_update u;
+	double seconds;
+};
+
+/* Returns the read position for write position p and delay d */
+static __inline__ ssize_t delay_read_pos(struct delay_state *state, ssize_t p, ssize_t d)
+{
+	return (p >= d) ? p - d : p - d + state->len;
+}
+
+/* Delays one channel. Sample i is at buf[i * stride]. */
+static void delay_channel_run(struct delay_state *state, sample_t *dbuf, ssize_t frames, sample_t *ibuf, sample_t *obuf, ssize_t stride)
+{
+	ssize_t i = 0, n, p = state->p, r = delay_read_pos(state, state->p, state->d), r_old;
+	sample_t s, a, b;
+	if (state->fade_pos < state->fade) {
+		n = MINIMUM(frames, state->fade - state->fade_pos);
+		r_old = delay_read_pos(state, state->p, state->d_old);
+		for (; i < n; ++i) {
+			s = ibuf[i * stride];
+			a = (state->d_old == 0) ? s : dbuf[r_old];
+			b = (state->d == 0) ? s : dbuf[r];
+			obuf[i * stride] = a + (b - a) * (sample_t) (state->fade_pos + i + 1) / state->fade;
+			dbuf[p] = s;
+			p = (p + 1 >= state->len) ? 0 : p + 1;
+			r = (r + 1 >= state->len) ? 0 : r + 1;
+			r_old = (r_old + 1 >= state->len) ? 0 : r_old + 1;
+		}
+	}
+	if (state->d == 0) {
+		for (; i < frames; ++i) {
+			obuf[i * stride] = ibuf[i * stride];
+			dbuf[p] = ibuf[i * stride];
+			p = (p + 1 >= state->len) ? 0 : p + 1;
+		}
+		return;
+	}
+	for (; i < frames; ++i) {
+		obuf[i * stride] = dbuf[r];
+		dbuf[p] = ibuf[i * stride];
+		p = (p + 1 >= state->len) ? 0 : p + 1;
+		r = (r + 1 >= state->len) ? 0 : r + 1;
+	}
+}
+
+sample_t * delay_effect_run_ch(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf, int start, int end)
 {
-	ssize_t i, k;
+	ssize_t i;
+	int k;
 	struct delay_state *state = (struct delay_state *) e->data;
-	for (i = 0; i < *frames; ++i) {
-		for (k = 0; k < e->istream.channels; ++k) {
-			if (state->bufs[k] && state->len > 0) {
-				obuf[i * e->istream.channels + k] = state->bufs[k][state->p];
-				state->bufs[k][state->p] = ibuf[i * e->istream.channels + k];
-			}
-			else
+	for (k = start; k < end; ++k) {
+		if (state->bufs[k])
+			delay_channel_run(state, state->bufs[k], *frames, &ibuf[k], &obuf[k], e->istream.channels);
+		else {
+			for (i = 0; i < *frames; ++i)
 				obuf[i * e->istream.channels + k] = ibuf[i * e->istream.channels + k];
 		}
-		state->p = (state->p + 1 >= state->len) ? 0 : state->p + 1;
 	}
 	return obuf;
 }
 
+void delay_effect_run_ch_commit(struct effect *e, ssize_t frames)
+{
+	struct delay_state *state = (struct delay_state *) e->data;
+	if (state->len > 0)
+		state->p = (state->p + frames) % state->len;
+	state->fade_pos = MINIMUM(state->fade_pos + frames, state->fade);
+}
+
+sample_t * delay_effect_run(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf)
+{
+	delay_effect_run_ch(e, frames, ibuf, obuf, 0, e->istream.channels);
+	delay_effect_run_ch_commit(e, *frames);
+	return obuf;
+}
+
+sample_t * delay_effect_run_planar(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf)
+{
+	int k;
+	sample_t *in, *out;
+	struct delay_state *state = (struct delay_state *) e->data;
+	for (k = 0; k < e->istream.channels; ++k) {
+		in = &ibuf[k * *frames];
+		out = &obuf[k * *frames];
+		if (state->bufs[k])
+			delay_channel_run(state, state->bufs[k], *frames, in, out, 1);
+		else
+			memcpy(out, in, *frames * sizeof(sample_t));
+	}
+	delay_effect_run_ch_commit(e, *frames);
+	return obuf;
+}
+
 void delay_effect_reset(struct effect *e)
 {
 	int i;
@@ -36,6 +119,7 @@ void delay_effect_reset(struct effect *e)
 		if (state->bufs[i] && state->len > 0)
 			memset(state->bufs[i], 0, state->len * sizeof(sample_t));
 	state->p = 0;
+	state->fade_pos = state->fade;
 }
 
 void delay_effect_plot(struct effect *e, int i)
@@ -45,6 +129,26 @@ void delay_effect_plot(struct effect *e, int i)
 		printf("H%d_%d(f)=0\n", k, i);
 }
 
+static struct effect_ctl_update * delay_ctl_prepare(struct effect_ctl *c, const double *values)
+{
+	struct delay_ctl_update *u = calloc(1, sizeof(struct delay_ctl_update));
+	u->seconds = values[0];
+	return &u->u;
+}
+
+/* The output is crossfaded from the old delay to the new one. If a fade is
+   still in progress, it starts again from whichever tap dominates. */
+static void delay_ctl_apply(struct effect_ctl *c, struct effect_ctl_update *u)
+{
+	struct effect *e = (struct effect *) c->data;
+	struct delay_state *state = (struct delay_state *) e->data;
+	if (state->fade_pos * 2 >= state->fade)
+		state->d_old = state->d;
+	state->d = MAXIMUM(MINIMUM(lround(((struct delay_ctl_update *) u)->seconds * e->istream.fs), state->len), 0);
+	state->fade = MAXIMUM(e->istream.fs * DELAY_CTL_FADE_MS / 1000, 1);
+	state->fade_pos = 0;
+}
+
 void delay_effect_destroy(struct effect *e)
 {
 	int i;
@@ -59,6 +163,7 @@ struct effect * delay_effect_init(struct effect_info *ei, struct stream_info *is
 {
 	char *endptr;
 	struct effect *e;
+	struct effect_ctl *c;
 	struct delay_state *state;
 	int i;
 	ssize_t samples;
@@ -73,7 +178,7 @@ struct effect * delay_effect_init(struct effect_info *ei, struct stream_info *is
 	CHECK_RANGE(samples >= 0, "delay", return NULL);
 	LOG_FMT(LL_VERBOSE, "%s: info: actual delay is %gs (%zd sample%s)", argv[0], (double) samples / istream->fs, samples, (samples == 1) ? "" : "s");
 	state = calloc(1, sizeof(struct delay_state));
-	state->len = samples;
+	state->len = state->d = state->d_old = samples;
 	state->bufs = calloc(istream->channels, sizeof(sample_t *));
 	for (i = 0; i < istream->channels; ++i)
 		if (GET_BIT(channel_selector, i) && state->len > 0)
@@ -84,9 +189,20 @@ struct effect * delay_effect_init(struct effect_info *ei, struct stream_info *is
 	e->istream.fs = e->ostream.fs = istream->fs;
 	e->istream.channels = e->ostream.channels = istream->channels;
 	e->run = delay_effect_run;
+	e->run_planar = delay_effect_run_planar;
+	e->run_ch = delay_effect_run_ch;
+	e->run_ch_commit = delay_effect_run_ch_commit;
 	e->reset = delay_effect_reset;
 	e->plot = delay_effect_plot;
 	e->destroy = delay_effect_destroy;
 	e->data = state;
+	if (state->len > 0) {
+		c = add_effect_ctl(e, ei->name, 1);
+		c->params[0].name = "delay";
+		c->params[0].value = c->params[0].max = (double) state->len / istream->fs;
+		c->prepare = delay_ctl_prepare;
+		c->apply = delay_ctl_apply;
+		c->data = e;
+	}
 	return e;
 }
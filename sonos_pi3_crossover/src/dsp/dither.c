@@ -0,0 +1,333 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "dither.h"
+#include "sampleconv.h"
+#include "util.h"
+
+/* Error feedback noise shaping. The quantization error (including the dither)
+   of the previous samples is filtered and subtracted from the next sample, so
+   the noise transfer function is 1 - sum(h[k] * z^-(k+1)). The filter is the
+   linear predictor which minimizes the noise power weighted by the inverse of
+   the threshold of hearing, plus a constant floor that limits how far the
+   noise rises where the ear is insensitive. It is designed when the shaper is
+   created, so it suits any sample rate; above about 40kHz the noise is simply
+   moved out of the audio band. The channels of each frame are processed
+   together in vectors of NS_VEC_LEN. */
+
+#define NS_MAX_ORDER      9
+#define NS_VEC_LEN        4
+#define NS_DESIGN_POINTS  4096
+#define MEASURE_FFT_LEN   4096
+#define MEASURE_BLOCKS    64
+#define MEASURE_SEED      0x2545f491
+
+typedef sample_t ns_vec_t __attribute__((vector_size(NS_VEC_LEN * sizeof(sample_t)), aligned(sizeof(sample_t))));
+
+struct noise_shaper {
+	int channels, groups, order, pos;
+	sample_t scale;
+	ns_vec_t h[NS_MAX_ORDER];
+	ns_vec_t *hist;  /* error history; 2 * order vectors per group so that the last order errors are always contiguous */
+};
+
+static const struct noise_shaper_info shapers[] = {
+	{ "none",   0, 0 },
+	{ "light",  2, 1e-3 },
+	{ "medium", 5, 1e-3 },
+	{ "heavy",  9, 1e-4 },
+};
+
+const struct noise_shaper_info * get_noise_shaper_info(const char *name)
+{
+	int i;
+	if (name == NULL)
+		return &shapers[0];
+	for (i = 0; i < LENGTH(shapers); ++i)
+		if (strcmp(name, shapers[i].name) == 0)
+			return &shapers[i];
+	return NULL;
+}
+
+void print_noise_shapers(void)
+{
+	int i;
+	fprintf(stdout, "Noise shapers:");
+	for (i = 0; i < LENGTH(shapers); ++i)
+		fprintf(stdout, " %s", shapers[i].name);
+	fputc('\n', stdout);
+}
+
+/* Threshold of hearing in dB SPL (Terhardt) */
+static double ath(double f)
+{
+	const double k = MAXIMUM(f, 20.0) / 1000.0;
+	return 3.64 * pow(k, -0.8) - 6.5 * exp(-0.6 * (k - 3.3) * (k - 3.3)) + 1e-3 * pow(k, 4);
+}
+
+static double ath_weight(double f)
+{
+	return pow(10.0, -MINIMUM(ath(f), 120.0) / 10.0);
+}
+
+/* A-weighting (power), 0dB at 1kHz */
+static double a_weight(double f)
+{
+	const double f2 = f * f;
+	const double ra = 148693636.0 * f2 * f2 / ((f2 + 424.36) * sqrt((f2 + 11599.29) * (f2 + 544496.41)) * (f2 + 148693636.0));
+	return ra * ra * 1.258925412;
+}
+
+static void design_filter(const struct noise_shaper_info *info, int fs, double *h)
+{
+	int i, k;
+	double f, w, e, acc, r[NS_MAX_ORDER + 1] = { 0 }, a[NS_MAX_ORDER + 1] = { 1 }, t[NS_MAX_ORDER + 1];
+
+	/* autocorrelation of the weighting function */
+	for (i = 0; i < NS_DESIGN_POINTS; ++i) {
+		f = (i + 0.5) / NS_DESIGN_POINTS * 0.5;
+		w = ath_weight(f * fs) + info->floor;
+		for (k = 0; k <= info->order; ++k)
+			r[k] += w * cos(2.0 * M_PI * f * k);
+	}
+	/* Levinson-Durbin recursion */
+	e = r[0];
+	for (i = 1; i <= info->order; ++i) {
+		acc = r[i];
+		for (k = 1; k < i; ++k)
+			acc += a[k] * r[i - k];
+		memcpy(t, a, sizeof(a));
+		a[i] = -acc / e;
+		for (k = 1; k < i; ++k)
+			a[k] = t[k] + a[i] * t[i - k];
+		e *= 1.0 - a[i] * a[i];
+	}
+	for (k = 0; k < info->order; ++k)
+		h[k] = -a[k + 1];
+}
+
+struct noise_shaper * noise_shaper_new(const struct noise_shaper_info *info, int fs, int channels, int prec)
+{
+	int k;
+	double h[NS_MAX_ORDER];
+	struct noise_shaper *ns;
+
+	if (info->order == 0)
+		return NULL;
+	/* the rounding in noise_shaper_run() needs two spare bits */
+	if (prec < 1 || prec > 32 || prec > SAMPLE_T_PREC - 2) {
+		LOG_FMT(LL_NORMAL, "warning: noise shaping is not possible at %d bits precision; using plain TPDF dither", prec);
+		return NULL;
+	}
+	ns = calloc(1, sizeof(struct noise_shaper));
+	ns->channels = channels;
+	ns->groups = (channels + NS_VEC_LEN - 1) / NS_VEC_LEN;
+	ns->order = info->order;
+	ns->scale = (sample_t) ((uint64_t) 1 << (prec - 1));
+	design_filter(info, fs, h);
+	for (k = 0; k < ns->order; ++k)
+		ns->h[k] = (ns_vec_t) { 0 } + (sample_t) h[k];
+	ns->hist = calloc(ns->groups * 2 * ns->order, sizeof(ns_vec_t));
+	return ns;
+}
+
+void noise_shaper_run(struct noise_shaper *ns, struct out_stage *st, sample_t *buf, ssize_t s)
+{
+	int g, i, k, n, npos;
+	ssize_t f, p;
+	uint32_t cn;
+	sample_t a, *x;
+	ns_vec_t v, w, q, e, *hist;
+	const ssize_t frames = s / ns->channels;
+	const sample_t lsb = 1 / ns->scale, max = 1 - lsb, emax = 4 * lsb;
+	const sample_t m = lsb / (sample_t) 4294967296.0;
+	/* adding and subtracting this rounds to an integer */
+	const sample_t magic = (sample_t) 1.5 * (sample_t) ((uint64_t) 1 << (SAMPLE_T_PREC - 1));
+	const uint32_t key = dither_hash32(st->dither_seed + (uint32_t) (st->dither_pos >> 32));
+	const uint32_t c0 = (uint32_t) st->dither_pos;
+
+	for (f = 0; f < frames; ++f) {
+		x = &buf[f * ns->channels];
+		npos = ((ns->pos == 0) ? ns->order : ns->pos) - 1;
+		for (g = 0; g < ns->groups; ++g) {
+			n = MINIMUM(NS_VEC_LEN, ns->channels - g * NS_VEC_LEN);
+			hist = &ns->hist[g * 2 * ns->order];
+			v = (ns_vec_t) { 0 };
+			for (i = 0; i < n; ++i)
+				v[i] = x[g * NS_VEC_LEN + i];
+			for (k = 0; k < ns->order; ++k)
+				v -= ns->h[k] * hist[ns->pos + k];
+			/* same dither sequence as the unshaped output stage */
+			for (i = 0; i < NS_VEC_LEN; ++i) {
+				p = f * ns->channels + g * NS_VEC_LEN + i;
+				cn = c0 + 2 * (uint32_t) p;
+				w[i] = v[i] + ((sample_t) (int32_t) dither_hash32(cn ^ key) - (sample_t) (int32_t) dither_hash32((cn + 1) ^ key)) * m;
+			}
+			for (i = 0; i < n; ++i) {
+				a = (w[i] < 0) ? -w[i] : w[i];
+				if (a > st->peak)
+					st->peak = a;
+				if (a > 1)
+					++st->clip_count;
+			}
+			for (i = 0; i < NS_VEC_LEN; ++i) {
+				q[i] = (w[i] > max) ? max : (w[i] < -1) ? -1 : w[i];
+				q[i] = ((q[i] * ns->scale + magic) - magic) * lsb;
+				e[i] = q[i] - v[i];
+				/* keep clipping from upsetting the feedback loop */
+				e[i] = (e[i] > emax) ? emax : (e[i] < -emax) ? -emax : e[i];
+			}
+			hist[npos] = hist[npos + ns->order] = e;
+			for (i = 0; i < n; ++i)
+				x[g * NS_VEC_LEN + i] = q[i];
+		}
+		ns->pos = npos;
+	}
+}
+
+void noise_shaper_reset(struct noise_shaper *ns)
+{
+	if (ns == NULL)
+		return;
+	memset(ns->hist, 0, ns->groups * 2 * ns->order * sizeof(ns_vec_t));
+	ns->pos = 0;
+}
+
+void noise_shaper_destroy(struct noise_shaper *ns)
+{
+	if (ns == NULL)
+		return;
+	free(ns->hist);
+	free(ns);
+}
+
+static void fft(double *re, double *im, int n)
+{
+	int i, j, k, len;
+	double t, wr, wi, ur, ui, vr, vi;
+	for (i = 1, j = 0; i < n; ++i) {
+		for (k = n >> 1; j & k; k >>= 1)
+			j ^= k;
+		j ^= k;
+		if (i < j) {
+			t = re[i]; re[i] = re[j]; re[j] = t;
+			t = im[i]; im[i] = im[j]; im[j] = t;
+		}
+	}
+	for (len = 2; len <= n; len <<= 1) {
+		for (i = 0; i < n; i += len) {
+			for (k = 0; k < len / 2; ++k) {
+				wr = cos(-2.0 * M_PI * k / len);
+				wi = sin(-2.0 * M_PI * k / len);
+				ur = re[i + k];
+				ui = im[i + k];
+				vr = re[i + k + len / 2] * wr - im[i + k + len / 2] * wi;
+				vi = re[i + k + len / 2] * wi + im[i + k + len / 2] * wr;
+				re[i + k] = ur + vr;
+				im[i + k] = ui + vi;
+				re[i + k + len / 2] = ur - vr;
+				im[i + k + len / 2] = ui - vi;
+			}
+		}
+	}
+}
+
+/* Accumulates the one-sided power spectrum of the quantized output of channel
+   0 in psd. The result is normalized so that the bins sum to the mean square
+   of the noise. */
+static void measure_psd(struct noise_shaper *ns, int channels, int prec, double *psd)
+{
+	int b;
+	ssize_t i;
+	double win_pow = 0, *re, *im, *win;
+	const double scale = (double) ((uint64_t) 1 << (prec - 1));
+	struct out_stage st = { prec, MEASURE_SEED, 0, 0, 0, ns };
+	sample_t *buf = calloc(MEASURE_FFT_LEN * channels, sizeof(sample_t));
+
+	re = calloc(MEASURE_FFT_LEN, sizeof(double));
+	im = calloc(MEASURE_FFT_LEN, sizeof(double));
+	win = calloc(MEASURE_FFT_LEN, sizeof(double));
+	for (i = 0; i < MEASURE_FFT_LEN; ++i) {
+		win[i] = 0.5 - 0.5 * cos(2.0 * M_PI * i / MEASURE_FFT_LEN);
+		win_pow += win[i] * win[i];
+	}
+	for (b = 0; b < MEASURE_BLOCKS; ++b) {
+		memset(buf, 0, MEASURE_FFT_LEN * channels * sizeof(sample_t));
+		out_stage_sample(&st, buf, (char *) buf, MEASURE_FFT_LEN * channels);
+		for (i = 0; i < MEASURE_FFT_LEN; ++i) {
+			/* quantize as the encoder would */
+			re[i] = lround(buf[i * channels] * scale) / scale * win[i];
+			im[i] = 0;
+		}
+		fft(re, im, MEASURE_FFT_LEN);
+		for (i = 1; i < MEASURE_FFT_LEN / 2; ++i)
+			psd[i] += 2.0 * (re[i] * re[i] + im[i] * im[i]) / (MEASURE_FFT_LEN * win_pow * MEASURE_BLOCKS);
+	}
+	free(buf);
+	free(re);
+	free(im);
+	free(win);
+}
+
+/* Power relative to a full scale sine */
+#define TO_DBFS(x) (10.0 * log10((x) / 0.5))
+
+int dither_measure(const struct noise_shaper_info *info, int fs, int channels, int prec)
+{
+	int i, j, k, n;
+	double f, lo, hi, band[2], total[2][3] = { { 0 } }, *psd[2];
+	struct noise_shaper *ns = NULL;
+	const double ath_ref = ath_weight(1000.0);
+
+	if (prec < 1 || prec > 32) {
+		LOG_FMT(LL_ERROR, "error: cannot dither at %d bits precision", prec);
+		return 1;
+	}
+	if (info->order > 0 && (ns = noise_shaper_new(info, fs, channels, prec)) == NULL)
+		info = get_noise_shaper_info(NULL);
+	n = (ns == NULL) ? 1 : 2;
+	for (k = 0; k < n; ++k) {
+		psd[k] = calloc(MEASURE_FFT_LEN / 2, sizeof(double));
+		measure_psd((k == 0) ? NULL : ns, channels, prec, psd[k]);
+		for (i = 1; i < MEASURE_FFT_LEN / 2; ++i) {
+			f = (double) i * fs / MEASURE_FFT_LEN;
+			total[k][0] += psd[k][i];
+			total[k][1] += psd[k][i] * a_weight(f);
+			total[k][2] += psd[k][i] * ath_weight(f) / ath_ref;
+		}
+	}
+
+	fprintf(stdout, "Noise spectrum: shaper=%s fs=%d precision=%d\n\n", info->name, fs, prec);
+	fprintf(stdout, "%-14s %14s", "band (Hz)", "tpdf (dBFS)");
+	if (ns != NULL)
+		fprintf(stdout, " %14s", info->name);
+	fputc('\n', stdout);
+	/* 1/3 octave bands; the lowest ones are skipped if they contain no bins */
+	for (i = -17; (f = 1000.0 * pow(2.0, i / 3.0)) < fs / 2; ++i) {
+		lo = f * pow(2.0, -1.0 / 6.0);
+		hi = MINIMUM(f * pow(2.0, 1.0 / 6.0), fs / 2.0);
+		if (ceil(lo * MEASURE_FFT_LEN / fs) >= hi * MEASURE_FFT_LEN / fs)
+			continue;
+		for (k = 0; k < n; ++k) {
+			band[k] = 0;
+			for (j = (int) ceil(lo * MEASURE_FFT_LEN / fs); j < MEASURE_FFT_LEN / 2 && j < hi * MEASURE_FFT_LEN / fs; ++j)
+				band[k] += psd[k][j];
+		}
+		fprintf(stdout, "%-14.0f %14.1f", f, TO_DBFS(band[0]));
+		if (ns != NULL)
+			fprintf(stdout, " %14.1f", TO_DBFS(band[1]));
+		fputc('\n', stdout);
+	}
+	fputc('\n', stdout);
+	for (i = 0; i < 3; ++i) {
+		fprintf(stdout, "%-14s %14.1f", (i == 0) ? "unweighted" : (i == 1) ? "A-weighted" : "ATH-weighted", TO_DBFS(total[0][i]));
+		if (ns != NULL)
+			fprintf(stdout, " %14.1f", TO_DBFS(total[1][i]));
+		fputc('\n', stdout);
+	}
+	for (k = 0; k < n; ++k)
+		free(psd[k]);
+	noise_shaper_destroy(ns);
+	return 0;
+}
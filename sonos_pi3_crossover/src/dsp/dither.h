@@ -0,0 +1,47 @@
+#ifndef _DITHER_H
+#define _DITHER_H
+
+#include <stdint.h>
+#include "dsp.h"
+
+struct out_stage;
+struct noise_shaper;
+
+struct noise_shaper_info {
+	const char *name;
+	int order;     /* 0 for plain TPDF dither */
+	double floor;  /* relative weight of the noise at frequencies the ear is insensitive to; limits the total noise gain */
+};
+
+/* 32-bit integer hash ("lowbias32" by Chris Wellons). Hashing a counter gives
+   a random number generator that can be evaluated for any number of samples
+   in parallel. */
+static __inline__ uint32_t dither_hash32(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352d;
+	x ^= x >> 15;
+	x *= 0x846ca68b;
+	x ^= x >> 16;
+	return x;
+}
+
+const struct noise_shaper_info * get_noise_shaper_info(const char *);
+void print_noise_shapers(void);
+/* Error feedback noise shaper. The filter is designed for the given sample
+   rate and quantizes to prec bits. Returns NULL (without an error) if the
+   shaper does plain TPDF dither or if prec is too high to be shaped.
+   args: info, fs, channels, prec */
+struct noise_shaper * noise_shaper_new(const struct noise_shaper_info *, int, int, int);
+/* Dithers, noise shapes, clips and quantizes s interleaved samples in place
+   and updates the peak, clip count and dither position of the out_stage. The
+   dither position is not advanced. */
+void noise_shaper_run(struct noise_shaper *, struct out_stage *, sample_t *, ssize_t);
+void noise_shaper_reset(struct noise_shaper *);
+void noise_shaper_destroy(struct noise_shaper *);
+/* Runs silence through the output stage and prints the spectrum of the
+   resulting noise to stdout.
+   args: info, fs, channels, prec */
+int dither_measure(const struct noise_shaper_info *, int, int, int);
+
+#endif
@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "drift.h"
+#include "util.h"
+
+/* Variable-ratio windowed sinc interpolator. The kernel is tabulated at
+   DRIFT_PHASES fractional positions and each output frame is linearly
+   interpolated between the two nearest phases, so the ratio can change by
+   arbitrarily small amounts from one frame to the next without glitches. */
+
+/* Tunables */
+#define DRIFT_TAPS   128  /* taps per phase; transition band is 8/DRIFT_TAPS of fs wide */
+#define DRIFT_PHASES 256
+#define CHUNK_FRAMES 1024
+static const double max_ppm     = 1000;    /* ratio correction limit */
+static const double settle_time = 2.0;     /* seconds to measure the delay before locking the target */
+static const double avg_time    = 1.0;     /* time constant of the delay measurement */
+static const double kp          = 0.1;     /* proportional gain (ratio per second of error) */
+static const double ki          = 0.0025;  /* integral gain (critically damped: kp^2/4) */
+
+#define DRIFT_VEC_SIZE 16
+#define DRIFT_LANES    ((int) (DRIFT_VEC_SIZE / sizeof(sample_t)))
+
+typedef sample_t drift_vec_t __attribute__((vector_size(DRIFT_VEC_SIZE)));
+typedef sample_t drift_uvec_t __attribute__((vector_size(DRIFT_VEC_SIZE), aligned(sizeof(sample_t))));  /* unaligned */
+
+struct drift_comp {
+	int fs, channels, has_avg, locked;
+	ssize_t buf_len, fill, obuf_frames;
+	double pos;  /* position of the next output frame in buf */
+	double ratio, delay_avg, target, integral, elapsed;
+	drift_vec_t *coefs;  /* (DRIFT_PHASES + 1) phases, time reversed */
+	sample_t **buf, *obuf;
+};
+
+static __inline__ sample_t drift_dot(const sample_t *x, const drift_vec_t *c)
+{
+	int k;
+	const drift_uvec_t *xv = (const drift_uvec_t *) x;
+	drift_vec_t acc0 = { 0 }, acc1 = { 0 }, x0, x1;
+	sample_t r = 0;
+	for (k = 0; k < DRIFT_TAPS / DRIFT_LANES; k += 2) {
+		x0 = xv[k];
+		x1 = xv[k + 1];
+		acc0 += x0 * c[k];
+		acc1 += x1 * c[k + 1];
+	}
+	acc0 += acc1;
+	for (k = 0; k < DRIFT_LANES; ++k)
+		r += acc0[k];
+	return r;
+}
+
+struct drift_comp * drift_comp_new(int fs, int channels)
+{
+	int i, p, m;
+	double u, x, h, fc;
+	sample_t *coefs;
+	struct drift_comp *d = calloc(1, sizeof(struct drift_comp));
+
+	d->fs = fs;
+	d->channels = channels;
+	d->ratio = 1.0;
+	if (posix_memalign((void **) &d->coefs, DRIFT_VEC_SIZE, (DRIFT_PHASES + 1) * DRIFT_TAPS * sizeof(sample_t)) != 0) {
+		free(d);
+		return NULL;
+	}
+	/* the stopband starts at fs/2 */
+	fc = 0.5 - 8.0 / DRIFT_TAPS / 2;
+	coefs = (sample_t *) d->coefs;
+	for (p = 0; p <= DRIFT_PHASES; ++p) {
+		for (m = 0; m < DRIFT_TAPS; ++m) {
+			u = (double) p / DRIFT_PHASES + DRIFT_TAPS / 2 - 1 - m;  /* distance from the output frame */
+			h = (u == 0) ? 2 * fc : sin(2 * M_PI * fc * u) / (M_PI * u);
+			/* apply Nuttall window */
+			x = (u + DRIFT_TAPS / 2) / DRIFT_TAPS;
+			h *= 0.355768 - 0.487396 * cos(2 * M_PI * x) + 0.144232 * cos(4 * M_PI * x) - 0.012604 * cos(6 * M_PI * x);
+			coefs[p * DRIFT_TAPS + m] = h;
+		}
+	}
+	d->buf_len = DRIFT_TAPS + CHUNK_FRAMES;
+	d->buf = calloc(channels, sizeof(sample_t *));
+	for (i = 0; i < channels; ++i)
+		d->buf[i] = calloc(d->buf_len, sizeof(sample_t));
+	/* output frame 0 lines up with input frame 0 */
+	d->fill = d->pos = DRIFT_TAPS / 2;
+	return d;
+}
+
+sample_t * drift_comp_run(struct drift_comp *d, ssize_t *frames, sample_t *ibuf)
+{
+	int i, p;
+	ssize_t n, k, keep, iframes = 0, oframes = 0;
+	const ssize_t max_oframes = *frames + *frames / 500 + 2;
+	const double step = 1.0 / d->ratio;
+	const sample_t *x;
+	const drift_vec_t *c0, *c1;
+	sample_t a, b, frac;
+
+	if (max_oframes > d->obuf_frames) {
+		d->obuf_frames = max_oframes;
+		d->obuf = realloc(d->obuf, d->obuf_frames * d->channels * sizeof(sample_t));
+	}
+	while (iframes < *frames) {
+		n = MINIMUM(d->buf_len - d->fill, *frames - iframes);
+		for (i = 0; i < d->channels; ++i)
+			copy_samples(&d->buf[i][d->fill], 1, &ibuf[iframes * d->channels + i], d->channels, n);
+		d->fill += n;
+		iframes += n;
+		while ((k = (ssize_t) d->pos) + DRIFT_TAPS / 2 < d->fill) {
+			frac = (d->pos - k) * DRIFT_PHASES;
+			p = (int) frac;
+			frac -= p;
+			c0 = &d->coefs[p * (DRIFT_TAPS / DRIFT_LANES)];
+			c1 = c0 + DRIFT_TAPS / DRIFT_LANES;
+			for (i = 0; i < d->channels; ++i) {
+				x = &d->buf[i][k - DRIFT_TAPS / 2 + 1];
+				a = drift_dot(x, c0);
+				b = drift_dot(x, c1);
+				d->obuf[oframes * d->channels + i] = a + (b - a) * frac;
+			}
+			++oframes;
+			d->pos += step;
+		}
+		if (d->fill == d->buf_len) {
+			keep = (ssize_t) d->pos - DRIFT_TAPS / 2 + 1;
+			for (i = 0; i < d->channels; ++i)
+				memmove(d->buf[i], &d->buf[i][keep], (d->fill - keep) * sizeof(sample_t));
+			d->fill -= keep;
+			d->pos -= keep;
+		}
+	}
+	*frames = oframes;
+	return d->obuf;
+}
+
+void drift_comp_update(struct drift_comp *d, double delay, ssize_t frames)
+{
+	double e, corr, dt = (double) frames / d->fs;
+	if (!d->has_avg) {
+		d->delay_avg = delay;
+		d->has_avg = 1;
+	}
+	else
+		d->delay_avg += (delay - d->delay_avg) * MINIMUM(dt / avg_time, 1.0);
+	d->elapsed += dt;
+	if (!d->locked) {
+		if (d->elapsed >= settle_time) {
+			d->target = d->delay_avg;
+			d->locked = 1;
+			LOG_FMT(LL_VERBOSE, "info: drift: target delay: %.2fms", d->target * 1000.0);
+		}
+		return;
+	}
+	e = d->delay_avg - d->target;
+	d->integral += e * dt;
+	corr = -(kp * e + ki * d->integral);
+	if (fabs(corr) > max_ppm / 1e6) {
+		d->integral -= e * dt;  /* don't wind up while saturated */
+		corr = (corr > 0) ? max_ppm / 1e6 : -max_ppm / 1e6;
+	}
+	d->ratio = 1.0 + corr;
+}
+
+void drift_comp_reset(struct drift_comp *d)
+{
+	/* the integral term tracks the clock drift, so keep it */
+	d->has_avg = d->locked = 0;
+	d->elapsed = 0;
+}
+
+double drift_comp_ppm(struct drift_comp *d)
+{
+	return (d->ratio - 1.0) * 1e6;
+}
+
+ssize_t drift_comp_delay(struct drift_comp *d)
+{
+	return d->fill - (ssize_t) d->pos;
+}
+
+void drift_comp_destroy(struct drift_comp *d)
+{
+	int i;
+	if (d == NULL)
+		return;
+	for (i = 0; i < d->channels; ++i)
+		free(d->buf[i]);
+	free(d->buf);
+	free(d->obuf);
+	free(d->coefs);
+	free(d);
+}
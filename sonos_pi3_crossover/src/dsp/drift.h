@@ -0,0 +1,24 @@
+#ifndef _DRIFT_H
+#define _DRIFT_H
+
+#include "dsp.h"
+
+/* Adaptive resampler for bridging devices with independent clocks. The ratio
+   is servoed so that the measured input + output delay stays at the value
+   measured shortly after startup (or after drift_comp_reset()). */
+struct drift_comp;
+
+/* args: fs, channels */
+struct drift_comp * drift_comp_new(int, int);
+/* Resamples an interleaved block. Returns an internal buffer and sets frames
+   to the number of output frames. */
+sample_t * drift_comp_run(struct drift_comp *, ssize_t *, sample_t *);
+/* args: measured delay in seconds, frames written since the last update */
+void drift_comp_update(struct drift_comp *, double, ssize_t);
+/* Discards the target delay (e.g. after the output has been dropped) */
+void drift_comp_reset(struct drift_comp *);
+double drift_comp_ppm(struct drift_comp *);
+ssize_t drift_comp_delay(struct drift_comp *);
+void drift_comp_destroy(struct drift_comp *);
+
+#endif
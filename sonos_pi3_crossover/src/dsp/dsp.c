@@ -10,6 +10,13 @@
 #include "effect.h"
 #include "codec.h"
 #include "util.h"
+#include "pipeline.h"
+#include "drift.h"
+#include "sampleconv.h"
+#include "dither.h"
+#include "rt.h"
+#include "reload.h"
+#include "biquad.h"
 
 #define CHOOSE_INPUT_FS(x) \
 	(((x) == -1) ? (in_codecs.head == NULL || input_mode == INPUT_MODE_SEQUENCE) ? DEFAULT_FS : in_codecs.head->fs : (x))
@@ -31,6 +38,7 @@
 struct codec_params {
 	const char *path, *type, *enc;
 	int fs, channels, endian, mode;
+	const struct noise_shaper_info *shaper;
 };
 
 enum {
@@ -40,12 +48,19 @@ enum {
 
 static struct termios term_attrs;
 static int interactive = -1, show_progress = 1, plot = 0, input_mode = INPUT_MODE_CONCAT,
-	term_attrs_saved = 0, force_dither = 0, drain_effects = 1, verbose_progress = 0;
+	term_attrs_saved = 0, force_dither = 0, drain_effects = 1, verbose_progress = 0, pipeline_stages = 1,
+	threads = 1, use_drift_comp = 0, measure_dither = 0, profile_effects = 0;
 static volatile sig_atomic_t term_sig = 0, tstp_sig = 0;
 static struct effects_chain chain = { NULL, NULL };
 static struct codec_list in_codecs = { NULL, NULL };
 static struct codec *out_codec = NULL;
+static struct drift_comp *drift = NULL;
+static struct effects_profile *profile = NULL;
+static struct reloader *reloader = NULL;
+static const char *reload_fade = NULL;
 static sample_t *buf1 = NULL, *buf2 = NULL, *obuf;
+static ssize_t buf1_2_len = 0;
+static struct rt_watchdog watchdog;
 
 static const char help_text[] =
 	"Usage: %s [options] path ... [!] [:channel_selector] [@[~/]effects_file] [effect [args ...]] ...\n"
@@ -54,6 +69,9 @@ static const char help_text[] =
 	"  -h         show this help\n"
 	"  -b frames  set buffer size (must be given before the first input)\n"
 	"  -R ratio   set codec maximum buffer ratio (must be given before the first input)\n"
+	"  -l period[,periods[,start]]\n"
+	"             set audio device period size, number of periods, and start threshold\n"
+	"             (must be given before the first input)\n"
 	"  -i         force interactive mode\n"
 	"  -I         disable interactive mode\n"
 	"  -q         disable progress display\n"
@@ -65,6 +83,17 @@ static const char help_text[] =
 	"  -p         plot effects chain instead of processing audio\n"
 	"  -V         enable verbose progress display\n"
 	"  -S         run in sequence mode\n"
+	"  -P stages  run the effects chain as a pipeline of threaded stages\n"
+	"  -T threads process channels in parallel using up to threads threads\n"
+	"  -A         compensate for clock drift between the input and output\n"
+	"  -F         profile the effects chain\n"
+	"  -M         measure the dither noise spectrum of the output and exit\n"
+	"  -w fade[s|m|S]\n"
+	"             hot reload: rebuild the effects chain in the background when an effects\n"
+	"             file changes (or on 'e') and crossfade to it over the given time\n"
+	"  -X priority[:cpus[:worker_cpus]]\n"
+	"             real-time mode: run at SCHED_FIFO priority with memory locked and\n"
+	"             the main and worker threads pinned to the given CPUs\n"
 	"\n"
 	"Input/output options:\n"
 	"  -o               output\n"
@@ -73,6 +102,7 @@ static const char help_text[] =
 	"  -B/L/N           big/little/native endian\n"
 	"  -r frequency[k]  sample rate\n"
 	"  -c channels      number of channels\n"
+	"  -Q shaper        noise shaper (output only)\n"
 	"  -n               equivalent to '-t null null'\n"
 	"\n"
 	"Selector syntax:\n"
@@ -93,41 +123,44 @@ static const char interactive_help[] =
 	"  q : quit\n";
 
 struct dsp_globals dsp_globals = {
-	0,                      /* clip_count */
-	0,                      /* peak */
 	LL_NORMAL,              /* loglevel */
 	DEFAULT_BUF_FRAMES,     /* buf_frames */
 	DEFAULT_MAX_BUF_RATIO,  /* max_buf_ratio */
 	"dsp",                  /* prog_name */
+	0,                      /* dev_period_frames */
+	0,                      /* dev_start_frames */
+	DEFAULT_DEV_PERIODS,    /* dev_periods */
 };
 
-static sample_t clip(sample_t s)
-{
-	if (s > 1.0) {
-		++dsp_globals.clip_count;
-		return 1.0;
-	}
-	else if (s < -1.0) {
-		++dsp_globals.clip_count;
-		return -1.0;
-	}
-	else
-		return s;
-}
+static struct out_stage out_stage = {
+	0,           /* dither_prec */
+	0x9e3779b9,  /* dither_seed */
+	0,           /* dither_pos */
+	0,           /* clip_count */
+	0,           /* peak */
+	NULL,        /* shaper */
+};
 
 static void cleanup_and_exit(int s)
 {
+	rt_watchdog_report(&watchdog);
+	reloader_destroy(reloader);
 	destroy_codec_list(&in_codecs);
 	if (out_codec != NULL)
 		destroy_codec(out_codec);
 	destroy_effects_chain(&chain);
+	if (profile != NULL && LOGLEVEL(LL_NORMAL))
+		print_effects_profile(profile, stderr);
+	destroy_effects_profile(profile);
+	drift_comp_destroy(drift);
+	noise_shaper_destroy(out_stage.shaper);
 	free(buf1);
 	free(buf2);
 	if (term_attrs_saved)
 		tcsetattr(0, TCSANOW, &term_attrs);
-	if (dsp_globals.clip_count > 0)
+	if (out_stage.clip_count > 0)
 		LOG_FMT(LL_NORMAL, "warning: clipped %ld samples (%.2fdBFS peak)",
-			dsp_globals.clip_count, log10(dsp_globals.peak) * 20);
+			out_stage.clip_count, log10(out_stage.peak) * 20);
 	exit(s);
 }
 
@@ -158,10 +191,49 @@ static int input_pending(void)
 static void print_help(void)
 {
 	fprintf(stdout, help_text, dsp_globals.prog_name);
+	fprintf(stdout, "\nSample precision: %s (%d bits)\n", (sizeof(sample_t) == sizeof(float)) ? "single" : "double", SAMPLE_T_PREC);
+	fprintf(stdout, "Biquad cascade lanes: %d (%s)\n", CASCADE_LANES, (sizeof(cascade_sample_t) == sizeof(float)) ? "single" : "double");
 	fputc('\n', stdout);
 	print_all_codecs();
 	fputc('\n', stdout);
 	print_all_effects();
+	fputc('\n', stdout);
+	print_noise_shapers();
+}
+
+/* Parses "period[,periods[,start]]" into dsp_globals */
+static int parse_dev_latency(const char *str)
+{
+	const char *s = str;
+	char *endptr;
+	long v[3] = { 0, DEFAULT_DEV_PERIODS, 0 };
+	int i;
+	for (i = 0; i < LENGTH(v); ++i) {
+		v[i] = strtol(s, &endptr, 10);
+		if (endptr == s || (*endptr != '\0' && *endptr != ',') || (*endptr == ',' && i == LENGTH(v) - 1)) {
+			LOG_FMT(LL_ERROR, "error: failed to parse device latency: %s", str);
+			return 1;
+		}
+		if (*endptr == '\0')
+			break;
+		s = endptr + 1;
+	}
+	if (v[0] <= 0) {
+		LOG_S(LL_ERROR, "error: period size must be > 0");
+		return 1;
+	}
+	if (v[1] < 2) {
+		LOG_S(LL_ERROR, "error: number of periods must be >= 2");
+		return 1;
+	}
+	if (v[2] < 0) {
+		LOG_S(LL_ERROR, "error: start threshold must be >= 0");
+		return 1;
+	}
+	dsp_globals.dev_period_frames = v[0];
+	dsp_globals.dev_periods = v[1];
+	dsp_globals.dev_start_frames = v[2];
+	return 0;
 }
 
 static int parse_codec_params(int argc, char *argv[], struct codec_params *p)
@@ -173,8 +245,9 @@ static int parse_codec_params(int argc, char *argv[], struct codec_params *p)
 	p->fs = p->channels = -1;
 	p->endian = CODEC_ENDIAN_DEFAULT;
 	p->mode = CODEC_MODE_READ;
+	p->shaper = NULL;
 
-	while ((opt = getopt(argc, argv, "+:hb:R:iIqsvdDEpVSot:e:BLNr:c:n")) != -1) {
+	while ((opt = getopt(argc, argv, "+:hb:R:l:iIqsvdDEpVSP:T:AFMw:X:ot:e:BLNr:c:Q:n")) != -1) {
 		switch (opt) {
 		case 'h':
 			print_help();
@@ -203,6 +276,13 @@ static int parse_codec_params(int argc, char *argv[], struct codec_params *p)
 			else
 				LOG_S(LL_ERROR, "warning: buffer ratio must be specified before the first input");
 			break;
+		case 'l':
+			if (in_codecs.head == NULL) {
+				if (parse_dev_latency(optarg)) return 1;
+			}
+			else
+				LOG_S(LL_ERROR, "warning: device latency must be specified before the first input");
+			break;
 		case 'i':
 			interactive = 1;
 			break;
@@ -236,6 +316,37 @@ static int parse_codec_params(int argc, char *argv[], struct codec_params *p)
 		case 'S':
 			input_mode = INPUT_MODE_SEQUENCE;
 			break;
+		case 'P':
+			pipeline_stages = strtol(optarg, &endptr, 10);
+			if (check_endptr(NULL, optarg, endptr, "number of stages")) return 1;
+			if (pipeline_stages <= 0) {
+				LOG_S(LL_ERROR, "error: number of stages must be > 0");
+				return 1;
+			}
+			break;
+		case 'T':
+			threads = strtol(optarg, &endptr, 10);
+			if (check_endptr(NULL, optarg, endptr, "number of threads")) return 1;
+			if (threads <= 0) {
+				LOG_S(LL_ERROR, "error: number of threads must be > 0");
+				return 1;
+			}
+			break;
+		case 'A':
+			use_drift_comp = 1;
+			break;
+		case 'F':
+			profile_effects = 1;
+			break;
+		case 'w':
+			reload_fade = optarg;
+			break;
+		case 'X':
+			if (rt_enable(optarg)) return 1;
+			break;
+		case 'M':
+			measure_dither = 1;
+			break;
 		case 'o':
 			p->mode = CODEC_MODE_WRITE;
 			break;
@@ -270,6 +381,12 @@ static int parse_codec_params(int argc, char *argv[], struct codec_params *p)
 				return 1;
 			}
 			break;
+		case 'Q':
+			if ((p->shaper = get_noise_shaper_info(optarg)) == NULL) {
+				LOG_FMT(LL_ERROR, "error: bad noise shaper: %s", optarg);
+				return 1;
+			}
+			break;
 		case 'n':
 			p->path = p->type = "null";
 			return 0;
@@ -296,6 +413,15 @@ static void print_io_info(struct codec *c, int ll, const char *n)
 		n, c->path, c->type, c->enc, c->prec, c->channels, c->fs, c->frames, TIME_FMT_ARGS(c->frames, c->fs));
 }
 
+/* Output latency in seconds, including the drift compensator */
+static double get_out_delay(struct codec *out)
+{
+	double delay = (double) out->delay(out) / out->fs;
+	if (drift != NULL)
+		delay += (double) drift_comp_delay(drift) / out->fs;
+	return delay;
+}
+
 #ifdef HAVE_CLOCK_GETTIME
 static int has_elapsed(struct timespec *then, double s)
 {
@@ -314,7 +440,7 @@ static void print_progress(struct codec *in, struct codec *out, ssize_t pos, int
 	if (has_elapsed(&then, 0.1) || force) {
 #endif
 		double in_delay_s = (double) in->delay(in) / in->fs;
-		double out_delay_s = (double) out->delay(out) / out->fs;
+		double out_delay_s = get_out_delay(out);
 		double effects_chain_delay_s = get_effects_chain_delay(&chain);
 		ssize_t delay = lround((out_delay_s + effects_chain_delay_s) * in->fs);
 		ssize_t p = (pos > delay) ? pos - delay : 0;
@@ -325,28 +451,61 @@ static void print_progress(struct codec *in, struct codec *out, ssize_t pos, int
 		if (verbose_progress)
 			fprintf(stderr, "lat:%.2fms+%.2fms+%.2fms=%.2fms  ",
 				in_delay_s * 1000.0, effects_chain_delay_s * 1000.0, out_delay_s * 1000.0, (in_delay_s + effects_chain_delay_s + out_delay_s) * 1000.0);
-		if (verbose_progress || dsp_globals.clip_count != 0)
-			fprintf(stderr, "peak:%.2fdBFS  clip:%ld  ", log10(dsp_globals.peak) * 20, dsp_globals.clip_count);
+		if (verbose_progress || out_stage.clip_count != 0)
+			fprintf(stderr, "peak:%.2fdBFS  clip:%ld  ", log10(out_stage.peak) * 20, out_stage.clip_count);
+		if (verbose_progress && drift != NULL)
+			fprintf(stderr, "drift:%+.1fppm  ", drift_comp_ppm(drift));
+		if (out->print_progress != NULL)
+			out->print_progress(out, verbose_progress);
+		if (verbose_progress && profile != NULL)
+			print_effects_profile_summary(profile, stderr);
+		if (verbose_progress && watchdog.blocks > 0)
+			fprintf(stderr, "load:%.0f%%/%.0f%%  ", watchdog.load_sum / watchdog.blocks * 100.0, watchdog.load_max * 100.0);
+		if (watchdog.misses != 0)
+			fprintf(stderr, "miss:%ld  ", watchdog.misses);
 		fprintf(stderr, "\033[K");
 #ifdef HAVE_CLOCK_GETTIME
 	}
 #endif
 }
 
-static void write_out(ssize_t frames, sample_t *buf, int do_dither)
+/* The buffers only grow so that rebuilding the effects chain doesn't
+   allocate (and fault in) new memory every time */
+static void alloc_bufs(ssize_t len)
 {
-	ssize_t i;
-	for (i = 0; i < frames * out_codec->channels; ++i) {
-		if (do_dither)
-			buf[i] = tpdf_dither_sample(buf[i], out_codec->prec);
-		if (fabs(buf[i]) > dsp_globals.peak)
-			dsp_globals.peak = fabs(buf[i]);
-		buf[i] = clip(buf[i]);
-	}
+	if (len <= buf1_2_len)
+		return;
+	buf1 = realloc(buf1, len * sizeof(sample_t));
+	buf2 = realloc(buf2, len * sizeof(sample_t));
+	memset(buf1, 0, len * sizeof(sample_t));
+	memset(buf2, 0, len * sizeof(sample_t));
+	buf1_2_len = len;
+}
+
+/* If timed_frames > 0, the watchdog is stopped for a block of that many input
+   frames before the write, which may wait for the output */
+static void write_out(ssize_t frames, sample_t *buf, int do_dither, ssize_t timed_frames)
+{
+	double delay;
+	if (drift != NULL && frames > 0)
+		buf = drift_comp_run(drift, &frames, buf);
+	/* dither, clip, peak tracking and encoding are done in one pass by the
+	   codec if it supports it */
+	out_stage.dither_prec = (do_dither) ? out_codec->prec : 0;
+	if (out_codec->out_stage == NULL)
+		out_stage_sample(&out_stage, buf, (char *) buf, frames * out_codec->channels);
+	if (timed_frames > 0)
+		rt_watchdog_stop(&watchdog, timed_frames, in_codecs.head->fs);
 	if (frames != 0 && out_codec->write(out_codec, buf, frames) != frames) {
 		LOG_S(LL_ERROR, "error: short write");
 		cleanup_and_exit(1);
 	}
+	if (drift != NULL && frames != 0) {
+		delay = (double) out_codec->delay(out_codec) / out_codec->fs;
+		if (in_codecs.head != NULL)
+			delay += (double) in_codecs.head->delay(in_codecs.head) / in_codecs.head->fs;
+		drift_comp_update(drift, delay, frames);
+	}
 }
 
 static ssize_t do_seek(struct codec *in, struct codec *out, ssize_t pos, ssize_t delay, ssize_t offset, int whence)
@@ -360,7 +519,10 @@ static ssize_t do_seek(struct codec *in, struct codec *out, ssize_t pos, ssize_t
 		s = pos + offset - delay;
 	if ((s = in->seek(in, s)) >= 0) {
 		out->drop(out);
+		noise_shaper_reset(out_stage.shaper);
 		reset_effects_chain(&chain);
+		if (drift != NULL)
+			drift_comp_reset(drift);
 		return s;
 	}
 	return pos;
@@ -390,9 +552,111 @@ static struct codec * init_out_codec(struct codec_params *p, struct stream_info
 		return NULL;
 	}
 	c->frames = frames;
+	if (c->has_out_stage)
+		c->out_stage = &out_stage;
+	noise_shaper_destroy(out_stage.shaper);
+	out_stage.shaper = NULL;
+	if (p->shaper != NULL && p->shaper->order > 0) {
+		if (c->can_dither)
+			out_stage.shaper = noise_shaper_new(p->shaper, c->fs, c->channels, c->prec);
+		else
+			LOG_FMT(LL_NORMAL, "warning: %s: encoding can't be dithered; noise shaper ignored", c->path);
+	}
 	return c;
 }
 
+static void init_drift_comp(void)
+{
+	drift_comp_destroy(drift);
+	drift = NULL;
+	if (!use_drift_comp)
+		return;
+	if (!out_codec->interactive) {
+		LOG_S(LL_NORMAL, "warning: clock drift compensation requires a real-time output; disabled");
+		return;
+	}
+	drift = drift_comp_new(out_codec->fs, out_codec->channels);
+	if (drift == NULL) {
+		LOG_S(LL_ERROR, "error: failed to initialize clock drift compensation");
+		cleanup_and_exit(1);
+	}
+}
+
+/* Returns the buffer length for the chain. This must be computed before the
+   chain is split because the wrapper effects hide any internal sample rate
+   changes. */
+static ssize_t split_effects_chain(void)
+{
+	ssize_t buf_len = get_effects_chain_buffer_len(&chain, dsp_globals.buf_frames, in_codecs.head->channels);
+	if (profile_effects) {
+		/* the previous chain has already been destroyed */
+		if (profile != NULL && LOGLEVEL(LL_NORMAL))
+			print_effects_profile(profile, stderr);
+		destroy_effects_profile(profile);
+		profile = profile_effects_chain(&chain);
+	}
+	shard_effects_chain(&chain, threads);
+	if (pipeline_stages > 1 && pipeline_effects_chain(&chain, pipeline_stages, dsp_globals.buf_frames))
+		cleanup_and_exit(1);
+	return buf_len;
+}
+
+/* Builds a chain on the reloader's thread. arg is the effects chain argument
+   list, which is terminated by argv's NULL. */
+static int reload_build(void *arg, struct stream_info *stream, ssize_t frames, struct reload_chain *rc)
+{
+	int argc = 0, in_channels = stream->channels;
+	char **argv = (char **) arg;
+	while (argv[argc] != NULL)
+		++argc;
+	if (build_effects_chain(argc, argv, &rc->chain, stream, NULL, NULL))
+		return 1;
+	rc->buf_len = get_effects_chain_buffer_len(&rc->chain, frames, in_channels);
+	if (profile_effects)
+		rc->data = profile_effects_chain(&rc->chain);
+	shard_effects_chain(&rc->chain, threads);
+	return (pipeline_stages > 1 && pipeline_effects_chain(&rc->chain, pipeline_stages, frames));
+}
+
+/* Called once the chain a profile belongs to has been destroyed */
+static void reload_destroy_data(void *arg, void *data)
+{
+	if (LOGLEVEL(LL_NORMAL))
+		print_effects_profile((struct effects_profile *) data, stderr);
+	destroy_effects_profile((struct effects_profile *) data);
+}
+
+/* Must be called whenever the chain has been rebuilt by split_effects_chain() */
+static void reset_reloader(ssize_t buf_len)
+{
+	struct stream_info istream, ostream;
+	if (reloader == NULL)
+		return;
+	istream.fs = in_codecs.head->fs;
+	istream.channels = in_codecs.head->channels;
+	ostream.fs = out_codec->fs;
+	ostream.channels = out_codec->channels;
+	if (reloader_reset(reloader, &istream, &ostream, dsp_globals.buf_frames, buf_len, profile))
+		cleanup_and_exit(1);
+}
+
+static void init_reloader(int argc, char **argv, ssize_t buf_len)
+{
+	char *endptr;
+	ssize_t fade_frames = parse_len(reload_fade, out_codec->fs, &endptr);
+	if (check_endptr(NULL, reload_fade, endptr, "fade length"))
+		cleanup_and_exit(1);
+	if (fade_frames < 0) {
+		LOG_S(LL_ERROR, "error: fade length must be >= 0");
+		cleanup_and_exit(1);
+	}
+	if ((reloader = reloader_new(reload_build, reload_destroy_data, argv, fade_frames)) == NULL)
+		cleanup_and_exit(1);
+	if (reloader_watch_chain_args(reloader, argc, argv, NULL))
+		cleanup_and_exit(1);
+	reset_reloader(buf_len);
+}
+
 static void sig_handler_term(int s)
 {
 	term_sig = s;
@@ -420,10 +684,12 @@ int main(int argc, char *argv[])
 	int k, is_paused = 0, do_dither = 0, effect_start, effect_argc, ch;
 	ssize_t r, w, delay, pos = 0, out_frames, buf_len;
 	double in_time = 0;
+	struct timespec t0;
 	struct codec *c = NULL;
 	struct stream_info stream;
+	struct reload_chain *rc;
 	struct codec_params p,
-		out_p = { NULL, NULL, NULL, -1, -1, CODEC_ENDIAN_DEFAULT, CODEC_MODE_WRITE };
+		out_p = { NULL, NULL, NULL, -1, -1, CODEC_ENDIAN_DEFAULT, CODEC_MODE_WRITE, NULL };
 	struct sigaction sa, old_sigtstp_sa, new_sigtstp_sa;
 
 	dsp_globals.prog_name = argv[0];
@@ -496,6 +762,13 @@ int main(int argc, char *argv[])
 		if ((out_codec = init_out_codec(&out_p, &stream, out_frames)) == NULL)
 			cleanup_and_exit(1);
 		print_io_info(out_codec, LL_NORMAL, "output");
+		if (measure_dither)
+			cleanup_and_exit(dither_measure((out_p.shaper != NULL) ? out_p.shaper : get_noise_shaper_info(NULL),
+				out_codec->fs, out_codec->channels, out_codec->prec));
+		init_drift_comp();
+		buf_len = split_effects_chain();
+		if (reload_fade != NULL)
+			init_reloader(effect_argc, &argv[effect_start], buf_len);
 
 		if (interactive == -1) {
 			if (out_codec->interactive)
@@ -504,9 +777,7 @@ int main(int argc, char *argv[])
 				interactive = 0;
 		}
 
-		buf_len = get_effects_chain_buffer_len(&chain, dsp_globals.buf_frames, in_codecs.head->channels);
-		buf1 = calloc(buf_len, sizeof(sample_t));
-		buf2 = calloc(buf_len, sizeof(sample_t));
+		alloc_bufs(buf_len);
 		/* LOG_FMT(LL_VERBOSE, "info: buffer length: %zd samples", (size_t) buf_len); */
 
 		if (interactive) {
@@ -528,7 +799,7 @@ int main(int argc, char *argv[])
 						print_progress(in_codecs.head, out_codec, pos, is_paused, 1);
 				}
 				while (interactive && (input_pending() || is_paused)) {
-					delay = lround(((double) out_codec->delay(out_codec) / out_codec->fs + get_effects_chain_delay(&chain)) * in_codecs.head->fs);
+					delay = lround((get_out_delay(out_codec) + get_effects_chain_delay(&chain)) * in_codecs.head->fs);
 					ch = getchar();
 					switch (ch) {
 					case 'h':
@@ -554,6 +825,8 @@ int main(int argc, char *argv[])
 					case 'n':
 						out_codec->drop(out_codec);
 						reset_effects_chain(&chain);
+						if (drift != NULL)
+							drift_comp_reset(drift);
 						goto next_input;
 					case 'c':
 						is_paused = !is_paused;
@@ -562,13 +835,17 @@ int main(int argc, char *argv[])
 					case 'e':
 						if (show_progress)
 							fputs("\033[1K\r", stderr);
+						if (reloader != NULL) {
+							reloader_trigger(reloader);
+							break;
+						}
 						LOG_S(LL_NORMAL, "info: rebuilding effects chain");
 						if (!is_paused && drain_effects) {
 							do {
 								w = dsp_globals.buf_frames;
 								obuf = drain_effects_chain(&chain, &w, buf1, buf2);
 								if (w > 0)
-									write_out(w, obuf, do_dither);
+									write_out(w, obuf, do_dither, 0);
 							} while (w != -1);
 						}
 						destroy_effects_chain(&chain);
@@ -576,6 +853,7 @@ int main(int argc, char *argv[])
 						stream.channels = in_codecs.head->channels;
 						if (build_effects_chain(effect_argc, &argv[effect_start], &chain, &stream, NULL, NULL))
 							cleanup_and_exit(1);
+						buf_len = split_effects_chain();
 						if (input_mode != INPUT_MODE_SEQUENCE) {
 							if (out_codec->fs != stream.fs) {
 								LOG_FMT(LL_ERROR, "error: sample rate mismatch: %s", out_codec->path);
@@ -592,10 +870,10 @@ int main(int argc, char *argv[])
 							if ((out_codec = init_out_codec(&out_p, &stream, -1)) == NULL)
 								cleanup_and_exit(1);
 							print_io_info(out_codec, LL_NORMAL, "output");
+							init_drift_comp();
 						}
-						buf_len = get_effects_chain_buffer_len(&chain, dsp_globals.buf_frames, in_codecs.head->channels);
-						buf1 = realloc(buf1, buf_len * sizeof(sample_t));
-						buf2 = realloc(buf2, buf_len * sizeof(sample_t));
+						alloc_bufs(buf_len);
+						reset_reloader(buf_len);
 						do_dither = SHOULD_DITHER(in_codecs.head, out_codec, chain.head != NULL);
 						LOG_FMT(LL_VERBOSE, "info: dither %s", (do_dither) ? "on" : "off" );
 						break;
@@ -619,10 +897,25 @@ int main(int argc, char *argv[])
 					if (show_progress)
 						print_progress(in_codecs.head, out_codec, pos, is_paused, 1);
 				}
+				if (reloader != NULL && (rc = reloader_swap(reloader, &chain)) != NULL) {
+					alloc_bufs(rc->buf_len);
+					if (profile_effects)
+						profile = (struct effects_profile *) rc->data;
+					do_dither = SHOULD_DITHER(in_codecs.head, out_codec, chain.head != NULL);
+				}
 				w = r = in_codecs.head->read(in_codecs.head, buf1, dsp_globals.buf_frames);
 				pos += r;
-				obuf = run_effects_chain(chain.head, &w, buf1, buf2);
-				write_out(w, obuf, do_dither);
+				if (rt_is_enabled())
+					rt_watchdog_start(&watchdog);
+				if (profile != NULL)
+					clock_gettime(CLOCK_MONOTONIC, &t0);
+				if (reloader != NULL)
+					obuf = reloader_run(reloader, &chain, &w, buf1, buf2, 0);
+				else
+					obuf = run_effects_chain(chain.head, &w, buf1, buf2);
+				if (profile != NULL)
+					effects_profile_add_block(profile, &t0, r);
+				write_out(w, obuf, do_dither, (rt_is_enabled()) ? r : 0);
 				k += w;
 				if (show_progress && k >= out_codec->fs) {
 					print_progress(in_codecs.head, out_codec, pos, is_paused, 0);
@@ -643,7 +936,7 @@ int main(int argc, char *argv[])
 						w = dsp_globals.buf_frames;
 						obuf = drain_effects_chain(&chain, &w, buf1, buf2);
 						if (w > 0)
-							write_out(w, obuf, do_dither);
+							write_out(w, obuf, do_dither, 0);
 					} while (w != -1);
 				}
 				destroy_effects_chain(&chain);
@@ -651,23 +944,24 @@ int main(int argc, char *argv[])
 				stream.channels = in_codecs.head->channels;
 				if (build_effects_chain(effect_argc, &argv[effect_start], &chain, &stream, NULL, NULL))
 					cleanup_and_exit(1);
+				buf_len = split_effects_chain();
 				if (out_codec->fs != stream.fs || out_codec->channels != stream.channels) {
 					LOG_S(LL_NORMAL, "info: output sample rate and/or channels changed; reopening output");
 					destroy_codec(out_codec);
 					if ((out_codec = init_out_codec(&out_p, &stream, -1)) == NULL)
 						cleanup_and_exit(1);
 					print_io_info(out_codec, LL_NORMAL, "output");
+					init_drift_comp();
 				}
-				buf_len = get_effects_chain_buffer_len(&chain, dsp_globals.buf_frames, in_codecs.head->channels);
-				buf1 = realloc(buf1, buf_len * sizeof(sample_t));
-				buf2 = realloc(buf2, buf_len * sizeof(sample_t));
+				alloc_bufs(buf_len);
+				reset_reloader(buf_len);
 			}
 		}
 		do {
 			w = dsp_globals.buf_frames;
 			obuf = drain_effects_chain(&chain, &w, buf1, buf2);
 			if (w > 0)
-				write_out(w, obuf, do_dither);
+				write_out(w, obuf, do_dither, 0);
 		} while (w != -1);
 	}
 	end_rw_loop:
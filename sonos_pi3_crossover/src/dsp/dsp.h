@@ -19,17 +19,31 @@ enum {
 #define DEFAULT_CHANNELS      1
 #define DEFAULT_BUF_FRAMES    2048
 #define DEFAULT_MAX_BUF_RATIO 32
+#define DEFAULT_DEV_PERIODS   2
 #define BIT_PERFECT 1
 
+/* sample_t is double unless built with --enable-single-precision. SAMPLE_T_PREC
+   is the number of significant bits of sample_t and FFTW(x) maps to the fftw3
+   function or type of matching precision. */
+#ifdef SINGLE_PRECISION
+typedef float sample_t;
+#define SAMPLE_T_PREC 24
+#define FFTW(x) fftwf_ ## x
+#else
 typedef double sample_t;
+#define SAMPLE_T_PREC 53
+#define FFTW(x) fftw_ ## x
+#endif
 
 struct dsp_globals {
-	long clip_count;
-	sample_t peak;
 	int loglevel;
 	ssize_t buf_frames;
 	ssize_t max_buf_ratio;
 	const char *prog_name;
+	/* audio device latency; the buffer size is derived from buf_frames and
+	   max_buf_ratio if dev_period_frames is zero */
+	ssize_t dev_period_frames, dev_start_frames;
+	unsigned int dev_periods;
 };
 
 struct stream_info {
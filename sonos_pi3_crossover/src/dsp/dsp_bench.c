@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "dsp.h"
+#include "effect.h"
+#include "codec.h"
+#include "util.h"
+#include "pipeline.h"
+
+/* Offline benchmark for effects chains. Builds the chain from the arguments
+   (which may include @effects_file), feeds it an sgen signal and reports the
+   throughput of the whole chain and of each effect. Only the time spent in
+   the effects chain is measured; generating the signal is not.
+
+   The output is one line per record, each with a record type followed by
+   key=value pairs:
+
+       bench key=value ...
+       effect index=n name=effect key=value ...
+
+   Cycles are counted with the CPU cycle counter (perf_event_open) when the
+   kernel allows it. Otherwise, they are computed from the clock rate given
+   with -m, or not reported. */
+
+#define BENCH_DEFAULT_FS       48000
+#define BENCH_DEFAULT_CHANNELS 2
+#define BENCH_DEFAULT_SECONDS  10.0
+
+struct dsp_globals dsp_globals = {
+	LL_NORMAL,              /* loglevel */
+	DEFAULT_BUF_FRAMES,     /* buf_frames */
+	DEFAULT_MAX_BUF_RATIO,  /* max_buf_ratio */
+	"dsp_bench",            /* prog_name */
+	0,                      /* dev_period_frames */
+	0,                      /* dev_start_frames */
+	DEFAULT_DEV_PERIODS,    /* dev_periods */
+};
+
+static const char help_text[] =
+	"Usage: %s [options] [@[~/]effects_file] [effect [args ...]] ...\n"
+	"\n"
+	"Options:\n"
+	"  -h         show this help\n"
+	"  -r fs[k]   sample rate (default: %d)\n"
+	"  -c n       number of channels (default: %d)\n"
+	"  -b frames  block size (default: %d)\n"
+	"  -l secs    length of the test signal (default: %g)\n"
+	"  -g signal  sgen signal (default: a 20Hz-20kHz sine sweep)\n"
+	"  -T threads process channels in parallel using up to threads threads\n"
+	"  -P stages  run the effects chain as a pipeline of threaded stages\n"
+	"  -m MHz     CPU clock rate for the cycle counts if the cycle counter is unavailable\n"
+	"  -s         silent mode\n"
+	"  -v         verbose mode\n";
+
+static int perf_fd = -1;
+
+static void open_cycle_counter(void)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_CPU_CYCLES;
+	attr.disabled = 1;
+	attr.inherit = 1;  /* include the worker threads */
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	perf_fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	if (perf_fd == -1)
+		LOG_S(LL_VERBOSE, "info: cycle counter not available");
+}
+
+static double read_cycle_counter(void)
+{
+	long long count;
+	if (perf_fd == -1 || read(perf_fd, &count, sizeof(count)) != sizeof(count))
+		return -1.0;
+	return (double) count;
+}
+
+static double elapsed_ns(const struct timespec *t0)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - t0->tv_sec) * 1e9 + (now.tv_nsec - t0->tv_nsec);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, fs = BENCH_DEFAULT_FS, channels = BENCH_DEFAULT_CHANNELS, threads = 1, stages = 1, i;
+	double seconds = BENCH_DEFAULT_SECONDS, mhz = 0.0, chain_ns = 0.0, cycles = -1.0, ghz = 0.0;
+	char *endptr, *signal = NULL, default_signal[64];
+	const char *cycles_source = "none";
+	ssize_t frames, in_frames, total_frames = 0, out_frames = 0, len_frames, buf_len;
+	sample_t *buf1, *buf2;
+	struct codec *c;
+	struct stream_info stream;
+	struct effects_chain chain = { NULL, NULL };
+	struct effects_profile *profile;
+	struct effect_profile_stats st;
+	struct timespec t0;
+
+	dsp_globals.prog_name = argv[0];
+	opterr = 0;
+	while ((opt = getopt(argc, argv, "+:hr:c:b:l:g:T:P:m:sv")) != -1) {
+		switch (opt) {
+		case 'h':
+			fprintf(stdout, help_text, dsp_globals.prog_name, BENCH_DEFAULT_FS, BENCH_DEFAULT_CHANNELS,
+				DEFAULT_BUF_FRAMES, BENCH_DEFAULT_SECONDS);
+			return 0;
+		case 'r':
+			fs = parse_freq(optarg, &endptr);
+			if (check_endptr(NULL, optarg, endptr, "sample rate")) return 1;
+			if (fs <= 0) {
+				LOG_S(LL_ERROR, "error: sample rate must be > 0");
+				return 1;
+			}
+			break;
+		case 'c':
+			channels = strtol(optarg, &endptr, 10);
+			if (check_endptr(NULL, optarg, endptr, "number of channels")) return 1;
+			if (channels <= 0) {
+				LOG_S(LL_ERROR, "error: number of channels must be > 0");
+				return 1;
+			}
+			break;
+		case 'b':
+			dsp_globals.buf_frames = strtol(optarg, &endptr, 10);
+			if (check_endptr(NULL, optarg, endptr, "block size")) return 1;
+			if (dsp_globals.buf_frames <= 0) {
+				LOG_S(LL_ERROR, "error: block size must be > 0");
+				return 1;
+			}
+			break;
+		case 'l':
+			seconds = strtod(optarg, &endptr);
+			if (check_endptr(NULL, optarg, endptr, "length")) return 1;
+			if (seconds <= 0.0) {
+				LOG_S(LL_ERROR, "error: length must be > 0");
+				return 1;
+			}
+			break;
+		case 'g':
+			signal = optarg;
+			break;
+		case 'T':
+			threads = strtol(optarg, &endptr, 10);
+			if (check_endptr(NULL, optarg, endptr, "number of threads")) return 1;
+			if (threads <= 0) {
+				LOG_S(LL_ERROR, "error: number of threads must be > 0");
+				return 1;
+			}
+			break;
+		case 'P':
+			stages = strtol(optarg, &endptr, 10);
+			if (check_endptr(NULL, optarg, endptr, "number of stages")) return 1;
+			if (stages <= 0) {
+				LOG_S(LL_ERROR, "error: number of stages must be > 0");
+				return 1;
+			}
+			break;
+		case 'm':
+			mhz = strtod(optarg, &endptr);
+			if (check_endptr(NULL, optarg, endptr, "clock rate")) return 1;
+			if (mhz <= 0.0) {
+				LOG_S(LL_ERROR, "error: clock rate must be > 0");
+				return 1;
+			}
+			break;
+		case 's':
+			dsp_globals.loglevel = 0;
+			break;
+		case 'v':
+			dsp_globals.loglevel = LL_VERBOSE;
+			break;
+		case ':':
+			LOG_FMT(LL_ERROR, "error: expected argument to option '%c'", optopt);
+			return 1;
+		default:
+			LOG_FMT(LL_ERROR, "error: illegal option '%c'", optopt);
+			return 1;
+		}
+	}
+
+	if (signal == NULL) {
+		snprintf(default_signal, sizeof(default_signal), "sine:freq=20-20k+%g", seconds);
+		signal = default_signal;
+	}
+	c = init_codec(signal, "sgen", NULL, fs, channels, CODEC_ENDIAN_DEFAULT, CODEC_MODE_READ);
+	if (c == NULL) {
+		LOG_FMT(LL_ERROR, "error: failed to open input: %s", signal);
+		return 1;
+	}
+	stream.fs = c->fs;
+	stream.channels = c->channels;
+	if (build_effects_chain(argc - optind, &argv[optind], &chain, &stream, NULL, NULL)) {
+		destroy_codec(c);
+		return 1;
+	}
+	buf_len = get_effects_chain_buffer_len(&chain, dsp_globals.buf_frames, c->channels);
+	profile = profile_effects_chain(&chain);
+	open_cycle_counter();  /* before any worker threads are created */
+	shard_effects_chain(&chain, threads);
+	if (stages > 1 && pipeline_effects_chain(&chain, stages, dsp_globals.buf_frames)) {
+		destroy_effects_chain(&chain);
+		destroy_effects_profile(profile);
+		destroy_codec(c);
+		return 1;
+	}
+	buf1 = calloc(buf_len, sizeof(sample_t));
+	buf2 = calloc(buf_len, sizeof(sample_t));
+
+	len_frames = (ssize_t) llround(seconds * c->fs);
+	while (total_frames < len_frames) {
+		frames = c->read(c, buf1, MINIMUM(dsp_globals.buf_frames, len_frames - total_frames));
+		if (frames <= 0)
+			break;
+		total_frames += in_frames = frames;
+		if (perf_fd != -1)
+			ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		run_effects_chain(chain.head, &frames, buf1, buf2);
+		chain_ns += elapsed_ns(&t0);
+		effects_profile_add_block(profile, &t0, in_frames);
+		if (perf_fd != -1)
+			ioctl(perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+		out_frames += frames;
+	}
+
+	if ((cycles = read_cycle_counter()) >= 0.0) {
+		ghz = cycles / chain_ns;
+		cycles_source = "perf";
+	}
+	else if (mhz > 0.0) {
+		ghz = mhz / 1000.0;
+		cycles = chain_ns * ghz;
+		cycles_source = "clock";
+	}
+	fprintf(stdout, "bench precision=%s fs=%d channels=%d block=%zd threads=%d stages=%d frames=%zd out_frames=%zd "
+		"seconds=%.3f chain_ns=%.0f rtf=%.2f ns_per_sample=%.3f",
+		(sizeof(sample_t) == sizeof(float)) ? "single" : "double", c->fs, c->channels, (ssize_t) dsp_globals.buf_frames,
+		threads, stages, total_frames, out_frames, (double) total_frames / c->fs, chain_ns,
+		(chain_ns > 0.0) ? (double) total_frames / c->fs / (chain_ns / 1e9) : 0.0,
+		(total_frames > 0) ? chain_ns / (total_frames * c->channels) : 0.0);
+	if (cycles >= 0.0)
+		fprintf(stdout, " cycles_per_sample=%.2f ghz=%.3f", (total_frames > 0) ? cycles / (total_frames * c->channels) : 0.0, ghz);
+	fprintf(stdout, " cycles_source=%s\n", cycles_source);
+	for (i = 0; get_effect_profile_stats(profile, i, &st) == 0; ++i) {
+		fprintf(stdout, "effect index=%d name=%s blocks=%ld min_ns=%.0f avg_ns=%.0f max_ns=%.0f p99_ns=%.0f "
+			"ns_per_sample=%.3f load=%.6f",
+			i, st.name, st.blocks, st.min_ns, st.avg_ns, st.max_ns, st.p99_ns, st.ns_per_sample, st.load);
+		if (cycles >= 0.0)
+			fprintf(stdout, " cycles_per_sample=%.2f", st.ns_per_sample * ghz);
+		fputc('\n', stdout);
+	}
+	get_effects_chain_profile_stats(profile, &st);
+	fprintf(stdout, "chain blocks=%ld min_ns=%.0f avg_ns=%.0f max_ns=%.0f p99_ns=%.0f load=%.6f misses=%ld\n",
+		st.blocks, st.min_ns, st.avg_ns, st.max_ns, st.p99_ns, st.load, st.misses);
+
+	if (perf_fd != -1)
+		close(perf_fd);
+	destroy_effects_chain(&chain);
+	destroy_effects_profile(profile);
+	destroy_codec(c);
+	free(buf1);
+	free(buf2);
+	return 0;
+}
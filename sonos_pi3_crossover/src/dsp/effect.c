@@ -1,19 +1,27 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <time.h>
 #include <errno.h>
+#include <signal.h>
+#include <pthread.h>
 #include "effect.h"
 #include "util.h"
+#include "rt.h"
 
 #include "biquad.h"
 #include "gain.h"
 #include "crossfeed.h"
 #include "remix.h"
+#include "crossover.h"
 #include "st2ms.h"
 #include "delay.h"
 #include "resample.h"
+#include "resample_poly.h"
 #include "fir.h"
 #include "fir_p.h"
+#include "fir_fdl.h"
 #include "zita_convolver.h"
 #include "noise.h"
 #include "ladspa_host.h"
@@ -39,15 +47,18 @@ static struct effect_info effects[] = {
 	{ "add",                "add [channel] value",                     gain_effect_init,      GAIN_EFFECT_NUMBER_ADD },
 	{ "crossfeed",          "crossfeed f0[k] separation",              crossfeed_effect_init, 0 },
 	{ "remix",              "remix channel_selector|. ...",            remix_effect_init,     0 },
+	{ "crossover",          "crossover [lr<order>] [align] f0[k] [f1[k] ...] [gain=gain,...] [delay=delay[s|m|S],...]", crossover_effect_init, 0 },
 	{ "st2ms",              "st2ms",                                   st2ms_effect_init,     ST2MS_EFFECT_NUMBER_ST2MS },
 	{ "ms2st",              "ms2st",                                   st2ms_effect_init,     ST2MS_EFFECT_NUMBER_MS2ST },
 	{ "delay",              "delay delay[s|m|S]",                      delay_effect_init,     0 },
+	{ "resample_poly",      "resample_poly [bandwidth] fs[k]",         resample_poly_effect_init, 0 },
 #ifdef HAVE_FFTW3
 #ifndef SYMMETRIC_IO
 	{ "resample",           "resample [bandwidth] fs[k]",              resample_effect_init,  0 },
 #endif
 	{ "fir",                "fir [~/]impulse_path",                    fir_effect_init,       0 },
-	{ "fir_p",              "fir_p [min_part_len [max_part_len]] [~/]impulse_path", fir_p_effect_init, 0 },
+	{ "fir_p",              "fir_p [min_part_len [max_part_len [async_part_len]]] [~/]impulse_path", fir_p_effect_init, 0 },
+	{ "fir_fdl",            "fir_fdl [part_len] [~/]impulse_path",     fir_fdl_effect_init,   0 },
 #endif
 #ifdef HAVE_ZITA_CONVOLVER
 	{ "zita_convolver",     "zita_convolver [min_part_len [max_part_len]] [~/]impulse_path", zita_convolver_effect_init, 0 },
@@ -68,12 +79,52 @@ struct effect_info * get_effect_info(const char *name)
 	return NULL;
 }
 
+static void destroy_effect_ctl(struct effect_ctl *c)
+{
+	struct effect_ctl_update *u, *next;
+	if (c->destroy != NULL) c->destroy(c);
+	free(c->pending);
+	for (u = c->done; u != NULL; u = next) {
+		next = u->next;
+		free(u);
+	}
+	free(c->params);
+	free(c);
+}
+
 void destroy_effect(struct effect *e)
 {
+	struct effect_ctl *c, *next;
 	if (e->destroy != NULL) e->destroy(e);
+	for (c = e->ctl; c != NULL; c = next) {
+		next = c->next;
+		if (!c->detached) destroy_effect_ctl(c);
+	}
 	free(e);
 }
 
+struct effect_ctl * add_effect_ctl(struct effect *e, const char *name, int n_params)
+{
+	struct effect_ctl **p = &e->ctl, *c = calloc(1, sizeof(struct effect_ctl));
+	c->name = name;
+	c->n_params = n_params;
+	c->params = calloc(n_params, sizeof(struct effect_param));
+	while (*p != NULL)
+		p = &(*p)->next;
+	*p = c;
+	return c;
+}
+
+/* Moves the controls of src to the end of e's list */
+static void move_effect_ctls(struct effect *e, struct effect *src)
+{
+	struct effect_ctl **c = &e->ctl;
+	while (*c != NULL)
+		c = &(*c)->next;
+	*c = src->ctl;
+	src->ctl = NULL;
+}
+
 void append_effect(struct effects_chain *chain, struct effect *e)
 {
 	if (chain->tail == NULL)
@@ -169,10 +220,15 @@ int build_effects_chain(int argc, char **argv, struct effects_chain *chain, stru
 					goto fail;
 				}
 			}
-			else if (e->run == NULL) {
+			else if (e->run == NULL && e->run_planar == NULL) {
 				LOG_FMT(LL_VERBOSE, "info: not using effect: %s", argv[k]);
 				destroy_effect(e);
 			}
+			else if (chain->tail != NULL && chain->tail->merge != NULL && chain->tail->merge(chain->tail, e)) {
+				LOG_FMT(LL_VERBOSE, "info: merged effect: %s -> %s", argv[k], chain->tail->name);
+				move_effect_ctls(chain->tail, e);
+				destroy_effect(e);
+			}
 			else {
 				append_effect(chain, e);
 				if (e->ostream.channels != stream->channels) channels_changed = 1;
@@ -246,20 +302,322 @@ ssize_t get_effects_chain_buffer_len(struct effects_chain *chain, ssize_t in_fra
 	return max_len;
 }
 
-sample_t * run_effects_chain(struct effect *e, ssize_t *frames, sample_t *buf1, sample_t *buf2)
+void interleave_buffer(sample_t *dest, const sample_t *src, ssize_t frames, int channels)
+{
+	ssize_t i;
+	int k;
+	for (k = 0; k < channels; ++k, src += frames)
+		for (i = 0; i < frames; ++i)
+			dest[i * channels + k] = src[i];
+}
+
+void deinterleave_buffer(sample_t *dest, const sample_t *src, ssize_t frames, int channels)
+{
+	ssize_t i;
+	int k;
+	for (k = 0; k < channels; ++k, dest += frames)
+		for (i = 0; i < frames; ++i)
+			dest[i] = src[i * channels + k];
+}
+
+/* Per-effect timing. Block times are binned into a log-spaced histogram
+   (PROFILE_BINS_PER_OCT bins per octave starting at PROFILE_MIN_NS) for the
+   p99 estimate. Each profile is only updated by the thread that runs the
+   effect. */
+#define PROFILE_BINS         192
+#define PROFILE_BINS_PER_OCT 8
+#define PROFILE_MIN_NS       64.0
+
+struct effect_profile {
+	char *name;
+	int fs;
+	long blocks, misses;  /* misses: blocks that took longer than their duration (only reported for whole blocks) */
+	double ns_sum, ns_min, ns_max, frames, samples;
+	long hist[PROFILE_BINS];
+};
+
+struct effects_profile {
+	int n, channels;
+	struct effect_profile *p;
+	struct effect_profile chain;  /* whole blocks, timed by the frontend */
+};
+
+static void effect_profile_add(struct effect_profile *p, const struct timespec *t0, ssize_t frames, int channels)
+{
+	int bin = 0;
+	double ns;
+	struct timespec now;
+	if (frames <= 0)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ns = (now.tv_sec - t0->tv_sec) * 1e9 + (now.tv_nsec - t0->tv_nsec);
+	if (p->blocks == 0 || ns < p->ns_min)
+		p->ns_min = ns;
+	p->ns_max = MAXIMUM(p->ns_max, ns);
+	p->ns_sum += ns;
+	p->frames += frames;
+	p->samples += frames * channels;
+	if (ns > frames * 1e9 / p->fs)
+		++p->misses;
+	if (ns > PROFILE_MIN_NS)
+		bin = MINIMUM((int) (log2(ns / PROFILE_MIN_NS) * PROFILE_BINS_PER_OCT), PROFILE_BINS - 1);
+	++p->hist[bin];
+	++p->blocks;
+}
+
+static double effect_profile_p99(struct effect_profile *p)
+{
+	int i;
+	long n = 0, target = (long) ceil(p->blocks * 0.99);
+	for (i = 0; i < PROFILE_BINS; ++i) {
+		n += p->hist[i];
+		if (n >= target)
+			break;
+	}
+	return MINIMUM(PROFILE_MIN_NS * exp2((double) (i + 1) / PROFILE_BINS_PER_OCT), p->ns_max);
+}
+
+/* Time spent in the effect as a fraction of the duration of the audio it processed */
+static double effect_profile_load(struct effect_profile *p)
+{
+	return (p->frames > 0) ? p->ns_sum / (p->frames * 1e9 / p->fs) : 0.0;
+}
+
+struct effects_profile * profile_effects_chain(struct effects_chain *chain)
+{
+	int i;
+	struct effect *e;
+	struct effects_profile *prof = calloc(1, sizeof(struct effects_profile));
+	for (e = chain->head; e != NULL; e = e->next)
+		++prof->n;
+	prof->p = calloc(prof->n, sizeof(struct effect_profile));
+	for (e = chain->head, i = 0; e != NULL; e = e->next, ++i) {
+		prof->p[i].name = strdup(e->name);
+		prof->p[i].fs = e->istream.fs;
+		e->profile = &prof->p[i];
+	}
+	if (chain->head != NULL) {
+		prof->chain.fs = chain->head->istream.fs;
+		prof->channels = chain->head->istream.channels;
+	}
+	return prof;
+}
+
+void effects_profile_add_block(struct effects_profile *prof, const struct timespec *t0, ssize_t frames)
+{
+	if (prof->chain.fs > 0)
+		effect_profile_add(&prof->chain, t0, frames, prof->channels);
+}
+
+struct effects_profile * new_effects_profile_snapshot(struct effects_profile *prof)
+{
+	int i;
+	struct effects_profile *snap = calloc(1, sizeof(struct effects_profile));
+	snap->n = prof->n;
+	snap->channels = prof->channels;
+	snap->chain.fs = prof->chain.fs;
+	snap->p = calloc(snap->n, sizeof(struct effect_profile));
+	for (i = 0; i < snap->n; ++i) {
+		snap->p[i].name = strdup(prof->p[i].name);
+		snap->p[i].fs = prof->p[i].fs;
+	}
+	return snap;
+}
+
+void snapshot_effects_profile(struct effects_profile *snap, struct effects_profile *prof)
+{
+	int i;
+	char *name;
+	for (i = 0; i < prof->n; ++i) {
+		name = snap->p[i].name;
+		snap->p[i] = prof->p[i];
+		snap->p[i].name = name;
+	}
+	snap->chain = prof->chain;
+}
+
+static void print_effect_profile_row(struct effect_profile *p, const char *index, const char *name, int show_misses, FILE *f)
+{
+	char misses[24] = "";
+	if (p->blocks == 0) {
+		fprintf(f, "%s: profile: %3s %-20s %10ld\n", dsp_globals.prog_name, index, name, p->blocks);
+		return;
+	}
+	if (show_misses)
+		snprintf(misses, sizeof(misses), "%ld", p->misses);
+	fprintf(f, "%s: profile: %3s %-20s %10ld %10.0f %10.0f %10.0f %10.0f %8.2f %7.2f %8s\n", dsp_globals.prog_name,
+		index, name, p->blocks, p->ns_min, p->ns_sum / p->blocks, p->ns_max, effect_profile_p99(p),
+		p->ns_sum / p->samples, effect_profile_load(p) * 100.0, misses);
+}
+
+void print_effects_profile(struct effects_profile *prof, FILE *f)
+{
+	int i;
+	char index[16];
+	fprintf(f, "%s: profile: %3s %-20s %10s %10s %10s %10s %10s %8s %7s %8s\n", dsp_globals.prog_name,
+		"#", "effect", "blocks", "min_ns", "avg_ns", "max_ns", "p99_ns", "ns/smp", "load%", "misses");
+	for (i = 0; i < prof->n; ++i) {
+		snprintf(index, sizeof(index), "%d", i);
+		print_effect_profile_row(&prof->p[i], index, prof->p[i].name, 0, f);
+	}
+	/* an effect can't miss a deadline on its own, so misses are only counted for whole blocks */
+	print_effect_profile_row(&prof->chain, "", "total", 1, f);
+}
+
+void print_effects_profile_summary(struct effects_profile *prof, FILE *f)
+{
+	int i, max_i = -1;
+	double load, max_load = 0.0;
+	for (i = 0; i < prof->n; ++i) {
+		load = effect_profile_load(&prof->p[i]);
+		if (load > max_load) {
+			max_load = load;
+			max_i = i;
+		}
+	}
+	fprintf(f, "fx:%.1f%%  ", effect_profile_load(&prof->chain) * 100.0);
+	if (max_i >= 0)
+		fprintf(f, "top:%d:%s:%.1f%%  ", max_i, prof->p[max_i].name, max_load * 100.0);
+}
+
+static void fill_effect_profile_stats(struct effect_profile *p, const char *name, int with_misses, struct effect_profile_stats *st)
+{
+	memset(st, 0, sizeof(struct effect_profile_stats));
+	st->name = name;
+	st->blocks = p->blocks;
+	if (with_misses)
+		st->misses = p->misses;
+	if (p->blocks > 0) {
+		st->min_ns = p->ns_min;
+		st->avg_ns = p->ns_sum / p->blocks;
+		st->max_ns = p->ns_max;
+		st->p99_ns = effect_profile_p99(p);
+		st->ns_per_sample = p->ns_sum / p->samples;
+		st->load = effect_profile_load(p);
+	}
+}
+
+int get_effect_profile_stats(struct effects_profile *prof, int n, struct effect_profile_stats *st)
+{
+	if (n < 0 || n >= prof->n)
+		return 1;
+	fill_effect_profile_stats(&prof->p[n], prof->p[n].name, 0, st);
+	return 0;
+}
+
+void get_effects_chain_profile_stats(struct effects_profile *prof, struct effect_profile_stats *st)
+{
+	fill_effect_profile_stats(&prof->chain, "total", 1, st);
+}
+
+void destroy_effects_profile(struct effects_profile *prof)
+{
+	int i;
+	if (prof == NULL)
+		return;
+	for (i = 0; i < prof->n; ++i)
+		free(prof->p[i].name);
+	free(prof->p);
+	free(prof);
+}
+
+/* Applies the updates that have been handed to the effect's controls. Called
+   by the thread that runs the effect, between blocks. */
+static void apply_effect_ctls(struct effect *e)
+{
+	struct effect_ctl *c;
+	struct effect_ctl_update *u;
+	for (c = e->ctl; c != NULL; c = c->next) {
+		if (__atomic_load_n(&c->pending, __ATOMIC_RELAXED) == NULL
+				|| (u = __atomic_exchange_n(&c->pending, NULL, __ATOMIC_ACQUIRE)) == NULL)
+			continue;
+		c->apply(c, u);
+		/* hand the update back to be freed by the next effect_ctl_set() */
+		u->next = __atomic_load_n(&c->done, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&c->done, &u->next, u, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	}
+}
+
+/* Runs the effects starting at e on a buffer in the given layout and returns
+   the output in the same layout. A single channel buffer is both planar and
+   interleaved, so it is never converted. */
+static sample_t * run_effects_chain_layout(struct effect *e, ssize_t *frames, sample_t *buf1, sample_t *buf2, int layout_planar)
 {
+	int planar = layout_planar, channels = 0;
+	ssize_t in_frames;
+	struct timespec t0;
 	sample_t *ibuf = buf1, *obuf = buf2, *tmp;
 	while (e != NULL && *frames > 0) {
-		tmp = e->run(e, frames, ibuf, obuf);
+		in_frames = *frames;
+		if (e->ctl != NULL)
+			apply_effect_ctls(e);
+		if (e->profile != NULL)
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+		/* only change the layout when the effect requires it */
+		if (e->run_planar != NULL && (planar || e->run == NULL)) {
+			if (!planar) {
+				if (e->istream.channels > 1) {
+					deinterleave_buffer(obuf, ibuf, *frames, e->istream.channels);
+					tmp = ibuf;
+					ibuf = obuf;
+					obuf = tmp;
+				}
+				planar = 1;
+			}
+			tmp = e->run_planar(e, frames, ibuf, obuf);
+		}
+		else {
+			if (planar) {
+				if (e->istream.channels > 1) {
+					interleave_buffer(obuf, ibuf, *frames, e->istream.channels);
+					tmp = ibuf;
+					ibuf = obuf;
+					obuf = tmp;
+				}
+				planar = 0;
+			}
+			tmp = e->run(e, frames, ibuf, obuf);
+		}
+		if (e->profile != NULL)
+			effect_profile_add(e->profile, &t0, in_frames, e->istream.channels);
 		if (tmp == obuf) {
 			obuf = ibuf;
 			ibuf = tmp;
 		}
+		channels = e->ostream.channels;
 		e = e->next;
 	}
+	if (planar != layout_planar && *frames > 0 && channels > 1) {
+		if (planar)
+			interleave_buffer(obuf, ibuf, *frames, channels);
+		else
+			deinterleave_buffer(obuf, ibuf, *frames, channels);
+		ibuf = obuf;
+	}
 	return ibuf;
 }
 
+sample_t * run_effects_chain(struct effect *e, ssize_t *frames, sample_t *buf1, sample_t *buf2)
+{
+	return run_effects_chain_layout(e, frames, buf1, buf2, 0);
+}
+
+sample_t * run_effects_chain_planar(struct effect *e, ssize_t *frames, sample_t *buf1, sample_t *buf2)
+{
+	return run_effects_chain_layout(e, frames, buf1, buf2, 1);
+}
+
+/* Returns nonzero if every effect in the chain can run on planar buffers */
+int effects_chain_is_planar(struct effects_chain *chain)
+{
+	struct effect *e = chain->head;
+	while (e != NULL) {
+		if (e->run_planar == NULL) return 0;
+		e = e->next;
+	}
+	return 1;
+}
+
 double get_effects_chain_delay(struct effects_chain *chain)
 {
 	double delay = 0.0;
@@ -355,6 +713,396 @@ void destroy_effects_chain(struct effects_chain *chain)
 	chain->tail = NULL;
 }
 
+/* Channel-sharded execution: runs of effects that implement run_ch() are
+   wrapped in a single effect that splits each block by channel and runs the
+   pieces on a shared pool of worker threads. */
+
+struct shard_job {
+	struct effect *e;
+	sample_t *ibuf, *obuf;
+	ssize_t frames;
+	int start, end, *pending;
+	struct shard_job *next;
+};
+
+struct shard_state {
+	struct effects_chain chain;
+	int n_effects, n_jobs;
+	ssize_t buf_len, *in_frames;  /* in_frames[i] is the number of frames given to the i'th effect */
+	sample_t **bufs;  /* two per job */
+	struct shard_job *jobs;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t work, done;
+	pthread_t *threads;
+	int n_threads, refs, stop;
+	struct shard_job *head, *tail;
+} pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, 0, 0, 0, NULL, NULL };
+
+static void run_shard_job(struct shard_job *job)
+{
+	struct effect *e = job->e, *ie;
+	struct shard_state *state = (struct shard_state *) e->data;
+	int i, k, n = job - state->jobs, channels = e->ostream.channels;
+	ssize_t j, frames = job->frames, in_frames;
+	struct timespec t0;
+	sample_t *ibuf = state->bufs[n * 2], *obuf = state->bufs[n * 2 + 1], *tmp;
+
+	for (j = 0; j < frames * channels; j += channels)
+		for (k = job->start; k < job->end; ++k)
+			ibuf[j + k] = job->ibuf[j + k];
+	for (ie = state->chain.head, i = 0; ie != NULL && frames > 0; ie = ie->next, ++i) {
+		in_frames = frames;
+		/* only the first job is always run by the calling thread, so only
+		   it updates the profile (which then covers its channels only) */
+		if (n == 0) {
+			state->in_frames[i] = frames;
+			if (ie->profile != NULL)
+				clock_gettime(CLOCK_MONOTONIC, &t0);
+		}
+		tmp = ie->run_ch(ie, &frames, ibuf, obuf, job->start, job->end);
+		if (n == 0 && ie->profile != NULL)
+			effect_profile_add(ie->profile, &t0, in_frames, job->end - job->start);
+		if (tmp == obuf) {
+			obuf = ibuf;
+			ibuf = tmp;
+		}
+	}
+	for (j = 0; j < frames * channels; j += channels)
+		for (k = job->start; k < job->end; ++k)
+			job->obuf[j + k] = ibuf[j + k];
+	job->frames = frames;
+}
+
+/* pool.lock must be held */
+static struct shard_job * shard_pool_pop(void)
+{
+	struct shard_job *job = pool.head;
+	if (job != NULL) {
+		pool.head = job->next;
+		if (pool.head == NULL) pool.tail = NULL;
+	}
+	return job;
+}
+
+/* pool.lock must be held */
+static void shard_job_done(struct shard_job *job)
+{
+	if (--*job->pending == 0)
+		pthread_cond_broadcast(&pool.done);
+}
+
+static void * shard_pool_worker(void *arg)
+{
+	struct shard_job *job;
+	rt_thread_init(RT_THREAD_WORKER);
+	pthread_mutex_lock(&pool.lock);
+	while (!pool.stop) {
+		if ((job = shard_pool_pop()) == NULL) {
+			pthread_cond_wait(&pool.work, &pool.lock);
+			continue;
+		}
+		pthread_mutex_unlock(&pool.lock);
+		run_shard_job(job);
+		pthread_mutex_lock(&pool.lock);
+		shard_job_done(job);
+	}
+	pthread_mutex_unlock(&pool.lock);
+	return NULL;
+}
+
+static void shard_pool_ref(int threads)
+{
+	int err;
+	sigset_t set, old_set;
+	pthread_mutex_lock(&pool.lock);
+	while (pool.stop)
+		pthread_cond_wait(&pool.done, &pool.lock);
+	++pool.refs;
+	if (pool.n_threads < threads - 1) {
+		pool.threads = realloc(pool.threads, (threads - 1) * sizeof(pthread_t));
+		/* signals are handled by the main thread */
+		sigfillset(&set);
+		pthread_sigmask(SIG_SETMASK, &set, &old_set);
+		while (pool.n_threads < threads - 1) {
+			if ((err = pthread_create(&pool.threads[pool.n_threads], NULL, shard_pool_worker, NULL)) != 0) {
+				LOG_FMT(LL_ERROR, "warning: failed to create worker thread: %s", strerror(err));
+				break;
+			}
+			++pool.n_threads;
+		}
+		pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+	}
+	pthread_mutex_unlock(&pool.lock);
+}
+
+static void shard_pool_unref(void)
+{
+	int i, n_threads;
+	pthread_t *threads;
+	pthread_mutex_lock(&pool.lock);
+	if (--pool.refs == 0 && pool.n_threads > 0) {
+		pool.stop = 1;
+		threads = pool.threads;
+		n_threads = pool.n_threads;
+		pool.threads = NULL;
+		pool.n_threads = 0;
+		pthread_cond_broadcast(&pool.work);
+		pthread_mutex_unlock(&pool.lock);
+		for (i = 0; i < n_threads; ++i)
+			pthread_join(threads[i], NULL);
+		free(threads);
+		pthread_mutex_lock(&pool.lock);
+		pool.stop = 0;
+		pthread_cond_broadcast(&pool.done);
+	}
+	pthread_mutex_unlock(&pool.lock);
+}
+
+static void shard_effect_grow_bufs(struct effect *e, ssize_t frames)
+{
+	int i;
+	struct shard_state *state = (struct shard_state *) e->data;
+	if (frames * e->ostream.channels > state->buf_len) {
+		state->buf_len = frames * e->ostream.channels;
+		for (i = 0; i < state->n_jobs * 2; ++i)
+			state->bufs[i] = realloc(state->bufs[i], state->buf_len * sizeof(sample_t));
+	}
+}
+
+sample_t * shard_effect_run(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf)
+{
+	int i, pending;
+	struct effect *ie;
+	struct shard_job *job;
+	struct shard_state *state = (struct shard_state *) e->data;
+
+	shard_effect_grow_bufs(e, *frames);
+	memset(state->in_frames, 0, state->n_effects * sizeof(ssize_t));
+	for (ie = state->chain.head; ie != NULL; ie = ie->next)
+		if (ie->ctl != NULL)
+			apply_effect_ctls(ie);
+	for (i = 0; i < state->n_jobs; ++i) {
+		state->jobs[i].ibuf = ibuf;
+		state->jobs[i].obuf = obuf;
+		state->jobs[i].frames = *frames;
+		state->jobs[i].pending = &pending;
+		state->jobs[i].next = NULL;
+	}
+	pending = state->n_jobs - 1;
+	pthread_mutex_lock(&pool.lock);
+	for (i = 1; i < state->n_jobs; ++i) {
+		if (pool.tail == NULL)
+			pool.head = &state->jobs[i];
+		else
+			pool.tail->next = &state->jobs[i];
+		pool.tail = &state->jobs[i];
+	}
+	pthread_cond_broadcast(&pool.work);
+	pthread_mutex_unlock(&pool.lock);
+
+	run_shard_job(&state->jobs[0]);
+
+	/* help out instead of sleeping while there is queued work */
+	pthread_mutex_lock(&pool.lock);
+	while (pending > 0) {
+		if ((job = shard_pool_pop()) != NULL) {
+			pthread_mutex_unlock(&pool.lock);
+			run_shard_job(job);
+			pthread_mutex_lock(&pool.lock);
+			shard_job_done(job);
+		}
+		else
+			pthread_cond_wait(&pool.done, &pool.lock);
+	}
+	pthread_mutex_unlock(&pool.lock);
+
+	for (ie = state->chain.head, i = 0; ie != NULL; ie = ie->next, ++i)
+		if (ie->run_ch_commit != NULL && state->in_frames[i] > 0)
+			ie->run_ch_commit(ie, state->in_frames[i]);
+	*frames = state->jobs[0].frames;
+	return obuf;
+}
+
+ssize_t shard_effect_delay(struct effect *e)
+{
+	ssize_t d = 0;
+	struct effect *ie;
+	struct shard_state *state = (struct shard_state *) e->data;
+	for (ie = state->chain.head; ie != NULL; ie = ie->next)
+		if (ie->delay != NULL) d += ie->delay(ie);
+	return d;
+}
+
+void shard_effect_reset(struct effect *e)
+{
+	struct shard_state *state = (struct shard_state *) e->data;
+	reset_effects_chain(&state->chain);
+}
+
+void shard_effect_drain(struct effect *e, ssize_t *frames, sample_t *obuf)
+{
+	sample_t *rbuf;
+	struct shard_state *state = (struct shard_state *) e->data;
+	shard_effect_grow_bufs(e, *frames);
+	rbuf = drain_effects_chain(&state->chain, frames, state->bufs[0], state->bufs[1]);
+	if (*frames > 0)
+		memcpy(obuf, rbuf, *frames * e->ostream.channels * sizeof(sample_t));
+}
+
+void shard_effect_destroy(struct effect *e)
+{
+	int i;
+	struct shard_state *state = (struct shard_state *) e->data;
+	shard_pool_unref();
+	destroy_effects_chain(&state->chain);
+	for (i = 0; i < state->n_jobs * 2; ++i)
+		free(state->bufs[i]);
+	free(state->bufs);
+	free(state->jobs);
+	free(state->in_frames);
+	free(state);
+}
+
+static struct effect * shard_effect_init(struct effects_chain *chain, int n_effects, int threads)
+{
+	int i, channels = chain->head->ostream.channels;
+	struct effect *e;
+	struct shard_state *state;
+
+	state = calloc(1, sizeof(struct shard_state));
+	state->chain = *chain;
+	state->n_effects = n_effects;
+	state->n_jobs = MINIMUM(threads, channels);
+	state->in_frames = calloc(n_effects, sizeof(ssize_t));
+	state->bufs = calloc(state->n_jobs * 2, sizeof(sample_t *));
+	state->jobs = calloc(state->n_jobs, sizeof(struct shard_job));
+	for (i = 0; i < state->n_jobs; ++i) {
+		state->jobs[i].start = channels * i / state->n_jobs;
+		state->jobs[i].end = channels * (i + 1) / state->n_jobs;
+	}
+	shard_pool_ref(state->n_jobs);
+
+	e = calloc(1, sizeof(struct effect));
+	e->name = "channel_shard";
+	e->istream = chain->head->istream;
+	e->ostream = chain->tail->ostream;
+	e->run = shard_effect_run;
+	e->delay = shard_effect_delay;
+	e->reset = shard_effect_reset;
+	e->drain = shard_effect_drain;
+	e->destroy = shard_effect_destroy;
+	e->data = state;
+	for (i = 0; i < state->n_jobs; ++i)
+		state->jobs[i].e = e;
+	return e;
+}
+
+/* run_ch() processes a fixed number of frames in place, so the rate must not change */
+#define CAN_SHARD(e) ((e)->run_ch != NULL && (e)->istream.fs == (e)->ostream.fs \
+	&& (e)->istream.channels == (e)->ostream.channels && (e)->ostream.channels > 1)
+
+void shard_effects_chain(struct effects_chain *chain, int threads)
+{
+	int n;
+	struct effect *e, *next;
+	struct effects_chain run, new_chain = { NULL, NULL };
+
+	if (threads < 2)
+		return;
+	e = chain->head;
+	while (e != NULL) {
+		if (!CAN_SHARD(e)) {
+			next = e->next;
+			append_effect(&new_chain, e);
+			e = next;
+			continue;
+		}
+		run.head = run.tail = NULL;
+		for (n = 0; e != NULL && CAN_SHARD(e) && (run.head == NULL || e->istream.channels == run.head->istream.channels); ++n) {
+			next = e->next;
+			append_effect(&run, e);
+			e = next;
+		}
+		if (LOGLEVEL(LL_VERBOSE)) {
+			fprintf(stderr, "%s: info: channel sharded:", dsp_globals.prog_name);
+			for (next = run.head; next != NULL; next = next->next)
+				fprintf(stderr, " %s", next->name);
+			fputc('\n', stderr);
+		}
+		append_effect(&new_chain, shard_effect_init(&run, n, threads));
+	}
+	*chain = new_chain;
+}
+
+struct effects_ctls {
+	int n;
+	struct effect_ctl **c;
+};
+
+struct effects_ctls * get_effects_chain_ctls(struct effects_chain *chain)
+{
+	struct effect *e;
+	struct effect_ctl *c;
+	struct effects_ctls *ctls = calloc(1, sizeof(struct effects_ctls));
+	for (e = chain->head; e != NULL; e = e->next) {
+		for (c = e->ctl; c != NULL; c = c->next) {
+			ctls->c = realloc(ctls->c, (ctls->n + 1) * sizeof(struct effect_ctl *));
+			ctls->c[ctls->n++] = c;
+			c->detached = 1;
+		}
+	}
+	return ctls;
+}
+
+int get_effects_ctls_count(struct effects_ctls *ctls)
+{
+	return ctls->n;
+}
+
+struct effect_ctl * get_effects_ctl(struct effects_ctls *ctls, int n)
+{
+	return (n >= 0 && n < ctls->n) ? ctls->c[n] : NULL;
+}
+
+int effect_ctl_set(struct effect_ctl *c, const double *values)
+{
+	int i;
+	struct effect_ctl_update *u, *next;
+	for (u = __atomic_exchange_n(&c->done, NULL, __ATOMIC_ACQUIRE); u != NULL; u = next) {
+		next = u->next;
+		free(u);
+	}
+	if ((u = c->prepare(c, values)) == NULL)
+		return 1;
+	for (i = 0; i < c->n_params; ++i)
+		c->params[i].value = values[i];
+	/* an update that has not been applied yet is simply replaced */
+	free(__atomic_exchange_n(&c->pending, u, __ATOMIC_ACQ_REL));
+	return 0;
+}
+
+void apply_effects_chain_ctls(struct effects_chain *chain)
+{
+	struct effect *e;
+	for (e = chain->head; e != NULL; e = e->next)
+		if (e->ctl != NULL)
+			apply_effect_ctls(e);
+}
+
+void destroy_effects_ctls(struct effects_ctls *ctls)
+{
+	int i;
+	if (ctls == NULL)
+		return;
+	for (i = 0; i < ctls->n; ++i)
+		destroy_effect_ctl(ctls->c[i]);
+	free(ctls->c);
+	free(ctls);
+}
+
 void print_all_effects(void)
 {
 	int i;
@@ -1,8 +1,56 @@
 #ifndef _EFFECT_H
 #define _EFFECT_H
 
+#include <time.h>
 #include "dsp.h"
 
+struct effect_profile;
+
+struct effect_profile_stats {
+	const char *name;
+	long blocks, misses;  /* misses are only counted for whole blocks */
+	double min_ns, avg_ns, max_ns, p99_ns, ns_per_sample, load;
+};
+
+/* Runtime control of effect parameters. Effects that support it attach one
+   effect_ctl per parameter set (a merged effect may carry several). New
+   values go to prepare() on a control thread, which computes whatever the
+   effect needs (coefficients, for example) into an update. The update is
+   handed over with atomics and passed to apply() by the thread that runs the
+   effect, before its next block.
+
+   prepare() runs on the control thread while the effect runs, and the chain
+   may already be retired by a hot reload, so it must not touch the effect or
+   its state. Anything it needs is copied into the control's own data when
+   the control is created; only apply() may use the effect. */
+
+struct effect_param {
+	const char *name;
+	double value, min, max;
+};
+
+struct effect_ctl_update {
+	struct effect_ctl_update *next;  /* for use by effect.c only */
+	/* effect-specific data follows */
+};
+
+struct effect_ctl {
+	struct effect_ctl *next;  /* next control of the same effect */
+	const char *name;  /* name of the effect as given in the effects chain */
+	int n_params;
+	struct effect_param *params;
+	/* Returns an update for the given values (one per parameter) or NULL on
+	   failure. The update is freed with free(). */
+	struct effect_ctl_update * (*prepare)(struct effect_ctl *, const double *);
+	void (*apply)(struct effect_ctl *, struct effect_ctl_update *);  /* must not block */
+	void (*destroy)(struct effect_ctl *);  /* frees data; may be NULL */
+	void *data;
+	struct effect_ctl_update *pending, *done;  /* exchanged with atomics */
+	int detached;  /* owned by an effects_ctls table instead of the effect */
+};
+
+struct effects_ctls;
+
 struct effect_info {
 	const char *name;
 	const char *usage;
@@ -16,12 +64,22 @@ struct effect {
 	struct stream_info istream, ostream;
 	char *channel_selector;  /* for use *only* by the effect */
 	/* All functions may be NULL */
-	sample_t * (*run)(struct effect *, ssize_t *, sample_t *, sample_t *);  /* if NULL, the effect will not be used */
+	sample_t * (*run)(struct effect *, ssize_t *, sample_t *, sample_t *);  /* if both run() and run_planar() are NULL, the effect will not be used */
+	/* Same as run(), but with planar buffers: channel k of an n frame block starts at buf[k * n]. If run() is NULL,
+	   the effect always gets planar buffers. Otherwise, run_planar() is only used when the buffer is already planar. */
+	sample_t * (*run_planar)(struct effect *, ssize_t *, sample_t *, sample_t *);
+	/* Same as run(), but only processes channels [start, end). May be called concurrently for disjoint
+	   channel ranges, so it must not modify any state that is shared between channels. */
+	sample_t * (*run_ch)(struct effect *, ssize_t *, sample_t *, sample_t *, int, int);
+	void (*run_ch_commit)(struct effect *, ssize_t);  /* called with the number of input frames once run_ch() has covered all channels */
 	ssize_t (*delay)(struct effect *);  /* returns the latency in frames at ostream.fs */
 	void (*reset)(struct effect *);
 	void (*plot)(struct effect *, int);
 	void (*drain)(struct effect *, ssize_t *, sample_t *);
+	int (*merge)(struct effect *, struct effect *);  /* absorbs the given (following) effect; returns nonzero on success */
 	void (*destroy)(struct effect *);
+	struct effect_profile *profile;  /* set by profile_effects_chain(); NULL if not profiled */
+	struct effect_ctl *ctl;  /* runtime controls; NULL if none */
 	void *data;
 };
 
@@ -32,16 +90,62 @@ struct effects_chain {
 
 struct effect_info * get_effect_info(const char *);
 void destroy_effect(struct effect *);
+/* Adds a control with the given number of (zeroed) parameters to the effect.
+   args: effect, name, number of parameters */
+struct effect_ctl * add_effect_ctl(struct effect *, const char *, int);
 void append_effect(struct effects_chain *, struct effect *);
 int build_effects_chain(int, char **, struct effects_chain *, struct stream_info *, char *, const char *);
 int build_effects_chain_from_file(struct effects_chain *, struct stream_info *, char *, const char *, const char *);
 ssize_t get_effects_chain_buffer_len(struct effects_chain *, ssize_t, int);
+void interleave_buffer(sample_t *, const sample_t *, ssize_t, int);
+void deinterleave_buffer(sample_t *, const sample_t *, ssize_t, int);
 sample_t * run_effects_chain(struct effect *, ssize_t *, sample_t *, sample_t *);
+sample_t * run_effects_chain_planar(struct effect *, ssize_t *, sample_t *, sample_t *);
+int effects_chain_is_planar(struct effects_chain *);
 double get_effects_chain_delay(struct effects_chain *);
 void reset_effects_chain(struct effects_chain *);
 void plot_effects_chain(struct effects_chain *, int);
 sample_t * drain_effects_chain(struct effects_chain *, ssize_t *, sample_t *, sample_t *);
 void destroy_effects_chain(struct effects_chain *);
+void shard_effects_chain(struct effects_chain *, int);
+/* Starts timing every effect in the chain. Must be called before the chain
+   is sharded or pipelined. The returned profile must be destroyed after the
+   chain. */
+struct effects_profile * profile_effects_chain(struct effects_chain *);
+/* Adds the time since t0 as one block of the given number of input frames
+   through the whole chain. Called by the frontend around the call that runs
+   the chain; a block that takes longer than the audio it contains is a miss. */
+void effects_profile_add_block(struct effects_profile *, const struct timespec *, ssize_t);
+/* Returns a profile with the same effects and no timings, for use with
+   snapshot_effects_profile() */
+struct effects_profile * new_effects_profile_snapshot(struct effects_profile *);
+/* Copies the timings into a profile returned by new_effects_profile_snapshot()
+   for the same chain. Does not allocate, so the audio thread can take a
+   snapshot and leave the printing to another thread. */
+void snapshot_effects_profile(struct effects_profile *, struct effects_profile *);
+/* Prints a table of per-effect timings and the timings of whole blocks */
+void print_effects_profile(struct effects_profile *, FILE *);
+/* Prints the total load and the most expensive effect for the progress line */
+void print_effects_profile_summary(struct effects_profile *, FILE *);
+/* Fills in the timings of the nth effect. Returns nonzero if there is no such effect. */
+int get_effect_profile_stats(struct effects_profile *, int, struct effect_profile_stats *);
+/* Fills in the timings of whole blocks */
+void get_effects_chain_profile_stats(struct effects_profile *, struct effect_profile_stats *);
+void destroy_effects_profile(struct effects_profile *);
+/* Collects the runtime controls of every effect in the chain in chain order.
+   Must be called before the chain is sharded or pipelined. The table takes
+   over the controls, so it must be destroyed after the chain. */
+struct effects_ctls * get_effects_chain_ctls(struct effects_chain *);
+int get_effects_ctls_count(struct effects_ctls *);
+struct effect_ctl * get_effects_ctl(struct effects_ctls *, int);
+/* Computes an update for the given values (one per parameter) and hands it
+   to the effect. Not for the audio thread, and only one thread may set a
+   given control. Returns nonzero on failure. */
+int effect_ctl_set(struct effect_ctl *, const double *);
+/* Applies pending updates right away. Only for chains that are not running
+   yet. A reset afterwards skips any smoothing of the changes. */
+void apply_effects_chain_ctls(struct effects_chain *);
+void destroy_effects_ctls(struct effects_ctls *);
 void print_all_effects(void);
 
 #endif
@@ -0,0 +1,390 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "fftw_cache.h"
+
+#define DEFAULT_XDG_CACHE_DIR "/.cache"
+#define DEFAULT_CACHE_DIR     "/dsp"
+#define SPECTRA_MAGIC         "dspspec3"
+#ifdef SINGLE_PRECISION
+	#define WISDOM_FILE "wisdom-single"
+#else
+	#define WISDOM_FILE "wisdom-double"
+#endif
+
+struct spectra_header {
+	char magic[8];
+	uint64_t hash, len;  /* of the impulse */
+	uint32_t sample_size, key_len;
+	uint64_t n;
+};
+
+static struct {
+	pthread_once_t once;
+	pthread_mutex_t lock;
+	char *dir;
+	unsigned int flags;
+	int wisdom_dirty;
+} cache = { PTHREAD_ONCE_INIT, PTHREAD_MUTEX_INITIALIZER, NULL, FFTW_ESTIMATE, 0 };
+
+static int make_dirs(char *path)
+{
+	char *p;
+	for (p = path + 1; *p != '\0'; ++p) {
+		if (*p == '/') {
+			*p = '\0';
+			if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+				*p = '/';
+				return -1;
+			}
+			*p = '/';
+		}
+	}
+	return (mkdir(path, 0755) != 0 && errno != EEXIST) ? -1 : 0;
+}
+
+static char * cache_path(const char *name)
+{
+	int i = strlen(cache.dir) + 1 + strlen(name) + 1;
+	char *p = calloc(i, sizeof(char));
+	snprintf(p, i, "%s/%s", cache.dir, name);
+	return p;
+}
+
+static char * tmp_path(const char *path)
+{
+	int i = strlen(path) + 32;
+	char *p = calloc(i, sizeof(char));
+	snprintf(p, i, "%s.tmp.%ld", path, (long) getpid());
+	return p;
+}
+
+static void cache_init(void)
+{
+	int i;
+	char *env, *p;
+
+	if ((env = getenv("DSP_CACHE_DIR")) && env[0] != '\0')
+		cache.dir = strdup(env);
+	else if (!((env = getenv("DSP_CACHE")) && strcmp(env, "1") == 0))
+		cache.dir = NULL;  /* the cache is opt-in */
+	else if ((env = getenv("XDG_CACHE_HOME")) && env[0] != '\0') {
+		i = strlen(env) + strlen(DEFAULT_CACHE_DIR) + 1;
+		cache.dir = calloc(i, sizeof(char));
+		snprintf(cache.dir, i, "%s%s", env, DEFAULT_CACHE_DIR);
+	}
+	else if ((env = getenv("HOME"))) {
+		i = strlen(env) + strlen(DEFAULT_XDG_CACHE_DIR) + strlen(DEFAULT_CACHE_DIR) + 1;
+		cache.dir = calloc(i, sizeof(char));
+		snprintf(cache.dir, i, "%s%s%s", env, DEFAULT_XDG_CACHE_DIR, DEFAULT_CACHE_DIR);
+	}
+	if (cache.dir && make_dirs(cache.dir) != 0) {
+		LOG_FMT(LL_VERBOSE, "info: fftw cache: failed to create directory: %s: %s", cache.dir, strerror(errno));
+		free(cache.dir);
+		cache.dir = NULL;
+	}
+	cache.flags = (cache.dir) ? FFTW_MEASURE : FFTW_ESTIMATE;
+	if ((env = getenv("DSP_FFTW_PLANNER"))) {
+		if (strcmp(env, "estimate") == 0)
+			cache.flags = FFTW_ESTIMATE;
+		else if (strcmp(env, "measure") == 0)
+			cache.flags = FFTW_MEASURE;
+		else if (strcmp(env, "patient") == 0)
+			cache.flags = FFTW_PATIENT;
+		else
+			LOG_FMT(LL_ERROR, "warning: fftw cache: unknown planner: %s", env);
+	}
+	if (cache.dir) {
+		LOG_FMT(LL_VERBOSE, "info: fftw cache: directory: %s", cache.dir);
+		p = cache_path(WISDOM_FILE);
+		if (FFTW(import_wisdom_from_filename)(p))
+			LOG_FMT(LL_VERBOSE, "info: fftw cache: loaded wisdom: %s", p);
+		free(p);
+	}
+}
+
+static FFTW(plan) plan_1d(int n, sample_t *r, FFTW(complex) *c, int c2r)
+{
+	FFTW(plan) plan;
+	unsigned int flags;
+	pthread_once(&cache.once, cache_init);
+	pthread_mutex_lock(&cache.lock);
+	flags = cache.flags;
+	if (flags != FFTW_ESTIMATE) {
+		/* try the wisdom first so that we know whether there is anything new to save */
+		flags |= FFTW_WISDOM_ONLY;
+		plan = (c2r) ? FFTW(plan_dft_c2r_1d)(n, c, r, flags) : FFTW(plan_dft_r2c_1d)(n, r, c, flags);
+		if (plan != NULL) {
+			pthread_mutex_unlock(&cache.lock);
+			return plan;
+		}
+		flags = cache.flags;
+		cache.wisdom_dirty = 1;
+	}
+	plan = (c2r) ? FFTW(plan_dft_c2r_1d)(n, c, r, flags) : FFTW(plan_dft_r2c_1d)(n, r, c, flags);
+	pthread_mutex_unlock(&cache.lock);
+	return plan;
+}
+
+FFTW(plan) fftw_cache_plan_estimate(int n, sample_t *in, FFTW(complex) *out)
+{
+	FFTW(plan) plan;
+	pthread_mutex_lock(&cache.lock);
+	plan = FFTW(plan_dft_r2c_1d)(n, in, out, FFTW_ESTIMATE);
+	pthread_mutex_unlock(&cache.lock);
+	return plan;
+}
+
+void fftw_cache_destroy_plan(FFTW(plan) plan)
+{
+	if (plan == NULL)
+		return;
+	pthread_mutex_lock(&cache.lock);
+	FFTW(destroy_plan)(plan);
+	pthread_mutex_unlock(&cache.lock);
+}
+
+void fftw_cache_lock(void)
+{
+	pthread_mutex_lock(&cache.lock);
+}
+
+void fftw_cache_unlock(void)
+{
+	pthread_mutex_unlock(&cache.lock);
+}
+
+FFTW(plan) fftw_cache_plan_r2c(int n, sample_t *in, FFTW(complex) *out)
+{
+	return plan_1d(n, in, out, 0);
+}
+
+FFTW(plan) fftw_cache_plan_c2r(int n, FFTW(complex) *in, sample_t *out)
+{
+	return plan_1d(n, out, in, 1);
+}
+
+void fftw_cache_save_wisdom(void)
+{
+	char *p, *tmp;
+	pthread_once(&cache.once, cache_init);
+	pthread_mutex_lock(&cache.lock);
+	if (cache.wisdom_dirty && cache.dir) {
+		p = cache_path(WISDOM_FILE);
+		tmp = tmp_path(p);
+		if (FFTW(export_wisdom_to_filename)(tmp) && rename(tmp, p) == 0)
+			LOG_FMT(LL_VERBOSE, "info: fftw cache: saved wisdom: %s", p);
+		else {
+			LOG_FMT(LL_VERBOSE, "info: fftw cache: failed to save wisdom: %s", p);
+			unlink(tmp);
+		}
+		free(p);
+		free(tmp);
+	}
+	cache.wisdom_dirty = 0;
+	pthread_mutex_unlock(&cache.lock);
+}
+
+/* Spectra are shared by all users in the process. Entries that are backed by
+   a cache file are mapped read-only, so other processes share the pages as
+   well. */
+struct spectra_entry {
+	struct spectra_header h;
+	char *key;
+	FFTW(complex) *data;
+	void *map;
+	size_t map_len;
+	int refs;
+	struct spectra_entry *next;
+};
+
+static struct spectra_entry *spectra_list = NULL;
+
+/* The data starts at a cache line boundary */
+static size_t spectra_offset(const struct spectra_header *h)
+{
+	return (sizeof(struct spectra_header) + h->key_len + 63) & ~((size_t) 63);
+}
+
+/* FNV-1a */
+static uint64_t hash_bytes(uint64_t hash, const void *p, size_t len)
+{
+	size_t i;
+	for (i = 0; i < len; ++i)
+		hash = (hash ^ ((const unsigned char *) p)[i]) * 1099511628211ULL;
+	return hash;
+}
+
+#define HASH_INIT 14695981039346656037ULL
+
+/* Builds the expected header and the key */
+static void spectra_key(const sample_t *impulse, size_t len, const char *id, size_t n, struct spectra_header *h, char **key)
+{
+	int i;
+	memset(h, 0, sizeof(struct spectra_header));
+	memcpy(h->magic, SPECTRA_MAGIC, sizeof(h->magic));
+	h->hash = hash_bytes(HASH_INIT, impulse, len * sizeof(sample_t));
+	h->len = len;
+	h->sample_size = sizeof(sample_t);
+	h->n = n;
+	i = 16 + 1 + 20 + 1 + strlen(id) + 1;
+	*key = calloc(i, sizeof(char));
+	snprintf(*key, i, "%016llx:%zu\n%s", (unsigned long long) h->hash, len, id);
+	h->key_len = strlen(*key);
+}
+
+/* The file name is a hash of the key, so a changed impulse gets a new file */
+static char * spectra_file(const char *key)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "spectra-%016llx", (unsigned long long) hash_bytes(HASH_INIT, key, strlen(key)));
+	return cache_path(name);
+}
+
+static struct spectra_entry * find_spectra(const struct spectra_header *h, const char *key)
+{
+	struct spectra_entry *entry;
+	for (entry = spectra_list; entry != NULL; entry = entry->next)
+		if (memcmp(&entry->h, h, sizeof(struct spectra_header)) == 0 && strcmp(entry->key, key) == 0)
+			return entry;
+	return NULL;
+}
+
+static struct spectra_entry * add_spectra(const struct spectra_header *h, char *key, FFTW(complex) *data, void *map, size_t map_len)
+{
+	struct spectra_entry *entry = calloc(1, sizeof(struct spectra_entry));
+	entry->h = *h;
+	entry->key = key;
+	entry->data = data;
+	entry->map = map;
+	entry->map_len = map_len;
+	entry->refs = 1;
+	entry->next = spectra_list;
+	spectra_list = entry;
+	return entry;
+}
+
+static struct spectra_entry * map_spectra(const char *file, const struct spectra_header *h, char *key)
+{
+	int fd;
+	void *map;
+	struct stat st;
+	size_t offset = spectra_offset(h), len = offset + h->n * sizeof(FFTW(complex));
+
+	if ((fd = open(file, O_RDONLY)) < 0)
+		return NULL;
+	if (fstat(fd, &st) != 0 || (size_t) st.st_size != len) {
+		close(fd);
+		return NULL;
+	}
+	map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+	if (memcmp(map, h, sizeof(struct spectra_header)) != 0 || memcmp((char *) map + sizeof(struct spectra_header), key, h->key_len) != 0) {
+		munmap(map, len);
+		return NULL;
+	}
+	return add_spectra(h, key, (FFTW(complex) *) ((char *) map + offset), map, len);
+}
+
+const FFTW(complex) * fftw_cache_load_spectra(const sample_t *impulse, size_t len, const char *id, size_t n)
+{
+	char *key, *file;
+	struct spectra_header h;
+	struct spectra_entry *entry = NULL;
+
+	pthread_once(&cache.once, cache_init);
+	spectra_key(impulse, len, id, n, &h, &key);
+	pthread_mutex_lock(&cache.lock);
+	if ((entry = find_spectra(&h, key))) {
+		++entry->refs;
+		LOG_FMT(LL_VERBOSE, "info: fftw cache: sharing spectra: refs=%d", entry->refs);
+		free(key);
+	}
+	else if (cache.dir) {
+		file = spectra_file(key);
+		if ((entry = map_spectra(file, &h, key)))
+			LOG_FMT(LL_VERBOSE, "info: fftw cache: loaded spectra: %s", file);
+		else
+			free(key);
+		free(file);
+	}
+	else
+		free(key);
+	pthread_mutex_unlock(&cache.lock);
+	return (entry) ? entry->data : NULL;
+}
+
+const FFTW(complex) * fftw_cache_store_spectra(const sample_t *impulse, size_t len, const char *id, FFTW(complex) *buf, size_t n)
+{
+	int ok = 0;
+	char *key, *file, *tmp, pad[64] = { 0 };
+	struct spectra_header h;
+	struct spectra_entry *entry = NULL;
+	FILE *f;
+
+	pthread_once(&cache.once, cache_init);
+	spectra_key(impulse, len, id, n, &h, &key);
+	pthread_mutex_lock(&cache.lock);
+	if ((entry = find_spectra(&h, key))) {
+		/* another instance got there first */
+		++entry->refs;
+		free(key);
+		FFTW(free)(buf);
+		pthread_mutex_unlock(&cache.lock);
+		return entry->data;
+	}
+	if (cache.dir) {
+		file = spectra_file(key);
+		tmp = tmp_path(file);
+		if ((f = fopen(tmp, "wb"))) {
+			ok = fwrite(&h, sizeof(h), 1, f) == 1
+				&& fwrite(key, sizeof(char), h.key_len, f) == h.key_len
+				&& fwrite(pad, sizeof(char), spectra_offset(&h) - sizeof(h) - h.key_len, f) == spectra_offset(&h) - sizeof(h) - h.key_len
+				&& fwrite(buf, sizeof(FFTW(complex)), n, f) == n;
+			ok = (fclose(f) == 0) && ok;
+		}
+		if (ok && rename(tmp, file) == 0) {
+			LOG_FMT(LL_VERBOSE, "info: fftw cache: saved spectra: %s", file);
+			if ((entry = map_spectra(file, &h, key)))
+				FFTW(free)(buf);
+		}
+		else {
+			LOG_FMT(LL_VERBOSE, "info: fftw cache: failed to save spectra: %s", file);
+			unlink(tmp);
+		}
+		free(file);
+		free(tmp);
+	}
+	if (entry == NULL)
+		entry = add_spectra(&h, key, buf, NULL, 0);
+	pthread_mutex_unlock(&cache.lock);
+	return entry->data;
+}
+
+void fftw_cache_release_spectra(const FFTW(complex) *data)
+{
+	struct spectra_entry **p, *entry;
+	if (data == NULL)
+		return;
+	pthread_mutex_lock(&cache.lock);
+	for (p = &spectra_list; *p != NULL && (*p)->data != data; p = &(*p)->next);
+	if ((entry = *p) != NULL && --entry->refs == 0) {
+		*p = entry->next;
+		if (entry->map)
+			munmap(entry->map, entry->map_len);
+		else
+			FFTW(free)(entry->data);
+		free(entry->key);
+		free(entry);
+	}
+	pthread_mutex_unlock(&cache.lock);
+}
@@ -0,0 +1,46 @@
+#ifndef _FFTW_CACHE_H
+#define _FFTW_CACHE_H
+
+#include <complex.h>
+#include <fftw3.h>
+#include "dsp.h"
+
+/* Persistent FFTW wisdom and filter spectra cache. The cache is off unless
+   $DSP_CACHE_DIR names a directory or $DSP_CACHE is 1, in which case the
+   directory is $XDG_CACHE_HOME/dsp or ~/.cache/dsp. $DSP_FFTW_PLANNER selects
+   the planner rigor (estimate, measure, or patient). The default is measure if
+   the cache is enabled and estimate otherwise. */
+
+/* The FFTW planner is not thread-safe, and chains are built and destroyed on
+   several threads (hot reload, ladspa_dsp instances), so every plan must be
+   created and destroyed through these functions. */
+
+/* Plans for transforms that are executed repeatedly. Planning with measure or
+   patient overwrites the arrays, so initialize them after planning. */
+FFTW(plan) fftw_cache_plan_r2c(int, sample_t *, FFTW(complex) *);
+FFTW(plan) fftw_cache_plan_c2r(int, FFTW(complex) *, sample_t *);
+/* An r2c plan for a transform that is executed only a few times */
+FFTW(plan) fftw_cache_plan_estimate(int, sample_t *, FFTW(complex) *);
+/* Does nothing if the plan is NULL */
+void fftw_cache_destroy_plan(FFTW(plan));
+/* Serializes planning done by other code (such as zita-convolver) */
+void fftw_cache_lock(void);
+void fftw_cache_unlock(void);
+/* Exports the wisdom if any new plans were created */
+void fftw_cache_save_wisdom(void);
+
+/* Spectra are keyed by a hash of the impulse samples (len samples with the
+   channels interleaved), the length, and an id string which must describe
+   everything else the spectra depend on (effect, sample rate, channels,
+   partition layout, etc.). Identical impulses share spectra no matter which
+   file they came from. The returned spectra are read-only and shared by all
+   users with the same key, both within the process and, through the cache
+   file, across processes. Load returns NULL if the spectra are not available.
+   Store takes ownership of the buffer (which must be allocated with
+   fftw_malloc()). Both must be paired with a call to
+   fftw_cache_release_spectra(). */
+const FFTW(complex) * fftw_cache_load_spectra(const sample_t *impulse, size_t len, const char *id, size_t);
+const FFTW(complex) * fftw_cache_store_spectra(const sample_t *impulse, size_t len, const char *id, FFTW(complex) *, size_t);
+void fftw_cache_release_spectra(const FFTW(complex) *);
+
+#endif
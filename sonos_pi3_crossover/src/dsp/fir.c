@@ -7,67 +7,102 @@
 #include "fir.h"
 #include "util.h"
 #include "codec.h"
+#include "fftw_cache.h"
 
 struct fir_state {
 	ssize_t len, fr_len, buf_pos, drain_pos, drain_frames;
-	fftw_complex **filter_fr, *tmp_fr;
+	const FFTW(complex) *spectra, **filter_fr;  /* filter_fr[i] points into the shared spectra */
+	FFTW(complex) **tmp_fr;
 	sample_t **input, **output, **overlap;
-	fftw_plan *r2c_plan, *c2r_plan;
+	FFTW(plan) *r2c_plan, *c2r_plan;
 	int has_output, is_draining;
 };
 
-sample_t * fir_effect_run(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf)
+/* Runs channel i. in and out point to the channel's first sample and successive frames are stride samples apart. */
+static ssize_t fir_run_channel(struct fir_state *state, int i, ssize_t frames, const sample_t *in, sample_t *out, ssize_t stride)
 {
-	struct fir_state *state = (struct fir_state *) e->data;
-	ssize_t i, k, iframes = 0, oframes = 0;
+	ssize_t k, n, iframes = 0, oframes = 0, buf_pos = state->buf_pos;
+	int has_output = state->has_output;
 
-	while (iframes < *frames) {
-		while (state->buf_pos < state->len && iframes < *frames) {
-			for (i = 0; i < e->ostream.channels; ++i) {
+	while (iframes < frames) {
+		n = MINIMUM(state->len - buf_pos, frames - iframes);
 #ifdef SYMMETRIC_IO
-				obuf[oframes * e->ostream.channels + i] = (state->has_output) ? state->output[i][state->buf_pos] : 0;
+		copy_samples(&out[oframes * stride], stride, (has_output) ? &state->output[i][buf_pos] : NULL, 1, n);
+		oframes += n;
 #else
-				if (state->has_output)
-					obuf[oframes * e->ostream.channels + i] = state->output[i][state->buf_pos];
-#endif
-				if (state->input[i])
-					state->input[i][state->buf_pos] = (ibuf) ? ibuf[iframes * e->ostream.channels + i] : 0;
-				else
-					state->output[i][state->buf_pos] = (ibuf) ? ibuf[iframes * e->ostream.channels + i] : 0;
-			}
-#ifdef SYMMETRIC_IO
-			++oframes;
-#else
-			if (state->has_output)
-				++oframes;
-#endif
-			++iframes;
-			++state->buf_pos;
+		if (has_output) {
+			copy_samples(&out[oframes * stride], stride, &state->output[i][buf_pos], 1, n);
+			oframes += n;
 		}
+#endif
+		copy_samples((state->input[i]) ? &state->input[i][buf_pos] : &state->output[i][buf_pos], 1, (in) ? &in[iframes * stride] : NULL, stride, n);
+		iframes += n;
+		buf_pos += n;
 
-		if (state->buf_pos == state->len) {
-			for (i = 0; i < e->ostream.channels; ++i) {
-				if (state->input[i]) {
-					fftw_execute(state->r2c_plan[i]);
-					for (k = 0; k < state->fr_len; ++k)
-						state->tmp_fr[k] *= state->filter_fr[i][k];
-					fftw_execute(state->c2r_plan[i]);
-					for (k = 0; k < state->len * 2; ++k)
-						state->output[i][k] /= state->len * 2;
-					for (k = 0; k < state->len; ++k) {
-						state->output[i][k] += state->overlap[i][k];
-						state->overlap[i][k] = state->output[i][k + state->len];
-					}
+		if (buf_pos == state->len) {
+			if (state->input[i]) {
+				FFTW(execute)(state->r2c_plan[i]);
+				for (k = 0; k < state->fr_len; ++k)
+					state->tmp_fr[i][k] *= state->filter_fr[i][k];
+				FFTW(execute)(state->c2r_plan[i]);
+				for (k = 0; k < state->len * 2; ++k)
+					state->output[i][k] /= state->len * 2;
+				for (k = 0; k < state->len; ++k) {
+					state->output[i][k] += state->overlap[i][k];
+					state->overlap[i][k] = state->output[i][k + state->len];
 				}
 			}
-			state->buf_pos = 0;
-			state->has_output = 1;
+			buf_pos = 0;
+			has_output = 1;
 		}
 	}
+	return oframes;
+}
+
+sample_t * fir_effect_run_ch(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf, int start, int end)
+{
+	struct fir_state *state = (struct fir_state *) e->data;
+	ssize_t oframes = 0;
+	int i;
+	for (i = start; i < end; ++i)
+		oframes = fir_run_channel(state, i, *frames, (ibuf) ? &ibuf[i] : NULL, &obuf[i], e->ostream.channels);
 	*frames = oframes;
 	return obuf;
 }
 
+void fir_effect_run_ch_commit(struct effect *e, ssize_t frames)
+{
+	struct fir_state *state = (struct fir_state *) e->data;
+	if (state->buf_pos + frames >= state->len)
+		state->has_output = 1;
+	state->buf_pos = (state->buf_pos + frames) % state->len;
+}
+
+/* Interleaved; only used for draining */
+static sample_t * fir_effect_run(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf)
+{
+	ssize_t in_frames = *frames;
+	fir_effect_run_ch(e, frames, ibuf, obuf, 0, e->ostream.channels);
+	fir_effect_run_ch_commit(e, in_frames);
+	return obuf;
+}
+
+sample_t * fir_effect_run_planar(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf)
+{
+	struct fir_state *state = (struct fir_state *) e->data;
+	ssize_t in_frames = *frames, out_frames = *frames;
+	int i;
+#ifndef SYMMETRIC_IO
+	if (!state->has_output)
+		out_frames = MAXIMUM(in_frames - (state->len - state->buf_pos), 0);
+#endif
+	for (i = 0; i < e->ostream.channels; ++i)
+		fir_run_channel(state, i, in_frames, &ibuf[i * in_frames], &obuf[i * out_frames], 1);
+	fir_effect_run_ch_commit(e, in_frames);
+	*frames = out_frames;
+	return obuf;
+}
+
 ssize_t fir_effect_delay(struct effect *e)
 {
 	struct fir_state *state = (struct fir_state *) e->data;
@@ -113,20 +148,21 @@ void fir_effect_destroy(struct effect *e)
 	int i;
 	struct fir_state *state = (struct fir_state *) e->data;
 	for (i = 0; i < e->ostream.channels; ++i) {
-		fftw_free(state->input[i]);
-		fftw_free(state->output[i]);
-		fftw_free(state->overlap[i]);
-		fftw_free(state->filter_fr[i]);
-		fftw_destroy_plan(state->r2c_plan[i]);
-		fftw_destroy_plan(state->c2r_plan[i]);
+		FFTW(free)(state->input[i]);
+		FFTW(free)(state->output[i]);
+		FFTW(free)(state->overlap[i]);
+		FFTW(free)(state->tmp_fr[i]);
+		fftw_cache_destroy_plan(state->r2c_plan[i]);
+		fftw_cache_destroy_plan(state->c2r_plan[i]);
 	}
 	free(state->input);
 	free(state->output);
 	free(state->overlap);
 	free(state->filter_fr);
-	fftw_free(state->tmp_fr);
+	free(state->tmp_fr);
 	free(state->r2c_plan);
 	free(state->c2r_plan);
+	fftw_cache_release_spectra(state->spectra);
 	free(state);
 }
 
@@ -136,9 +172,10 @@ struct effect * fir_effect_init(struct effect_info *ei, struct stream_info *istr
 	struct effect *e;
 	struct fir_state *state;
 	struct codec *c_filter;
-	sample_t *tmp_buf = NULL, *filter;
-	char *p;
-	fftw_plan filter_plan;
+	sample_t *tmp_buf, *filter;
+	char *p, id[128];
+	FFTW(complex) *filter_fr, *spectra;
+	FFTW(plan) filter_plan;
 
 	if (argc != 2) {
 		LOG_FMT(LL_ERROR, "%s: usage: %s", argv[0], ei->usage);
@@ -154,20 +191,22 @@ struct effect * fir_effect_init(struct effect_info *ei, struct stream_info *istr
 		free(p);
 		return NULL;
 	}
-	free(p);
 	if (c_filter->channels != 1 && c_filter->channels != n_channels) {
 		LOG_FMT(LL_ERROR, "%s: error: channel mismatch: channels=%d impulse_channels=%d", argv[0], n_channels, c_filter->channels);
 		destroy_codec(c_filter);
+		free(p);
 		return NULL;
 	}
 	if (c_filter->fs != istream->fs) {
 		LOG_FMT(LL_ERROR, "%s: error: sample rate mismatch: fs=%d impulse_fs=%d", argv[0], istream->fs, c_filter->fs);
 		destroy_codec(c_filter);
+		free(p);
 		return NULL;
 	}
 	if (c_filter->frames < 1) {
 		LOG_FMT(LL_ERROR, "%s: error: impulse length must be >= 1", argv[0]);
 		destroy_codec(c_filter);
+		free(p);
 		return NULL;
 	}
 	LOG_FMT(LL_VERBOSE, "%s: info: filter_frames=%zd", argv[0], c_filter->frames);
@@ -176,7 +215,9 @@ struct effect * fir_effect_init(struct effect_info *ei, struct stream_info *istr
 	e->name = ei->name;
 	e->istream.fs = e->ostream.fs = istream->fs;
 	e->istream.channels = e->ostream.channels = istream->channels;
-	e->run = fir_effect_run;
+	e->run_planar = fir_effect_run_planar;
+	e->run_ch = fir_effect_run_ch;
+	e->run_ch_commit = fir_effect_run_ch_commit;
 	e->delay = fir_effect_delay;
 	e->reset = fir_effect_reset;
 	e->drain = fir_effect_drain;
@@ -187,52 +228,61 @@ struct effect * fir_effect_init(struct effect_info *ei, struct stream_info *istr
 
 	state->len = c_filter->frames;
 	state->fr_len = state->len + 1;
-	state->tmp_fr = fftw_malloc(state->fr_len * sizeof(fftw_complex));
+	state->tmp_fr = calloc(e->ostream.channels, sizeof(FFTW(complex) *));
 	state->input = calloc(e->ostream.channels, sizeof(sample_t *));
 	state->output = calloc(e->ostream.channels, sizeof(sample_t *));
 	state->overlap = calloc(e->ostream.channels, sizeof(sample_t *));
-	state->filter_fr = calloc(e->ostream.channels, sizeof(fftw_complex *));
-	state->r2c_plan = calloc(e->ostream.channels, sizeof(fftw_plan));
-	state->c2r_plan = calloc(e->ostream.channels, sizeof(fftw_plan));
-	filter = fftw_malloc(state->len * 2 * sizeof(sample_t));
-	memset(filter, 0, state->len * 2 * sizeof(sample_t));
-	filter_plan = fftw_plan_dft_r2c_1d(state->len * 2, filter, state->tmp_fr, FFTW_ESTIMATE);
-	if (c_filter->channels == 1) {
-		if (c_filter->read(c_filter, filter, state->len) != state->len)
-			LOG_FMT(LL_ERROR, "%s: warning: short read", argv[0]);
-		fftw_execute(filter_plan);
+	state->filter_fr = calloc(e->ostream.channels, sizeof(const FFTW(complex) *));
+	state->r2c_plan = calloc(e->ostream.channels, sizeof(FFTW(plan)));
+	state->c2r_plan = calloc(e->ostream.channels, sizeof(FFTW(plan)));
+	for (i = 0; i < e->ostream.channels; ++i) {
+		state->output[i] = FFTW(malloc)(state->len * 2 * sizeof(sample_t));
+		if (GET_BIT(channel_selector, i)) {
+			state->input[i] = FFTW(malloc)(state->len * 2 * sizeof(sample_t));
+			state->overlap[i] = FFTW(malloc)(state->len * sizeof(sample_t));
+			memset(state->overlap[i], 0, state->len * sizeof(sample_t));
+			state->tmp_fr[i] = FFTW(malloc)(state->fr_len * sizeof(FFTW(complex)));
+			state->r2c_plan[i] = fftw_cache_plan_r2c(state->len * 2, state->input[i], state->tmp_fr[i]);
+			state->c2r_plan[i] = fftw_cache_plan_c2r(state->len * 2, state->tmp_fr[i], state->output[i]);
+			memset(state->input[i], 0, state->len * 2 * sizeof(sample_t));
+		}
+		memset(state->output[i], 0, state->len * 2 * sizeof(sample_t));
 	}
-	else {
-		tmp_buf = calloc(c_filter->frames * c_filter->channels, sizeof(sample_t));
-		if (c_filter->read(c_filter, tmp_buf, state->len) != state->len)
-			LOG_FMT(LL_ERROR, "%s: warning: short read", argv[0]);
+	fftw_cache_save_wisdom();
+
+	/* one spectrum per impulse channel */
+	snprintf(id, sizeof(id), "fir:fs=%d:channels=%d:len=%zd", istream->fs, n_channels, state->len);
+	tmp_buf = calloc(c_filter->frames * c_filter->channels, sizeof(sample_t));
+	if (c_filter->read(c_filter, tmp_buf, state->len) != state->len)
+		LOG_FMT(LL_ERROR, "%s: warning: short read", argv[0]);
+	state->spectra = fftw_cache_load_spectra(tmp_buf, state->len * c_filter->channels, id, state->fr_len * c_filter->channels);
+	if (state->spectra == NULL) {
+		spectra = FFTW(malloc)(state->fr_len * c_filter->channels * sizeof(FFTW(complex)));
+		filter = FFTW(malloc)(state->len * 2 * sizeof(sample_t));
+		memset(filter, 0, state->len * 2 * sizeof(sample_t));
+		filter_fr = FFTW(malloc)(state->fr_len * sizeof(FFTW(complex)));
+		filter_plan = fftw_cache_plan_estimate(state->len * 2, filter, filter_fr);
+		for (k = 0; k < c_filter->channels; ++k) {
+			for (j = 0; j < state->len; ++j)
+				filter[j] = tmp_buf[j * c_filter->channels + k];
+			FFTW(execute)(filter_plan);
+			memcpy(&spectra[k * state->fr_len], filter_fr, state->fr_len * sizeof(FFTW(complex)));
+		}
+		state->spectra = fftw_cache_store_spectra(tmp_buf, state->len * c_filter->channels, id, spectra, state->fr_len * c_filter->channels);
+		fftw_cache_destroy_plan(filter_plan);
+		FFTW(free)(filter);
+		FFTW(free)(filter_fr);
 	}
+	free(tmp_buf);
 	for (i = k = 0; i < e->ostream.channels; ++i) {
-		state->output[i] = fftw_malloc(state->len * 2 * sizeof(sample_t));
-		memset(state->output[i], 0, state->len * 2 * sizeof(sample_t));
 		if (GET_BIT(channel_selector, i)) {
-			state->input[i] = fftw_malloc(state->len * 2 * sizeof(sample_t));
-			memset(state->input[i], 0, state->len * 2 * sizeof(sample_t));
-			state->overlap[i] = fftw_malloc(state->len * sizeof(sample_t));
-			memset(state->overlap[i], 0, state->len * sizeof(sample_t));
-			state->filter_fr[i] = fftw_malloc(state->fr_len * sizeof(fftw_complex));
-			state->r2c_plan[i] = fftw_plan_dft_r2c_1d(state->len * 2, state->input[i], state->tmp_fr, FFTW_ESTIMATE);
-			state->c2r_plan[i] = fftw_plan_dft_c2r_1d(state->len * 2, state->tmp_fr, state->output[i], FFTW_ESTIMATE);
-			if (c_filter->channels == 1)
-				memcpy(state->filter_fr[i], state->tmp_fr, state->fr_len * sizeof(fftw_complex));
-			else {
-				for (j = 0; j < state->len; ++j)
-					filter[j] = tmp_buf[j * c_filter->channels + k];
-				fftw_execute(filter_plan);
-				memcpy(state->filter_fr[i], state->tmp_fr, state->fr_len * sizeof(fftw_complex));
+			state->filter_fr[i] = &state->spectra[k * state->fr_len];
+			if (c_filter->channels > 1)
 				++k;
-			}
 		}
 	}
 	destroy_codec(c_filter);
-	fftw_destroy_plan(filter_plan);
-	free(tmp_buf);
-	fftw_free(filter);
+	free(p);
 
 	return e;
 }
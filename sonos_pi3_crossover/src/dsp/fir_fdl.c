@@ -0,0 +1,361 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+#include <complex.h>
+#include <fftw3.h>
+#include "fir_fdl.h"
+#include "util.h"
+#include "codec.h"
+#include "fftw_cache.h"
+
+/* Uniformly partitioned overlap-save convolution with a frequency-domain
+   delay line (FDL). The impulse is split into nparts partitions of part_len
+   frames. Each block of part_len input frames is transformed once and stored
+   in the FDL. The spectra of the last nparts blocks are multiplied with the
+   partition spectra and summed, and one inverse transform yields the output
+   block. */
+
+#define MIN_PART_LEN 16
+#define MAX_PART_LEN (1 << 20)
+
+#define DEFAULT_PART_LEN 1024
+
+struct fir_fdl_state {
+	ssize_t part_len, nparts, fr_len, fr_stride, impulse_len, buf_pos, fdl_pos, drain_pos, drain_frames;
+	const FFTW(complex) *spectra, **filter_fr;  /* filter_fr[i] points into the shared spectra */
+	FFTW(complex) **fdl, **acc;
+	sample_t **input, **output, **tmp;
+	FFTW(plan) r2c_plan, c2r_plan;
+	int has_output, is_draining;
+};
+
+/* acc[k] (+)= x[k] * h[k]. Written out on real and imaginary parts since
+   complex multiplication in C checks for NaN/Inf results. */
+static void fdl_mac(FFTW(complex) *restrict acc, const FFTW(complex) *restrict x, const FFTW(complex) *restrict h, ssize_t n, int add)
+{
+	ssize_t k;
+	sample_t *a = (sample_t *) acc;
+	const sample_t *xs = (const sample_t *) x, *hs = (const sample_t *) h;
+	if (add) {
+		for (k = 0; k < n * 2; k += 2) {
+			a[k] += xs[k] * hs[k] - xs[k + 1] * hs[k + 1];
+			a[k + 1] += xs[k] * hs[k + 1] + xs[k + 1] * hs[k];
+		}
+	}
+	else {
+		for (k = 0; k < n * 2; k += 2) {
+			a[k] = xs[k] * hs[k] - xs[k + 1] * hs[k + 1];
+			a[k + 1] = xs[k] * hs[k + 1] + xs[k + 1] * hs[k];
+		}
+	}
+}
+
+static void fir_fdl_process_block(struct fir_fdl_state *state, int i, ssize_t fdl_pos)
+{
+	ssize_t p, slot;
+	FFTW(execute_dft_r2c)(state->r2c_plan, state->input[i], &state->fdl[i][fdl_pos * state->fr_stride]);
+	for (p = 0, slot = fdl_pos; p < state->nparts; ++p) {
+		fdl_mac(state->acc[i], &state->fdl[i][slot * state->fr_stride], &state->filter_fr[i][p * state->fr_stride], state->fr_len, p > 0);
+		slot = (slot == 0) ? state->nparts - 1 : slot - 1;
+	}
+	FFTW(execute_dft_c2r)(state->c2r_plan, state->acc[i], state->tmp[i]);
+	/* the filter spectra are prescaled, so the second half is the output */
+	memcpy(state->output[i], &state->tmp[i][state->part_len], state->part_len * sizeof(sample_t));
+	memmove(state->input[i], &state->input[i][state->part_len], state->part_len * sizeof(sample_t));
+}
+
+/* Runs channel i. in and out point to the channel's first sample and successive frames are stride samples apart. */
+static ssize_t fir_fdl_run_channel(struct fir_fdl_state *state, int i, ssize_t frames, const sample_t *in, sample_t *out, ssize_t stride)
+{
+	ssize_t n, iframes = 0, oframes = 0, buf_pos = state->buf_pos, fdl_pos = state->fdl_pos;
+	int has_output = state->has_output;
+
+	while (iframes < frames) {
+		n = MINIMUM(state->part_len - buf_pos, frames - iframes);
+#ifdef SYMMETRIC_IO
+		copy_samples(&out[oframes * stride], stride, (has_output) ? &state->output[i][buf_pos] : NULL, 1, n);
+		oframes += n;
+#else
+		if (has_output) {
+			copy_samples(&out[oframes * stride], stride, &state->output[i][buf_pos], 1, n);
+			oframes += n;
+		}
+#endif
+		copy_samples((state->input[i]) ? &state->input[i][state->part_len + buf_pos] : &state->output[i][buf_pos], 1, (in) ? &in[iframes * stride] : NULL, stride, n);
+		iframes += n;
+		buf_pos += n;
+
+		if (buf_pos == state->part_len) {
+			if (state->input[i])
+				fir_fdl_process_block(state, i, fdl_pos);
+			fdl_pos = (fdl_pos + 1) % state->nparts;
+			buf_pos = 0;
+			has_output = 1;
+		}
+	}
+	return oframes;
+}
+
+sample_t * fir_fdl_effect_run_ch(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf, int start, int end)
+{
+	struct fir_fdl_state *state = (struct fir_fdl_state *) e->data;
+	ssize_t oframes = 0;
+	int i;
+	for (i = start; i < end; ++i)
+		oframes = fir_fdl_run_channel(state, i, *frames, (ibuf) ? &ibuf[i] : NULL, &obuf[i], e->ostream.channels);
+	*frames = oframes;
+	return obuf;
+}
+
+void fir_fdl_effect_run_ch_commit(struct effect *e, ssize_t frames)
+{
+	struct fir_fdl_state *state = (struct fir_fdl_state *) e->data;
+	ssize_t blocks = (state->buf_pos + frames) / state->part_len;
+	if (blocks > 0)
+		state->has_output = 1;
+	state->fdl_pos = (state->fdl_pos + blocks) % state->nparts;
+	state->buf_pos = (state->buf_pos + frames) % state->part_len;
+}
+
+/* Interleaved; only used for draining */
+static sample_t * fir_fdl_effect_run(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf)
+{
+	ssize_t in_frames = *frames;
+	fir_fdl_effect_run_ch(e, frames, ibuf, obuf, 0, e->ostream.channels);
+	fir_fdl_effect_run_ch_commit(e, in_frames);
+	return obuf;
+}
+
+sample_t * fir_fdl_effect_run_planar(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf)
+{
+	struct fir_fdl_state *state = (struct fir_fdl_state *) e->data;
+	ssize_t in_frames = *frames, out_frames = *frames;
+	int i;
+#ifndef SYMMETRIC_IO
+	if (!state->has_output)
+		out_frames = MAXIMUM(in_frames - (state->part_len - state->buf_pos), 0);
+#endif
+	for (i = 0; i < e->ostream.channels; ++i)
+		fir_fdl_run_channel(state, i, in_frames, &ibuf[i * in_frames], &obuf[i * out_frames], 1);
+	fir_fdl_effect_run_ch_commit(e, in_frames);
+	*frames = out_frames;
+	return obuf;
+}
+
+ssize_t fir_fdl_effect_delay(struct effect *e)
+{
+	struct fir_fdl_state *state = (struct fir_fdl_state *) e->data;
+	return (state->has_output) ? state->part_len : state->buf_pos;
+}
+
+void fir_fdl_effect_reset(struct effect *e)
+{
+	int i;
+	struct fir_fdl_state *state = (struct fir_fdl_state *) e->data;
+	state->buf_pos = 0;
+	state->fdl_pos = 0;
+	state->has_output = 0;
+	for (i = 0; i < e->ostream.channels; ++i) {
+		memset(state->output[i], 0, state->part_len * sizeof(sample_t));
+		if (state->input[i]) {
+			memset(state->input[i], 0, state->part_len * 2 * sizeof(sample_t));
+			memset(state->fdl[i], 0, state->nparts * state->fr_stride * sizeof(FFTW(complex)));
+		}
+	}
+}
+
+void fir_fdl_effect_drain(struct effect *e, ssize_t *frames, sample_t *obuf)
+{
+	struct fir_fdl_state *state = (struct fir_fdl_state *) e->data;
+	if (!state->has_output && state->buf_pos == 0)
+		*frames = -1;
+	else {
+		if (!state->is_draining) {
+			state->drain_frames = state->impulse_len;
+			if (state->has_output)
+				state->drain_frames += state->part_len - state->buf_pos;
+			state->drain_frames += state->buf_pos;
+			state->is_draining = 1;
+		}
+		if (state->drain_pos < state->drain_frames) {
+			fir_fdl_effect_run(e, frames, NULL, obuf);
+			state->drain_pos += *frames;
+			*frames -= (state->drain_pos > state->drain_frames) ? state->drain_pos - state->drain_frames : 0;
+		}
+		else
+			*frames = -1;
+	}
+}
+
+void fir_fdl_effect_destroy(struct effect *e)
+{
+	int i;
+	struct fir_fdl_state *state = (struct fir_fdl_state *) e->data;
+	for (i = 0; i < e->ostream.channels; ++i) {
+		FFTW(free)(state->input[i]);
+		FFTW(free)(state->output[i]);
+		FFTW(free)(state->tmp[i]);
+		FFTW(free)(state->fdl[i]);
+		FFTW(free)(state->acc[i]);
+	}
+	free(state->input);
+	free(state->output);
+	free(state->tmp);
+	free(state->filter_fr);
+	free(state->fdl);
+	free(state->acc);
+	fftw_cache_destroy_plan(state->r2c_plan);
+	fftw_cache_destroy_plan(state->c2r_plan);
+	fftw_cache_release_spectra(state->spectra);
+	free(state);
+}
+
+struct effect * fir_fdl_effect_init(struct effect_info *ei, struct stream_info *istream, char *channel_selector, const char *dir, int argc, char **argv)
+{
+	int i, k, n_channels;
+	ssize_t j, p, part_len = 0;
+	struct effect *e;
+	struct fir_fdl_state *state;
+	struct codec *c_filter;
+	size_t n_spectra;
+	sample_t *tmp_buf, *filter;
+	char *endptr, *path, id[128];
+	FFTW(complex) *filter_fr, *spectra;
+
+	if (argc > 3 || argc < 2) {
+		LOG_FMT(LL_ERROR, "%s: usage: %s", argv[0], ei->usage);
+		return NULL;
+	}
+	if (argc > 2) {
+		part_len = strtol(argv[1], &endptr, 10);
+		CHECK_ENDPTR(argv[1], endptr, "part_len", return NULL);
+	}
+	part_len = (part_len == 0) ? DEFAULT_PART_LEN : part_len;
+	if (!IS_POWER_OF_2(part_len)) {
+		LOG_FMT(LL_ERROR, "%s: error: partition length must be a power of 2", argv[0]);
+		return NULL;
+	}
+	if (part_len < MIN_PART_LEN || part_len > MAX_PART_LEN) {
+		LOG_FMT(LL_ERROR, "%s: error: partition length must be within [%d,%d] or 0 for default", argv[0], MIN_PART_LEN, MAX_PART_LEN);
+		return NULL;
+	}
+
+	for (i = n_channels = 0; i < istream->channels; ++i)
+		if (GET_BIT(channel_selector, i))
+			++n_channels;
+	path = construct_full_path(dir, argv[argc - 1]);
+	c_filter = init_codec(path, NULL, NULL, istream->fs, n_channels, CODEC_ENDIAN_DEFAULT, CODEC_MODE_READ);
+	if (c_filter == NULL) {
+		LOG_FMT(LL_ERROR, "%s: error: failed to open impulse file: %s", argv[0], path);
+		free(path);
+		return NULL;
+	}
+	if (c_filter->channels != 1 && c_filter->channels != n_channels) {
+		LOG_FMT(LL_ERROR, "%s: error: channel mismatch: channels=%d impulse_channels=%d", argv[0], n_channels, c_filter->channels);
+		destroy_codec(c_filter);
+		free(path);
+		return NULL;
+	}
+	if (c_filter->fs != istream->fs) {
+		LOG_FMT(LL_ERROR, "%s: error: sample rate mismatch: fs=%d impulse_fs=%d", argv[0], istream->fs, c_filter->fs);
+		destroy_codec(c_filter);
+		free(path);
+		return NULL;
+	}
+	if (c_filter->frames < 1) {
+		LOG_FMT(LL_ERROR, "%s: error: impulse length must be >= 1", argv[0]);
+		destroy_codec(c_filter);
+		free(path);
+		return NULL;
+	}
+
+	e = calloc(1, sizeof(struct effect));
+	e->name = ei->name;
+	e->istream.fs = e->ostream.fs = istream->fs;
+	e->istream.channels = e->ostream.channels = istream->channels;
+	e->run_planar = fir_fdl_effect_run_planar;
+	e->run_ch = fir_fdl_effect_run_ch;
+	e->run_ch_commit = fir_fdl_effect_run_ch_commit;
+	e->delay = fir_fdl_effect_delay;
+	e->reset = fir_fdl_effect_reset;
+	e->drain = fir_fdl_effect_drain;
+	e->destroy = fir_fdl_effect_destroy;
+
+	state = calloc(1, sizeof(struct fir_fdl_state));
+	e->data = state;
+
+	state->impulse_len = c_filter->frames;
+	state->part_len = part_len;
+	state->nparts = (c_filter->frames + part_len - 1) / part_len;
+	state->fr_len = part_len + 1;
+	/* keep every spectrum in the delay line as aligned as the first one so the plans can be reused */
+	state->fr_stride = (state->fr_len + 3) & ~((ssize_t) 3);
+	LOG_FMT(LL_VERBOSE, "%s: info: filter_frames=%zd part_len=%zd nparts=%zd", argv[0], c_filter->frames, state->part_len, state->nparts);
+
+	state->input = calloc(e->ostream.channels, sizeof(sample_t *));
+	state->output = calloc(e->ostream.channels, sizeof(sample_t *));
+	state->tmp = calloc(e->ostream.channels, sizeof(sample_t *));
+	state->filter_fr = calloc(e->ostream.channels, sizeof(const FFTW(complex) *));
+	state->fdl = calloc(e->ostream.channels, sizeof(FFTW(complex) *));
+	state->acc = calloc(e->ostream.channels, sizeof(FFTW(complex) *));
+
+	filter = FFTW(malloc)(part_len * 2 * sizeof(sample_t));
+	filter_fr = FFTW(malloc)(state->fr_len * sizeof(FFTW(complex)));
+	state->r2c_plan = fftw_cache_plan_r2c(part_len * 2, filter, filter_fr);
+	for (i = 0; i < e->ostream.channels; ++i) {
+		state->output[i] = FFTW(malloc)(part_len * sizeof(sample_t));
+		memset(state->output[i], 0, part_len * sizeof(sample_t));
+		if (GET_BIT(channel_selector, i)) {
+			state->input[i] = FFTW(malloc)(part_len * 2 * sizeof(sample_t));
+			memset(state->input[i], 0, part_len * 2 * sizeof(sample_t));
+			state->tmp[i] = FFTW(malloc)(part_len * 2 * sizeof(sample_t));
+			state->fdl[i] = FFTW(malloc)(state->nparts * state->fr_stride * sizeof(FFTW(complex)));
+			memset(state->fdl[i], 0, state->nparts * state->fr_stride * sizeof(FFTW(complex)));
+			state->acc[i] = FFTW(malloc)(state->fr_stride * sizeof(FFTW(complex)));
+			if (state->c2r_plan == NULL)
+				state->c2r_plan = fftw_cache_plan_c2r(part_len * 2, state->acc[i], state->tmp[i]);
+		}
+	}
+	fftw_cache_save_wisdom();
+
+	/* one spectrum per impulse channel per partition, laid out like the FDL */
+	n_spectra = state->fr_stride * state->nparts * c_filter->channels;
+	snprintf(id, sizeof(id), "fir_fdl:fs=%d:channels=%d:frames=%zd:part_len=%zd", istream->fs, n_channels, c_filter->frames, part_len);
+	tmp_buf = calloc(c_filter->frames * c_filter->channels, sizeof(sample_t));
+	if (c_filter->read(c_filter, tmp_buf, c_filter->frames) != c_filter->frames)
+		LOG_FMT(LL_ERROR, "%s: warning: short read", argv[0]);
+	state->spectra = fftw_cache_load_spectra(tmp_buf, c_filter->frames * c_filter->channels, id, n_spectra);
+	if (state->spectra == NULL) {
+		spectra = FFTW(malloc)(n_spectra * sizeof(FFTW(complex)));
+		memset(spectra, 0, n_spectra * sizeof(FFTW(complex)));
+		for (k = 0; k < c_filter->channels; ++k) {
+			for (p = 0; p < state->nparts; ++p) {
+				/* overlap-save: each partition is placed in the first half of a zero-padded block */
+				memset(filter, 0, part_len * 2 * sizeof(sample_t));
+				for (j = 0; j < part_len && p * part_len + j < c_filter->frames; ++j)
+					filter[j] = tmp_buf[(p * part_len + j) * c_filter->channels + k];
+				FFTW(execute)(state->r2c_plan);
+				/* prescale by 1/N for the unnormalized inverse transform */
+				for (j = 0; j < state->fr_len; ++j)
+					spectra[(k * state->nparts + p) * state->fr_stride + j] = filter_fr[j] / (part_len * 2);
+			}
+		}
+		state->spectra = fftw_cache_store_spectra(tmp_buf, c_filter->frames * c_filter->channels, id, spectra, n_spectra);
+	}
+	free(tmp_buf);
+	for (i = k = 0; i < e->ostream.channels; ++i) {
+		if (GET_BIT(channel_selector, i)) {
+			state->filter_fr[i] = &state->spectra[k * state->nparts * state->fr_stride];
+			if (c_filter->channels > 1)
+				++k;
+		}
+	}
+	destroy_codec(c_filter);
+	free(path);
+	FFTW(free)(filter);
+	FFTW(free)(filter_fr);
+
+	return e;
+}
@@ -0,0 +1,9 @@
+#ifndef _FIR_FDL_H
+#define _FIR_FDL_H
+
+#include "dsp.h"
+#include "effect.h"
+
+struct effect * fir_fdl_effect_init(struct effect_info *, struct stream_info *, char *, const char *, int, char **);
+
+#endif
@@ -3,11 +3,15 @@
 #include <string.h>
 #include <math.h>
 #include <limits.h>
+#include <signal.h>
+#include <pthread.h>
 #include <complex.h>
 #include <fftw3.h>
 #include "fir_p.h"
 #include "util.h"
+#include "rt.h"
 #include "codec.h"
+#include "fftw_cache.h"
 
 #define MIN_PART_LEN 1
 #define MAX_PART_LEN INT_MAX
@@ -15,118 +19,264 @@
 
 #define DEFAULT_MIN_PART_LEN 16
 #define DEFAULT_MAX_PART_LEN 16384
+#define DEFAULT_ASYNC_PART_LEN 1024
+
+/* Partitions of at least async_part_len frames are convolved on worker
+   threads. The input of such a partition is taken one partition length
+   earlier than it would otherwise be, so the convolution of a block has a
+   full block period to complete. Pending jobs run earliest deadline first. */
+
+struct fir_p_state;
+
+struct fir_p_job {
+	struct fir_p_state *state;
+	int part, channel, busy;
+	ssize_t deadline;
+	sample_t *input, *output;
+	FFTW(complex) *tmp_fr;
+	struct fir_p_job *next;
+};
+
+struct fir_p_workers {
+	pthread_mutex_t lock;
+	pthread_cond_t work, done;
+	pthread_t *threads;
+	int n_threads, stop;
+	struct fir_p_job *head;  /* sorted by deadline */
+};
 
 struct partition {
 	ssize_t len, delay, in_pos, pos;
 	union {
 		struct {
 			ssize_t fr_len;
-			fftw_complex **filter_fr;
-			fftw_plan *r2c_plan, *c2r_plan;
+			const FFTW(complex) **filter_fr;  /* points into the shared spectra */
+			FFTW(plan) *r2c_plan, *c2r_plan;
 		} fft;
 		struct {
 			sample_t **filter;
 		} direct;
 	} m;
 	sample_t **input, **output, **overlap;
-	int has_output;
+	struct fir_p_job *jobs;  /* one per channel if is_async is set */
+	int has_output, is_async;
 };
 
 struct fir_p_state {
-	ssize_t nparts, in_len, in_pos, impulse_len, drain_frames, drain_pos;
-	fftw_complex *tmp_fr;
+	ssize_t nparts, in_len, in_pos, impulse_len, drain_frames, drain_pos, frame_pos;
+	FFTW(complex) **tmp_fr;
+	const FFTW(complex) *spectra;
 	sample_t **input;
 	struct partition *part;
+	struct fir_p_workers workers;
 	int is_draining;
 };
 
-sample_t * fir_p_effect_run(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf)
+static void fir_p_convolve(struct partition *part, int i, sample_t *input, sample_t *output, FFTW(complex) *tmp_fr)
 {
-	struct fir_p_state *state = (struct fir_p_state *) e->data;
-	ssize_t i, k, j, l, iframes = 0, oframes = 0;
-
-	while (iframes < *frames) {
-		while (state->part[0].pos < state->part[0].len && iframes < *frames) {
-			for (i = 0; i < e->ostream.channels; ++i) {
-				if (state->input[i])
-					state->input[i][state->in_pos] = (ibuf) ? ibuf[iframes * e->ostream.channels + i] : 0;
-				#ifdef __SYMMETRIC_IO__
-					obuf[oframes * e->ostream.channels + i] = 0;
-				#else
-					if (state->part[0].has_output)
-						obuf[oframes * e->ostream.channels + i] = 0;
-				#endif
+	ssize_t k;
+	FFTW(execute_dft_r2c)(part->m.fft.r2c_plan[i], input, tmp_fr);
+	for (k = 0; k < part->m.fft.fr_len; ++k)
+		tmp_fr[k] *= part->m.fft.filter_fr[i][k];
+	FFTW(execute_dft_c2r)(part->m.fft.c2r_plan[i], tmp_fr, output);
+	for (k = 0; k < part->len * 2; ++k)
+		output[k] /= part->len * 2;
+	for (k = 0; k < part->len; ++k) {
+		output[k] += part->overlap[i][k];
+		part->overlap[i][k] = output[k + part->len];
+	}
+}
+
+static void * fir_p_worker(void *arg)
+{
+	struct fir_p_workers *w = (struct fir_p_workers *) arg;
+	struct fir_p_job *job;
+	rt_thread_init(RT_THREAD_BACKGROUND);
+	pthread_mutex_lock(&w->lock);
+	while (!w->stop) {
+		if ((job = w->head) == NULL) {
+			pthread_cond_wait(&w->work, &w->lock);
+			continue;
+		}
+		w->head = job->next;
+		pthread_mutex_unlock(&w->lock);
+		fir_p_convolve(&job->state->part[job->part], job->channel, job->input, job->output, job->tmp_fr);
+		pthread_mutex_lock(&w->lock);
+		job->busy = 0;
+		pthread_cond_broadcast(&w->done);
+	}
+	pthread_mutex_unlock(&w->lock);
+	return NULL;
+}
+
+/* Waits for the previous block of partition j on channel i, makes its result
+   the current output, and queues the block that was just completed. The
+   result is needed one block period from now. */
+static void fir_p_submit_job(struct fir_p_state *state, int j, int i, ssize_t now)
+{
+	struct partition *part = &state->part[j];
+	struct fir_p_job *job = &part->jobs[i], **p;
+	sample_t *tmp;
+	pthread_mutex_lock(&state->workers.lock);
+	while (job->busy)
+		pthread_cond_wait(&state->workers.done, &state->workers.lock);
+	pthread_mutex_unlock(&state->workers.lock);
+
+	tmp = part->output[i];
+	part->output[i] = job->output;
+	job->output = tmp;
+	memcpy(job->input, part->input[i], part->len * sizeof(sample_t));
+	job->deadline = now + part->len;
+
+	pthread_mutex_lock(&state->workers.lock);
+	job->busy = 1;
+	for (p = &state->workers.head; *p != NULL && (*p)->deadline <= job->deadline; p = &(*p)->next);
+	job->next = *p;
+	*p = job;
+	pthread_cond_signal(&state->workers.work);
+	pthread_mutex_unlock(&state->workers.lock);
+}
+
+static void fir_p_wait_jobs(struct fir_p_state *state, int channels)
+{
+	int j, i;
+	pthread_mutex_lock(&state->workers.lock);
+	for (j = 0; j < state->nparts; ++j)
+		if (state->part[j].is_async)
+			for (i = 0; i < channels; ++i)
+				while (state->part[j].jobs[i].busy)
+					pthread_cond_wait(&state->workers.done, &state->workers.lock);
+	pthread_mutex_unlock(&state->workers.lock);
+}
+
+/* Runs channel i. in and out point to the channel's first sample and successive frames are stride samples apart. */
+static ssize_t fir_p_run_channel(struct fir_p_state *state, int i, ssize_t frames, const sample_t *in, sample_t *out, ssize_t stride)
+{
+	struct partition *part = state->part;
+	ssize_t k, j, l, iframes = 0, oframes = 0, in_pos = state->in_pos, pos[state->nparts], part_in_pos[state->nparts];
+	sample_t s;
+	#ifndef SYMMETRIC_IO
+		int has_output = part[0].has_output;
+	#endif
+
+	for (k = 0; k < state->nparts; ++k) {
+		pos[k] = part[k].pos;
+		part_in_pos[k] = part[k].in_pos;
+	}
+	while (iframes < frames) {
+		while (pos[0] < part[0].len && iframes < frames) {
+			if (state->input[i])
+				state->input[i][in_pos] = (in) ? in[iframes * stride] : 0;
+		#ifndef SYMMETRIC_IO
+			if (has_output) {
+		#endif
+				s = 0;
+				for (k = 0; k < state->nparts; ++k)
+					s += part[k].output[i][pos[k]];
+				out[oframes++ * stride] = s;
+		#ifndef SYMMETRIC_IO
 			}
-			for (k = 0; k < state->nparts; ++k) {
-				for (i = 0; i < e->ostream.channels; ++i) {
-					obuf[oframes * e->ostream.channels + i] += state->part[k].output[i][state->part[k].pos];
-					if (state->input[i])
-						state->part[k].input[i][state->part[k].pos] = state->input[i][state->part[k].in_pos];
-				}
+		#endif
+			if (state->input[i]) {
+				for (k = 0; k < state->nparts; ++k)
+					part[k].input[i][pos[k]] = state->input[i][part_in_pos[k]];
 			}
-			for (i = 0; i < e->ostream.channels; ++i)
-				if (!state->input[i])
-					state->part[0].output[i][state->part[0].pos] = (ibuf) ? ibuf[iframes * e->ostream.channels + i] : 0;
-			#ifdef __SYMMETRIC_IO__
-				++oframes;
-			#else
-				if (state->part[0].has_output)
-					++oframes;
-			#endif
+			else
+				part[0].output[i][pos[0]] = (in) ? in[iframes * stride] : 0;
 			++iframes;
-			if (++state->in_pos == state->in_len)
-				state->in_pos = 0;
+			if (++in_pos == state->in_len)
+				in_pos = 0;
 			for (k = 0; k < state->nparts; ++k) {
-				if (++state->part[k].in_pos == state->in_len)
-					state->part[k].in_pos = 0;
-				++state->part[k].pos;
+				if (++part_in_pos[k] == state->in_len)
+					part_in_pos[k] = 0;
+				++pos[k];
 			}
 		}
 
 		for (j = 0; j < state->nparts; ++j) {
-			if (state->part[j].pos == state->part[j].len) {
-				if (state->part[j].len > MAX_DIRECT_LEN) {
-					/* FFT convolution */
-					for (i = 0; i < e->ostream.channels; ++i) {
-						if (state->part[j].input[i]) {
-							/* FFT convolution */
-							fftw_execute(state->part[j].m.fft.r2c_plan[i]);
-							for (k = 0; k < state->part[j].m.fft.fr_len; ++k)
-								state->tmp_fr[k] *= state->part[j].m.fft.filter_fr[i][k];
-							fftw_execute(state->part[j].m.fft.c2r_plan[i]);
-							for (k = 0; k < state->part[j].len * 2; ++k)
-								state->part[j].output[i][k] /= state->part[j].len * 2;
-							for (k = 0; k < state->part[j].len; ++k) {
-								state->part[j].output[i][k] += state->part[j].overlap[i][k];
-								state->part[j].overlap[i][k] = state->part[j].output[i][k + state->part[j].len];
-							}
-						}
-					}
+			if (pos[j] == part[j].len) {
+				if (part[j].is_async) {
+					if (part[j].input[i])
+						fir_p_submit_job(state, j, i, state->frame_pos + iframes);
 				}
-				else {
-					/* Direct convolution */
-					for (i = 0; i < e->ostream.channels; ++i) {
-						if (state->part[j].input[i]) {
-							memset(state->part[j].output[i], 0, state->part[j].len * 2 * sizeof(sample_t));
-							for (k = 0; k < state->part[j].len; ++k)
-								for (l = 0; l < state->part[j].len; ++l)
-									state->part[j].output[i][k + l] += state->part[j].input[i][k] * state->part[j].m.direct.filter[i][l];
-							for (k = 0; k < state->part[j].len; ++k) {
-								state->part[j].output[i][k] += state->part[j].overlap[i][k];
-								state->part[j].overlap[i][k] = state->part[j].output[i][k + state->part[j].len];
-							}
+				else if (part[j].input[i]) {
+					if (part[j].len > MAX_DIRECT_LEN) {
+						/* FFT convolution */
+						fir_p_convolve(&part[j], i, part[j].input[i], part[j].output[i], state->tmp_fr[i]);
+					}
+					else {
+						/* Direct convolution */
+						memset(part[j].output[i], 0, part[j].len * 2 * sizeof(sample_t));
+						for (k = 0; k < part[j].len; ++k)
+							for (l = 0; l < part[j].len; ++l)
+								part[j].output[i][k + l] += part[j].input[i][k] * part[j].m.direct.filter[i][l];
+						for (k = 0; k < part[j].len; ++k) {
+							part[j].output[i][k] += part[j].overlap[i][k];
+							part[j].overlap[i][k] = part[j].output[i][k + part[j].len];
 						}
 					}
 				}
-				state->part[j].pos = 0;
-				state->part[j].has_output = 1;
+				pos[j] = 0;
+			#ifndef SYMMETRIC_IO
+				if (j == 0)
+					has_output = 1;
+			#endif
 			}
 		}
 	}
+	return oframes;
+}
+
+sample_t * fir_p_effect_run_ch(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf, int start, int end)
+{
+	struct fir_p_state *state = (struct fir_p_state *) e->data;
+	ssize_t oframes = 0;
+	int i;
+	for (i = start; i < end; ++i)
+		oframes = fir_p_run_channel(state, i, *frames, (ibuf) ? &ibuf[i] : NULL, &obuf[i], e->ostream.channels);
 	*frames = oframes;
 	return obuf;
 }
 
+void fir_p_effect_run_ch_commit(struct effect *e, ssize_t frames)
+{
+	int k;
+	struct fir_p_state *state = (struct fir_p_state *) e->data;
+	state->frame_pos += frames;
+	state->in_pos = (state->in_pos + frames) % state->in_len;
+	for (k = 0; k < state->nparts; ++k) {
+		state->part[k].in_pos = (state->part[k].in_pos + frames) % state->in_len;
+		if (state->part[k].pos + frames >= state->part[k].len)
+			state->part[k].has_output = 1;
+		state->part[k].pos = (state->part[k].pos + frames) % state->part[k].len;
+	}
+}
+
+/* Interleaved; only used for draining */
+static sample_t * fir_p_effect_run(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf)
+{
+	ssize_t in_frames = *frames;
+	fir_p_effect_run_ch(e, frames, ibuf, obuf, 0, e->ostream.channels);
+	fir_p_effect_run_ch_commit(e, in_frames);
+	return obuf;
+}
+
+sample_t * fir_p_effect_run_planar(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf)
+{
+	struct fir_p_state *state = (struct fir_p_state *) e->data;
+	ssize_t in_frames = *frames, out_frames = *frames;
+	int i;
+#ifndef SYMMETRIC_IO
+	if (!state->part[0].has_output)
+		out_frames = MAXIMUM(in_frames - (state->part[0].len - state->part[0].pos), 0);
+#endif
+	for (i = 0; i < e->ostream.channels; ++i)
+		fir_p_run_channel(state, i, in_frames, &ibuf[i * in_frames], &obuf[i * out_frames], 1);
+	fir_p_effect_run_ch_commit(e, in_frames);
+	*frames = out_frames;
+	return obuf;
+}
+
 ssize_t fir_p_effect_delay(struct effect *e)
 {
 	struct fir_p_state *state = (struct fir_p_state *) e->data;
@@ -137,6 +287,7 @@ void fir_p_effect_reset(struct effect *e)
 {
 	int i, k;
 	struct fir_p_state *state = (struct fir_p_state *) e->data;
+	fir_p_wait_jobs(state, e->ostream.channels);
 	for (i = 0; i < e->ostream.channels; ++i)
 		if (state->input[i])
 			memset(state->input[i], 0, state->in_len * sizeof(sample_t));
@@ -147,6 +298,8 @@ void fir_p_effect_reset(struct effect *e)
 			memset(state->part[k].output[i], 0, state->part[k].len * 2 * sizeof(sample_t));
 			if (state->part[k].overlap[i])
 				memset(state->part[k].overlap[i], 0, state->part[k].len * sizeof(sample_t));
+			if (state->part[k].is_async && state->part[k].jobs[i].output)
+				memset(state->part[k].jobs[i].output, 0, state->part[k].len * 2 * sizeof(sample_t));
 		}
 	}
 }
@@ -178,15 +331,31 @@ void fir_p_effect_destroy(struct effect *e)
 {
 	int i, k;
 	struct fir_p_state *state = (struct fir_p_state *) e->data;
+	if (state->workers.n_threads > 0) {
+		pthread_mutex_lock(&state->workers.lock);
+		state->workers.stop = 1;
+		pthread_cond_broadcast(&state->workers.work);
+		pthread_mutex_unlock(&state->workers.lock);
+		for (i = 0; i < state->workers.n_threads; ++i)
+			pthread_join(state->workers.threads[i], NULL);
+	}
+	free(state->workers.threads);
+	pthread_mutex_destroy(&state->workers.lock);
+	pthread_cond_destroy(&state->workers.work);
+	pthread_cond_destroy(&state->workers.done);
 	for (k = 0; k < state->nparts; ++k) {
 		for (i = 0; i < e->ostream.channels; ++i) {
-			fftw_free(state->part[k].input[i]);
-			fftw_free(state->part[k].output[i]);
-			fftw_free(state->part[k].overlap[i]);
+			if (state->part[k].is_async) {
+				FFTW(free)(state->part[k].jobs[i].input);
+				FFTW(free)(state->part[k].jobs[i].output);
+				FFTW(free)(state->part[k].jobs[i].tmp_fr);
+			}
+			FFTW(free)(state->part[k].input[i]);
+			FFTW(free)(state->part[k].output[i]);
+			FFTW(free)(state->part[k].overlap[i]);
 			if (state->part[k].len > MAX_DIRECT_LEN) {
-				fftw_free(state->part[k].m.fft.filter_fr[i]);
-				fftw_destroy_plan(state->part[k].m.fft.r2c_plan[i]);
-				fftw_destroy_plan(state->part[k].m.fft.c2r_plan[i]);
+				fftw_cache_destroy_plan(state->part[k].m.fft.r2c_plan[i]);
+				fftw_cache_destroy_plan(state->part[k].m.fft.c2r_plan[i]);
 			}
 			else {
 				free(state->part[k].m.direct.filter[i]);
@@ -195,6 +364,7 @@ void fir_p_effect_destroy(struct effect *e)
 		free(state->part[k].input);
 		free(state->part[k].output);
 		free(state->part[k].overlap);
+		free(state->part[k].jobs);
 		if (state->part[k].len > MAX_DIRECT_LEN) {
 			free(state->part[k].m.fft.filter_fr);
 			free(state->part[k].m.fft.r2c_plan);
@@ -204,26 +374,33 @@ void fir_p_effect_destroy(struct effect *e)
 			free(state->part[k].m.direct.filter);
 		}
 	}
-	for (i = 0; i < e->ostream.channels; ++i)
+	for (i = 0; i < e->ostream.channels; ++i) {
 		free(state->input[i]);
+		FFTW(free)(state->tmp_fr[i]);
+	}
 	free(state->input);
-	fftw_free(state->tmp_fr);
+	free(state->tmp_fr);
 	free(state->part);
+	fftw_cache_release_spectra(state->spectra);
 	free(state);
 }
 
 struct effect * fir_p_effect_init(struct effect_info *ei, struct stream_info *istream, char *channel_selector, const char *dir, int argc, char **argv)
 {
-	int i, k, j, n_channels;
-	ssize_t filter_pos = 0, delay = 0, max_delay = 0, min_part_len = 0, max_part_len = 0;
+	int i, k, j, l, n_channels, n_async_sizes = 0, err;
+	ssize_t filter_pos = 0, max_delay = 0, min_part_len = 0, max_part_len = 0, async_part_len = 0;
 	struct effect *e;
 	struct fir_p_state *state;
 	struct codec *c_filter;
+	size_t id_len, n_spectra = 0, s_pos;
 	sample_t *tmp_buf = NULL, *filter = NULL;
-	char *endptr, *p;
-	fftw_plan filter_plan;
+	char *endptr, *p, *id;
+	FFTW(complex) *filter_fr, *spectra;
+	FFTW(plan) filter_plan;
 
-	if (argc > 4 || argc < 2) {
+	sigset_t sigset, old_sigset;
+
+	if (argc > 5 || argc < 2) {
 		LOG_FMT(LL_ERROR, "%s: usage: %s", argv[0], ei->usage);
 		return NULL;
 	}
@@ -235,8 +412,17 @@ struct effect * fir_p_effect_init(struct effect_info *ei, struct stream_info *is
 		max_part_len = strtol(argv[2], &endptr, 10);
 		CHECK_ENDPTR(argv[2], endptr, "max_part_len", return NULL);
 	}
+	if (argc > 4) {
+		async_part_len = strtol(argv[3], &endptr, 10);
+		CHECK_ENDPTR(argv[3], endptr, "async_part_len", return NULL);
+	}
 	min_part_len = (min_part_len == 0) ? DEFAULT_MIN_PART_LEN : min_part_len;
 	max_part_len = (max_part_len == 0) ? DEFAULT_MAX_PART_LEN : max_part_len;
+	async_part_len = (async_part_len == 0) ? DEFAULT_ASYNC_PART_LEN : async_part_len;
+	if (async_part_len < 0) {
+		LOG_FMT(LL_ERROR, "%s: error: async_part_len must be positive or 0 for default", argv[0]);
+		return NULL;
+	}
 	if (!(IS_POWER_OF_2(min_part_len) && IS_POWER_OF_2(max_part_len))) {
 		LOG_FMT(LL_ERROR, "%s: error: partition lengths must be powers of 2", argv[0]);
 		return NULL;
@@ -260,20 +446,22 @@ struct effect * fir_p_effect_init(struct effect_info *ei, struct stream_info *is
 		free(p);
 		return NULL;
 	}
-	free(p);
 	if (c_filter->channels != 1 && c_filter->channels != n_channels) {
 		LOG_FMT(LL_ERROR, "%s: error: channel mismatch: channels=%d impulse_channels=%d", argv[0], n_channels, c_filter->channels);
 		destroy_codec(c_filter);
+		free(p);
 		return NULL;
 	}
 	if (c_filter->fs != istream->fs) {
 		LOG_FMT(LL_ERROR, "%s: error: sample rate mismatch: fs=%d impulse_fs=%d", argv[0], istream->fs, c_filter->fs);
 		destroy_codec(c_filter);
+		free(p);
 		return NULL;
 	}
 	if (c_filter->frames < 1) {
 		LOG_FMT(LL_ERROR, "%s: error: impulse length must be >= 1", argv[0]);
 		destroy_codec(c_filter);
+		free(p);
 		return NULL;
 	}
 	LOG_FMT(LL_VERBOSE, "%s: info: filter_frames=%zd", argv[0], c_filter->frames);
@@ -282,7 +470,9 @@ struct effect * fir_p_effect_init(struct effect_info *ei, struct stream_info *is
 	e->name = ei->name;
 	e->istream.fs = e->ostream.fs = istream->fs;
 	e->istream.channels = e->ostream.channels = istream->channels;
-	e->run = fir_p_effect_run;
+	e->run_planar = fir_p_effect_run_planar;
+	e->run_ch = fir_p_effect_run_ch;
+	e->run_ch_commit = fir_p_effect_run_ch_commit;
 	e->delay = fir_p_effect_delay;
 	e->reset = fir_p_effect_reset;
 	e->drain = fir_p_effect_drain;
@@ -301,96 +491,157 @@ struct effect * fir_p_effect_init(struct effect_info *ei, struct stream_info *is
 		state->part[i].overlap = calloc(e->ostream.channels, sizeof(sample_t *));
 		if (state->part[i].len > MAX_DIRECT_LEN) {
 			state->part[i].m.fft.fr_len = state->part[i].len + 1;
-			state->part[i].m.fft.filter_fr = calloc(e->ostream.channels, sizeof(fftw_complex *));
-			state->part[i].m.fft.r2c_plan = calloc(e->ostream.channels, sizeof(fftw_plan));
-			state->part[i].m.fft.c2r_plan = calloc(e->ostream.channels, sizeof(fftw_plan));
+			state->part[i].m.fft.filter_fr = calloc(e->ostream.channels, sizeof(const FFTW(complex) *));
+			state->part[i].m.fft.r2c_plan = calloc(e->ostream.channels, sizeof(FFTW(plan)));
+			state->part[i].m.fft.c2r_plan = calloc(e->ostream.channels, sizeof(FFTW(plan)));
 		}
 		else {
 			state->part[i].m.direct.filter = calloc(e->ostream.channels, sizeof(sample_t *));
 		}
-		state->part[i].delay = delay;
-		max_delay = MAXIMUM(delay, max_delay);
+		/* An async partition's result arrives one block late, so its input must be taken one block earlier */
+		state->part[i].is_async = (k >= async_part_len && k > MAX_DIRECT_LEN && j + state->part[0].len >= k * 2);
+		state->part[i].delay = j + state->part[0].len - k * ((state->part[i].is_async) ? 2 : 1);
+		max_delay = MAXIMUM(state->part[i].delay, max_delay);
+		if (state->part[i].is_async) {
+			state->part[i].jobs = calloc(e->ostream.channels, sizeof(struct fir_p_job));
+			for (l = 0; l < i && (!state->part[l].is_async || state->part[l].len != k); ++l);
+			if (l == i)
+				++n_async_sizes;
+		}
 		j += state->part[i].len;
-		if (k < max_part_len && j + k < c_filter->frames)
+		if (k < max_part_len && j + k < c_filter->frames && (k * 2 < async_part_len || k * 2 <= MAX_DIRECT_LEN || j + state->part[0].len >= k * 4))
 			k *= 2;
-		else
-			delay += state->part[i].len;
-		LOG_FMT(LL_VERBOSE, "%s: info: partition %d: len=%zd delay=%zd total=%d", argv[0], i, state->part[i].len, state->part[i].delay, j);
+		LOG_FMT(LL_VERBOSE, "%s: info: partition %d: len=%zd delay=%zd total=%d%s", argv[0], i, state->part[i].len, state->part[i].delay, j, (state->part[i].is_async) ? " async" : "");
 	}
 	state->in_len = max_delay + 1;
 	state->input = calloc(e->ostream.channels, sizeof(sample_t *));
+	state->tmp_fr = calloc(e->ostream.channels, sizeof(FFTW(complex) *));
 	for (i = 0; i < e->ostream.channels; ++i)
 		if (GET_BIT(channel_selector, i))
 			state->input[i] = calloc(state->in_len, sizeof(sample_t));
 	if (state->part[state->nparts - 1].len > MAX_DIRECT_LEN) {
-		filter = fftw_malloc(state->part[state->nparts - 1].len * 2 * sizeof(sample_t));
-		memset(filter, 0, state->part[state->nparts - 1].len * 2 * sizeof(sample_t));
-		state->tmp_fr = fftw_malloc(state->part[state->nparts - 1].m.fft.fr_len * sizeof(fftw_complex));
+		for (i = 0; i < e->ostream.channels; ++i)
+			if (GET_BIT(channel_selector, i))
+				state->tmp_fr[i] = FFTW(malloc)(state->part[state->nparts - 1].m.fft.fr_len * sizeof(FFTW(complex)));
 	}
-	tmp_buf = calloc(c_filter->frames * c_filter->channels, sizeof(sample_t));
-	if (c_filter->read(c_filter, tmp_buf, c_filter->frames) != c_filter->frames)
-		LOG_FMT(LL_ERROR, "%s: warning: short read", argv[0]);
-
 	for (k = 0; k < state->nparts; ++k) {
-		if (state->part[k].len > MAX_DIRECT_LEN) {
-			filter_plan = fftw_plan_dft_r2c_1d(state->part[k].len * 2, filter, state->tmp_fr, FFTW_ESTIMATE);
-			if (c_filter->channels == 1) {
-				if (filter_pos + state->part[k].len > c_filter->frames)
-					memcpy(filter, &tmp_buf[filter_pos], (c_filter->frames - filter_pos) * sizeof(sample_t));
-				else
-					memcpy(filter, &tmp_buf[filter_pos], state->part[k].len * sizeof(sample_t));
-				fftw_execute(filter_plan);
-			}
-		}
-		else
-			filter_plan = NULL;
 		for (i = 0; i < e->ostream.channels; ++i) {
-			state->part[k].output[i] = fftw_malloc(state->part[k].len * 2 * sizeof(sample_t));
-			memset(state->part[k].output[i], 0, state->part[k].len * 2 * sizeof(sample_t));
+			state->part[k].output[i] = FFTW(malloc)(state->part[k].len * 2 * sizeof(sample_t));
 			if (GET_BIT(channel_selector, i)) {
-				state->part[k].input[i] = fftw_malloc(state->part[k].len * 2 * sizeof(sample_t));
-				memset(state->part[k].input[i], 0, state->part[k].len * 2 * sizeof(sample_t));
-				state->part[k].overlap[i] = fftw_malloc(state->part[k].len * sizeof(sample_t));
+				state->part[k].input[i] = FFTW(malloc)(state->part[k].len * 2 * sizeof(sample_t));
+				state->part[k].overlap[i] = FFTW(malloc)(state->part[k].len * sizeof(sample_t));
 				memset(state->part[k].overlap[i], 0, state->part[k].len * sizeof(sample_t));
 				if (state->part[k].len > MAX_DIRECT_LEN) {
-					state->part[k].m.fft.filter_fr[i] = fftw_malloc(state->part[k].m.fft.fr_len * sizeof(fftw_complex));
-					state->part[k].m.fft.r2c_plan[i] = fftw_plan_dft_r2c_1d(state->part[k].len * 2, state->part[k].input[i], state->tmp_fr, FFTW_ESTIMATE);
-					state->part[k].m.fft.c2r_plan[i] = fftw_plan_dft_c2r_1d(state->part[k].len * 2, state->tmp_fr, state->part[k].output[i], FFTW_ESTIMATE);
-					if (c_filter->channels == 1)
-						memcpy(state->part[k].m.fft.filter_fr[i], state->tmp_fr, state->part[k].m.fft.fr_len * sizeof(fftw_complex));
-					else {
-						for (j = 0; j < state->part[k].len && j + filter_pos < c_filter->frames; ++j)
-							filter[j] = tmp_buf[(j + filter_pos) * c_filter->channels + i];
-						fftw_execute(filter_plan);
-						memcpy(state->part[k].m.fft.filter_fr[i], state->tmp_fr, state->part[k].m.fft.fr_len * sizeof(fftw_complex));
-					}
+					state->part[k].m.fft.r2c_plan[i] = fftw_cache_plan_r2c(state->part[k].len * 2, state->part[k].input[i], state->tmp_fr[i]);
+					state->part[k].m.fft.c2r_plan[i] = fftw_cache_plan_c2r(state->part[k].len * 2, state->tmp_fr[i], state->part[k].output[i]);
 				}
-				else {
+				else
 					state->part[k].m.direct.filter[i] = calloc(state->part[k].len, sizeof(sample_t));
-					if (c_filter->channels == 1) {
-						if (filter_pos + state->part[k].len > c_filter->frames)
-							memcpy(state->part[k].m.direct.filter[i], &tmp_buf[filter_pos], (c_filter->frames - filter_pos) * sizeof(sample_t));
-						else
-							memcpy(state->part[k].m.direct.filter[i], &tmp_buf[filter_pos], state->part[k].len * sizeof(sample_t));
-					}
-					else {
-						for (j = 0; j < state->part[k].len && j + filter_pos < c_filter->frames; ++j)
-							state->part[k].m.direct.filter[i][j] = tmp_buf[(j + filter_pos) * c_filter->channels + i];
-					}
+				memset(state->part[k].input[i], 0, state->part[k].len * 2 * sizeof(sample_t));
+				if (state->part[k].is_async) {
+					state->part[k].jobs[i].state = state;
+					state->part[k].jobs[i].part = k;
+					state->part[k].jobs[i].channel = i;
+					state->part[k].jobs[i].input = FFTW(malloc)(state->part[k].len * 2 * sizeof(sample_t));
+					memset(state->part[k].jobs[i].input, 0, state->part[k].len * 2 * sizeof(sample_t));
+					state->part[k].jobs[i].output = FFTW(malloc)(state->part[k].len * 2 * sizeof(sample_t));
+					memset(state->part[k].jobs[i].output, 0, state->part[k].len * 2 * sizeof(sample_t));
+					state->part[k].jobs[i].tmp_fr = FFTW(malloc)(state->part[k].m.fft.fr_len * sizeof(FFTW(complex)));
 				}
 			}
+			memset(state->part[k].output[i], 0, state->part[k].len * 2 * sizeof(sample_t));
 		}
-		if (state->part[k].len > MAX_DIRECT_LEN) {
-			fftw_destroy_plan(filter_plan);
+		state->part[k].in_pos = (state->part[k].delay == 0) ? 0 : state->in_len - state->part[k].delay;
+	}
+	fftw_cache_save_wisdom();
+
+	/* The spectra of all FFT partitions are cached in one block (one spectrum
+	   per impulse channel per partition) */
+	id_len = snprintf(NULL, 0, "fir_p:fs=%d:channels=%d:frames=%zd:parts=", istream->fs, n_channels, c_filter->frames);
+	id_len += state->nparts * 21 + 1;
+	id = calloc(id_len, sizeof(char));
+	j = snprintf(id, id_len, "fir_p:fs=%d:channels=%d:frames=%zd:parts=", istream->fs, n_channels, c_filter->frames);
+	for (k = 0; k < state->nparts; ++k) {
+		j += snprintf(&id[j], id_len - j, (k == 0) ? "%zd" : ",%zd", state->part[k].len);
+		if (state->part[k].len > MAX_DIRECT_LEN)
+			n_spectra += state->part[k].m.fft.fr_len * c_filter->channels;
+	}
+	tmp_buf = calloc(c_filter->frames * c_filter->channels, sizeof(sample_t));
+	if (c_filter->read(c_filter, tmp_buf, c_filter->frames) != c_filter->frames)
+		LOG_FMT(LL_ERROR, "%s: warning: short read", argv[0]);
+	if (n_spectra > 0)
+		state->spectra = fftw_cache_load_spectra(tmp_buf, c_filter->frames * c_filter->channels, id, n_spectra);
+
+	if (n_spectra > 0 && state->spectra == NULL) {
+		spectra = FFTW(malloc)(n_spectra * sizeof(FFTW(complex)));
+		filter = FFTW(malloc)(state->part[state->nparts - 1].len * 2 * sizeof(sample_t));
+		memset(filter, 0, state->part[state->nparts - 1].len * 2 * sizeof(sample_t));
+		filter_fr = FFTW(malloc)(state->part[state->nparts - 1].m.fft.fr_len * sizeof(FFTW(complex)));
+		for (k = 0, s_pos = 0; k < state->nparts; filter_pos += state->part[k].len, ++k) {
+			if (state->part[k].len <= MAX_DIRECT_LEN)
+				continue;
+			filter_plan = fftw_cache_plan_estimate(state->part[k].len * 2, filter, filter_fr);
+			for (l = 0; l < c_filter->channels; ++l) {
+				for (j = 0; j < state->part[k].len && j + filter_pos < c_filter->frames; ++j)
+					filter[j] = tmp_buf[(j + filter_pos) * c_filter->channels + l];
+				FFTW(execute)(filter_plan);
+				memcpy(&spectra[s_pos], filter_fr, state->part[k].m.fft.fr_len * sizeof(FFTW(complex)));
+				s_pos += state->part[k].m.fft.fr_len;
+			}
+			fftw_cache_destroy_plan(filter_plan);
 			memset(filter, 0, state->part[k].len * sizeof(sample_t));
 		}
-		filter_pos += state->part[k].len;
-		state->part[k].in_pos = (state->part[k].delay == 0) ? 0 : state->in_len - state->part[k].delay;
+		state->spectra = fftw_cache_store_spectra(tmp_buf, c_filter->frames * c_filter->channels, id, spectra, n_spectra);
+		FFTW(free)(filter);
+		FFTW(free)(filter_fr);
+	}
+
+	for (k = 0, s_pos = 0, filter_pos = 0; k < state->nparts; filter_pos += state->part[k].len, ++k) {
+		for (i = l = 0; i < e->ostream.channels; ++i) {
+			if (GET_BIT(channel_selector, i)) {
+				if (state->part[k].len > MAX_DIRECT_LEN)
+					state->part[k].m.fft.filter_fr[i] = &state->spectra[s_pos + l * state->part[k].m.fft.fr_len];
+				else {
+					for (j = 0; j < state->part[k].len && j + filter_pos < c_filter->frames; ++j)
+						state->part[k].m.direct.filter[i][j] = tmp_buf[(j + filter_pos) * c_filter->channels + l];
+				}
+				if (c_filter->channels > 1)
+					++l;
+			}
+		}
+		if (state->part[k].len > MAX_DIRECT_LEN)
+			s_pos += state->part[k].m.fft.fr_len * c_filter->channels;
 	}
 	state->impulse_len = c_filter->frames;
 	destroy_codec(c_filter);
 	free(tmp_buf);
-	fftw_free(filter);
+	free(id);
+	free(p);
+
+	pthread_mutex_init(&state->workers.lock, NULL);
+	pthread_cond_init(&state->workers.work, NULL);
+	pthread_cond_init(&state->workers.done, NULL);
+	if (n_async_sizes > 0) {
+		/* one worker per distinct async partition length */
+		LOG_FMT(LL_VERBOSE, "%s: info: starting %d worker thread(s)", argv[0], n_async_sizes);
+		state->workers.threads = calloc(n_async_sizes, sizeof(pthread_t));
+		/* signals are handled by the main thread */
+		sigfillset(&sigset);
+		pthread_sigmask(SIG_SETMASK, &sigset, &old_sigset);
+		for (i = 0; i < n_async_sizes; ++i) {
+			if ((err = pthread_create(&state->workers.threads[i], NULL, fir_p_worker, &state->workers)) != 0) {
+				LOG_FMT(LL_ERROR, "%s: error: failed to create worker thread: %s", argv[0], strerror(err));
+				break;
+			}
+			++state->workers.n_threads;
+		}
+		pthread_sigmask(SIG_SETMASK, &old_sigset, NULL);
+		if (state->workers.n_threads == 0) {
+			fir_p_effect_destroy(e);
+			free(e);
+			return NULL;
+		}
+	}
 
 	return e;
 }
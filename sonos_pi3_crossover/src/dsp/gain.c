@@ -4,16 +4,66 @@
 #include "gain.h"
 #include "util.h"
 
+/* Gain changes made through a control are ramped over this long */
+#define GAIN_CTL_RAMP_MS  20
+#define GAIN_CTL_MIN_DB   -120.0
+#define GAIN_CTL_MAX_DB   40.0
+#define GAIN_CTL_MAX_MULT 100.0
+
 struct gain_state {
 	int channel;
 	sample_t v;
+	sample_t target, step;  /* while ramping: v is the gain at the start of the block */
+	ssize_t ramp;           /* frames left in the ramp */
 };
 
+struct gain_ctl_update {
+	struct effect_ctl_update u;
+	sample_t v;
+};
+
+static __inline__ int gain_selected(struct effect *e, struct gain_state *state, int k)
+{
+	return (state->channel == -1) ? GET_BIT(e->channel_selector, k) : k == state->channel;
+}
+
+/* Sample (frame i, channel k) is at buf[i * frame_stride + k * channel_stride] */
+static void gain_ramp_run(struct effect *e, ssize_t frames, sample_t *buf, ssize_t frame_stride, ssize_t channel_stride, int start, int end)
+{
+	ssize_t i;
+	int k;
+	sample_t *p;
+	struct gain_state *state = (struct gain_state *) e->data;
+	for (k = start; k < end; ++k) {
+		if (gain_selected(e, state, k)) {
+			p = &buf[k * channel_stride];
+			for (i = 0; i < frames; ++i)
+				p[i * frame_stride] *= (i < state->ramp) ? state->v + state->step * (i + 1) : state->target;
+		}
+	}
+}
+
+static void gain_ramp_advance(struct gain_state *state, ssize_t frames)
+{
+	if (frames >= state->ramp) {
+		state->v = state->target;
+		state->ramp = 0;
+	}
+	else {
+		state->v += state->step * frames;
+		state->ramp -= frames;
+	}
+}
+
 sample_t * gain_effect_run(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf)
 {
 	ssize_t i, k, samples = *frames * e->ostream.channels;
 	struct gain_state *state = (struct gain_state *) e->data;
-	if (state->channel == -1) {
+	if (state->ramp > 0) {
+		gain_ramp_run(e, *frames, ibuf, e->ostream.channels, 1, 0, e->ostream.channels);
+		gain_ramp_advance(state, *frames);
+	}
+	else if (state->channel == -1) {
 		for (i = 0; i < samples; i += e->ostream.channels)
 			for (k = 0; k < e->ostream.channels; ++k)
 				if (GET_BIT(e->channel_selector, k))
@@ -26,6 +76,50 @@ sample_t * gain_effect_run(struct effect *e, ssize_t *frames, sample_t *ibuf, sa
 	return ibuf;
 }
 
+sample_t * gain_effect_run_ch(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf, int start, int end)
+{
+	ssize_t i, samples = *frames * e->ostream.channels;
+	int k;
+	struct gain_state *state = (struct gain_state *) e->data;
+	if (state->ramp > 0) {
+		gain_ramp_run(e, *frames, ibuf, e->ostream.channels, 1, start, end);
+		return ibuf;
+	}
+	for (k = start; k < end; ++k)
+		if (gain_selected(e, state, k))
+			for (i = k; i < samples; i += e->ostream.channels)
+				ibuf[i] *= state->v;
+	return ibuf;
+}
+
+void gain_effect_run_ch_commit(struct effect *e, ssize_t frames)
+{
+	struct gain_state *state = (struct gain_state *) e->data;
+	if (state->ramp > 0)
+		gain_ramp_advance(state, frames);
+}
+
+sample_t * gain_effect_run_planar(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf)
+{
+	ssize_t i;
+	int k;
+	sample_t *buf;
+	struct gain_state *state = (struct gain_state *) e->data;
+	if (state->ramp > 0) {
+		gain_ramp_run(e, *frames, ibuf, 1, *frames, 0, e->ostream.channels);
+		gain_ramp_advance(state, *frames);
+		return ibuf;
+	}
+	for (k = 0; k < e->ostream.channels; ++k) {
+		if (gain_selected(e, state, k)) {
+			buf = &ibuf[k * *frames];
+			for (i = 0; i < *frames; ++i)
+				buf[i] *= state->v;
+		}
+	}
+	return ibuf;
+}
+
 sample_t * add_effect_run(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf)
 {
 	ssize_t i, k, samples = *frames * e->ostream.channels;
@@ -43,6 +137,41 @@ sample_t * add_effect_run(struct effect *e, ssize_t *frames, sample_t *ibuf, sam
 	return ibuf;
 }
 
+sample_t * add_effect_run_ch(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf, int start, int end)
+{
+	ssize_t i, samples = *frames * e->ostream.channels;
+	int k;
+	struct gain_state *state = (struct gain_state *) e->data;
+	for (k = start; k < end; ++k)
+		if ((state->channel == -1) ? GET_BIT(e->channel_selector, k) : k == state->channel)
+			for (i = k; i < samples; i += e->ostream.channels)
+				ibuf[i] += state->v;
+	return ibuf;
+}
+
+sample_t * add_effect_run_planar(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf)
+{
+	ssize_t i;
+	int k;
+	sample_t *buf;
+	struct gain_state *state = (struct gain_state *) e->data;
+	for (k = 0; k < e->ostream.channels; ++k) {
+		if ((state->channel == -1) ? GET_BIT(e->channel_selector, k) : k == state->channel) {
+			buf = &ibuf[k * *frames];
+			for (i = 0; i < *frames; ++i)
+				buf[i] += state->v;
+		}
+	}
+	return ibuf;
+}
+
+void gain_effect_reset(struct effect *e)
+{
+	struct gain_state *state = (struct gain_state *) e->data;
+	state->v = state->target;
+	state->ramp = 0;
+}
+
 void gain_effect_plot(struct effect *e, int i)
 {
 	struct gain_state *state = (struct gain_state *) e->data;
@@ -72,6 +201,29 @@ void add_effect_plot(struct effect *e, int i)
 		printf("H%d_%d(f)=0\n", k, i);
 }
 
+static struct effect_ctl_update * gain_ctl_prepare(struct effect_ctl *c, const double *values)
+{
+	struct gain_ctl_update *u = calloc(1, sizeof(struct gain_ctl_update));
+	u->v = pow(10.0, values[0] / 20.0);
+	return &u->u;
+}
+
+static struct effect_ctl_update * mult_ctl_prepare(struct effect_ctl *c, const double *values)
+{
+	struct gain_ctl_update *u = calloc(1, sizeof(struct gain_ctl_update));
+	u->v = values[0];
+	return &u->u;
+}
+
+static void gain_ctl_apply(struct effect_ctl *c, struct effect_ctl_update *u)
+{
+	struct effect *e = (struct effect *) c->data;
+	struct gain_state *state = (struct gain_state *) e->data;
+	state->target = ((struct gain_ctl_update *) u)->v;
+	state->ramp = MAXIMUM(e->ostream.fs * GAIN_CTL_RAMP_MS / 1000, 1);
+	state->step = (state->target - state->v) / state->ramp;
+}
+
 void gain_effect_destroy(struct effect *e)
 {
 	free(e->data);
@@ -81,6 +233,7 @@ void gain_effect_destroy(struct effect *e)
 struct effect * gain_effect_init(struct effect_info *ei, struct stream_info *istream, char *channel_selector, const char *dir, int argc, char **argv)
 {
 	struct effect *e;
+	struct effect_ctl *c;
 	struct gain_state *state;
 	double v;
 	int channel = -1;
@@ -124,11 +277,36 @@ struct effect * gain_effect_init(struct effect_info *ei, struct stream_info *ist
 	e->channel_selector = NEW_SELECTOR(istream->channels);
 	COPY_SELECTOR(e->channel_selector, channel_selector, istream->channels);
 	e->run = (ei->effect_number == GAIN_EFFECT_NUMBER_ADD) ? add_effect_run : gain_effect_run;
+	e->run_planar = (ei->effect_number == GAIN_EFFECT_NUMBER_ADD) ? add_effect_run_planar : gain_effect_run_planar;
+	e->run_ch = (ei->effect_number == GAIN_EFFECT_NUMBER_ADD) ? add_effect_run_ch : gain_effect_run_ch;
+	if (ei->effect_number != GAIN_EFFECT_NUMBER_ADD) {
+		e->run_ch_commit = gain_effect_run_ch_commit;
+		e->reset = gain_effect_reset;
+	}
 	e->plot = (ei->effect_number == GAIN_EFFECT_NUMBER_ADD) ? add_effect_plot : gain_effect_plot;
 	e->destroy = gain_effect_destroy;
 	state = calloc(1, sizeof(struct gain_state));
 	state->channel = channel;
-	state->v = v;
+	state->v = state->target = v;
 	e->data = state;
+	if (ei->effect_number != GAIN_EFFECT_NUMBER_ADD) {
+		c = add_effect_ctl(e, ei->name, 1);
+		if (ei->effect_number == GAIN_EFFECT_NUMBER_GAIN) {
+			c->params[0].name = "gain";
+			c->params[0].value = 20.0 * log10(v);
+			c->params[0].min = GAIN_CTL_MIN_DB;
+			c->params[0].max = GAIN_CTL_MAX_DB;
+			c->prepare = gain_ctl_prepare;
+		}
+		else {
+			c->params[0].name = "multiplier";
+			c->params[0].value = v;
+			c->params[0].min = -GAIN_CTL_MAX_MULT;
+			c->params[0].max = GAIN_CTL_MAX_MULT;
+			c->prepare = mult_ctl_prepare;
+		}
+		c->apply = gain_ctl_apply;
+		c->data = e;
+	}
 	return e;
 }
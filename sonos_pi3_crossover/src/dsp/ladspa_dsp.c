@@ -1,8 +1,12 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 #include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <sys/types.h>
+#include <sys/eventfd.h>
 #include <dirent.h>
 #include <errno.h>
 #include <locale.h>
@@ -11,47 +15,185 @@
 #include "dsp.h"
 #include "effect.h"
 #include "util.h"
+#include "reload.h"
+#include "control.h"
+#include "rt.h"
 
 #define DEFAULT_CONFIG_DIR     "/ladspa_dsp"
 #define DEFAULT_XDG_CONFIG_DIR "/.config"
 #define GLOBAL_CONFIG_DIR      "/etc"DEFAULT_CONFIG_DIR
+#define PROFILE_DUMP_INTERVAL  10  /* seconds of audio */
 
 struct ladspa_dsp {
 	sample_t *buf1, *buf2;
 	size_t frames;
-	int input_channels, output_channels;
+	int input_channels, output_channels, planar;
 	struct effects_chain chain;
 	LADSPA_Data **ports;
+	struct effects_profile *profile;
+	struct effects_profile *snapshot;  /* of profile, taken by the audio thread */
+	struct effects_profile *dump;      /* snapshot handed to profile_thread (exchanged with atomics) */
+	char *profile_path;
+	const char *label;
+	ssize_t profile_frames, profile_interval, buf_len;
+	pthread_t profile_thread;
+	pthread_mutex_t profile_lock;  /* held while profile_thread writes a snapshot */
+	int profile_efd, has_profile_thread, profile_stop;
+	struct ladspa_dsp_config *config;
+	struct reloader *reloader;
+	struct effects_ctls *ctls;
+	struct control *control;
+	struct chain_data *data;  /* data of the current chain if hot reloading is enabled */
 };
 
 struct ladspa_dsp_config {
-	int input_channels, output_channels, chain_argc;
-	char *name, *dir_path, *lc_n, **chain_argv;
+	int input_channels, output_channels, threads, chain_argc;
+	char *name, *path, *dir_path, *lc_n, *hot_reload, *control, **chain_argv;
+};
+
+/* Attached to the chains built by the reloader */
+struct chain_data {
+	struct effects_profile *profile, *snapshot;
+	struct effects_ctls *ctls;
 };
 
 struct dsp_globals dsp_globals = {
-	0,                      /* clip_count */
-	0,                      /* peak */
 	LL_NORMAL,              /* loglevel */
 	DEFAULT_BUF_FRAMES,     /* buf_frames */
 	DEFAULT_MAX_BUF_RATIO,  /* max_buf_ratio */
 	"ladspa_dsp",           /* prog_name */
+	0,                      /* dev_period_frames */
+	0,                      /* dev_start_frames */
+	DEFAULT_DEV_PERIODS,    /* dev_periods */
 };
 
 static int n_configs = 0;
 static struct ladspa_dsp_config *configs = NULL;
 static LADSPA_Descriptor *descriptors = NULL;
+static const char *profile_path = NULL;
+static int n_profiled_instances = 0;
+
+/* Rewrites the profile file (or prints to stderr if the path is "-") */
+static void dump_profile(struct ladspa_dsp *d, struct effects_profile *profile)
+{
+	FILE *f = stderr;
+	if (strcmp(d->profile_path, "-") != 0 && (f = fopen(d->profile_path, "w")) == NULL) {
+		LOG_FMT(LL_ERROR, "warning: failed to open profile file: %s: %s", d->profile_path, strerror(errno));
+		return;
+	}
+	fprintf(f, "%s: profile: label: %s\n", dsp_globals.prog_name, d->label);
+	print_effects_profile(profile, f);
+	if (f != stderr)
+		fclose(f);
+}
+
+/* Writes the snapshots that the audio thread hands over, so that the audio
+   thread does no file I/O */
+static void * profile_thread(void *arg)
+{
+	uint64_t v;
+	struct effects_profile *snap;
+	struct ladspa_dsp *d = (struct ladspa_dsp *) arg;
+
+	rt_thread_init(RT_THREAD_CONTROL);
+	while (!__atomic_load_n(&d->profile_stop, __ATOMIC_ACQUIRE)) {
+		if (read(d->profile_efd, &v, sizeof(v)) != sizeof(v)) {
+			if (errno == EINTR)
+				continue;
+			LOG_FMT(LL_ERROR, "error: profile thread: read() failed: %s", strerror(errno));
+			break;
+		}
+		pthread_mutex_lock(&d->profile_lock);
+		if ((snap = __atomic_load_n(&d->dump, __ATOMIC_ACQUIRE)) != NULL) {
+			dump_profile(d, snap);
+			__atomic_store_n(&d->dump, NULL, __ATOMIC_RELEASE);
+		}
+		pthread_mutex_unlock(&d->profile_lock);
+	}
+	return NULL;
+}
+
+static int init_profile_thread(struct ladspa_dsp *d)
+{
+	int err;
+	sigset_t set, old_set;
+	pthread_mutex_init(&d->profile_lock, NULL);
+	if ((d->profile_efd = eventfd(0, EFD_CLOEXEC)) == -1) {
+		LOG_FMT(LL_ERROR, "error: eventfd() failed: %s", strerror(errno));
+		return 1;
+	}
+	/* signals are handled by the host */
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &old_set);
+	err = pthread_create(&d->profile_thread, NULL, profile_thread, d);
+	pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+	if (err != 0) {
+		LOG_FMT(LL_ERROR, "error: failed to create profile thread: %s", strerror(err));
+		return 1;
+	}
+	d->has_profile_thread = 1;
+	return 0;
+}
+
+static void destroy_profile_thread(struct ladspa_dsp *d)
+{
+	uint64_t v = 1;
+	if (d->profile_path == NULL)
+		return;
+	if (d->has_profile_thread) {
+		__atomic_store_n(&d->profile_stop, 1, __ATOMIC_RELEASE);
+		if (write(d->profile_efd, &v, sizeof(v)) != sizeof(v))
+			LOG_FMT(LL_ERROR, "warning: profile thread: write() failed: %s", strerror(errno));
+		pthread_join(d->profile_thread, NULL);
+		d->has_profile_thread = 0;
+	}
+	if (d->profile_efd != -1)
+		close(d->profile_efd);
+	pthread_mutex_destroy(&d->profile_lock);
+}
+
+/* Called by the audio thread. Skipped if the previous snapshot has not been
+   written yet. */
+static void post_profile(struct ladspa_dsp *d)
+{
+	uint64_t v = 1;
+	if (!d->has_profile_thread || __atomic_load_n(&d->dump, __ATOMIC_ACQUIRE) != NULL)
+		return;
+	snapshot_effects_profile(d->snapshot, d->profile);
+	__atomic_store_n(&d->dump, d->snapshot, __ATOMIC_RELEASE);
+	if (write(d->profile_efd, &v, sizeof(v)) != sizeof(v))
+		LOG_FMT(LL_ERROR, "warning: profile thread: write() failed: %s", strerror(errno));
+}
 
 static void init_config(struct ladspa_dsp_config *config, const char *file_name, const char *dir_path)
 {
+	int i;
 	memset(config, 0, sizeof(struct ladspa_dsp_config));
 	config->input_channels = 1;
 	config->output_channels = 1;
+	config->threads = 1;
 	if (strcmp(file_name, "config") != 0)
 		config->name = strdup(&file_name[7]);
+	i = strlen(dir_path) + strlen(file_name) + 2;
+	config->path = calloc(i, sizeof(char));
+	snprintf(config->path, i, "%s/%s", dir_path, file_name);
 	config->dir_path = strdup(dir_path);
 }
 
+static void free_config(struct ladspa_dsp_config *config)
+{
+	int i;
+	for (i = 0; i < config->chain_argc; ++i)
+		free(config->chain_argv[i]);
+	free(config->chain_argv);
+	free(config->lc_n);
+	free(config->hot_reload);
+	free(config->control);
+	free(config->dir_path);
+	free(config->path);
+	free(config->name);
+}
+
 static int read_config(struct ladspa_dsp_config *config, const char *path)
 {
 	int i, k;
@@ -83,10 +225,26 @@ static int read_config(struct ladspa_dsp_config *config, const char *path)
 					goto parse_fail;
 				}
 			}
+			else if (strcmp(key, "threads") == 0) {
+				config->threads = strtol(value, &endptr, 10);
+				if (check_endptr(path, value, endptr, "threads")) goto parse_fail;
+				if (config->threads <= 0) {
+					LOG_S(LL_ERROR, "error: threads must be > 0");
+					goto parse_fail;
+				}
+			}
 			else if (strcmp(key, "LC_NUMERIC") == 0) {
 				free(config->lc_n);
 				config->lc_n = strdup(value);
 			}
+			else if (strcmp(key, "hot_reload") == 0) {
+				free(config->hot_reload);
+				config->hot_reload = strdup(value);
+			}
+			else if (strcmp(key, "control") == 0) {
+				free(config->control);
+				config->control = strdup(value);
+			}
 			else if (strcmp(key, "effects_chain") == 0) {
 				for (k = 0; k < config->chain_argc; ++k)
 					free(config->chain_argv[k]);
@@ -173,41 +331,183 @@ static void load_configs(void)
 	free(path);
 }
 
-static LADSPA_Handle instantiate_dsp(const LADSPA_Descriptor *desc, unsigned long fs)
+/* The host expects one output frame per input frame for any block size. A
+   resample_poly upsampler followed by a downsampler back to the same rate
+   guarantees that (see resample_poly.c), but a downsampler that is not undoing
+   an earlier upsampler does not, even if the chain ends at the host rate. */
+static int check_frames_per_block(struct effects_chain *chain)
+{
+	int n = 0, depth = 0, r = 0, *up;
+	struct effect *e;
+	for (e = chain->head; e != NULL; e = e->next)
+		if (e->istream.fs != e->ostream.fs) ++n;
+	if (n == 0) return 0;
+	up = calloc(n, sizeof(int));
+	for (e = chain->head; e != NULL && r == 0; e = e->next) {
+		if (e->istream.fs < e->ostream.fs)
+			up[depth++] = e->istream.fs;
+		else if (e->istream.fs > e->ostream.fs) {
+			if (depth == 0 || up[depth - 1] != e->ostream.fs) {
+				LOG_FMT(LL_ERROR, "error: %s: downsampling from %d to %d does not undo an earlier upsampler; the output frames would not match the input frames",
+					e->name, e->istream.fs, e->ostream.fs);
+				r = 1;
+			}
+			else --depth;
+		}
+	}
+	free(up);
+	return r;
+}
+
+static int build_chain_from_config(struct ladspa_dsp_config *config, struct stream_info *stream, struct effects_chain *chain)
 {
 	int r;
 	locale_t old_locale = 0, new_locale = 0;
-	struct stream_info stream;
-	struct ladspa_dsp_config *config = (struct ladspa_dsp_config *) desc->ImplementationData;
-	struct ladspa_dsp *d = calloc(1, sizeof(struct ladspa_dsp));
-
-	LOG_FMT(LL_VERBOSE, "info: using label: %s", desc->Label);
-	d->input_channels = config->input_channels;
-	d->output_channels = config->output_channels;
-	d->ports = calloc(d->input_channels + d->output_channels, sizeof(LADSPA_Data *));
-	stream.fs = fs;
-	stream.channels = d->input_channels;
-	LOG_S(LL_VERBOSE, "info: begin effects chain");
 	if (config->lc_n != NULL) {
 		LOG_FMT(LL_VERBOSE, "info: setting LC_NUMERIC to \"%s\"", config->lc_n);
 		new_locale = duplocale(uselocale((locale_t) 0));
 		if (new_locale == (locale_t) 0) {
 			LOG_S(LL_ERROR, "error: duplocale() failed");
-			goto fail;
+			return 1;
 		}
 		new_locale = newlocale(LC_NUMERIC_MASK, config->lc_n, new_locale);
 		if (new_locale == (locale_t) 0) {
 			LOG_S(LL_ERROR, "error: newlocale() failed");
-			goto fail;
+			return 1;
 		}
 		old_locale = uselocale(new_locale);
 	}
-	r = build_effects_chain(config->chain_argc, config->chain_argv, &d->chain, &stream, NULL, config->dir_path);
+	r = build_effects_chain(config->chain_argc, config->chain_argv, chain, stream, NULL, config->dir_path);
 	if (old_locale != (locale_t) 0) {
 		LOG_S(LL_VERBOSE, "info: resetting locale");
 		uselocale(old_locale);
 	}
 	if (new_locale != (locale_t) 0) freelocale(new_locale);
+	if (r == 0)
+		r = check_frames_per_block(chain);
+	return r;
+}
+
+/* Re-reads the config file and builds a new chain on the reloader's thread */
+static int reload_build(void *arg, struct stream_info *stream, ssize_t frames, struct reload_chain *rc)
+{
+	int r = 1;
+	struct ladspa_dsp *d = (struct ladspa_dsp *) arg;
+	struct ladspa_dsp_config config;
+	struct chain_data *cd;
+
+	init_config(&config, "config", d->config->dir_path);
+	if (read_config(&config, d->config->path)) {
+		LOG_FMT(LL_ERROR, "error: failed to read config file: %s", d->config->path);
+		goto done;
+	}
+	if (config.input_channels != d->input_channels || config.output_channels != d->output_channels) {
+		LOG_S(LL_ERROR, "error: input_channels and output_channels can't be changed without reloading the plugin");
+		goto done;
+	}
+	if (build_chain_from_config(&config, stream, &rc->chain))
+		goto done;
+	rc->buf_len = get_effects_chain_buffer_len(&rc->chain, frames, d->input_channels);
+	cd = calloc(1, sizeof(struct chain_data));
+	if (d->profile_path != NULL) {
+		cd->profile = profile_effects_chain(&rc->chain);
+		cd->snapshot = new_effects_profile_snapshot(cd->profile);
+	}
+	if (d->control != NULL) {
+		/* start with the values the controller has set instead of fading
+		   to the values in the config */
+		cd->ctls = get_effects_chain_ctls(&rc->chain);
+		control_init_ctls(d->control, cd->ctls);
+		apply_effects_chain_ctls(&rc->chain);
+		reset_effects_chain(&rc->chain);
+	}
+	rc->data = cd;
+	shard_effects_chain(&rc->chain, config.threads);
+	r = 0;
+
+	done:
+	free_config(&config);
+	return r;
+}
+
+static void destroy_chain_data(struct ladspa_dsp *d, struct chain_data *cd)
+{
+	struct effects_profile *expected = cd->snapshot;
+	if (cd->ctls != NULL) {
+		control_release(d->control, cd->ctls);
+		destroy_effects_ctls(cd->ctls);
+	}
+	if (cd->snapshot != NULL && d->has_profile_thread) {
+		/* if the thread has not written it yet, it is simply dropped */
+		pthread_mutex_lock(&d->profile_lock);
+		__atomic_compare_exchange_n(&d->dump, &expected, NULL, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&d->profile_lock);
+	}
+	destroy_effects_profile(cd->profile);
+	destroy_effects_profile(cd->snapshot);
+	free(cd);
+}
+
+static void reload_destroy_data(void *arg, void *data)
+{
+	destroy_chain_data((struct ladspa_dsp *) arg, (struct chain_data *) data);
+}
+
+static int init_reloader(struct ladspa_dsp *d, unsigned long fs, ssize_t buf_len)
+{
+	char *endptr;
+	struct stream_info istream, ostream;
+	ssize_t fade_frames = parse_len(d->config->hot_reload, fs, &endptr);
+	if (check_endptr(d->config->path, d->config->hot_reload, endptr, "hot_reload")) return 1;
+	if (fade_frames < 0) {
+		LOG_S(LL_ERROR, "error: hot_reload must be >= 0");
+		return 1;
+	}
+	if ((d->reloader = reloader_new(reload_build, reload_destroy_data, d, fade_frames)) == NULL)
+		return 1;
+	if (reloader_watch(d->reloader, d->config->path)
+			|| reloader_watch_chain_args(d->reloader, d->config->chain_argc, d->config->chain_argv, d->config->dir_path))
+		return 1;
+	istream.fs = ostream.fs = fs;
+	istream.channels = d->input_channels;
+	ostream.channels = d->output_channels;
+	d->data = calloc(1, sizeof(struct chain_data));
+	d->data->profile = d->profile;
+	d->data->snapshot = d->snapshot;
+	d->data->ctls = d->ctls;
+	return reloader_reset(d->reloader, &istream, &ostream, dsp_globals.buf_frames, buf_len, d->data);
+}
+
+static int init_control(struct ladspa_dsp *d)
+{
+	int i = strlen(d->config->control) + 2;
+	char *name = calloc(i, sizeof(char));
+	/* shm_open() wants a leading slash; control_new() picks name.N if
+	   another instance uses the name */
+	snprintf(name, i, "%s%s", (d->config->control[0] == '/') ? "" : "/", d->config->control);
+	d->ctls = get_effects_chain_ctls(&d->chain);
+	d->control = control_new(name, d->ctls);
+	free(name);
+	return d->control == NULL;
+}
+
+static LADSPA_Handle instantiate_dsp(const LADSPA_Descriptor *desc, unsigned long fs)
+{
+	int r;
+	ssize_t buf_len;
+	struct stream_info stream;
+	struct ladspa_dsp_config *config = (struct ladspa_dsp_config *) desc->ImplementationData;
+	struct ladspa_dsp *d = calloc(1, sizeof(struct ladspa_dsp));
+
+	LOG_FMT(LL_VERBOSE, "info: using label: %s", desc->Label);
+	d->config = config;
+	d->input_channels = config->input_channels;
+	d->output_channels = config->output_channels;
+	d->ports = calloc(d->input_channels + d->output_channels, sizeof(LADSPA_Data *));
+	stream.fs = fs;
+	stream.channels = d->input_channels;
+	LOG_S(LL_VERBOSE, "info: begin effects chain");
+	r = build_chain_from_config(config, &stream, &d->chain);
 	if (r) goto fail;
 	LOG_S(LL_VERBOSE, "info: end effects chain");
 	if (stream.channels != d->output_channels) {
@@ -218,10 +518,43 @@ static LADSPA_Handle instantiate_dsp(const LADSPA_Descriptor *desc, unsigned lon
 		LOG_S(LL_ERROR, "error: sample rate mismatch");
 		goto fail;
 	}
+	if (profile_path != NULL) {
+		/* every instance after the first writes to path.N */
+		d->profile_path = calloc(strlen(profile_path) + 16, sizeof(char));
+		if (n_profiled_instances == 0 || strcmp(profile_path, "-") == 0)
+			strcpy(d->profile_path, profile_path);
+		else
+			sprintf(d->profile_path, "%s.%d", profile_path, n_profiled_instances);
+		++n_profiled_instances;
+		d->label = desc->Label;
+		d->profile_interval = PROFILE_DUMP_INTERVAL * fs;
+		d->profile = profile_effects_chain(&d->chain);
+		d->snapshot = new_effects_profile_snapshot(d->profile);
+		LOG_FMT(LL_VERBOSE, "info: writing profile to %s", d->profile_path);
+		if (init_profile_thread(d))
+			LOG_S(LL_ERROR, "warning: writing the profile at cleanup only");
+	}
+	if (config->control != NULL && init_control(d))
+		goto fail;
+	buf_len = get_effects_chain_buffer_len(&d->chain, dsp_globals.buf_frames, d->input_channels);
+	shard_effects_chain(&d->chain, config->threads);
+	d->planar = effects_chain_is_planar(&d->chain);
+	if (d->planar)
+		LOG_S(LL_VERBOSE, "info: using planar buffers");
+	if (config->hot_reload != NULL && init_reloader(d, fs, buf_len))
+		goto fail;
 	return d;
 
 	fail:
+	reloader_destroy(d->reloader);
+	destroy_profile_thread(d);
+	control_destroy(d->control);
 	destroy_effects_chain(&d->chain);
+	destroy_effects_ctls(d->ctls);
+	destroy_effects_profile(d->profile);
+	destroy_effects_profile(d->snapshot);
+	free(d->data);
+	free(d->profile_path);
 	free(d->ports);
 	free(d);
 	return NULL;
@@ -234,40 +567,146 @@ static void connect_port_to_dsp(LADSPA_Handle inst, unsigned long port, LADSPA_D
 		d->ports[port] = data;
 }
 
+#ifdef SINGLE_PRECISION
+/* Returns nonzero if the output ports form a single planar buffer which the
+   input ports either are part of (in place) or do not overlap */
+static int can_run_in_ports(struct ladspa_dsp *d, unsigned long s)
+{
+	int k;
+	LADSPA_Data *in, *out = d->ports[d->input_channels];
+	if (get_effects_chain_buffer_len(&d->chain, s, d->input_channels) > s * d->output_channels)
+		return 0;
+	for (k = 1; k < d->output_channels; ++k)
+		if (d->ports[d->input_channels + k] != out + k * s)
+			return 0;
+	for (k = 0; k < d->input_channels; ++k) {
+		in = d->ports[k];
+		if (in != out + k * s && in + s > out && in < out + d->output_channels * s)
+			return 0;
+	}
+	return 1;
+}
+#endif
+
+static sample_t * run_chain(struct ladspa_dsp *d, ssize_t *frames, sample_t *ibuf, sample_t *obuf, int planar)
+{
+	ssize_t in_frames = *frames;
+	struct timespec t0;
+	if (d->profile != NULL)
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+	if (d->reloader != NULL)
+		obuf = reloader_run(d->reloader, &d->chain, frames, ibuf, obuf, planar);
+	else if (planar)
+		obuf = run_effects_chain_planar(d->chain.head, frames, ibuf, obuf);
+	else
+		obuf = run_effects_chain(d->chain.head, frames, ibuf, obuf);
+	if (d->profile != NULL)
+		effects_profile_add_block(d->profile, &t0, in_frames);
+	return obuf;
+}
+
+static void run_dsp_planar(struct ladspa_dsp *d, unsigned long s)
+{
+	unsigned long i;
+	int k;
+	sample_t *ibuf = d->buf1, *obuf;
+	ssize_t w = s;
+
+#ifdef SINGLE_PRECISION
+	/* sample_t is LADSPA_Data, so the ports can be used as the buffer */
+	if (can_run_in_ports(d, s)) {
+		ibuf = d->ports[d->input_channels];
+		for (k = 0; k < d->input_channels; ++k)
+			if (d->ports[k] != ibuf + k * s)
+				memcpy(ibuf + k * s, d->ports[k], s * sizeof(sample_t));
+		obuf = run_chain(d, &w, ibuf, d->buf2, 1);
+		if (obuf != ibuf)
+			memcpy(ibuf, obuf, s * d->output_channels * sizeof(sample_t));
+		return;
+	}
+#endif
+	for (k = 0; k < d->input_channels; ++k)
+		for (i = 0; i < s; ++i)
+			ibuf[k * s + i] = (sample_t) d->ports[k][i];
+
+	obuf = run_chain(d, &w, ibuf, d->buf2, 1);
+
+	for (k = 0; k < d->output_channels; ++k)
+		for (i = 0; i < s; ++i)
+			d->ports[d->input_channels + k][i] = (LADSPA_Data) obuf[k * s + i];
+}
+
 static void run_dsp(LADSPA_Handle inst, unsigned long s)
 {
 	unsigned long i, j, k;
 	sample_t *obuf;
-	ssize_t w = s, buf_len;
+	ssize_t w = s, buf_len = 0;
+	struct reload_chain *rc;
 	struct ladspa_dsp *d = (struct ladspa_dsp *) inst;
 
 	if (s == 0) return;
+	if (d->reloader != NULL && (rc = reloader_swap(d->reloader, &d->chain)) != NULL) {
+		d->planar = effects_chain_is_planar(&d->chain);
+		d->data = (struct chain_data *) rc->data;
+		d->profile = d->data->profile;
+		d->snapshot = d->data->snapshot;
+		d->ctls = d->data->ctls;
+		/* The old chain may already be retired. Its controls stay safe to
+		   use until destroy_chain_data() releases them, which happens
+		   before the chain is destroyed. */
+		if (d->control != NULL)
+			control_switch(d->control, d->ctls);
+		buf_len = rc->buf_len;
+	}
 	if (s > d->frames) {
 		d->frames = s;
-		buf_len = get_effects_chain_buffer_len(&d->chain, s, d->input_channels);
+		buf_len = MAXIMUM(buf_len, get_effects_chain_buffer_len(&d->chain, s, d->input_channels));
+		LOG_FMT(LL_VERBOSE, "info: frames=%zd", d->frames);
+	}
+	if (buf_len > d->buf_len) {
+		d->buf_len = buf_len;
 		d->buf1 = realloc(d->buf1, buf_len * sizeof(sample_t));
 		d->buf2 = realloc(d->buf2, buf_len * sizeof(sample_t));
-		LOG_FMT(LL_VERBOSE, "info: frames=%zd", d->frames);
 	}
 
-	for (i = j = 0; i < s; i++)
-		for (k = 0; k < d->input_channels; ++k)
-			d->buf1[j++] = (sample_t) d->ports[k][i];
+	if (d->planar)
+		run_dsp_planar(d, s);
+	else {
+		for (i = j = 0; i < s; i++)
+			for (k = 0; k < d->input_channels; ++k)
+				d->buf1[j++] = (sample_t) d->ports[k][i];
 
-	obuf = run_effects_chain(d->chain.head, &w, d->buf1, d->buf2);
+		obuf = run_chain(d, &w, d->buf1, d->buf2, 0);
 
-	for (i = j = 0; i < s; i++)
-		for (k = d->input_channels; k < d->input_channels + d->output_channels; ++k)
-			d->ports[k][i] = (LADSPA_Data) obuf[j++];
+		for (i = j = 0; i < s; i++)
+			for (k = d->input_channels; k < d->input_channels + d->output_channels; ++k)
+				d->ports[k][i] = (LADSPA_Data) obuf[j++];
+	}
+
+	if (d->profile != NULL && (d->profile_frames += s) >= d->profile_interval) {
+		post_profile(d);
+		d->profile_frames = 0;
+	}
 }
 
 static void cleanup_dsp(LADSPA_Handle inst)
 {
 	struct ladspa_dsp *d = (struct ladspa_dsp *) inst;
 	LOG_S(LL_VERBOSE, "info: cleaning up...");
+	reloader_destroy(d->reloader);
+	destroy_profile_thread(d);
 	free(d->buf1);
 	free(d->buf2);
+	control_destroy(d->control);
 	destroy_effects_chain(&d->chain);
+	destroy_effects_ctls(d->ctls);
+	free(d->data);
+	if (d->profile != NULL) {
+		dump_profile(d, d->profile);
+		destroy_effects_profile(d->profile);
+		destroy_effects_profile(d->snapshot);
+		free(d->profile_path);
+	}
 	free(d->ports);
 	free(d);
 }
@@ -290,6 +729,7 @@ void __attribute__((constructor)) ladspa_dsp_so_init()
 		else
 			LOG_FMT(LL_ERROR, "warning: unrecognized loglevel: %s", env);
 	}
+	profile_path = getenv("LADSPA_DSP_PROFILE");
 
 	load_configs();
 	if (n_configs > 0)
@@ -352,12 +792,7 @@ void __attribute__((destructor)) ladspa_dsp_so_fini()
 			free((char *) descriptors[k].PortNames[i]);
 		free((char **) descriptors[k].PortNames);
 		free((LADSPA_PortRangeHint *) descriptors[k].PortRangeHints);
-		for (i = 0; i < configs[k].chain_argc; ++i)
-			free(configs[k].chain_argv[i]);
-		free(configs[k].chain_argv);
-		free(configs[k].lc_n);
-		free(configs[k].dir_path);
-		free(configs[k].name);
+		free_config(&configs[k]);
 	}
 	free(descriptors);
 	free(configs);
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <ladspa.h>
 #include <ltdl.h>
@@ -24,7 +25,7 @@ struct ladspa_host_state {
 };
 
 /* For plugins with multiple input ports */
-sample_t * ladspa_host_effect_run(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf)
+sample_t * ladspa_host_effect_run_planar(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf)
 {
 	ssize_t f = 0, len;
 	struct ladspa_host_state *state = (struct ladspa_host_state *) e->data;
@@ -35,8 +36,9 @@ sample_t * ladspa_host_effect_run(struct effect *e, ssize_t *frames, sample_t *i
 		for (int c = 0, iport = 0; c < e->istream.channels; ++c) {
 			if (GET_BIT(e->channel_selector, c)) {
 				CM_DEBUG("ibuf(c%d) -> in[%d]\n", c, iport);
+				const sample_t *in = &ibuf[c * *frames + f];
 				for (ssize_t i = 0; i < len; ++i)
-					state->in[iport][i] = (LADSPA_Data) ibuf[(f + i) * e->istream.channels + c];
+					state->in[iport][i] = (LADSPA_Data) in[i];
 				++iport;
 			}
 		}
@@ -46,24 +48,25 @@ sample_t * ladspa_host_effect_run(struct effect *e, ssize_t *frames, sample_t *i
 				if (oport < state->n_out) {
 					if (oport < state->n_in) {
 						CM_DEBUG("out[%d] -> obuf(c%d)\n", oport, out_c);
+						sample_t *out = &obuf[out_c * *frames + f];
 						for (ssize_t i = 0; i < len; ++i)
-							obuf[(f + i) * e->ostream.channels + out_c] = (sample_t) state->out[oport][i];
+							out[i] = (sample_t) state->out[oport][i];
 						++oport;
 						++out_c;
 					}
 					if (oport == state->n_in) {
 						for (; oport < state->n_out; ++oport, ++out_c) {
 							CM_DEBUG("out[%d] -> obuf(c%d)\n", oport, out_c);
+							sample_t *out = &obuf[out_c * *frames + f];
 							for (ssize_t i = 0; i < len; ++i)
-								obuf[(f + i) * e->ostream.channels + out_c] = (sample_t) state->out[oport][i];
+								out[i] = (sample_t) state->out[oport][i];
 						}
 					}
 				}
 			}
 			else {
 				CM_DEBUG("ibuf(c%d) -> obuf(c%d)\n", in_c, out_c);
-				for (ssize_t i = 0; i < len; ++i)
-					obuf[(f + i) * e->ostream.channels + out_c] = ibuf[(f + i) * e->istream.channels + in_c];
+				memcpy(&obuf[out_c * *frames + f], &ibuf[in_c * *frames + f], len * sizeof(sample_t));
 				++out_c;
 			}
 		}
@@ -74,7 +77,7 @@ sample_t * ladspa_host_effect_run(struct effect *e, ssize_t *frames, sample_t *i
 }
 
 /* For plugins with a single input port */
-sample_t * ladspa_host_effect_run_cloned(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf)
+sample_t * ladspa_host_effect_run_planar_cloned(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf)
 {
 	ssize_t f = 0, len;
 	struct ladspa_host_state *state = (struct ladspa_host_state *) e->data;
@@ -86,20 +89,21 @@ sample_t * ladspa_host_effect_run_cloned(struct effect *e, ssize_t *frames, samp
 			if (GET_BIT(e->channel_selector, in_c)) {
 				if (state->n_in > 0) {
 					CM_DEBUG("ibuf(c%d) -> in[%d]\n", in_c, 0);
+					const sample_t *in = &ibuf[in_c * *frames + f];
 					for (ssize_t i = 0; i < len; ++i)
-						state->in[0][i] = (LADSPA_Data) ibuf[(f + i) * e->istream.channels + in_c];
+						state->in[0][i] = (LADSPA_Data) in[i];
 				}
 				state->desc->run(state->handles[handle++], (unsigned long) len);
 				for (int oport = 0; oport < state->n_out; ++oport, ++out_c) {
 					CM_DEBUG("out[%d] -> obuf(c%d)\n", oport, out_c);
+					sample_t *out = &obuf[out_c * *frames + f];
 					for (ssize_t i = 0; i < len; ++i)
-						obuf[(f + i) * e->ostream.channels + out_c] = (sample_t) state->out[oport][i];
+						out[i] = (sample_t) state->out[oport][i];
 				}
 			}
 			else {
 				CM_DEBUG("ibuf(c%d) -> obuf(c%d)\n", in_c, out_c);
-				for (ssize_t i = 0; i < len; ++i)
-					obuf[(f + i) * e->ostream.channels + out_c] = ibuf[(f + i) * e->istream.channels + in_c];
+				memcpy(&obuf[out_c * *frames + f], &ibuf[in_c * *frames + f], len * sizeof(sample_t));
 				++out_c;
 			}
 		}
@@ -327,7 +331,7 @@ struct effect * ladspa_host_effect_init(struct effect_info *ei, struct stream_in
 	e->ostream.channels = total_output_channels;
 	e->channel_selector = NEW_SELECTOR(istream->channels);
 	COPY_SELECTOR(e->channel_selector, channel_selector, istream->channels);
-	e->run = (state->n_in <= 1) ? ladspa_host_effect_run_cloned : ladspa_host_effect_run;
+	e->run_planar = (state->n_in <= 1) ? ladspa_host_effect_run_planar_cloned : ladspa_host_effect_run_planar;
 	e->destroy = ladspa_host_effect_destroy;
 
 	free(path);
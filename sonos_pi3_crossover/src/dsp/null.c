@@ -47,7 +47,7 @@ struct codec * null_codec_init(const char *path, const char *type, const char *e
 	c->enc = "sample_t";
 	c->fs = fs;
 	c->channels = channels;
-	c->prec = 53;
+	c->prec = SAMPLE_T_PREC;
 	c->frames = -1;
 	c->read = null_read;
 	c->write = null_write;
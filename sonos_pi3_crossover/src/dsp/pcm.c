@@ -20,18 +20,21 @@ struct pcm_enc_info {
 	int bytes, prec, can_dither;
 	void (*read_func)(char *, sample_t *, ssize_t);
 	void (*write_func)(sample_t *, char *, ssize_t);
+	void (*out_func)(struct out_stage *, sample_t *, char *, ssize_t);
 };
 
 static const char codec_name[] = "pcm";
 
 static struct pcm_enc_info encodings[] = {
-	{ "s16",    2, 16, 1, read_buf_s16,    write_buf_s16 },
-	{ "u8",     1, 8,  1, read_buf_u8,     write_buf_u8 },
-	{ "s8",     1, 8,  1, read_buf_s8,     write_buf_s8 },
-	{ "s24",    4, 24, 1, read_buf_s24,    write_buf_s24 },
-	{ "s32",    4, 32, 1, read_buf_s32,    write_buf_s32 },
-	{ "float",  4, 24, 0, read_buf_float,  write_buf_float },
-	{ "double", 8, 53, 0, read_buf_double, write_buf_double },
+	{ "s16",    2, 16, 1, read_buf_s16,    write_buf_s16, out_stage_s16 },
+	{ "u8",     1, 8,  1, read_buf_u8,     write_buf_u8, out_stage_u8 },
+	{ "s8",     1, 8,  1, read_buf_s8,     write_buf_s8, out_stage_s8 },
+	{ "s24",    4, 24, 1, read_buf_s24,    write_buf_s24, out_stage_s24 },
+	{ "s32",    4, 32, 1, read_buf_s32,    write_buf_s32, out_stage_s32 },
+	{ "float",  4, 24, 0, read_buf_float,  write_buf_float, out_stage_float },
+#ifndef SINGLE_PRECISION
+	{ "double", 8, 53, 0, read_buf_double, write_buf_double, out_stage_double },
+#endif
 };
 
 static struct pcm_enc_info * pcm_get_enc_info(const char *enc)
@@ -66,7 +69,10 @@ ssize_t pcm_write(struct codec *c, sample_t *buf, ssize_t frames)
 	ssize_t n;
 	struct pcm_state *state = (struct pcm_state *) c->data;
 
-	state->enc_info->write_func(buf, (char *) buf, frames * c->channels);
+	if (c->out_stage != NULL)
+		state->enc_info->out_func(c->out_stage, buf, (char *) buf, frames * c->channels);
+	else
+		state->enc_info->write_func(buf, (char *) buf, frames * c->channels);
 	n = write(state->fd, buf, frames * c->channels * state->enc_info->bytes);
 	if (n == -1) {
 		LOG_FMT(LL_ERROR, "%s: write failed: %s", codec_name, strerror(errno));
@@ -151,6 +157,7 @@ struct codec * pcm_codec_init(const char *path, const char *type, const char *en
 	c->channels = channels;
 	c->prec = enc_info->prec;
 	c->can_dither = enc_info->can_dither;
+	c->has_out_stage = 1;
 	c->frames = -1;
 	if (mode == CODEC_MODE_READ) {
 		size = lseek(fd, 0, SEEK_END);
@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <signal.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include "pipeline.h"
+#include "rt.h"
+#include "util.h"
+
+/* At most two blocks are ever in a stage's queues, so this never fills */
+#define QUEUE_LEN 4
+
+struct block {
+	sample_t *buf[2], *data;
+	ssize_t frames, in_frames;
+};
+
+/* Lock-free single producer/single consumer ring. The semaphore is only
+   used to sleep while the ring is empty. */
+struct block_queue {
+	struct block *b[QUEUE_LEN];
+	unsigned int head, tail;
+	sem_t items;
+};
+
+struct pipeline_stage_state {
+	struct effects_chain chain;
+	struct block blocks[2], *pending;
+	struct block_queue in_q, out_q;
+	int next_block, has_thread;
+	ssize_t chain_delay;  /* delay of the stage's effects in frames at ostream.fs */
+	pthread_t thread;
+};
+
+static void queue_push(struct block_queue *q, struct block *b)
+{
+	unsigned int t = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+	q->b[t % QUEUE_LEN] = b;
+	__atomic_store_n(&q->tail, t + 1, __ATOMIC_RELEASE);
+	sem_post(&q->items);
+}
+
+static struct block * queue_pop(struct block_queue *q)
+{
+	unsigned int h;
+	struct block *b;
+	while (sem_wait(&q->items) != 0);
+	h = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+	while (__atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) == h);
+	b = q->b[h % QUEUE_LEN];
+	__atomic_store_n(&q->head, h + 1, __ATOMIC_RELEASE);
+	return b;
+}
+
+static void * pipeline_stage_worker(void *arg)
+{
+	struct pipeline_stage_state *state = (struct pipeline_stage_state *) arg;
+	struct block *b;
+	rt_thread_init(RT_THREAD_WORKER);
+	while ((b = queue_pop(&state->in_q)) != NULL) {
+		b->data = run_effects_chain(state->chain.head, &b->frames, b->buf[0], b->buf[1]);
+		queue_push(&state->out_q, b);
+	}
+	return NULL;
+}
+
+static struct block * wait_pending(struct pipeline_stage_state *state)
+{
+	struct block *b = NULL;
+	if (state->pending != NULL) {
+		b = queue_pop(&state->out_q);
+		state->pending = NULL;
+	}
+	return b;
+}
+
+static void update_chain_delay(struct effect *e)
+{
+	struct pipeline_stage_state *state = (struct pipeline_stage_state *) e->data;
+	state->chain_delay = lround(get_effects_chain_delay(&state->chain) * e->ostream.fs);
+}
+
+sample_t * pipeline_stage_effect_run(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf)
+{
+	struct pipeline_stage_state *state = (struct pipeline_stage_state *) e->data;
+	struct block *b = &state->blocks[state->next_block], *done;
+
+	/* The worker is idle once the previous block is back, so the stage's
+	   effects can be queried safely here */
+	done = wait_pending(state);
+	update_chain_delay(e);
+
+	memcpy(b->buf[0], ibuf, *frames * e->istream.channels * sizeof(sample_t));
+	b->frames = b->in_frames = *frames;
+	state->pending = b;
+	state->next_block = !state->next_block;
+	queue_push(&state->in_q, b);
+
+	if (done == NULL)
+		*frames = 0;
+	else {
+		memcpy(obuf, done->data, done->frames * e->ostream.channels * sizeof(sample_t));
+		*frames = done->frames;
+	}
+	return obuf;
+}
+
+ssize_t pipeline_stage_effect_delay(struct effect *e)
+{
+	struct pipeline_stage_state *state = (struct pipeline_stage_state *) e->data;
+	ssize_t d = state->chain_delay;
+	if (state->pending != NULL)
+		d += lround((double) state->pending->in_frames * e->ostream.fs / e->istream.fs);
+	return d;
+}
+
+void pipeline_stage_effect_reset(struct effect *e)
+{
+	struct pipeline_stage_state *state = (struct pipeline_stage_state *) e->data;
+	wait_pending(state);
+	reset_effects_chain(&state->chain);
+	update_chain_delay(e);
+}
+
+void pipeline_stage_effect_drain(struct effect *e, ssize_t *frames, sample_t *obuf)
+{
+	struct pipeline_stage_state *state = (struct pipeline_stage_state *) e->data;
+	struct block *b;
+	sample_t *rbuf;
+	if ((b = wait_pending(state)) != NULL) {
+		memcpy(obuf, b->data, b->frames * e->ostream.channels * sizeof(sample_t));
+		*frames = b->frames;
+	}
+	else {
+		b = &state->blocks[state->next_block];
+		rbuf = drain_effects_chain(&state->chain, frames, b->buf[0], b->buf[1]);
+		if (*frames > 0)
+			memcpy(obuf, rbuf, *frames * e->ostream.channels * sizeof(sample_t));
+	}
+	update_chain_delay(e);
+}
+
+void pipeline_stage_effect_destroy(struct effect *e)
+{
+	int i;
+	struct pipeline_stage_state *state = (struct pipeline_stage_state *) e->data;
+	if (state->has_thread) {
+		wait_pending(state);
+		queue_push(&state->in_q, NULL);
+		pthread_join(state->thread, NULL);
+	}
+	destroy_effects_chain(&state->chain);
+	for (i = 0; i < 2; ++i) {
+		free(state->blocks[i].buf[0]);
+		free(state->blocks[i].buf[1]);
+	}
+	sem_destroy(&state->in_q.items);
+	sem_destroy(&state->out_q.items);
+	free(state);
+}
+
+static struct effect * pipeline_stage_effect_init(struct effects_chain *chain, ssize_t frames, int n)
+{
+	int i, err;
+	ssize_t buf_len;
+	sigset_t set, old_set;
+	struct effect *e;
+	struct pipeline_stage_state *state;
+
+	state = calloc(1, sizeof(struct pipeline_stage_state));
+	state->chain = *chain;
+	sem_init(&state->in_q.items, 0, 0);
+	sem_init(&state->out_q.items, 0, 0);
+	buf_len = get_effects_chain_buffer_len(chain, frames, chain->head->istream.channels);
+	for (i = 0; i < 2; ++i) {
+		state->blocks[i].buf[0] = calloc(buf_len, sizeof(sample_t));
+		state->blocks[i].buf[1] = calloc(buf_len, sizeof(sample_t));
+	}
+
+	e = calloc(1, sizeof(struct effect));
+	e->name = "pipeline_stage";
+	e->istream = chain->head->istream;
+	e->ostream = chain->tail->ostream;
+	e->run = pipeline_stage_effect_run;
+	e->delay = pipeline_stage_effect_delay;
+	e->reset = pipeline_stage_effect_reset;
+	e->drain = pipeline_stage_effect_drain;
+	e->destroy = pipeline_stage_effect_destroy;
+	e->data = state;
+	update_chain_delay(e);
+
+	/* signals are handled by the main thread */
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &old_set);
+	err = pthread_create(&state->thread, NULL, pipeline_stage_worker, state);
+	pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+	if (err != 0) {
+		LOG_FMT(LL_ERROR, "pipeline: error: failed to create thread for stage %d: %s", n, strerror(err));
+		destroy_effect(e);
+		return NULL;
+	}
+	state->has_thread = 1;
+	return e;
+}
+
+int pipeline_effects_chain(struct effects_chain *chain, int stages, ssize_t frames)
+{
+	int i, k, n = 0, gcd;
+	ssize_t stage_frames;
+	struct effect *e, *next, *stage;
+	struct effects_chain stage_chain, new_chain = { NULL, NULL };
+
+	for (e = chain->head; e != NULL; e = e->next) ++n;
+	if (stages > n) stages = n;
+	if (stages < 2)
+		return 0;
+
+	e = chain->head;
+	for (i = 0; i < stages; ++i) {
+		stage_chain.head = stage_chain.tail = NULL;
+		for (k = 0; k < n / stages + (i < n % stages); ++k) {
+			next = e->next;
+			append_effect(&stage_chain, e);
+			e = next;
+		}
+		if (LOGLEVEL(LL_VERBOSE)) {
+			fprintf(stderr, "%s: info: pipeline stage %d:", dsp_globals.prog_name, i);
+			for (next = stage_chain.head; next != NULL; next = next->next)
+				fprintf(stderr, " %s", next->name);
+			fputc('\n', stderr);
+		}
+		stage_frames = frames;
+		for (next = stage_chain.head; next != NULL; next = next->next) {
+			if (next->ostream.fs != next->istream.fs) {
+				gcd = find_gcd(next->ostream.fs, next->istream.fs);
+				frames = ratio_mult_ceil(frames, next->ostream.fs / gcd, next->istream.fs / gcd);
+			}
+		}
+		if ((stage = pipeline_stage_effect_init(&stage_chain, stage_frames, i)) == NULL) {
+			/* the failed stage destroyed its own effects; the caller destroys the finished stages */
+			while (e != NULL) {
+				next = e->next;
+				destroy_effect(e);
+				e = next;
+			}
+			*chain = new_chain;
+			return 1;
+		}
+		append_effect(&new_chain, stage);
+	}
+	*chain = new_chain;
+	return 0;
+}
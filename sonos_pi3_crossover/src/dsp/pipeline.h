@@ -0,0 +1,11 @@
+#ifndef _PIPELINE_H
+#define _PIPELINE_H
+
+#include "dsp.h"
+#include "effect.h"
+
+/* Splits the chain into (at most) the given number of stages, each of which
+   runs on its own thread. Adds one block of latency per stage. */
+int pipeline_effects_chain(struct effects_chain *, int, ssize_t);
+
+#endif
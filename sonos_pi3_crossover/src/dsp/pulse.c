@@ -12,6 +12,7 @@ struct pulse_enc_info {
 	int fmt, bytes, prec, can_dither;
 	void (*write_func)(sample_t *, char *, ssize_t);
 	void (*read_func)(char *, sample_t *, ssize_t);
+	void (*out_func)(struct out_stage *, sample_t *, char *, ssize_t);
 };
 
 struct pulse_state {
@@ -39,7 +40,10 @@ ssize_t pulse_write(struct codec *c, sample_t *buf, ssize_t frames)
 	int err;
 	struct pulse_state *state = (struct pulse_state *) c->data;
 
-	state->enc_info->write_func(buf, (char *) buf, frames * c->channels);
+	if (c->out_stage != NULL)
+		state->enc_info->out_func(c->out_stage, buf, (char *) buf, frames * c->channels);
+	else
+		state->enc_info->write_func(buf, (char *) buf, frames * c->channels);
 	if (pa_simple_write(state->s, buf, frames * c->channels * state->enc_info->bytes, &err) < 0) {
 		LOG_FMT(LL_ERROR, "%s: write: error: %s", codec_name, pa_strerror(err));
 		return 0;
@@ -78,12 +82,12 @@ void pulse_destroy(struct codec *c)
 }
 
 static struct pulse_enc_info encodings[] = {
-	{ "s16",   PA_SAMPLE_S16NE,     2, 16, 1, write_buf_s16,   read_buf_s16 },
-	{ "u8",    PA_SAMPLE_U8,        1,  8, 1, write_buf_u8,    read_buf_u8 },
-	{ "s24",   PA_SAMPLE_S24_32NE,  4, 24, 1, write_buf_s24,   read_buf_s24 },
-	{ "s24_3", PA_SAMPLE_S24LE,     3, 24, 1, write_buf_s24_3, read_buf_s24_3 },
-	{ "s32",   PA_SAMPLE_S32NE,     4, 32, 1, write_buf_s32,   read_buf_s32 },
-	{ "float", PA_SAMPLE_FLOAT32NE, 4, 24, 0, write_buf_float, read_buf_float },
+	{ "s16",   PA_SAMPLE_S16NE,     2, 16, 1, write_buf_s16,   read_buf_s16, out_stage_s16 },
+	{ "u8",    PA_SAMPLE_U8,        1,  8, 1, write_buf_u8,    read_buf_u8, out_stage_u8 },
+	{ "s24",   PA_SAMPLE_S24_32NE,  4, 24, 1, write_buf_s24,   read_buf_s24, out_stage_s24 },
+	{ "s24_3", PA_SAMPLE_S24LE,     3, 24, 1, write_buf_s24_3, read_buf_s24_3, out_stage_s24_3 },
+	{ "s32",   PA_SAMPLE_S32NE,     4, 32, 1, write_buf_s32,   read_buf_s32, out_stage_s32 },
+	{ "float", PA_SAMPLE_FLOAT32NE, 4, 24, 0, write_buf_float, read_buf_float, out_stage_float },
 };
 
 static struct pulse_enc_info * pulse_get_enc_info(const char *enc)
@@ -133,6 +137,7 @@ struct codec * pulse_codec_init(const char *path, const char *type, const char *
 	c->prec = enc_info->prec;
 	c->can_dither = enc_info->can_dither;
 	c->interactive = (mode == CODEC_MODE_WRITE) ? 1 : 0;
+	c->has_out_stage = 1;
 	c->frames = -1;
 	c->read = pulse_read;
 	c->write = pulse_write;
@@ -0,0 +1,621 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include "reload.h"
+#include "rt.h"
+#include "util.h"
+
+/* Writes to a file often come as several events (truncate, write, close or
+   write to a temporary file, rename). The chain is rebuilt once no event has
+   arrived for this long. */
+#define RELOAD_SETTLE_MS 100
+
+enum {
+	RELOAD_FLAG_STOP    = 1 << 0,
+	RELOAD_FLAG_TRIGGER = 1 << 1,
+};
+
+struct reload_watch {
+	int wd;
+	char *name;
+};
+
+#ifndef SYMMETRIC_IO
+/* Interleaved frames. The frames of both chains are labeled with the index of
+   the old chain's output frame (counted from the swap) for the same input
+   frame. */
+struct reload_fifo {
+	sample_t *buf;
+	ssize_t len, start, fill;
+	ssize_t label;  /* label of buf[start] */
+};
+#endif
+
+struct reloader {
+	reload_build_func build;
+	reload_destroy_data_func destroy_data;
+	void *arg;
+	ssize_t fade_frames, fade_pos;
+	int ifd, efd, n_watches, has_thread;
+	unsigned int flags;  /* set with atomics */
+	struct reload_watch *watches;
+	pthread_t thread;
+	pthread_mutex_t lock;  /* protects the members below and the publishing of pending chains */
+	struct stream_info istream, ostream;
+	ssize_t frames, max_buf_len;
+	unsigned int generation;
+	ssize_t seen_frames;  /* largest block seen by reloader_run(); set with atomics */
+	struct reload_chain *pending, *retired;  /* exchanged with atomics */
+	struct reload_chain *cur, *fading;  /* owned by the audio thread */
+#ifndef SYMMETRIC_IO
+	struct reload_fifo fifo[2];  /* old and new chain; use the align_buf of cur */
+	ssize_t next_label;  /* label of the next output frame */
+	int aligned;   /* the new chain has produced output and fifo[1].label is set */
+	int draining;  /* the crossfade is done, but fifo[1] is not empty yet */
+#endif
+};
+
+static void destroy_reload_chain(struct reloader *r, struct reload_chain *rc)
+{
+	if (rc == NULL)
+		return;
+	/* the data goes first: it may hold references into the chain, such as
+	   controls that another thread can still reach */
+	if (r->destroy_data != NULL && rc->data != NULL)
+		r->destroy_data(r->arg, rc->data);
+	destroy_effects_chain(&rc->chain);
+	free(rc->fade_buf[0]);
+	free(rc->fade_buf[1]);
+	free(rc->align_buf[0]);
+	free(rc->align_buf[1]);
+	free(rc);
+}
+
+static void wake_thread(struct reloader *r, unsigned int flags)
+{
+	uint64_t v = 1;
+	__atomic_or_fetch(&r->flags, flags, __ATOMIC_RELEASE);
+	if (write(r->efd, &v, sizeof(v)) != sizeof(v))
+		LOG_FMT(LL_ERROR, "reload: warning: write() failed: %s", strerror(errno));
+}
+
+/* Hands a chain that is no longer used to the background thread */
+static void retire_chain(struct reloader *r, struct reload_chain *rc)
+{
+	struct reload_chain *expected = NULL;
+	if (r->has_thread && __atomic_compare_exchange_n(&r->retired, &expected, rc, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		wake_thread(r, 0);
+	else
+		destroy_reload_chain(r, rc);  /* the previous one has not been collected yet (unlikely) */
+}
+
+static void build_chain(struct reloader *r)
+{
+	struct stream_info stream, ostream;
+	struct reload_chain *rc, *old;
+	ssize_t max_buf_len;
+	unsigned int generation;
+
+	pthread_mutex_lock(&r->lock);
+	stream = r->istream;
+	ostream = r->ostream;
+	rc = calloc(1, sizeof(struct reload_chain));
+	rc->frames = MAXIMUM(r->frames, __atomic_load_n(&r->seen_frames, __ATOMIC_RELAXED));
+	max_buf_len = r->max_buf_len;
+	generation = r->generation;
+	pthread_mutex_unlock(&r->lock);
+
+	LOG_S(LL_NORMAL, "reload: info: rebuilding effects chain");
+	if (r->build(r->arg, &stream, rc->frames, rc)) {
+		LOG_S(LL_ERROR, "reload: error: failed to build effects chain; keeping the current one");
+		goto fail;
+	}
+	if (stream.fs != ostream.fs || stream.channels != ostream.channels) {
+		LOG_S(LL_ERROR, "reload: error: the new effects chain changes the output sample rate or number of channels; keeping the current one");
+		goto fail;
+	}
+#ifndef SYMMETRIC_IO
+	if (r->fade_frames > 0) {
+		/* the frontend's buffers must fit a block plus the frames held back
+		   while the chains are lined up; the fifos must fit a latency
+		   difference of up to a second plus the crossfade */
+		rc->buf_len *= 2;
+		rc->align_frames = r->fade_frames + 2 * (MAXIMUM(rc->buf_len, max_buf_len) / ostream.channels) + ostream.fs;
+		rc->align_buf[0] = calloc(rc->align_frames * ostream.channels, sizeof(sample_t));
+		rc->align_buf[1] = calloc(rc->align_frames * ostream.channels, sizeof(sample_t));
+	}
+#endif
+	/* the fade buffers must also fit the output of the current chain */
+	max_buf_len = MAXIMUM(rc->buf_len, max_buf_len);
+	rc->fade_buf[0] = calloc(max_buf_len, sizeof(sample_t));
+	rc->fade_buf[1] = calloc(max_buf_len, sizeof(sample_t));
+
+	pthread_mutex_lock(&r->lock);
+	if (generation != r->generation) {
+		/* the frontend rebuilt the chain itself while this one was being built */
+		pthread_mutex_unlock(&r->lock);
+		goto fail;
+	}
+	r->max_buf_len = MAXIMUM(r->max_buf_len, max_buf_len);
+	old = __atomic_exchange_n(&r->pending, rc, __ATOMIC_ACQ_REL);
+	pthread_mutex_unlock(&r->lock);
+	destroy_reload_chain(r, old);
+	LOG_S(LL_VERBOSE, "reload: info: new effects chain ready");
+	return;
+
+	fail:
+	destroy_reload_chain(r, rc);
+}
+
+/* Returns nonzero if any of the events are for a watched file */
+static int read_watch_events(struct reloader *r)
+{
+	int i, match = 0;
+	ssize_t len;
+	char *p, buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	while ((len = read(r->ifd, buf, sizeof(buf))) > 0) {
+		for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + ev->len) {
+			ev = (const struct inotify_event *) p;
+			for (i = 0; i < r->n_watches; ++i) {
+				if (ev->wd == r->watches[i].wd && ev->len > 0 && strcmp(ev->name, r->watches[i].name) == 0) {
+					LOG_FMT(LL_VERBOSE, "reload: info: file changed: %s", ev->name);
+					match = 1;
+				}
+			}
+		}
+	}
+	return match;
+}
+
+static void * reload_thread(void *arg)
+{
+	int do_build;
+	uint64_t v;
+	unsigned int flags;
+	struct pollfd pfds[2];
+	struct reloader *r = (struct reloader *) arg;
+
+	rt_thread_init(RT_THREAD_CONTROL);
+	pfds[0].fd = r->efd;
+	pfds[0].events = POLLIN;
+	pfds[1].fd = r->ifd;  /* ignored by poll() if -1 */
+	pfds[1].events = POLLIN;
+	for (;;) {
+		if (poll(pfds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			LOG_FMT(LL_ERROR, "reload: error: poll() failed: %s", strerror(errno));
+			break;
+		}
+		do_build = 0;
+		if (pfds[0].revents & POLLIN) {
+			if (read(r->efd, &v, sizeof(v)) != sizeof(v))
+				LOG_FMT(LL_ERROR, "reload: warning: read() failed: %s", strerror(errno));
+			flags = __atomic_exchange_n(&r->flags, 0, __ATOMIC_ACQUIRE);
+			destroy_reload_chain(r, __atomic_exchange_n(&r->retired, NULL, __ATOMIC_ACQUIRE));
+			if (flags & RELOAD_FLAG_STOP)
+				break;
+			if (flags & RELOAD_FLAG_TRIGGER)
+				do_build = 1;
+		}
+		if ((pfds[1].revents & POLLIN) && read_watch_events(r)) {
+			do_build = 1;
+			while (poll(&pfds[1], 1, RELOAD_SETTLE_MS) > 0)
+				read_watch_events(r);
+		}
+		if (do_build)
+			build_chain(r);
+	}
+	return NULL;
+}
+
+struct reloader * reloader_new(reload_build_func build, reload_destroy_data_func destroy_data, void *arg, ssize_t fade_frames)
+{
+	struct reloader *r = calloc(1, sizeof(struct reloader));
+	r->build = build;
+	r->destroy_data = destroy_data;
+	r->arg = arg;
+	r->fade_frames = fade_frames;
+	r->ifd = -1;
+	if ((r->efd = eventfd(0, EFD_CLOEXEC)) == -1) {
+		LOG_FMT(LL_ERROR, "reload: error: eventfd() failed: %s", strerror(errno));
+		free(r);
+		return NULL;
+	}
+	pthread_mutex_init(&r->lock, NULL);
+	return r;
+}
+
+int reloader_watch(struct reloader *r, const char *path)
+{
+	int wd;
+	char *dir = strdup(path), *name = strrchr(dir, '/');
+	if (name == NULL) {
+		name = dir;
+		dir = strdup(".");
+	}
+	else {
+		*name++ = '\0';
+		name = strdup(name);
+		if (*dir == '\0') {  /* file in / */
+			free(dir);
+			dir = strdup("/");
+		}
+	}
+	if (r->ifd == -1 && (r->ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1) {
+		LOG_FMT(LL_ERROR, "reload: error: inotify_init1() failed: %s", strerror(errno));
+		goto fail;
+	}
+	if ((wd = inotify_add_watch(r->ifd, dir, IN_CLOSE_WRITE | IN_MOVED_TO)) == -1) {
+		LOG_FMT(LL_ERROR, "reload: error: failed to watch %s: %s", dir, strerror(errno));
+		goto fail;
+	}
+	r->watches = realloc(r->watches, (r->n_watches + 1) * sizeof(struct reload_watch));
+	r->watches[r->n_watches].wd = wd;
+	r->watches[r->n_watches].name = name;
+	++r->n_watches;
+	LOG_FMT(LL_VERBOSE, "reload: info: watching %s", path);
+	free(dir);
+	return 0;
+
+	fail:
+	free(dir);
+	free(name);
+	return 1;
+}
+
+int reloader_watch_chain_args(struct reloader *r, int argc, char **argv, const char *dir)
+{
+	int i, err = 0;
+	char *p;
+	for (i = 0; i < argc; ++i) {
+		if (argv[i][0] == '@') {
+			p = construct_full_path(dir, &argv[i][1]);
+			err |= reloader_watch(r, p);
+			free(p);
+		}
+	}
+	return err;
+}
+
+int reloader_reset(struct reloader *r, const struct stream_info *istream, const struct stream_info *ostream, ssize_t frames, ssize_t buf_len, void *data)
+{
+	int err;
+	sigset_t set, old_set;
+
+	pthread_mutex_lock(&r->lock);
+	r->istream = *istream;
+	r->ostream = *ostream;
+	r->frames = frames;
+	r->max_buf_len = buf_len;
+	++r->generation;
+	destroy_reload_chain(r, __atomic_exchange_n(&r->pending, NULL, __ATOMIC_ACQ_REL));
+	pthread_mutex_unlock(&r->lock);
+
+	destroy_reload_chain(r, r->fading);
+	r->fading = NULL;
+#ifndef SYMMETRIC_IO
+	r->draining = 0;
+#endif
+	if (r->cur == NULL)
+		r->cur = calloc(1, sizeof(struct reload_chain));
+	r->cur->frames = frames;
+	r->cur->buf_len = buf_len;
+	r->cur->data = data;
+
+	if (!r->has_thread) {
+		/* signals are handled by the main thread */
+		sigfillset(&set);
+		pthread_sigmask(SIG_SETMASK, &set, &old_set);
+		err = pthread_create(&r->thread, NULL, reload_thread, r);
+		pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+		if (err != 0) {
+			LOG_FMT(LL_ERROR, "reload: error: failed to create thread: %s", strerror(err));
+			return 1;
+		}
+		r->has_thread = 1;
+	}
+	return 0;
+}
+
+void reloader_trigger(struct reloader *r)
+{
+	wake_thread(r, RELOAD_FLAG_TRIGGER);
+}
+
+struct reload_chain * reloader_swap(struct reloader *r, struct effects_chain *chain)
+{
+	struct reload_chain *rc, *old;
+	if (r->fading != NULL || __atomic_load_n(&r->pending, __ATOMIC_RELAXED) == NULL)
+		return NULL;
+#ifndef SYMMETRIC_IO
+	if (r->draining)  /* the fifos belong to the current chain */
+		return NULL;
+#endif
+	if ((rc = __atomic_exchange_n(&r->pending, NULL, __ATOMIC_ACQUIRE)) == NULL)
+		return NULL;
+	old = r->cur;
+	old->chain = *chain;
+	*chain = rc->chain;
+	rc->chain.head = rc->chain.tail = NULL;
+	r->cur = rc;
+	if (r->fade_frames > 0) {
+		r->fading = old;
+		r->fade_pos = 0;
+#ifndef SYMMETRIC_IO
+		memset(r->fifo, 0, sizeof(r->fifo));
+		r->fifo[0].buf = rc->align_buf[0];
+		r->fifo[1].buf = rc->align_buf[1];
+		r->fifo[0].len = r->fifo[1].len = rc->align_frames;
+		r->next_label = 0;
+		r->aligned = 0;
+#endif
+	}
+	else
+		retire_chain(r, old);
+	return rc;
+}
+
+#ifndef SYMMETRIC_IO
+static int fifo_push(struct reload_fifo *f, const sample_t *buf, ssize_t frames, int channels, int planar)
+{
+	ssize_t i;
+	int k;
+	sample_t *d;
+	if (f->fill + frames > f->len)
+		return 1;
+	if (f->start + f->fill + frames > f->len) {
+		memmove(f->buf, &f->buf[f->start * channels], f->fill * channels * sizeof(sample_t));
+		f->start = 0;
+	}
+	d = &f->buf[(f->start + f->fill) * channels];
+	if (planar)
+		for (i = 0; i < frames; ++i)
+			for (k = 0; k < channels; ++k)
+				d[i * channels + k] = buf[k * frames + i];
+	else
+		memcpy(d, buf, frames * channels * sizeof(sample_t));
+	f->fill += frames;
+	return 0;
+}
+
+/* Drops the frames labeled before label */
+static void fifo_drop(struct reload_fifo *f, ssize_t label)
+{
+	const ssize_t n = MINIMUM(MAXIMUM(label - f->label, 0), f->fill);
+	f->start = (f->fill == n) ? 0 : f->start + n;
+	f->fill -= n;
+	f->label += n;
+}
+
+static int fifo_has(const struct reload_fifo *f, ssize_t label)
+{
+	return label >= f->label && label < f->label + f->fill;
+}
+
+static sample_t * fifo_frame(struct reload_fifo *f, ssize_t label, int channels)
+{
+	return &f->buf[(f->start + label - f->label) * channels];
+}
+
+/* Copies n interleaved frames to obuf */
+static void write_frames(sample_t *obuf, const sample_t *buf, ssize_t n, int channels, int planar)
+{
+	ssize_t i;
+	int k;
+	if (planar)
+		for (i = 0; i < n; ++i)
+			for (k = 0; k < channels; ++k)
+				obuf[k * n + i] = buf[i * channels + k];
+	else
+		memcpy(obuf, buf, n * channels * sizeof(sample_t));
+}
+
+static void end_fade(struct reloader *r)
+{
+	retire_chain(r, r->fading);
+	r->fading = NULL;
+	r->draining = (r->fifo[1].fill > 0);
+	LOG_S(LL_VERBOSE, "reload: info: crossfade done");
+}
+
+/* Queues the outputs of both chains and returns as many lined-up frames as
+   are ready (at most what fits the buffers) */
+static sample_t * crossfade_aligned(struct reloader *r, struct effects_chain *chain, sample_t *old_obuf, ssize_t old_frames, sample_t *obuf, ssize_t *frames, int planar)
+{
+	int k, channels = r->ostream.channels;
+	ssize_t n = 0, label = r->next_label;
+	const ssize_t max_frames = r->cur->buf_len / channels;
+	double g, old_delay, new_delay;
+	sample_t *buf = r->cur->fade_buf[0], *x, *y, *o;
+	struct reload_fifo *old_f = &r->fifo[0], *new_f = &r->fifo[1];
+
+	if (fifo_push(old_f, old_obuf, old_frames, channels, planar))
+		goto overflow;
+	if (!r->aligned && *frames > 0) {
+		/* the next output frame of each chain belongs to the input frame
+		   that is delay() frames behind the end of the input so far */
+		old_delay = get_effects_chain_delay(&r->fading->chain);
+		new_delay = get_effects_chain_delay(chain);
+		new_f->label = old_f->label + old_f->fill - *frames + lround((old_delay - new_delay) * r->ostream.fs);
+		r->aligned = 1;
+		LOG_FMT(LL_VERBOSE, "reload: info: new effects chain starts %zd frames after the swap", new_f->label);
+	}
+	if (r->aligned && fifo_push(new_f, obuf, *frames, channels, planar))
+		goto overflow;
+	fifo_drop(new_f, label);
+
+	while (n < max_frames) {
+		o = &buf[n * channels];
+		if (r->fade_pos >= r->fade_frames) {
+			if (!fifo_has(new_f, label))
+				break;
+			memcpy(o, fifo_frame(new_f, label, channels), channels * sizeof(sample_t));
+		}
+		else if (fifo_has(old_f, label) && (!r->aligned || label < new_f->label)) {
+			/* the new chain has no output for this frame yet */
+			memcpy(o, fifo_frame(old_f, label, channels), channels * sizeof(sample_t));
+		}
+		else if (fifo_has(old_f, label) && fifo_has(new_f, label)) {
+			/* linear crossfade: the outputs are highly correlated, so this
+			   keeps the level constant */
+			x = fifo_frame(old_f, label, channels);
+			y = fifo_frame(new_f, label, channels);
+			g = (double) MINIMUM(r->fade_pos + 1, r->fade_frames) / r->fade_frames;
+			for (k = 0; k < channels; ++k)
+				o[k] = x[k] + g * (y[k] - x[k]);
+			++r->fade_pos;
+		}
+		else
+			break;
+		++label;
+		++n;
+	}
+	r->next_label = label;
+	fifo_drop(old_f, label);
+	fifo_drop(new_f, label);
+	write_frames(obuf, buf, n, channels, planar);
+	*frames = n;
+	if (r->fade_pos >= r->fade_frames)
+		end_fade(r);
+	return obuf;
+
+	overflow:
+	LOG_S(LL_ERROR, "reload: warning: the latencies of the old and new effects chains differ too much to line them up; switching without a crossfade");
+	r->fifo[1].fill = 0;
+	end_fade(r);
+	return obuf;
+}
+
+/* Returns the frames of the new chain that are still queued after the
+   crossfade, followed by its current output */
+static sample_t * drain_aligned(struct reloader *r, sample_t *obuf, ssize_t *frames, int planar)
+{
+	int channels = r->ostream.channels;
+	struct reload_fifo *f = &r->fifo[1];
+	const ssize_t n = MINIMUM(f->fill, r->cur->buf_len / channels);
+	if (fifo_push(f, obuf, *frames, channels, planar)) {
+		/* can't happen: the buffers fit two blocks */
+		f->fill = 0;
+		r->draining = 0;
+		return obuf;
+	}
+	write_frames(obuf, fifo_frame(f, f->label, channels), n, channels, planar);
+	fifo_drop(f, f->label + n);
+	*frames = n;
+	r->draining = (f->fill > 0);
+	return obuf;
+}
+#endif
+
+sample_t * reloader_run(struct reloader *r, struct effects_chain *chain, ssize_t *frames, sample_t *buf1, sample_t *buf2, int planar)
+{
+	ssize_t old_frames = *frames;
+#ifdef SYMMETRIC_IO
+	int k, channels = r->ostream.channels;
+	ssize_t i, n;
+	double g, old_delay, new_delay;
+#endif
+	sample_t *obuf, *old_obuf;
+	sample_t * (*run)(struct effect *, ssize_t *, sample_t *, sample_t *) = (planar) ? run_effects_chain_planar : run_effects_chain;
+	struct reload_chain *old = r->fading;
+
+	if (*frames > __atomic_load_n(&r->seen_frames, __ATOMIC_RELAXED))
+		__atomic_store_n(&r->seen_frames, *frames, __ATOMIC_RELAXED);
+#ifndef SYMMETRIC_IO
+	if (r->draining) {
+		obuf = run(chain->head, frames, buf1, buf2);
+		return drain_aligned(r, obuf, frames, planar);
+	}
+#endif
+	if (old == NULL)
+		return run(chain->head, frames, buf1, buf2);
+	if (*frames > old->frames || *frames > r->cur->frames) {
+		/* the fade buffers are too small for this block */
+		r->fading = NULL;
+		retire_chain(r, old);
+		return run(chain->head, frames, buf1, buf2);
+	}
+
+	memcpy(r->cur->fade_buf[0], buf1, *frames * r->istream.channels * sizeof(sample_t));
+	old_obuf = run(old->chain.head, &old_frames, r->cur->fade_buf[0], r->cur->fade_buf[1]);
+	obuf = run(chain->head, frames, buf1, buf2);
+#ifndef SYMMETRIC_IO
+	return crossfade_aligned(r, chain, old_obuf, old_frames, obuf, frames, planar);
+#else
+	if (old_frames == *frames) {
+		/* linear crossfade: the outputs are highly correlated, so this
+		   keeps the level constant */
+		n = *frames;
+		for (i = 0; i < n; ++i) {
+			g = (double) MINIMUM(r->fade_pos + i + 1, r->fade_frames) / r->fade_frames;
+			if (planar)
+				for (k = 0; k < channels; ++k)
+					obuf[k * n + i] = old_obuf[k * n + i] + g * (obuf[k * n + i] - old_obuf[k * n + i]);
+			else
+				for (k = 0; k < channels; ++k)
+					obuf[i * channels + k] = old_obuf[i * channels + k] + g * (obuf[i * channels + k] - old_obuf[i * channels + k]);
+		}
+		r->fade_pos += n;
+	}
+	else {
+		/* can't happen: every effect outputs one frame per input frame */
+		LOG_S(LL_ERROR, "reload: warning: the new effects chain is out of step with the old one; switching without a crossfade");
+		r->fade_pos = r->fade_frames;
+	}
+	if (r->fade_pos >= r->fade_frames) {
+		if (old_frames == *frames) {
+			/* both chains have now run long enough for their latencies to be comparable */
+			old_delay = get_effects_chain_delay(&old->chain);
+			new_delay = get_effects_chain_delay(chain);
+			if (fabs(new_delay - old_delay) * r->ostream.fs >= 1.0)
+				LOG_FMT(LL_ERROR, "reload: warning: the old and new effects chains differ in latency (%gms and %gms at the end of the crossfade); the crossfade was not delay-matched", old_delay * 1000.0, new_delay * 1000.0);
+		}
+		r->fading = NULL;
+		retire_chain(r, old);
+		LOG_S(LL_VERBOSE, "reload: info: crossfade done");
+	}
+	return obuf;
+#endif
+}
+
+void reloader_destroy(struct reloader *r)
+{
+	int i;
+	if (r == NULL)
+		return;
+	if (r->has_thread) {
+		wake_thread(r, RELOAD_FLAG_STOP);
+		pthread_join(r->thread, NULL);
+		r->has_thread = 0;
+	}
+	destroy_reload_chain(r, r->pending);
+	destroy_reload_chain(r, r->retired);
+	destroy_reload_chain(r, r->fading);
+	if (r->cur != NULL) {
+		/* the chain and data belong to the frontend */
+		free(r->cur->fade_buf[0]);
+		free(r->cur->fade_buf[1]);
+		free(r->cur->align_buf[0]);
+		free(r->cur->align_buf[1]);
+		free(r->cur);
+	}
+	for (i = 0; i < r->n_watches; ++i)
+		free(r->watches[i].name);
+	free(r->watches);
+	if (r->ifd != -1)
+		close(r->ifd);
+	close(r->efd);
+	pthread_mutex_destroy(&r->lock);
+	free(r);
+}
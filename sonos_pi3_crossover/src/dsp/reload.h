@@ -0,0 +1,78 @@
+#ifndef _RELOAD_H
+#define _RELOAD_H
+
+#include "dsp.h"
+#include "effect.h"
+
+/* Hot reloading of effects chains. A background thread watches the effects
+   files (and config files) with inotify, rebuilds the chain when one of them
+   changes or when a reload is requested, and hands the new chain to the audio
+   thread, which swaps it in at a block boundary and crossfades from the
+   output of the old chain to the output of the new one. Old chains are
+   destroyed on the background thread. Effects must therefore be safe to
+   build and destroy concurrently with the frontend and other instances; FFTW
+   plans are serialized by fftw_cache. */
+
+struct reloader;
+
+struct reload_chain {
+	struct effects_chain chain;
+	ssize_t frames;   /* block size the chain was built for */
+	ssize_t buf_len;  /* buffer length needed for a block, in samples */
+	void *data;       /* frontend data attached to the chain (for example, its profile) */
+	sample_t *fade_buf[2];
+	sample_t *align_buf[2];  /* outputs of the old and new chain while they are lined up (not with SYMMETRIC_IO) */
+	ssize_t align_frames;    /* length of each align_buf, in frames */
+};
+
+/* Builds a new chain on the background thread. args: arg, stream (the input
+   stream on entry, set to the output stream), block size, chain (chain,
+   buf_len and data are to be filled in). Returns nonzero on failure. */
+typedef int (*reload_build_func)(void *, struct stream_info *, ssize_t, struct reload_chain *);
+/* Frees the data of a chain before the chain is destroyed, so the data can
+   detach itself from the chain first. May be NULL. */
+typedef void (*reload_destroy_data_func)(void *, void *);
+
+/* args: build func, destroy data func, arg, fade length in frames */
+struct reloader * reloader_new(reload_build_func, reload_destroy_data_func, void *, ssize_t);
+/* Watches the given file. Editors often replace files instead of writing
+   them, so the directory is watched. */
+int reloader_watch(struct reloader *, const char *);
+/* Watches the @effects_file arguments in an effects chain argument list.
+   args: reloader, argc, argv, dir */
+int reloader_watch_chain_args(struct reloader *, int, char **, const char *);
+/* Sets the streams, block size, buffer length and data of the current chain
+   and starts the background thread if it is not running. Must also be called
+   after the frontend rebuilds the chain itself; any pending chain and any
+   crossfade in progress are discarded. Not for the audio thread.
+   args: reloader, input stream, output stream, block size, buffer length, data */
+int reloader_reset(struct reloader *, const struct stream_info *, const struct stream_info *, ssize_t, ssize_t, void *);
+/* Requests a rebuild as if a watched file had changed */
+void reloader_trigger(struct reloader *);
+/* Called by the audio thread before each block. If a new chain is ready and
+   no crossfade is in progress, moves it into the given chain, starts a
+   crossfade from the old one and returns the new chain's info (the chain
+   member is empty). The caller must make its buffers at least buf_len long.
+   Returns NULL otherwise. */
+struct reload_chain * reloader_swap(struct reloader *, struct effects_chain *);
+/* Runs the given chain (like run_effects_chain() or, if planar is nonzero,
+   run_effects_chain_planar()), crossfading from the old chain if a crossfade
+   is in progress.
+
+   Without SYMMETRIC_IO, the outputs are delay-matched: the old chain's output
+   is passed through until the new chain produces output (for example, once a
+   block-based filter has filled), and the two outputs are then lined up using
+   the effects' delay() callbacks, so each output frame mixes frames that
+   belong to the same input frame. A change in latency changes the number of
+   frames that are returned: fewer while the crossfade waits for a new chain
+   with more latency, more after it ends for one with less latency.
+
+   With SYMMETRIC_IO, the number of frames can't change, so the outputs are
+   mixed as they are. If the chains differ in latency, the crossfade is
+   between misaligned signals and a warning is printed when it ends. */
+sample_t * reloader_run(struct reloader *, struct effects_chain *, ssize_t *, sample_t *, sample_t *, int);
+/* Stops the background thread and destroys every chain other than the
+   current one. The data of the current chain is not freed. */
+void reloader_destroy(struct reloader *);
+
+#endif
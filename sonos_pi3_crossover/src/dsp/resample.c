@@ -6,6 +6,7 @@
 #include <fftw3.h>
 #include "resample.h"
 #include "util.h"
+#include "fftw_cache.h"
 
 /* Tunables */
 static const double default_bw = 0.95;  /* default bandwidth */
@@ -16,10 +17,10 @@ struct resample_state {
 		int n, d;
 	} ratio;
 	ssize_t m, sinc_len, sinc_fr_len, tmp_fr_len, in_len, out_len, in_buf_pos, out_buf_pos, drain_pos, drain_frames, out_delay;
-	fftw_complex *sinc_fr;
-	fftw_complex *tmp_fr;
+	FFTW(complex) *sinc_fr;
+	FFTW(complex) *tmp_fr;
 	sample_t **input, **output, **overlap;
-	fftw_plan *r2c_plan, *c2r_plan;
+	FFTW(plan) *r2c_plan, *c2r_plan;
 	int has_output, is_draining;
 };
 
@@ -47,12 +48,16 @@ sample_t * resample_effect_run(struct effect *e, ssize_t *frames, sample_t *ibuf
 		if (state->in_buf_pos == state->in_len && (!state->has_output || state->out_buf_pos == state->out_len)) {
 			for (i = 0; i < e->ostream.channels; ++i) {
 				/* FFT(state->input[i]) -> state->tmp_fr */
-				fftw_execute(state->r2c_plan[i]);
+				FFTW(execute)(state->r2c_plan[i]);
 				/* convolve input with sinc filter */
 				for (k = 0; k < state->sinc_fr_len; ++k)
 					state->tmp_fr[k] *= state->sinc_fr[k];
+				/* when upsampling, the bins above in_len are not written by
+				   the r2c transform, and the c2r transform may clobber them */
+				if (state->out_len > state->in_len)
+					memset(&state->tmp_fr[state->in_len + 1], 0, (state->out_len - state->in_len) * sizeof(FFTW(complex)));
 				/* IFFT(state->tmp_fr) -> state->output[i] */
-				fftw_execute(state->c2r_plan[i]);
+				FFTW(execute)(state->c2r_plan[i]);
 				/* normalize */
 				for (k = 0; k < state->out_len * 2; ++k)
 					state->output[i][k] /= state->in_len * 2;
@@ -123,14 +128,14 @@ void resample_effect_destroy(struct effect *e)
 {
 	int i;
 	struct resample_state *state = (struct resample_state *) e->data;
-	fftw_free(state->sinc_fr);
-	fftw_free(state->tmp_fr);
+	FFTW(free)(state->sinc_fr);
+	FFTW(free)(state->tmp_fr);
 	for (i = 0; i < e->ostream.channels; ++i) {
-		fftw_free(state->input[i]);
-		fftw_free(state->output[i]);
-		fftw_free(state->overlap[i]);
-		fftw_destroy_plan(state->r2c_plan[i]);
-		fftw_destroy_plan(state->c2r_plan[i]);
+		FFTW(free)(state->input[i]);
+		FFTW(free)(state->output[i]);
+		FFTW(free)(state->overlap[i]);
+		fftw_cache_destroy_plan(state->r2c_plan[i]);
+		fftw_cache_destroy_plan(state->c2r_plan[i]);
 	}
 	free(state->input);
 	free(state->output);
@@ -148,7 +153,7 @@ struct effect * resample_effect_init(struct effect_info *ei, struct stream_info
 	int rate, max_rate, min_rate, max_factor, gcd, i;
 	double bw = default_bw;
 	sample_t *sinc, width, fc, m;
-	fftw_plan sinc_plan;
+	FFTW(plan) sinc_plan;
 
 	if (argc < 2 || argc > 3) {
 		LOG_FMT(LL_ERROR, "%s: usage: %s", argv[0], ei->usage);
@@ -212,29 +217,31 @@ struct effect * resample_effect_init(struct effect_info *ei, struct stream_info
 		state->out_delay = lround((double) state->m / 2 * state->ratio.n / state->ratio.d);
 
 	/* allocate arrays, construct fftw plans */
-	sinc = fftw_malloc(state->sinc_len * 2 * sizeof(sample_t));
+	sinc = FFTW(malloc)(state->sinc_len * 2 * sizeof(sample_t));
 	memset(sinc, 0, state->sinc_len * 2 * sizeof(sample_t));
-	state->sinc_fr = fftw_malloc(state->sinc_fr_len * sizeof(fftw_complex));
-	memset(state->sinc_fr, 0, state->sinc_fr_len * sizeof(fftw_complex));
-	sinc_plan = fftw_plan_dft_r2c_1d(state->sinc_len * 2, sinc, state->sinc_fr, FFTW_ESTIMATE);
+	state->sinc_fr = FFTW(malloc)(state->sinc_fr_len * sizeof(FFTW(complex)));
+	memset(state->sinc_fr, 0, state->sinc_fr_len * sizeof(FFTW(complex)));
+	sinc_plan = fftw_cache_plan_estimate(state->sinc_len * 2, sinc, state->sinc_fr);
 
-	state->tmp_fr = fftw_malloc(state->tmp_fr_len * sizeof(fftw_complex));
-	memset(state->tmp_fr, 0, state->tmp_fr_len * sizeof(fftw_complex));
+	state->tmp_fr = FFTW(malloc)(state->tmp_fr_len * sizeof(FFTW(complex)));
 	state->input = calloc(e->ostream.channels, sizeof(sample_t *));
 	state->output = calloc(e->ostream.channels, sizeof(sample_t *));
 	state->overlap = calloc(e->ostream.channels, sizeof(sample_t *));
-	state->r2c_plan = calloc(e->ostream.channels, sizeof(fftw_plan));
-	state->c2r_plan = calloc(e->ostream.channels, sizeof(fftw_plan));
+	state->r2c_plan = calloc(e->ostream.channels, sizeof(FFTW(plan)));
+	state->c2r_plan = calloc(e->ostream.channels, sizeof(FFTW(plan)));
 	for (i = 0; i < e->ostream.channels; ++i) {
-		state->input[i] = fftw_malloc(state->in_len * 2 * sizeof(sample_t));
+		state->input[i] = FFTW(malloc)(state->in_len * 2 * sizeof(sample_t));
+		state->output[i] = FFTW(malloc)(state->out_len * 2 * sizeof(sample_t));
+		state->overlap[i] = FFTW(malloc)(state->out_len * sizeof(sample_t));
+		memset(state->overlap[i], 0, state->out_len * sizeof(sample_t));
+		state->r2c_plan[i] = fftw_cache_plan_r2c(state->in_len * 2, state->input[i], state->tmp_fr);
+		state->c2r_plan[i] = fftw_cache_plan_c2r(state->out_len * 2, state->tmp_fr, state->output[i]);
 		memset(state->input[i], 0, state->in_len * 2 * sizeof(sample_t));
-		state->output[i] = fftw_malloc(state->out_len * 2 * sizeof(sample_t));
 		memset(state->output[i], 0, state->out_len * 2 * sizeof(sample_t));
-		state->overlap[i] = fftw_malloc(state->out_len * sizeof(sample_t));
-		memset(state->overlap[i], 0, state->out_len * sizeof(sample_t));
-		state->r2c_plan[i] = fftw_plan_dft_r2c_1d(state->in_len * 2, state->input[i], state->tmp_fr, FFTW_ESTIMATE);
-		state->c2r_plan[i] = fftw_plan_dft_c2r_1d(state->out_len * 2, state->tmp_fr, state->output[i], FFTW_ESTIMATE);
 	}
+	/* planning may overwrite the arrays */
+	memset(state->tmp_fr, 0, state->tmp_fr_len * sizeof(FFTW(complex)));
+	fftw_cache_save_wisdom();
 
 	/* generate windowed sinc function */
 	for (i = 0; i < (int) m + 1; ++i) {
@@ -251,9 +258,9 @@ struct effect * resample_effect_init(struct effect_info *ei, struct stream_info
 		/* sinc[i] *= 0.3635819 - 0.4891775 * cos(2 * M_PI * i / m) + 0.1365995 * cos(4 * M_PI * i / m) - 0.0106411 * cos(6 * M_PI * i / m); */
 	}
 
-	fftw_execute(sinc_plan);
-	fftw_destroy_plan(sinc_plan);
-	fftw_free(sinc);
+	FFTW(execute)(sinc_plan);
+	fftw_cache_destroy_plan(sinc_plan);
+	FFTW(free)(sinc);
 
 	/* convolve sinc function with itself (doubles stopband attenuation) */
 	for (i = 0; i < state->sinc_fr_len; ++i)
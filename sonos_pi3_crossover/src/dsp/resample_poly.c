@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "resample_poly.h"
+#include "util.h"
+
+/* Streaming polyphase FIR resampler. For a ratio of l/m (in lowest terms),
+   output frame k is the input upsampled by l, lowpass filtered, and sampled
+   at k*m. Only the taps that line up with input frames are evaluated, so each
+   output frame costs one dot product of the coefficients of phase (k*m)%l with
+   the most recent input frames.
+
+   The number of output frames depends only on the total number of input
+   frames: ceil(n*l/m) when upsampling and floor(n*l/m) when downsampling.
+   Upsampling followed by downsampling by the inverse ratio therefore yields
+   exactly one output frame per input frame for any block size, which is what
+   allows a pair of resamplers to be used in ladspa_dsp. */
+
+/* Tunables */
+static const double default_bw = 0.95;  /* default bandwidth */
+static const double m_fact = 8;         /* controls window size; 8 for Nuttall window */
+
+#define POLY_VEC_SIZE 16
+#define POLY_LANES    ((int) (POLY_VEC_SIZE / sizeof(sample_t)))
+#define MAX_COEFS     (1 << 22)
+#define CHUNK_FRAMES  1024
+
+typedef sample_t poly_vec_t __attribute__((vector_size(POLY_VEC_SIZE)));
+typedef sample_t poly_uvec_t __attribute__((vector_size(POLY_VEC_SIZE), aligned(sizeof(sample_t))));  /* unaligned */
+
+struct resample_poly_pos {
+	ssize_t fill, in_pos, n_in, n_out;  /* in_pos is the input frame number of buf[i][0] */
+};
+
+struct resample_poly_state {
+	int l, m, taps, has_input, is_draining;  /* taps per phase is a multiple of 2 * POLY_LANES */
+	ssize_t buf_len, out_delay, drain_pos, drain_frames;
+	poly_vec_t *coefs;  /* taps per phase, time reversed, one phase after another */
+	sample_t **buf;
+	struct resample_poly_pos pos;
+};
+
+static __inline__ sample_t poly_dot(const sample_t *x, const poly_vec_t *c, int n_vec)
+{
+	int k;
+	const poly_uvec_t *xv = (const poly_uvec_t *) x;
+	poly_vec_t acc0 = { 0 }, acc1 = { 0 }, x0, x1;
+	sample_t r = 0;
+	for (k = 0; k < n_vec; k += 2) {
+		x0 = xv[k];
+		x1 = xv[k + 1];
+		acc0 += x0 * c[k];
+		acc1 += x1 * c[k + 1];
+	}
+	acc0 += acc1;
+	for (k = 0; k < POLY_LANES; ++k)
+		r += acc0[k];
+	return r;
+}
+
+static ssize_t resample_poly_target(struct resample_poly_state *state, ssize_t n_in)
+{
+	long long int r = (long long int) n_in * state->l;
+	return (ssize_t) ((state->l > state->m) ? (r + state->m - 1) / state->m : r / state->m);
+}
+
+/* Runs channel i. in and out point to the channel's first sample and successive frames are stride samples apart.
+   The updated position is stored in pos. */
+static ssize_t resample_poly_run_channel(struct resample_poly_state *state, int i, ssize_t frames, const sample_t *in, sample_t *out, ssize_t stride, struct resample_poly_pos *pos)
+{
+	sample_t *x = state->buf[i];
+	const int n_vec = state->taps / POLY_LANES;
+	ssize_t n, target, keep, iframes = 0, oframes = 0;
+	long long int p;
+
+	*pos = state->pos;
+	while (iframes < frames) {
+		n = MINIMUM(state->buf_len - pos->fill, frames - iframes);
+		copy_samples(&x[pos->fill], 1, (in) ? &in[iframes * stride] : NULL, stride, n);
+		pos->fill += n;
+		pos->n_in += n;
+		iframes += n;
+		target = resample_poly_target(state, pos->n_in);
+		for (; pos->n_out < target; ++pos->n_out) {
+			p = (long long int) pos->n_out * state->m;
+			out[oframes++ * stride] = poly_dot(&x[p / state->l - pos->in_pos - state->taps + 1], &state->coefs[(p % state->l) * n_vec], n_vec);
+		}
+		if (pos->fill == state->buf_len) {
+			/* keep only the frames needed by the next output frame */
+			keep = (long long int) pos->n_out * state->m / state->l - pos->in_pos - state->taps + 1;
+			memmove(x, &x[keep], (pos->fill - keep) * sizeof(sample_t));
+			pos->fill -= keep;
+			pos->in_pos += keep;
+		}
+	}
+	return oframes;
+}
+
+static void resample_poly_commit(struct resample_poly_state *state, struct resample_poly_pos *pos)
+{
+	/* keep the counters small; m input frames always map to l output frames */
+	ssize_t q = MINIMUM(pos->n_out / state->l, pos->n_in / state->m);
+	pos->n_out -= q * state->l;
+	pos->n_in -= q * state->m;
+	pos->in_pos -= q * state->m;
+	state->pos = *pos;
+}
+
+sample_t * resample_poly_effect_run(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf)
+{
+	struct resample_poly_state *state = (struct resample_poly_state *) e->data;
+	struct resample_poly_pos pos;
+	ssize_t oframes = 0;
+	int i;
+	for (i = 0; i < e->ostream.channels; ++i)
+		oframes = resample_poly_run_channel(state, i, *frames, (ibuf) ? &ibuf[i] : NULL, &obuf[i], e->ostream.channels, &pos);
+	resample_poly_commit(state, &pos);
+	if (ibuf)
+		state->has_input = 1;
+	*frames = oframes;
+	return obuf;
+}
+
+sample_t * resample_poly_effect_run_planar(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf)
+{
+	struct resample_poly_state *state = (struct resample_poly_state *) e->data;
+	struct resample_poly_pos pos;
+	const ssize_t out_frames = resample_poly_target(state, state->pos.n_in + *frames) - state->pos.n_out;
+	int i;
+	for (i = 0; i < e->ostream.channels; ++i)
+		resample_poly_run_channel(state, i, *frames, &ibuf[i * *frames], &obuf[i * out_frames], 1, &pos);
+	resample_poly_commit(state, &pos);
+	state->has_input = 1;
+	*frames = out_frames;
+	return obuf;
+}
+
+ssize_t resample_poly_effect_delay(struct effect *e)
+{
+	struct resample_poly_state *state = (struct resample_poly_state *) e->data;
+	return state->out_delay;
+}
+
+static void resample_poly_init_pos(struct resample_poly_state *state)
+{
+	/* the history starts out as taps - 1 frames of silence */
+	state->pos.fill = state->taps - 1;
+	state->pos.in_pos = -(state->taps - 1);
+	state->pos.n_in = state->pos.n_out = 0;
+}
+
+void resample_poly_effect_reset(struct effect *e)
+{
+	int i;
+	struct resample_poly_state *state = (struct resample_poly_state *) e->data;
+	for (i = 0; i < e->ostream.channels; ++i)
+		memset(state->buf[i], 0, state->buf_len * sizeof(sample_t));
+	resample_poly_init_pos(state);
+	state->has_input = 0;
+}
+
+void resample_poly_effect_drain(struct effect *e, ssize_t *frames, sample_t *obuf)
+{
+	struct resample_poly_state *state = (struct resample_poly_state *) e->data;
+	if (!state->has_input)
+		*frames = -1;
+	else {
+		if (!state->is_draining) {
+			state->drain_frames = state->out_delay + 1;
+			state->is_draining = 1;
+		}
+		if (state->drain_pos < state->drain_frames) {
+			resample_poly_effect_run(e, frames, NULL, obuf);
+			state->drain_pos += *frames;
+			*frames -= (state->drain_pos > state->drain_frames) ? state->drain_pos - state->drain_frames : 0;
+		}
+		else
+			*frames = -1;
+	}
+}
+
+void resample_poly_effect_destroy(struct effect *e)
+{
+	int i;
+	struct resample_poly_state *state = (struct resample_poly_state *) e->data;
+	for (i = 0; i < e->ostream.channels; ++i)
+		free(state->buf[i]);
+	free(state->buf);
+	free(state->coefs);
+	free(state);
+}
+
+struct effect * resample_poly_effect_init(struct effect_info *ei, struct stream_info *istream, char *channel_selector, const char *dir, int argc, char **argv)
+{
+	struct effect *e;
+	struct resample_poly_state *state;
+	char *endptr;
+	int rate, min_rate, gcd, i;
+	ssize_t j, n;
+	double bw = default_bw, width, fc, t, x, h;
+	sample_t *coefs;
+
+	if (argc < 2 || argc > 3) {
+		LOG_FMT(LL_ERROR, "%s: usage: %s", argv[0], ei->usage);
+		return NULL;
+	}
+	if (argc == 3) {
+		bw = strtod(argv[1], &endptr);
+		CHECK_ENDPTR(argv[1], endptr, "bandwidth", return NULL);
+		rate = lround(parse_freq(argv[2], &endptr));
+		CHECK_ENDPTR(argv[2], endptr, "fs", return NULL);
+	}
+	else {
+		rate = lround(parse_freq(argv[1], &endptr));
+		CHECK_ENDPTR(argv[1], endptr, "fs", return NULL);
+	}
+	CHECK_RANGE(bw > 0 && bw < 1, "bandwidth", return NULL);
+	CHECK_RANGE(rate > 0, "rate", return NULL);
+
+	e = calloc(1, sizeof(struct effect));
+	if (rate == istream->fs) {
+		LOG_FMT(LL_VERBOSE, "%s: info: sample rates match; no proccessing will be done", argv[0]);
+		return e;  /* Note: the effect will not be used because run() is unset */
+	}
+
+	state = calloc(1, sizeof(struct resample_poly_state));
+	gcd = find_gcd(rate, istream->fs);
+	state->l = rate / gcd;
+	state->m = istream->fs / gcd;
+	min_rate = MINIMUM(rate, istream->fs);
+
+	/* windowed sinc lowpass at istream->fs * l; the stopband starts at min_rate / 2 */
+	width = (min_rate - min_rate * bw) / 2;
+	fc = (min_rate - width) / 2 / ((double) istream->fs * state->l);  /* cycles per sample */
+	state->taps = (int) ceil(m_fact * istream->fs / width);
+	state->taps = (state->taps + 2 * POLY_LANES - 1) / (2 * POLY_LANES) * (2 * POLY_LANES);
+	n = (ssize_t) state->taps * state->l;
+	if (n > MAX_COEFS) {
+		LOG_FMT(LL_ERROR, "%s: error: ratio %d/%d needs too many coefficients (%zd); use the resample effect instead", argv[0], state->l, state->m, n);
+		free(state);
+		free(e);
+		return NULL;
+	}
+	if (posix_memalign((void **) &state->coefs, POLY_VEC_SIZE, n * sizeof(sample_t)) != 0) {
+		LOG_FMT(LL_ERROR, "%s: error: failed to allocate coefficients", argv[0]);
+		free(state);
+		free(e);
+		return NULL;
+	}
+	coefs = (sample_t *) state->coefs;
+	for (j = 0; j < n; ++j) {
+		t = j - (n - 1) / 2.0;
+		h = (t == 0) ? 2 * fc : sin(2 * M_PI * fc * t) / (M_PI * t);
+		/* apply Nuttall window (continuous first derivative) (~112dB stopband attenuation) */
+		x = (double) j / (n - 1);
+		h *= 0.355768 - 0.487396 * cos(2 * M_PI * x) + 0.144232 * cos(4 * M_PI * x) - 0.012604 * cos(6 * M_PI * x);
+		/* compensate for the zeros between the upsampled input frames */
+		coefs[(j % state->l) * state->taps + state->taps - 1 - j / state->l] = h * state->l;
+	}
+	state->out_delay = lround((n - 1) / (2.0 * state->m));
+	state->buf_len = state->taps + MAXIMUM(CHUNK_FRAMES, 2 * (state->m / state->l + 2));
+	state->buf = calloc(istream->channels, sizeof(sample_t *));
+	for (i = 0; i < istream->channels; ++i)
+		state->buf[i] = calloc(state->buf_len, sizeof(sample_t));
+	resample_poly_init_pos(state);
+	LOG_FMT(LL_VERBOSE, "%s: info: ratio=%d/%d taps_per_phase=%d delay=%zd", argv[0], state->l, state->m, state->taps, state->out_delay);
+
+	e->name = ei->name;
+	e->istream.fs = istream->fs;
+	e->ostream.fs = rate;
+	e->istream.channels = e->ostream.channels = istream->channels;
+	e->run = resample_poly_effect_run;
+	e->run_planar = resample_poly_effect_run_planar;
+	e->delay = resample_poly_effect_delay;
+	e->reset = resample_poly_effect_reset;
+	e->drain = resample_poly_effect_drain;
+	e->destroy = resample_poly_effect_destroy;
+	e->data = state;
+
+	return e;
+}
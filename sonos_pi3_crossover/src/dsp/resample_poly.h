@@ -0,0 +1,9 @@
+#ifndef _RESAMPLE_POLY_H
+#define _RESAMPLE_POLY_H
+
+#include "dsp.h"
+#include "effect.h"
+
+struct effect * resample_poly_effect_init(struct effect_info *, struct stream_info *, char *, const char *, int, char **);
+
+#endif
@@ -0,0 +1,190 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <alloca.h>
+#include <malloc.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "rt.h"
+#include "util.h"
+
+#define MAIN_STACK_PREFAULT   (512 * 1024)
+#define WORKER_STACK_PREFAULT (64 * 1024)
+#define PAGE_BYTES            4096
+
+static struct {
+	int enabled, priority, has_cpus, has_worker_cpus;
+	cpu_set_t cpus, worker_cpus;
+} rt;
+
+/* Parses a list like "0,2-3" up to the first ':' or the end of the string.
+   Returns a pointer to the character after the list or NULL on error. */
+static const char * parse_cpu_list(const char *s, cpu_set_t *set)
+{
+	char *endptr;
+	long i, first, last;
+	CPU_ZERO(set);
+	for (;;) {
+		first = last = strtol(s, &endptr, 10);
+		if (endptr == s || first < 0) return NULL;
+		if (*endptr == '-') {
+			s = endptr + 1;
+			last = strtol(s, &endptr, 10);
+			if (endptr == s || last < first) return NULL;
+		}
+		if (last >= CPU_SETSIZE) return NULL;
+		for (i = first; i <= last; ++i)
+			CPU_SET(i, set);
+		if (*endptr != ',') return endptr;
+		s = endptr + 1;
+	}
+}
+
+/* Touches the stack pages the thread is likely to use so that they are
+   faulted in (and locked) before any audio is processed */
+static void __attribute__((noinline)) prefault_stack(size_t bytes)
+{
+	size_t i;
+	volatile unsigned char *p = alloca(bytes);
+	for (i = 0; i < bytes; i += PAGE_BYTES)
+		p[i] = 0;
+}
+
+/* Uses SCHED_OTHER if priority is 0 */
+static void set_thread_sched(const char *name, int priority, const cpu_set_t *cpus)
+{
+	int err;
+	struct sched_param sp;
+	memset(&sp, 0, sizeof(sp));
+	sp.sched_priority = priority;
+	if ((err = pthread_setschedparam(pthread_self(), (priority > 0) ? SCHED_FIFO : SCHED_OTHER, &sp)) != 0)
+		LOG_FMT(LL_ERROR, "rt: warning: %s: failed to set %s priority %d: %s", name,
+			(priority > 0) ? "SCHED_FIFO" : "SCHED_OTHER", priority, strerror(err));
+	if (cpus != NULL && (err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), cpus)) != 0)
+		LOG_FMT(LL_ERROR, "rt: warning: %s: failed to set CPU affinity: %s", name, strerror(err));
+}
+
+int rt_enable(const char *arg)
+{
+	char *endptr;
+	const char *s;
+	int i, max_prio = sched_get_priority_max(SCHED_FIFO), min_prio = sched_get_priority_min(SCHED_FIFO);
+
+	rt.priority = strtol(arg, &endptr, 10);
+	if (endptr == arg || (*endptr != '\0' && *endptr != ':'))
+		goto parse_fail;
+	if (rt.priority < min_prio || rt.priority > max_prio) {
+		LOG_FMT(LL_ERROR, "rt: error: priority must be within [%d,%d]", min_prio, max_prio);
+		return 1;
+	}
+	if (*endptr == ':') {
+		if ((s = parse_cpu_list(endptr + 1, &rt.cpus)) == NULL || (*s != '\0' && *s != ':'))
+			goto parse_fail;
+		rt.has_cpus = 1;
+		if (*s == ':') {
+			if ((s = parse_cpu_list(s + 1, &rt.worker_cpus)) == NULL || *s != '\0')
+				goto parse_fail;
+			rt.has_worker_cpus = 1;
+		}
+		else {
+			CPU_ZERO(&rt.worker_cpus);
+			for (i = 0; i < CPU_SETSIZE && i < sysconf(_SC_NPROCESSORS_CONF); ++i)
+				if (!CPU_ISSET(i, &rt.cpus))
+					CPU_SET(i, &rt.worker_cpus);
+			rt.has_worker_cpus = (CPU_COUNT(&rt.worker_cpus) > 0);
+		}
+	}
+
+	/* keep freed memory (and large blocks) in the locked heap so that
+	   reallocating a buffer doesn't fault in new pages */
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+		LOG_FMT(LL_ERROR, "rt: warning: failed to lock memory: %s", strerror(errno));
+	set_thread_sched("main thread", rt.priority, (rt.has_cpus) ? &rt.cpus : NULL);
+	prefault_stack(MAIN_STACK_PREFAULT);
+	rt.enabled = 1;
+	LOG_FMT(LL_VERBOSE, "rt: info: SCHED_FIFO priority %d; cpus: %d; worker cpus: %d", rt.priority,
+		(rt.has_cpus) ? CPU_COUNT(&rt.cpus) : -1, (rt.has_worker_cpus) ? CPU_COUNT(&rt.worker_cpus) : -1);
+	return 0;
+
+	parse_fail:
+	LOG_FMT(LL_ERROR, "rt: error: failed to parse real-time settings: %s", arg);
+	return 1;
+}
+
+int rt_is_enabled(void)
+{
+	return rt.enabled;
+}
+
+int rt_thread_priority(int type)
+{
+	if (!rt.enabled || type == RT_THREAD_CONTROL)
+		return 0;
+	/* background work must not preempt the work that is due every block */
+	if (type == RT_THREAD_BACKGROUND)
+		return MAXIMUM(rt.priority - 1, sched_get_priority_min(SCHED_FIFO));
+	return rt.priority;
+}
+
+void rt_thread_init(int type)
+{
+	if (!rt.enabled)
+		return;
+	set_thread_sched((type == RT_THREAD_WORKER) ? "worker thread" : (type == RT_THREAD_BACKGROUND) ? "background thread" : "control thread",
+		rt_thread_priority(type), (rt.has_worker_cpus) ? &rt.worker_cpus : NULL);
+	/* a control thread has no deadline, so page faults don't matter */
+	if (type != RT_THREAD_CONTROL)
+		prefault_stack(WORKER_STACK_PREFAULT);
+}
+
+void rt_spawn_on_worker_cpus(int enter)
+{
+	if (!rt.enabled || !rt.has_cpus || !rt.has_worker_cpus)
+		return;
+	pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), (enter) ? &rt.worker_cpus : &rt.cpus);
+}
+
+static double elapsed(const struct timespec *t0)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - t0->tv_sec) + (now.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+void rt_watchdog_start(struct rt_watchdog *w)
+{
+	clock_gettime(CLOCK_MONOTONIC, &w->t0);
+}
+
+void rt_watchdog_stop(struct rt_watchdog *w, ssize_t frames, int fs)
+{
+	double t, period, load;
+	if (frames <= 0)
+		return;
+	t = elapsed(&w->t0);
+	period = (double) frames / fs;
+	load = t / period;
+	if (w->blocks == 0 || period - t < w->min_slack)
+		w->min_slack = period - t;
+	++w->blocks;
+	w->load_sum += load;
+	w->load_max = MAXIMUM(w->load_max, load);
+	if (load > 1.0)
+		++w->misses;
+}
+
+void rt_watchdog_report(struct rt_watchdog *w)
+{
+	if (w->blocks == 0)
+		return;
+	LOG_FMT((w->misses > 0) ? LL_NORMAL : LL_VERBOSE,
+		"rt: %s: %ld blocks; load: avg=%.1f%% max=%.1f%%; min slack=%.3fms; deadline misses: %ld",
+		(w->misses > 0) ? "warning" : "info", w->blocks, w->load_sum / w->blocks * 100.0, w->load_max * 100.0,
+		w->min_slack * 1000.0, w->misses);
+}
@@ -0,0 +1,46 @@
+#ifndef _RT_H
+#define _RT_H
+
+#include <time.h>
+#include "dsp.h"
+
+enum {
+	RT_THREAD_WORKER,      /* runs part of every block (pipeline stages, channel shards) */
+	RT_THREAD_BACKGROUND,  /* runs work that is due less often than every block */
+	RT_THREAD_CONTROL,     /* runs work with no deadline (rebuilding the effects chain) */
+};
+
+/* Watchdog for the main processing loop. The load of a block is the time
+   spent processing it divided by the time it represents. */
+struct rt_watchdog {
+	struct timespec t0;
+	long blocks, misses;
+	double load_sum, load_max;
+	double min_slack;  /* seconds */
+};
+
+/* Parses "priority[:cpus[:worker_cpus]]" and switches the calling thread to
+   SCHED_FIFO at the given priority, pinned to cpus (a list like "1" or
+   "0,2-3"), after locking all current and future memory. Threads that call
+   rt_thread_init() later are pinned to worker_cpus, which defaults to every
+   CPU not in cpus. Failing to get a privilege is only a warning. */
+int rt_enable(const char *);
+int rt_is_enabled(void);
+/* Applies the real-time settings (if enabled) to the calling thread. Called
+   at the start of every worker thread. */
+void rt_thread_init(int);
+/* Returns the SCHED_FIFO priority for the given thread type, or 0 if
+   real-time mode is not enabled or the thread should not run at a real-time
+   priority. For threads created by libraries. */
+int rt_thread_priority(int);
+/* Threads inherit the CPU affinity of their creator. Call with a nonzero
+   argument before a library creates its threads and with zero afterward so
+   that they are pinned to the worker CPUs. Called from the main thread. */
+void rt_spawn_on_worker_cpus(int);
+
+void rt_watchdog_start(struct rt_watchdog *);
+/* args: frames processed, sample rate */
+void rt_watchdog_stop(struct rt_watchdog *, ssize_t, int);
+void rt_watchdog_report(struct rt_watchdog *);
+
+#endif
@@ -1,4 +1,52 @@
 #include "sampleconv.h"
+#include "dither.h"
+
+/* The 16, 24, and 32-bit integer and the float/double conversions process
+   VEC_LEN samples at a time using GCC vector extensions, which compile to
+   SSE/AVX on x86 and NEON on aarch64. The results are identical to the scalar
+   macros in sampleconv.h, which handle the remaining samples. On x86_64, the
+   kernels are also compiled for AVX2 and the best version is selected when
+   the program is loaded.
+
+   Writes run forward and reads run backward so that the in-place use
+   described in sampleconv.h still works: each vector is loaded before the
+   result is stored, and a store never reaches memory that has not been loaded
+   yet. */
+
+#define VEC_LEN 4
+
+typedef sample_t sample_vec_t __attribute__((vector_size(VEC_LEN * sizeof(sample_t)), aligned(sizeof(sample_t))));
+typedef int32_t s32_vec_t __attribute__((vector_size(VEC_LEN * 4), aligned(4)));
+typedef int16_t s16_vec_t __attribute__((vector_size(VEC_LEN * 2), aligned(2)));
+typedef float float_vec_t __attribute__((vector_size(VEC_LEN * sizeof(float)), aligned(sizeof(float))));
+typedef double double_vec_t __attribute__((vector_size(VEC_LEN * sizeof(double)), aligned(sizeof(double))));
+typedef uint32_t u32_vec_t __attribute__((vector_size(VEC_LEN * 4), aligned(4)));
+#ifdef SINGLE_PRECISION
+typedef int32_t sample_mask_t __attribute__((vector_size(VEC_LEN * sizeof(sample_t))));
+#else
+typedef int64_t sample_mask_t __attribute__((vector_size(VEC_LEN * sizeof(sample_t))));
+#endif
+
+#define VEC_SELECT(m, a, b) ((sample_vec_t) (((sample_mask_t) (a) & (m)) | ((sample_mask_t) (b) & ~(m))))
+
+#if defined(__x86_64__) && defined(__linux__) && defined(__GNUC__) && !defined(__clang__)
+	#define SAMPLECONV_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+	#define SAMPLECONV_CLONES
+#endif
+
+/* Returns lround(clamp(v * scale, -scale, max)). The clamp matches the
+   BIT_PERFECT macros at the top and keeps the conversion in range. */
+static __inline__ __attribute__((always_inline)) s32_vec_t vec_scale_round(sample_vec_t v, sample_t scale, sample_t max)
+{
+	sample_vec_t y = v * scale, d;
+	s32_vec_t r;
+	y = VEC_SELECT(y > max, (sample_vec_t) { 0 } + max, y);
+	y = VEC_SELECT(y < -scale, (sample_vec_t) { 0 } - scale, y);
+	r = __builtin_convertvector(y, s32_vec_t);  /* truncates */
+	d = y - __builtin_convertvector(r, sample_vec_t);  /* exact */
+	return r + __builtin_convertvector((d <= (sample_t) -0.5) - (d >= (sample_t) 0.5), s32_vec_t);
+}
 
 void write_buf_u8(sample_t *in, char *out, ssize_t s)
 {
@@ -30,56 +78,88 @@ void read_buf_s8(char *in, sample_t *out, ssize_t s)
 		out[s] = S8_TO_SAMPLE(inn[s]);
 }
 
+SAMPLECONV_CLONES
 void write_buf_s16(sample_t *in, char *out, ssize_t s)
 {
 	int16_t *outn = (int16_t *) out;
-	ssize_t p = -1;
-	while (++p < s)
+	ssize_t p = 0;
+	for (; p + VEC_LEN <= s; p += VEC_LEN)
+		*(s16_vec_t *) &outn[p] = __builtin_convertvector(vec_scale_round(*(sample_vec_t *) &in[p], 32768.0, 32767.0), s16_vec_t);
+	for (; p < s; ++p)
 		outn[p] = SAMPLE_TO_S16(in[p]);
 }
 
+SAMPLECONV_CLONES
 void read_buf_s16(char *in, sample_t *out, ssize_t s)
 {
 	int16_t *inn = (int16_t *) in;
+	for (; s >= VEC_LEN; s -= VEC_LEN)
+		*(sample_vec_t *) &out[s - VEC_LEN] = __builtin_convertvector(*(s16_vec_t *) &inn[s - VEC_LEN], sample_vec_t) * (sample_t) (1.0 / 32768.0);
 	while (s-- > 0)
 		out[s] = S16_TO_SAMPLE(inn[s]);
 }
 
+SAMPLECONV_CLONES
 void write_buf_s24(sample_t *in, char *out, ssize_t s)
 {
 	int32_t *outn = (int32_t *) out;
-	ssize_t p = -1;
-	while (++p < s)
+	ssize_t p = 0;
+	for (; p + VEC_LEN <= s; p += VEC_LEN)
+		*(s32_vec_t *) &outn[p] = vec_scale_round(*(sample_vec_t *) &in[p], 8388608.0, 8388607.0);
+	for (; p < s; ++p)
 		outn[p] = SAMPLE_TO_S24(in[p]);
 }
 
+SAMPLECONV_CLONES
 void read_buf_s24(char *in, sample_t *out, ssize_t s)
 {
 	int32_t *inn = (int32_t *) in;
+	for (; s >= VEC_LEN; s -= VEC_LEN)
+		*(sample_vec_t *) &out[s - VEC_LEN] = __builtin_convertvector((*(s32_vec_t *) &inn[s - VEC_LEN] << 8) >> 8, sample_vec_t) * (sample_t) (1.0 / 8388608.0);
 	while (s-- > 0)
 		out[s] = S24_TO_SAMPLE(inn[s]);
 }
 
+SAMPLECONV_CLONES
 void write_buf_s32(sample_t *in, char *out, ssize_t s)
 {
 	int32_t *outn = (int32_t *) out;
-	ssize_t p = -1;
-	while (++p < s)
+	ssize_t p = 0;
+#ifndef SINGLE_PRECISION
+	/* 2147483647 is not representable as a float */
+	for (; p + VEC_LEN <= s; p += VEC_LEN)
+		*(s32_vec_t *) &outn[p] = vec_scale_round(*(sample_vec_t *) &in[p], 2147483648.0, 2147483647.0);
+#endif
+	for (; p < s; ++p)
 		outn[p] = SAMPLE_TO_S32(in[p]);
 }
 
+SAMPLECONV_CLONES
 void read_buf_s32(char *in, sample_t *out, ssize_t s)
 {
 	int32_t *inn = (int32_t *) in;
+	for (; s >= VEC_LEN; s -= VEC_LEN)
+		*(sample_vec_t *) &out[s - VEC_LEN] = __builtin_convertvector(*(s32_vec_t *) &inn[s - VEC_LEN], sample_vec_t) * (sample_t) (1.0 / 2147483648.0);
 	while (s-- > 0)
 		out[s] = S32_TO_SAMPLE(inn[s]);
 }
 
+SAMPLECONV_CLONES
 void write_buf_s24_3(sample_t *in, char *out, ssize_t s)
 {
+	int i;
 	int32_t v;
-	ssize_t p = -1;
-	while (++p < s) {
+	s32_vec_t vv;
+	ssize_t p = 0;
+	for (; p + VEC_LEN <= s; p += VEC_LEN) {
+		vv = vec_scale_round(*(sample_vec_t *) &in[p], 8388608.0, 8388607.0);
+		for (i = 0; i < VEC_LEN; ++i) {
+			out[(p + i) * 3 + 0] = (vv[i] >> 0) & 0xff;
+			out[(p + i) * 3 + 1] = (vv[i] >> 8) & 0xff;
+			out[(p + i) * 3 + 2] = (vv[i] >> 16) & 0xff;
+		}
+	}
+	for (; p < s; ++p) {
 		v = SAMPLE_TO_S24(in[p]);
 		out[p * 3 + 0] = (v >> 0) & 0xff;
 		out[p * 3 + 1] = (v >> 8) & 0xff;
@@ -98,32 +178,178 @@ void read_buf_s24_3(char *in, sample_t *out, ssize_t s)
 	}
 }
 
+SAMPLECONV_CLONES
 void write_buf_float(sample_t *in, char *out, ssize_t s)
 {
 	float *outn = (float *) out;
-	ssize_t p = -1;
-	while (++p < s)
+	ssize_t p = 0;
+	for (; p + VEC_LEN <= s; p += VEC_LEN)
+		*(float_vec_t *) &outn[p] = __builtin_convertvector(*(sample_vec_t *) &in[p], float_vec_t);
+	for (; p < s; ++p)
 		outn[p] = SAMPLE_TO_FLOAT(in[p]);
 }
 
+SAMPLECONV_CLONES
 void read_buf_float(char *in, sample_t *out, ssize_t s)
 {
 	float *inn = (float *) in;
+	for (; s >= VEC_LEN; s -= VEC_LEN)
+		*(sample_vec_t *) &out[s - VEC_LEN] = __builtin_convertvector(*(float_vec_t *) &inn[s - VEC_LEN], sample_vec_t);
 	while (s-- > 0)
 		out[s] = FLOAT_TO_SAMPLE(inn[s]);
 }
 
+SAMPLECONV_CLONES
 void write_buf_double(sample_t *in, char *out, ssize_t s)
 {
 	double *outn = (double *) out;
-	ssize_t p = -1;
-	while (++p < s)
+	ssize_t p = 0;
+	for (; p + VEC_LEN <= s; p += VEC_LEN)
+		*(double_vec_t *) &outn[p] = __builtin_convertvector(*(sample_vec_t *) &in[p], double_vec_t);
+	for (; p < s; ++p)
 		outn[p] = SAMPLE_TO_DOUBLE(in[p]);
 }
 
+SAMPLECONV_CLONES
 void read_buf_double(char *in, sample_t *out, ssize_t s)
 {
 	double *inn = (double *) in;
+	for (; s >= VEC_LEN; s -= VEC_LEN)
+		*(sample_vec_t *) &out[s - VEC_LEN] = __builtin_convertvector(*(double_vec_t *) &inn[s - VEC_LEN], sample_vec_t);
 	while (s-- > 0)
 		out[s] = DOUBLE_TO_SAMPLE(inn[s]);
 }
+
+/* Vector version of dither_hash32() */
+static __inline__ __attribute__((always_inline)) u32_vec_t vec_hash32(u32_vec_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352d;
+	x ^= x >> 15;
+	x *= 0x846ca68b;
+	x ^= x >> 16;
+	return x;
+}
+
+/* Each sample uses two counter values: c and c + 1 */
+static __inline__ __attribute__((always_inline)) sample_t out_stage_one(sample_t x, uint32_t c, uint32_t key, sample_t m, int dither, sample_t *peak, long *clips)
+{
+	sample_t a;
+	if (dither)
+		x += ((sample_t) (int32_t) dither_hash32(c ^ key) - (sample_t) (int32_t) dither_hash32((c + 1) ^ key)) * m;
+	a = (x < 0) ? -x : x;
+	if (a > *peak)
+		*peak = a;
+	if (a > 1) {
+		++*clips;
+		return (x < 0) ? -1 : 1;
+	}
+	return x;
+}
+
+/* Processes *v in place. Passing the vector by reference avoids ABI warnings
+   for the 32-byte vectors when AVX is not enabled. */
+static __inline__ __attribute__((always_inline)) void vec_out_stage(sample_vec_t *v, uint32_t c, uint32_t key, sample_t m, int dither, sample_vec_t *peak, sample_mask_t *clips)
+{
+	int i;
+	u32_vec_t cv;
+	sample_vec_t a, x = *v;
+	sample_mask_t mk;
+	if (dither) {
+		for (i = 0; i < VEC_LEN; ++i)
+			cv[i] = c + 2 * i;
+		x += (__builtin_convertvector((s32_vec_t) vec_hash32(cv ^ key), sample_vec_t)
+			- __builtin_convertvector((s32_vec_t) vec_hash32((cv + 1) ^ key), sample_vec_t)) * m;
+	}
+	a = VEC_SELECT(x < 0, -x, x);
+	*peak = VEC_SELECT(a > *peak, a, *peak);
+	mk = a > 1;
+	*clips -= mk;
+	*v = VEC_SELECT(mk, VEC_SELECT(x < 0, (sample_vec_t) { 0 } - 1, (sample_vec_t) { 0 } + 1), x);
+}
+
+#define OUT_STAGE_FUNC(name, vstore, sstore) \
+	SAMPLECONV_CLONES \
+	void out_stage_##name(struct out_stage *st, sample_t *in, char *out, ssize_t s) \
+	{ \
+		const int dither = (st->shaper == NULL && st->dither_prec >= 1 && st->dither_prec <= 32); \
+		const sample_t m = (dither) ? 1.0 / (4294967296.0 * ((uint64_t) 1 << (st->dither_prec - 1))) : 0.0; \
+		const uint32_t key = dither_hash32(st->dither_seed + (uint32_t) (st->dither_pos >> 32)); \
+		const uint32_t c = (uint32_t) st->dither_pos; \
+		sample_vec_t v, vpeak = { 0 }; \
+		sample_mask_t vclips = { 0 }; \
+		sample_t x, peak; \
+		long clips = 0; \
+		ssize_t p = 0; \
+		int i; \
+		if (st->shaper != NULL && st->dither_prec > 0) \
+			noise_shaper_run(st->shaper, st, in, s); \
+		peak = st->peak; \
+		for (; p + VEC_LEN <= s; p += VEC_LEN) { \
+			v = *(sample_vec_t *) &in[p]; \
+			vec_out_stage(&v, c + 2 * p, key, m, dither, &vpeak, &vclips); \
+			vstore; \
+		} \
+		for (; p < s; ++p) { \
+			x = out_stage_one(in[p], c + 2 * p, key, m, dither, &peak, &clips); \
+			sstore; \
+		} \
+		for (i = 0; i < VEC_LEN; ++i) { \
+			clips += vclips[i]; \
+			if (vpeak[i] > peak) \
+				peak = vpeak[i]; \
+		} \
+		st->clip_count += clips; \
+		st->peak = peak; \
+		st->dither_pos += 2 * s; \
+	}
+
+#define OUT_STAGE_LANES(store) \
+	for (i = 0; i < VEC_LEN; ++i) { \
+		x = v[i]; \
+		store; \
+	}
+
+#define STORE_U8(q, x) (((uint8_t *) out)[q] = SAMPLE_TO_U8(x))
+#define STORE_S8(q, x) (((int8_t *) out)[q] = SAMPLE_TO_S8(x))
+#define STORE_S32(q, x) (((int32_t *) out)[q] = SAMPLE_TO_S32(x))
+#define STORE_S24_3(q, x) do { \
+		int32_t sv = SAMPLE_TO_S24(x); \
+		out[(q) * 3 + 0] = (sv >> 0) & 0xff; \
+		out[(q) * 3 + 1] = (sv >> 8) & 0xff; \
+		out[(q) * 3 + 2] = (sv >> 16) & 0xff; \
+	} while (0)
+
+OUT_STAGE_FUNC(u8,
+	OUT_STAGE_LANES(STORE_U8(p + i, x)),
+	STORE_U8(p, x))
+OUT_STAGE_FUNC(s8,
+	OUT_STAGE_LANES(STORE_S8(p + i, x)),
+	STORE_S8(p, x))
+OUT_STAGE_FUNC(s16,
+	*(s16_vec_t *) &((int16_t *) out)[p] = __builtin_convertvector(vec_scale_round(v, 32768.0, 32767.0), s16_vec_t),
+	((int16_t *) out)[p] = SAMPLE_TO_S16(x))
+OUT_STAGE_FUNC(s24,
+	*(s32_vec_t *) &((int32_t *) out)[p] = vec_scale_round(v, 8388608.0, 8388607.0),
+	((int32_t *) out)[p] = SAMPLE_TO_S24(x))
+#ifdef SINGLE_PRECISION
+OUT_STAGE_FUNC(s32,
+	OUT_STAGE_LANES(STORE_S32(p + i, x)),
+	STORE_S32(p, x))
+#else
+OUT_STAGE_FUNC(s32,
+	*(s32_vec_t *) &((int32_t *) out)[p] = vec_scale_round(v, 2147483648.0, 2147483647.0),
+	STORE_S32(p, x))
+#endif
+OUT_STAGE_FUNC(s24_3,
+	OUT_STAGE_LANES(STORE_S24_3(p + i, x)),
+	STORE_S24_3(p, x))
+OUT_STAGE_FUNC(float,
+	*(float_vec_t *) &((float *) out)[p] = __builtin_convertvector(v, float_vec_t),
+	((float *) out)[p] = SAMPLE_TO_FLOAT(x))
+OUT_STAGE_FUNC(double,
+	*(double_vec_t *) &((double *) out)[p] = __builtin_convertvector(v, double_vec_t),
+	((double *) out)[p] = SAMPLE_TO_DOUBLE(x))
+OUT_STAGE_FUNC(sample,
+	*(sample_vec_t *) &((sample_t *) out)[p] = v,
+	((sample_t *) out)[p] = x)
@@ -5,11 +5,15 @@
 #include <math.h>
 #include "dsp.h"
 
+struct noise_shaper;
+
 /* ### NOTE ###
  * The read_buf_<fmt> and write_buf_<fmt> functions will work properly when
  * dest and src are the same buffer provided
- * sizeof(sample_t) >= sizeof(fmt). Since sample_t is currently a double,
- * this is true for all supported formats.
+ * sizeof(sample_t) >= sizeof(fmt). This is true for all supported formats
+ * if sample_t is a double. If sample_t is a float (SINGLE_PRECISION), the
+ * double format may not be used in place, so the pcm and alsa codecs do not
+ * offer it.
 */
 
 #define S24_SIGN_EXTEND(x) ((x & 0x800000) ? x | ~0x7fffff : x)
@@ -62,4 +66,31 @@ void read_buf_float(char *, sample_t *, ssize_t);
 void write_buf_double(sample_t *, char *, ssize_t);
 void read_buf_double(char *, sample_t *, ssize_t);
 
+/* Output stage: applies TPDF dither (if dither_prec is nonzero), tracks the
+   peak, clips to [-1, 1] and counts the clipped samples, and encodes, all in
+   a single pass. The dither noise comes from a counter-based generator, so it
+   depends only on the position in the stream and not on how the stream is
+   split into blocks. The same in-place rules as the write_buf_<fmt>
+   functions apply. out_stage_sample() does not encode (the output is
+   sample_t) and is meant for codecs which do their own encoding. If shaper is
+   set, the dither is noise shaped (see dither.h). */
+struct out_stage {
+	int dither_prec;
+	uint32_t dither_seed;
+	uint64_t dither_pos;
+	long clip_count;
+	sample_t peak;
+	struct noise_shaper *shaper;
+};
+
+void out_stage_u8(struct out_stage *, sample_t *, char *, ssize_t);
+void out_stage_s8(struct out_stage *, sample_t *, char *, ssize_t);
+void out_stage_s16(struct out_stage *, sample_t *, char *, ssize_t);
+void out_stage_s24(struct out_stage *, sample_t *, char *, ssize_t);
+void out_stage_s32(struct out_stage *, sample_t *, char *, ssize_t);
+void out_stage_s24_3(struct out_stage *, sample_t *, char *, ssize_t);
+void out_stage_float(struct out_stage *, sample_t *, char *, ssize_t);
+void out_stage_double(struct out_stage *, sample_t *, char *, ssize_t);
+void out_stage_sample(struct out_stage *, sample_t *, char *, ssize_t);
+
 #endif
@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include "sampleconv.h"
+#include "util.h"
+
+/* Microbenchmark for the sample format conversions. Compares each conversion
+   against a scalar loop over the sampleconv.h macros (the results must be
+   identical) and reports the throughput of both. The fused output stage is
+   compared against a separate dither/clip/peak loop followed by the
+   conversion.
+
+   usage: sampleconv_bench [samples [iterations]] */
+
+struct dsp_globals dsp_globals = {
+	LL_NORMAL,              /* loglevel */
+	DEFAULT_BUF_FRAMES,     /* buf_frames */
+	DEFAULT_MAX_BUF_RATIO,  /* max_buf_ratio */
+	"sampleconv_bench",     /* prog_name */
+	0,                      /* dev_period_frames */
+	0,                      /* dev_start_frames */
+	DEFAULT_DEV_PERIODS,    /* dev_periods */
+};
+
+#define SCALAR_WRITE(name, type, macro) \
+	static void scalar_write_##name(sample_t *in, char *out, ssize_t s) \
+	{ \
+		ssize_t p; \
+		for (p = 0; p < s; ++p) \
+			((type *) out)[p] = macro(in[p]); \
+	}
+#define SCALAR_READ(name, type, macro) \
+	static void scalar_read_##name(char *in, sample_t *out, ssize_t s) \
+	{ \
+		ssize_t p; \
+		for (p = 0; p < s; ++p) \
+			out[p] = macro(((type *) in)[p]); \
+	}
+
+SCALAR_WRITE(s16, int16_t, SAMPLE_TO_S16)
+SCALAR_READ(s16, int16_t, S16_TO_SAMPLE)
+SCALAR_WRITE(s24, int32_t, SAMPLE_TO_S24)
+SCALAR_READ(s24, int32_t, S24_TO_SAMPLE)
+SCALAR_WRITE(s32, int32_t, SAMPLE_TO_S32)
+SCALAR_READ(s32, int32_t, S32_TO_SAMPLE)
+SCALAR_WRITE(float, float, SAMPLE_TO_FLOAT)
+SCALAR_READ(float, float, FLOAT_TO_SAMPLE)
+SCALAR_WRITE(double, double, SAMPLE_TO_DOUBLE)
+SCALAR_READ(double, double, DOUBLE_TO_SAMPLE)
+
+static void scalar_write_s24_3(sample_t *in, char *out, ssize_t s)
+{
+	int32_t v;
+	ssize_t p;
+	for (p = 0; p < s; ++p) {
+		v = SAMPLE_TO_S24(in[p]);
+		out[p * 3 + 0] = (v >> 0) & 0xff;
+		out[p * 3 + 1] = (v >> 8) & 0xff;
+		out[p * 3 + 2] = (v >> 16) & 0xff;
+	}
+}
+
+static void scalar_read_s24_3(char *in, sample_t *out, ssize_t s)
+{
+	int32_t v;
+	ssize_t p;
+	for (p = 0; p < s; ++p) {
+		v = (in[p * 3 + 0] & 0xff) << 0;
+		v |= (in[p * 3 + 1] & 0xff) << 8;
+		v |= (in[p * 3 + 2] & 0xff) << 16;
+		out[p] = S24_TO_SAMPLE(v);
+	}
+}
+
+struct conv {
+	const char *name;
+	int bytes, prec;
+	void (*write_func)(sample_t *, char *, ssize_t);
+	void (*read_func)(char *, sample_t *, ssize_t);
+	void (*scalar_write_func)(sample_t *, char *, ssize_t);
+	void (*scalar_read_func)(char *, sample_t *, ssize_t);
+	void (*out_func)(struct out_stage *, sample_t *, char *, ssize_t);
+};
+
+static struct conv convs[] = {
+	{ "s16",    2, 16, write_buf_s16,    read_buf_s16,    scalar_write_s16,    scalar_read_s16,    out_stage_s16 },
+	{ "s24",    4, 24, write_buf_s24,    read_buf_s24,    scalar_write_s24,    scalar_read_s24,    out_stage_s24 },
+	{ "s24_3",  3, 24, write_buf_s24_3,  read_buf_s24_3,  scalar_write_s24_3,  scalar_read_s24_3,  out_stage_s24_3 },
+	{ "s32",    4, 32, write_buf_s32,    read_buf_s32,    scalar_write_s32,    scalar_read_s32,    out_stage_s32 },
+	{ "float",  4, 0,  write_buf_float,  read_buf_float,  scalar_write_float,  scalar_read_float,  out_stage_float },
+	{ "double", 8, 0,  write_buf_double, read_buf_double, scalar_write_double, scalar_read_double, out_stage_double },
+};
+
+/* The output stage as it was done before it was fused with the conversion */
+static long sep_clip_count;
+static sample_t sep_peak;
+
+static void separate_out_stage(sample_t *in, ssize_t s, int prec)
+{
+	ssize_t p;
+	const sample_t m = (prec > 0) ? 1 / ((sample_t) PM_RAND_MAX * ((unsigned long int) 1 << (prec - 1))) : 0;
+	for (p = 0; p < s; ++p) {
+		if (prec > 0)
+			in[p] += (sample_t) pm_rand() * m - (sample_t) pm_rand() * m;
+		if (fabs(in[p]) > sep_peak)
+			sep_peak = fabs(in[p]);
+		if (in[p] > 1.0) {
+			++sep_clip_count;
+			in[p] = 1.0;
+		}
+		else if (in[p] < -1.0) {
+			++sep_clip_count;
+			in[p] = -1.0;
+		}
+	}
+}
+
+static double now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/* Returns the throughput in megasamples per second */
+static double time_write(void (*f)(sample_t *, char *, ssize_t), sample_t *in, char *out, ssize_t s, int iter)
+{
+	int i;
+	double t = now();
+	for (i = 0; i < iter; ++i)
+		f(in, out, s);
+	return (double) s * iter / (now() - t) / 1e6;
+}
+
+static double time_separate(const struct conv *cv, sample_t *in, sample_t *tmp, char *out, ssize_t s, int iter)
+{
+	int i;
+	double t = now();
+	for (i = 0; i < iter; ++i) {
+		memcpy(tmp, in, s * sizeof(sample_t));
+		separate_out_stage(tmp, s, cv->prec);
+		cv->write_func(tmp, out, s);
+	}
+	return (double) s * iter / (now() - t) / 1e6;
+}
+
+static double time_fused(const struct conv *cv, sample_t *in, sample_t *tmp, char *out, ssize_t s, int iter)
+{
+	int i;
+	struct out_stage st = { cv->prec, 1, 0, 0, 0 };
+	double t = now();
+	for (i = 0; i < iter; ++i) {
+		memcpy(tmp, in, s * sizeof(sample_t));
+		cv->out_func(&st, tmp, out, s);
+	}
+	return (double) s * iter / (now() - t) / 1e6;
+}
+
+static double time_read(void (*f)(char *, sample_t *, ssize_t), char *in, sample_t *out, ssize_t s, int iter)
+{
+	int i;
+	double t = now();
+	for (i = 0; i < iter; ++i)
+		f(in, out, s);
+	return (double) s * iter / (now() - t) / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+	int i, iter = (argc > 2) ? atoi(argv[2]) : 1000, fail = 0;
+	ssize_t k, s = (argc > 1) ? atol(argv[1]) : 4096 + 5;
+	sample_t *in, *out_a, *out_b;
+	char *buf_a, *buf_b;
+	struct out_stage st;
+
+	if (s < 8 || iter < 1) {
+		fprintf(stderr, "usage: %s [samples [iterations]]\n", argv[0]);
+		return 1;
+	}
+	in = calloc(s, sizeof(sample_t));
+	out_a = calloc(s, sizeof(sample_t));
+	out_b = calloc(s, sizeof(sample_t));
+	buf_a = calloc(s, 8);
+	buf_b = calloc(s, 8);
+	srand(1);
+	for (k = 0; k < s; ++k)
+		in[k] = (sample_t) rand() / RAND_MAX * 2.0 - 1.0;
+	/* full scale, and values that round to an even and odd integer from exactly halfway */
+	in[0] = 1.0;
+	in[1] = -1.0;
+	in[2] = 0.5 / 32768.0;
+	in[3] = -1.5 / 32768.0;
+	in[4] = 2.5 / 8388608.0;
+	in[5] = -0.5 / 8388608.0;
+
+	printf("%-8s %14s %14s %14s %14s\n", "format", "write (MS/s)", "scalar", "read (MS/s)", "scalar");
+	for (i = 0; i < (int) (sizeof(convs) / sizeof(convs[0])); ++i) {
+		convs[i].write_func(in, buf_a, s);
+		convs[i].scalar_write_func(in, buf_b, s);
+		if (memcmp(buf_a, buf_b, s * convs[i].bytes) != 0) {
+			printf("%s: write mismatch\n", convs[i].name);
+			fail = 1;
+		}
+		convs[i].read_func(buf_a, out_a, s);
+		convs[i].scalar_read_func(buf_a, out_b, s);
+		if (memcmp(out_a, out_b, s * sizeof(sample_t)) != 0) {
+			printf("%s: read mismatch\n", convs[i].name);
+			fail = 1;
+		}
+		printf("%-8s %14.1f %14.1f %14.1f %14.1f\n", convs[i].name,
+			time_write(convs[i].write_func, in, buf_a, s, iter),
+			time_write(convs[i].scalar_write_func, in, buf_b, s, iter),
+			time_read(convs[i].read_func, buf_a, out_a, s, iter),
+			time_read(convs[i].scalar_read_func, buf_a, out_b, s, iter));
+	}
+
+	/* 1.5x the full scale so that some samples clip */
+	for (k = 0; k < s; ++k)
+		in[k] *= 1.5;
+	printf("\n%-8s %14s %14s\n", "format", "fused (MS/s)", "separate");
+	for (i = 0; i < (int) (sizeof(convs) / sizeof(convs[0])); ++i) {
+		/* without dither, the results must be identical */
+		memset(&st, 0, sizeof(st));
+		sep_clip_count = 0;
+		sep_peak = 0;
+		memcpy(out_a, in, s * sizeof(sample_t));
+		convs[i].out_func(&st, out_a, buf_a, s);
+		memcpy(out_b, in, s * sizeof(sample_t));
+		separate_out_stage(out_b, s, 0);
+		convs[i].write_func(out_b, buf_b, s);
+		if (memcmp(buf_a, buf_b, s * convs[i].bytes) != 0 || st.clip_count != sep_clip_count || st.peak != sep_peak) {
+			printf("%s: output stage mismatch\n", convs[i].name);
+			fail = 1;
+		}
+		printf("%-8s %14.1f %14.1f\n", convs[i].name,
+			time_fused(&convs[i], in, out_a, buf_a, s, iter),
+			time_separate(&convs[i], in, out_b, buf_b, s, iter));
+	}
+	free(in);
+	free(out_a);
+	free(out_b);
+	free(buf_a);
+	free(buf_b);
+	return fail;
+}
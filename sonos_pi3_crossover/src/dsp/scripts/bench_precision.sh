@@ -0,0 +1,85 @@
+#!/bin/sh
+
+#
+# Compare the throughput and noise floor of a double precision and a single
+# precision (./configure --enable-single-precision) build of dsp
+#
+# Usage:
+#     bench_precision.sh double_dsp single_dsp [effect [args ...]] ...
+#
+# Environment:
+#     CHANNELS  number of channels (default: 2)
+#     FS        sample rate (default: 48000)
+#     LENGTH    length of the test signal in seconds (default: 60)
+#
+# Throughput is measured by running the effects chain on a sine sweep with the
+# null output. The noise floor is the RMS level of the difference between the
+# outputs of the two builds, relative to full scale. The double precision
+# build is used as the reference.
+#
+
+if [ $# -lt 2 ]; then
+	echo "usage: $0 double_dsp single_dsp [effect [args ...]] ..." 1>&2
+	exit 1
+fi
+
+DSP_DOUBLE="$1"
+DSP_SINGLE="$2"
+shift 2
+[ $# -eq 0 ] && set -- \
+	highpass 30 0.707 \
+	lowpass 2k 0.707 lowpass 2k 0.707 \
+	eq 120 2 -4 eq 800 1.5 3 eq 3k 4 -2 \
+	lowshelf 200 0.7 2 gain -6 delay 1m
+
+CHANNELS=${CHANNELS:-2}
+FS=${FS:-48000}
+LENGTH=${LENGTH:-60}
+TMP_DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$TMP_DIR"' EXIT
+
+SIGNAL="sine:freq=20-20k+${LENGTH}"
+
+seconds() {
+	# prints the wall clock time of a command in seconds
+	start=$(date +%s.%N)
+	"$@" || return 1
+	end=$(date +%s.%N)
+	echo "$start $end" | awk '{ printf("%.3f", $2 - $1) }'
+}
+
+run_null() {
+	dsp="$1"; shift
+	"$dsp" -q -s -t sgen -c "$CHANNELS" -r "$FS" "$SIGNAL" -o -n "$@"
+}
+
+run_file() {
+	dsp="$1"; out="$2"; shift 2
+	"$dsp" -q -s -D -t sgen -c "$CHANNELS" -r "$FS" "$SIGNAL" -o -t pcm -e s32 "$out" "$@"
+}
+
+for build in double single; do
+	[ "$build" = "double" ] && dsp="$DSP_DOUBLE" || dsp="$DSP_SINGLE"
+	t=$(seconds run_null "$dsp" "$@") || { echo "error: $build build failed" 1>&2; exit 1; }
+	echo "$build $t $LENGTH" | awk '{ printf("%-8s %8.3fs  %8.1fx realtime\n", $1, $2, ($2 > 0) ? $3 / $2 : 0) }'
+done
+
+run_file "$DSP_DOUBLE" "$TMP_DIR/double.raw" "$@" || exit 1
+run_file "$DSP_SINGLE" "$TMP_DIR/single.raw" "$@" || exit 1
+od -An -v -t d4 -w4 "$TMP_DIR/double.raw" > "$TMP_DIR/double.txt"
+od -An -v -t d4 -w4 "$TMP_DIR/single.raw" > "$TMP_DIR/single.txt"
+paste "$TMP_DIR/double.txt" "$TMP_DIR/single.txt" | awk '
+{
+	d = ($2 - $1) / 2147483648.0
+	sum_sq += d * d
+	if (d < 0) d = -d
+	if (d > peak) peak = d
+	++n
+}
+END {
+	if (n == 0 || sum_sq == 0) {
+		print "noise floor: identical output"
+		exit
+	}
+	printf("noise floor: %.2f dBFS RMS, %.2f dBFS peak (%d samples)\n", 10 * log(sum_sq / n) / log(10), 20 * log(peak) / log(10), n)
+}'
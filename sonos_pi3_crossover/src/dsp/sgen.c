@@ -181,7 +181,7 @@ struct codec * sgen_codec_init(const char *path, const char *type, const char *e
 	c->enc = "sample_t";
 	c->fs = fs;
 	c->channels = channels;
-	c->prec = 53;
+	c->prec = SAMPLE_T_PREC;
 	c->frames = -1;
 	c->read = sgen_read;
 	c->write = sgen_write;
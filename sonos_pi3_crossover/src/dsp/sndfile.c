@@ -79,13 +79,21 @@ static struct sndfile_enc_info encodings[] = {
 ssize_t sndfile_read(struct codec *c, sample_t *buf, ssize_t frames)
 {
 	struct sndfile_state *state = (struct sndfile_state *) c->data;
+#ifdef SINGLE_PRECISION
+	return sf_readf_float(state->f, buf, frames);
+#else
 	return sf_readf_double(state->f, buf, frames);
+#endif
 }
 
 ssize_t sndfile_write(struct codec *c, sample_t *buf, ssize_t frames)
 {
 	struct sndfile_state *state = (struct sndfile_state *) c->data;
+#ifdef SINGLE_PRECISION
+	return sf_writef_float(state->f, buf, frames);
+#else
 	return sf_writef_double(state->f, buf, frames);
+#endif
 }
 
 ssize_t sndfile_seek(struct codec *c, ssize_t pos)
@@ -6,7 +6,8 @@
 
 struct stats_state {
 	ssize_t samples, peak_count, peak_frame;
-	sample_t sum, sum_sq, min, max, ref;
+	double sum, sum_sq, ref;  /* accumulators are double regardless of sample_t */
+	sample_t min, max;
 };
 
 sample_t * stats_effect_run(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf)
@@ -16,7 +17,7 @@ sample_t * stats_effect_run(struct effect *e, ssize_t *frames, sample_t *ibuf, s
 	for (i = 0; i < samples; i += e->ostream.channels) {
 		for (k = 0; k < e->ostream.channels; ++k) {
 			state[k].sum += ibuf[i + k];
-			state[k].sum_sq += ibuf[i + k] * ibuf[i + k];
+			state[k].sum_sq += (double) ibuf[i + k] * ibuf[i + k];
 			if (ibuf[i + k] < state[k].min) state[k].min = ibuf[i + k];
 			if (ibuf[i + k] > state[k].max) state[k].max = ibuf[i + k];
 			if (fabs(ibuf[i + k]) >= MAXIMUM(fabs(state[k].max), fabs(state[k].min))) {
@@ -93,7 +94,7 @@ struct effect * stats_effect_init(struct effect_info *ei, struct stream_info *is
 	char *endptr;
 	struct effect *e;
 	struct stats_state *state;
-	sample_t ref = -HUGE_VAL;
+	double ref = -HUGE_VAL;
 
 	if (argc == 2) {
 		ref = strtod(argv[1], &endptr);
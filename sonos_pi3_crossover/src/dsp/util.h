@@ -46,7 +46,7 @@ char * isolate(char *, char);
 
 static __inline__ long unsigned int pm_rand(void)
 {
-	static long unsigned int s = 1;
+	static __thread long unsigned int s = 1;
 	long unsigned int h, l;
 
 	l = 16807 * (s & 0xffff);
@@ -57,15 +57,22 @@ static __inline__ long unsigned int pm_rand(void)
 	return (s = l);
 }
 
-static __inline__ sample_t tpdf_dither_sample(sample_t s, int prec)
+/* Copies n samples between (possibly) strided buffers. If src is NULL, dest is zeroed. */
+static __inline__ void copy_samples(sample_t *dest, ssize_t dest_stride, const sample_t *src, ssize_t src_stride, ssize_t n)
 {
-	if (prec < 1 || prec > 32)
-		return s;
-	unsigned long int d = (unsigned long int) 1 << (prec - 1);
-	sample_t m = 1 / ((sample_t) PM_RAND_MAX * d);
-	sample_t n1 = (sample_t) pm_rand() * m;
-	sample_t n2 = (sample_t) pm_rand() * m;
-	return s + n1 - n2;
+	ssize_t i;
+	if (src == NULL) {
+		if (dest_stride == 1)
+			memset(dest, 0, n * sizeof(sample_t));
+		else
+			for (i = 0; i < n; ++i)
+				dest[i * dest_stride] = 0;
+	}
+	else if (dest_stride == 1 && src_stride == 1)
+		memcpy(dest, src, n * sizeof(sample_t));
+	else
+		for (i = 0; i < n; ++i)
+			dest[i * dest_stride] = src[i * src_stride];
 }
 
 static __inline__ ssize_t ratio_mult_ceil(ssize_t v, int n, int d)
@@ -1,5 +1,7 @@
 #include <cstdio>
 #include <cstdlib>
+#include <sched.h>
+#include <pthread.h>
 #include <zita-convolver.h>
 #include "zita_convolver.h"
 
@@ -7,8 +9,25 @@ extern "C" {
 	#include "util.h"
 	#include "codec.h"
 	#include "sampleconv.h"
+	#include "rt.h"
 }
 
+/* Convproc creates and destroys FFTW plans, and the FFTW planner is not
+   thread-safe, so configure() and cleanup() must be serialized with all other
+   planning. fftw_cache.h is not usable from C++ (complex.h). */
+#ifdef HAVE_FFTW3
+extern "C" {
+	void fftw_cache_lock(void);
+	void fftw_cache_unlock(void);
+}
+#define PLAN_LOCK() fftw_cache_lock()
+#define PLAN_UNLOCK() fftw_cache_unlock()
+#else
+static pthread_mutex_t plan_lock = PTHREAD_MUTEX_INITIALIZER;
+#define PLAN_LOCK() pthread_mutex_lock(&plan_lock)
+#define PLAN_UNLOCK() pthread_mutex_unlock(&plan_lock)
+#endif
+
 struct zita_convolver_state {
 	ssize_t filter_frames, len, pos, drain_frames, drain_pos;
 	sample_t **output;
@@ -16,35 +35,41 @@ struct zita_convolver_state {
 	int has_output, is_draining;
 };
 
-sample_t * zita_convolver_effect_run(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf)
+/* Sample (frame f, channel k) is at buf[f * f_stride + k * c_stride]. ibuf may be NULL. */
+static ssize_t zita_convolver_process(struct effect *e, ssize_t frames, sample_t *ibuf, ssize_t ic_stride, sample_t *obuf, ssize_t oc_stride, ssize_t f_stride)
 {
 	struct zita_convolver_state *state = (struct zita_convolver_state *) e->data;
-	ssize_t i, k, iframes = 0, oframes = 0;
-	while (iframes < *frames) {
-		while (state->pos < state->len && iframes < *frames) {
-			for (i = k = 0; i < e->ostream.channels; ++i) {
+	ssize_t j, n, iframes = 0, oframes = 0;
+	int i, k;
+	sample_t *in;
+	float *inp;
+	while (iframes < frames) {
+		n = MINIMUM(state->len - state->pos, frames - iframes);
+		for (i = k = 0; i < e->ostream.channels; ++i) {
+			in = (ibuf) ? &ibuf[iframes * f_stride + i * ic_stride] : NULL;
 #ifdef SYMMETRIC_IO
-				obuf[oframes * e->ostream.channels + i] = (state->has_output) ? state->output[i][state->pos] : 0;
+			copy_samples(&obuf[oframes * f_stride + i * oc_stride], f_stride, (state->has_output) ? &state->output[i][state->pos] : NULL, 1, n);
 #else
-				if (state->has_output)
-					obuf[oframes * e->ostream.channels + i] = state->output[i][state->pos];
+			if (state->has_output)
+				copy_samples(&obuf[oframes * f_stride + i * oc_stride], f_stride, &state->output[i][state->pos], 1, n);
 #endif
-				if (GET_BIT(e->channel_selector, i)) {
-					state->cproc->inpdata(k)[state->pos] = (ibuf) ? ibuf[iframes * e->ostream.channels + i] : 0;
-					++k;
-				}
-				else
-					state->output[i][state->pos] = (ibuf) ? ibuf[iframes * e->ostream.channels + i] : 0;
+			if (GET_BIT(e->channel_selector, i)) {
+				inp = &state->cproc->inpdata(k)[state->pos];
+				for (j = 0; j < n; ++j)
+					inp[j] = (in) ? in[j * f_stride] : 0;
+				++k;
 			}
+			else
+				copy_samples(&state->output[i][state->pos], 1, in, f_stride, n);
+		}
 #ifdef SYMMETRIC_IO
-			++oframes;
+		oframes += n;
 #else
-			if (state->has_output)
-				++oframes;
+		if (state->has_output)
+			oframes += n;
 #endif
-			++iframes;
-			++state->pos;
-		}
+		iframes += n;
+		state->pos += n;
 		if (state->pos == state->len) {
 			state->cproc->process(true);
 			for (i = k = 0; i < e->ostream.channels; ++i) {
@@ -57,7 +82,27 @@ sample_t * zita_convolver_effect_run(struct effect *e, ssize_t *frames, sample_t
 			state->has_output = 1;
 		}
 	}
-	*frames = oframes;
+	return oframes;
+}
+
+/* Interleaved; only used for draining */
+static sample_t * zita_convolver_effect_run(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf)
+{
+	*frames = zita_convolver_process(e, *frames, ibuf, 1, obuf, 1, e->ostream.channels);
+	return obuf;
+}
+
+sample_t * zita_convolver_effect_run_planar(struct effect *e, ssize_t *frames, sample_t *ibuf, sample_t *obuf)
+{
+#ifndef SYMMETRIC_IO
+	struct zita_convolver_state *state = (struct zita_convolver_state *) e->data;
+#endif
+	ssize_t out_frames = *frames;
+#ifndef SYMMETRIC_IO
+	if (!state->has_output)
+		out_frames = MAXIMUM(*frames - (state->len - state->pos), 0);
+#endif
+	*frames = zita_convolver_process(e, *frames, ibuf, *frames, obuf, out_frames, 1);
 	return obuf;
 }
 
@@ -104,8 +149,10 @@ void zita_convolver_effect_destroy(struct effect *e)
 	struct zita_convolver_state *state = (struct zita_convolver_state *) e->data;
 	if (!state->cproc->check_stop())
 		state->cproc->stop_process();
+	PLAN_LOCK();
 	state->cproc->cleanup();
 	delete state->cproc;
+	PLAN_UNLOCK();
 	for (i = 0; i < e->ostream.channels; ++i)
 		free(state->output[i]);
 	free(state->output);
@@ -190,16 +237,20 @@ struct effect * zita_convolver_effect_init(struct effect_info *ei, struct stream
 		return NULL;
 	}
 	cproc = new Convproc;
+	PLAN_LOCK();
 #if ZITA_CONVOLVER_MAJOR_VERSION >= 4
-	if (cproc->configure(n_channels, n_channels, c_filter->frames, min_part_len, min_part_len, max_part_len, 0.0f)) {
+	i = cproc->configure(n_channels, n_channels, c_filter->frames, min_part_len, min_part_len, max_part_len, 0.0f);
 #else
-	if (cproc->configure(n_channels, n_channels, c_filter->frames, min_part_len, min_part_len, max_part_len)) {
+	i = cproc->configure(n_channels, n_channels, c_filter->frames, min_part_len, min_part_len, max_part_len);
 #endif
+	if (i) {
+		delete cproc;
+		PLAN_UNLOCK();
 		LOG_FMT(LL_ERROR, "%s: error: failed to configure convolution engine", argv[0]);
 		destroy_codec(c_filter);
-		delete cproc;
 		return NULL;
 	}
+	PLAN_UNLOCK();
 	LOG_FMT(LL_VERBOSE, "%s: info: filter_frames=%zd min_part_len=%d max_part_len=%d", argv[0], c_filter->frames, min_part_len, max_part_len);
 
 	e = (struct effect *) calloc(1, sizeof(struct effect));
@@ -208,7 +259,7 @@ struct effect * zita_convolver_effect_init(struct effect_info *ei, struct stream
 	e->istream.channels = e->ostream.channels = istream->channels;
 	e->channel_selector = (char *) NEW_SELECTOR(istream->channels);
 	COPY_SELECTOR(e->channel_selector, channel_selector, istream->channels);
-	e->run = zita_convolver_effect_run;
+	e->run_planar = zita_convolver_effect_run_planar;
 	e->delay = zita_convolver_effect_delay;
 	e->reset = zita_convolver_effect_reset;
 	e->drain = zita_convolver_effect_drain;
@@ -241,7 +292,12 @@ struct effect * zita_convolver_effect_init(struct effect_info *ei, struct stream
 		free(buf_planar[i]);
 	free(buf_planar);
 	destroy_codec(c_filter);
-	cproc->start_process(0, 0);
+	rt_spawn_on_worker_cpus(1);
+	if (rt_is_enabled())
+		cproc->start_process(rt_thread_priority(RT_THREAD_BACKGROUND), SCHED_FIFO);
+	else
+		cproc->start_process(0, 0);
+	rt_spawn_on_worker_cpus(0);
 
 	return e;
 }
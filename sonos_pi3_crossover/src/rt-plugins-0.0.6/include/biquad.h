@@ -5,6 +5,7 @@
 
 #include "ladspa-util.h"
 #include <math.h>
+#include <string.h>
 
 #ifndef LIMIT
 #define LIMIT(v,l,u) (v<l?l:(v>u?u:v))
@@ -24,6 +25,14 @@
 // this value.  Note that 1.e-18 = -360dBFS
 #define DENORMALKILLER 1.e-18;
 
+// Ramp the coefficients from their old to their new values across a
+// period when a control changes, instead of switching at the start of the
+// period.  Costs five additions per filter per sample, but only in periods
+// where a control has changed.
+#ifndef BIQUAD_SMOOTH
+#define BIQUAD_SMOOTH 0
+#endif
+
 typedef BIQUAD_TYPE bq_t;
 
 /* Biquad filter (adapted from lisp code by Eli Brandt,
@@ -52,6 +61,56 @@ typedef struct {
 } bilin;
 
 
+// Step per sample while ramping the coefficients (see BIQUAD_SMOOTH)
+typedef struct {
+	bq_t a1;
+	bq_t a2;
+	bq_t b0;
+	bq_t b1;
+	bq_t b2;
+} biquad_step;
+
+typedef struct {
+	bq_t a1;
+	bq_t b0;
+	bq_t b1;
+} bilin_step;
+
+// The control values that the coefficients were last computed from.  The
+// *_set_params() functions call cos(), sin(), pow() and tan(), which are
+// expensive on small machines, so run() only calls them when a value
+// changes.
+#define CTL_CACHE_SIZE 3
+
+typedef struct {
+	float v[CTL_CACHE_SIZE];
+	int   valid;
+} ctl_cache;
+
+enum {
+	CTL_UNCHANGED = 0,
+	CTL_CHANGED,  // the coefficients need to move to new values
+	CTL_FIRST,    // the coefficients have never been computed
+};
+
+static inline void ctl_cache_init(ctl_cache *c) {
+	c->valid = 0;
+}
+
+// Stores the given control values (pass 0 for unused ones) and returns
+// whether they differ from the previous ones.  The values are compared bit
+// for bit, so a NaN is not recomputed on every call.
+static inline int ctl_changed(ctl_cache *c, float v0, float v1, float v2) {
+	const float v[CTL_CACHE_SIZE] = { v0, v1, v2 };
+	int ret = (c->valid) ? CTL_CHANGED : CTL_FIRST;
+
+	if (c->valid && memcmp(c->v, v, sizeof(v)) == 0)
+		return CTL_UNCHANGED;
+	memcpy(c->v, v, sizeof(v));
+	c->valid = 1;
+	return ret;
+}
+
 static inline void biquad_init(biquad *f) {
 	f->x1 = 0.0f;
 	f->x2 = 0.0f;
@@ -278,6 +337,75 @@ static inline void hp1_set_params(bilin *f, bq_t fc, bq_t fs)
 }
 
 
+// Moves the coefficients of f to those of t (which were computed by one of
+// the *_set_params() functions).  With BIQUAD_SMOOTH, if changed is
+// CTL_CHANGED, the coefficients are instead ramped to the new values over n
+// samples: biquad_ramp() must then be called before each sample and
+// biquad_ramp_end() after the last one.  Returns whether a ramp was started.
+static inline int biquad_retarget(biquad *f, const biquad *t, biquad_step *s,
+			  unsigned long n, int changed)
+{
+	if (BIQUAD_SMOOTH && changed == CTL_CHANGED && n > 1) {
+		s->a1 = (t->a1 - f->a1) / (bq_t) n;
+		s->a2 = (t->a2 - f->a2) / (bq_t) n;
+		s->b0 = (t->b0 - f->b0) / (bq_t) n;
+		s->b1 = (t->b1 - f->b1) / (bq_t) n;
+		s->b2 = (t->b2 - f->b2) / (bq_t) n;
+		return 1;
+	}
+	f->a1 = t->a1;
+	f->a2 = t->a2;
+	f->b0 = t->b0;
+	f->b1 = t->b1;
+	f->b2 = t->b2;
+	return 0;
+}
+
+static inline void biquad_ramp(biquad *f, const biquad_step *s) {
+	f->a1 += s->a1;
+	f->a2 += s->a2;
+	f->b0 += s->b0;
+	f->b1 += s->b1;
+	f->b2 += s->b2;
+}
+
+// lands exactly on the new coefficients, whatever the rounding on the way
+static inline void biquad_ramp_end(biquad *f, const biquad *t) {
+	f->a1 = t->a1;
+	f->a2 = t->a2;
+	f->b0 = t->b0;
+	f->b1 = t->b1;
+	f->b2 = t->b2;
+}
+
+// bilin versions of the above
+static inline int bilin_retarget(bilin *f, const bilin *t, bilin_step *s,
+			  unsigned long n, int changed)
+{
+	if (BIQUAD_SMOOTH && changed == CTL_CHANGED && n > 1) {
+		s->a1 = (t->a1 - f->a1) / (bq_t) n;
+		s->b0 = (t->b0 - f->b0) / (bq_t) n;
+		s->b1 = (t->b1 - f->b1) / (bq_t) n;
+		return 1;
+	}
+	f->a1 = t->a1;
+	f->b0 = t->b0;
+	f->b1 = t->b1;
+	return 0;
+}
+
+static inline void bilin_ramp(bilin *f, const bilin_step *s) {
+	f->a1 += s->a1;
+	f->b0 += s->b0;
+	f->b1 += s->b1;
+}
+
+static inline void bilin_ramp_end(bilin *f, const bilin *t) {
+	f->a1 = t->a1;
+	f->b0 = t->b0;
+	f->b1 = t->b1;
+}
+
 // routine that runs a biquad (i.e. 2nd-order) digital filter
 static inline bq_t biquad_run(biquad *f, const bq_t x) {
 	bq_t y;
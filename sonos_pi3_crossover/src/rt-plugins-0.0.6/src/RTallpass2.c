@@ -49,6 +49,7 @@ typedef struct {
 	LADSPA_Data *output;
 	biquad *     filter;
 	float        fs;
+	ctl_cache    cache;
 } AllPass;
 
 const LADSPA_Descriptor *ladspa_descriptor(unsigned long index) {
@@ -112,6 +113,7 @@ static LADSPA_Handle instantiateAllPass(
 
 	plugin_data->filter = filter;
 	plugin_data->fs = fs;
+	ctl_cache_init(&plugin_data->cache);
 
 	return (LADSPA_Handle)plugin_data;
 }
@@ -138,14 +140,25 @@ static void runAllPass(LADSPA_Handle instance, unsigned long sample_count) {
 	float fs = plugin_data->fs;
 
 	unsigned long pos;
-
-	ap_set_params(filter, fc, Q, fs);
+	biquad target = { 0 };
+	biquad_step step = { 0 };
+	int changed, ramp = 0;
+
+	changed = ctl_changed(&plugin_data->cache, fc, Q, 0.0f);
+	if (changed != CTL_UNCHANGED) {
+		ap_set_params(&target, fc, Q, fs);
+		ramp = biquad_retarget(filter, &target, &step, sample_count, changed);
+	}
 
 	for (pos = 0; pos < sample_count; pos++) {
+		if (ramp)
+			biquad_ramp(filter, &step);
 		// RT 2.9.2013: replace biquad_run with ap2_run to cut floating-
 		// point multiplications from 5 to 2:
 	  buffer_write(output[pos], (LADSPA_Data) ap2_run(filter, input[pos]));
 	}
+	if (ramp)
+		biquad_ramp_end(filter, &target);
 
 }
 
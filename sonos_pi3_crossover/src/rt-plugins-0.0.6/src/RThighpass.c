@@ -48,6 +48,7 @@ typedef struct {
 	LADSPA_Data *output;
 	biquad *     filter;
 	float        fs;
+	ctl_cache    cache;
 } HighPass;
 
 const LADSPA_Descriptor *ladspa_descriptor(unsigned long index) {
@@ -111,6 +112,7 @@ static LADSPA_Handle instantiateHighPass(
 
 	plugin_data->filter = filter;
 	plugin_data->fs = fs;
+	ctl_cache_init(&plugin_data->cache);
 
 	return (LADSPA_Handle)plugin_data;
 }
@@ -136,12 +138,23 @@ static void runHighPass(LADSPA_Handle instance, unsigned long sample_count) {
 	float fs = plugin_data->fs;
 
 	unsigned long pos;
-
-	hp_set_params(filter, fc, Q, fs);
+	biquad target = { 0 };
+	biquad_step step = { 0 };
+	int changed, ramp = 0;
+
+	changed = ctl_changed(&plugin_data->cache, fc, Q, 0.0f);
+	if (changed != CTL_UNCHANGED) {
+		hp_set_params(&target, fc, Q, fs);
+		ramp = biquad_retarget(filter, &target, &step, sample_count, changed);
+	}
 
 	for (pos = 0; pos < sample_count; pos++) {
+		if (ramp)
+			biquad_ramp(filter, &step);
 	  buffer_write(output[pos], (LADSPA_Data) biquad_run(filter, input[pos]));
 	}
+	if (ramp)
+		biquad_ramp_end(filter, &target);
 
 }
 
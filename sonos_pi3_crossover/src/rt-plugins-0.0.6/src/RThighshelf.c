@@ -50,6 +50,7 @@ typedef struct {
 	LADSPA_Data *output;
 	biquad *     filter;
 	float        fs;
+	ctl_cache    cache;
 } HighShelf;
 
 const LADSPA_Descriptor *ladspa_descriptor(unsigned long index) {
@@ -116,6 +117,7 @@ static LADSPA_Handle instantiateHighShelf(
 
 	plugin_data->filter = filter;
 	plugin_data->fs = fs;
+	ctl_cache_init(&plugin_data->cache);
 
 	return (LADSPA_Handle)plugin_data;
 }
@@ -144,12 +146,23 @@ static void runHighShelf(LADSPA_Handle instance, unsigned long sample_count) {
 	float fs = plugin_data->fs;
 
 	unsigned long pos;
-
-	hs_set_params(filter, fc, gain, Q, fs);
+	biquad target = { 0 };
+	biquad_step step = { 0 };
+	int changed, ramp = 0;
+
+	changed = ctl_changed(&plugin_data->cache, gain, fc, Q);
+	if (changed != CTL_UNCHANGED) {
+		hs_set_params(&target, fc, gain, Q, fs);
+		ramp = biquad_retarget(filter, &target, &step, sample_count, changed);
+	}
 
 	for (pos = 0; pos < sample_count; pos++) {
+		if (ramp)
+			biquad_ramp(filter, &step);
 	  buffer_write(output[pos], (LADSPA_Data) biquad_run(filter, input[pos]));
 	}
+	if (ramp)
+		biquad_ramp_end(filter, &target);
 
 }
 
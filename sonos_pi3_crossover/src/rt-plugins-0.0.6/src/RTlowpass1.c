@@ -46,6 +46,7 @@ typedef struct {
 	LADSPA_Data *output;
 	bilin *     filter;
 	float        fs;
+	ctl_cache    cache;
 } LowPass1;
 
 const LADSPA_Descriptor *ladspa_descriptor(unsigned long index) {
@@ -106,6 +107,7 @@ static LADSPA_Handle instantiateLowPass1(
 
 	plugin_data->filter = filter;
 	plugin_data->fs = fs;
+	ctl_cache_init(&plugin_data->cache);
 
 	return (LADSPA_Handle)plugin_data;
 }
@@ -129,12 +131,23 @@ static void runLowPass1(LADSPA_Handle instance, unsigned long sample_count) {
 	float fs = plugin_data->fs;
 
 	unsigned long pos;
-
-	lp1_set_params(filter, fc, fs);
+	bilin target = { 0 };
+	bilin_step step = { 0 };
+	int changed, ramp = 0;
+
+	changed = ctl_changed(&plugin_data->cache, fc, 0.0f, 0.0f);
+	if (changed != CTL_UNCHANGED) {
+		lp1_set_params(&target, fc, fs);
+		ramp = bilin_retarget(filter, &target, &step, sample_count, changed);
+	}
 
 	for (pos = 0; pos < sample_count; pos++) {
+		if (ramp)
+			bilin_ramp(filter, &step);
 	  buffer_write(output[pos], (LADSPA_Data) bilin_run(filter, input[pos]));
 	}
+	if (ramp)
+		bilin_ramp_end(filter, &target);
 
 }
 
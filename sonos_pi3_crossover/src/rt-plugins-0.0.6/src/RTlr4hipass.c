@@ -46,6 +46,7 @@ typedef struct {
 	LADSPA_Data *output;
 	biquad *     filters;
 	float        fs;
+	ctl_cache    cache;
 } LR4HighPass;
 
 const LADSPA_Descriptor *ladspa_descriptor(unsigned long index) {
@@ -108,6 +109,7 @@ static LADSPA_Handle instantiateLR4HighPass(
 
 	plugin_data->filters = filters;
 	plugin_data->fs = fs;
+	ctl_cache_init(&plugin_data->cache);
 
 	return (LADSPA_Handle)plugin_data;
 }
@@ -131,15 +133,30 @@ static void runLR4HighPass(LADSPA_Handle instance, unsigned long sample_count) {
 
 	unsigned long pos;
   bq_t in;
-
-	hp_set_params(&filters[0], fc, 0.7071068, fs);
-	hp_set_params(&filters[1], fc, 0.7071068, fs);
+	biquad target = { 0 };
+	biquad_step step = { 0 };
+	int changed, ramp = 0;
+
+	changed = ctl_changed(&plugin_data->cache, fc, 0.0f, 0.0f);
+	if (changed != CTL_UNCHANGED) {
+		hp_set_params(&target, fc, 0.7071068, fs);
+		ramp = biquad_retarget(&filters[0], &target, &step, sample_count, changed);
+		biquad_retarget(&filters[1], &target, &step, sample_count, changed);
+	}
 
 	for (pos = 0; pos < sample_count; pos++) {
+    if (ramp) {
+      biquad_ramp(&filters[0], &step);
+      biquad_ramp(&filters[1], &step);
+    }
     in = biquad_run(&filters[0], input[pos]);
     in = biquad_run(&filters[1], in);
     buffer_write(output[pos], (LADSPA_Data) in);
 	}
+	if (ramp) {
+		biquad_ramp_end(&filters[0], &target);
+		biquad_ramp_end(&filters[1], &target);
+	}
 
 }
 
@@ -0,0 +1,211 @@
+/* rtbench: measure the cost per period of the RT plugins
+
+  Runs every plugin in the given libraries on white noise, one period at a
+  time, the way an ALSA host would, and prints the average time per period
+  twice: once with the controls held still (the filter coefficients are
+  cached) and once with a control changing on every period (the
+  coefficients are recomputed on every run(), which is what every period
+  used to cost).
+
+  Usage: rtbench [-p period] [-n periods] [-r rate] plugin.so ...
+
+  For example, from the build directory:
+
+    ./testing/rtbench -p 64 src/RT*.so
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <dlfcn.h>
+
+#include <ladspa.h>
+
+#define MAX_PORTS 16
+#define ROUNDS    5
+
+typedef struct {
+	double still;     // ns per period with the controls held still
+	double changing;  // ns per period with a control changing every period
+} result;
+
+static double now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+}
+
+// default value of a control port, as given by its range hints
+static LADSPA_Data default_value(const LADSPA_PortRangeHint *h, unsigned long rate) {
+	LADSPA_PortRangeHintDescriptor d = h->HintDescriptor;
+	double lo = h->LowerBound, hi = h->UpperBound;
+	int lg = LADSPA_IS_HINT_LOGARITHMIC(d) && lo > 0.0 && hi > 0.0;
+
+	if (LADSPA_IS_HINT_SAMPLE_RATE(d)) {
+		lo *= (double) rate;
+		hi *= (double) rate;
+	}
+	switch (d & LADSPA_HINT_DEFAULT_MASK) {
+	case LADSPA_HINT_DEFAULT_MINIMUM:
+		return (LADSPA_Data) lo;
+	case LADSPA_HINT_DEFAULT_LOW:
+		return (LADSPA_Data) (lg ? exp(log(lo) * 0.75 + log(hi) * 0.25) : lo * 0.75 + hi * 0.25);
+	case LADSPA_HINT_DEFAULT_MIDDLE:
+		return (LADSPA_Data) (lg ? exp(log(lo) * 0.5 + log(hi) * 0.5) : lo * 0.5 + hi * 0.5);
+	case LADSPA_HINT_DEFAULT_HIGH:
+		return (LADSPA_Data) (lg ? exp(log(lo) * 0.25 + log(hi) * 0.75) : lo * 0.25 + hi * 0.75);
+	case LADSPA_HINT_DEFAULT_MAXIMUM:
+		return (LADSPA_Data) hi;
+	case LADSPA_HINT_DEFAULT_1:
+		return 1.0f;
+	case LADSPA_HINT_DEFAULT_100:
+		return 100.0f;
+	case LADSPA_HINT_DEFAULT_440:
+		return 440.0f;
+	default:
+		return 0.0f;
+	}
+}
+
+// Runs the plugin for n periods and returns the average ns per period. If
+// changing is nonzero, the first input control (ctl, if any) toggles between
+// base and the next float up, so every period sees a new value.
+static double run_periods(const LADSPA_Descriptor *desc, LADSPA_Handle h,
+			  LADSPA_Data *ctl, LADSPA_Data base,
+			  unsigned long period, unsigned long n, int changing) {
+	unsigned long i;
+	double start = now_ns();
+
+	for (i = 0; i < n; i++) {
+		if (changing && ctl != NULL)
+			*ctl = (i & 1) ? nextafterf(base, HUGE_VALF) : base;
+		desc->run(h, period);
+	}
+	return (now_ns() - start) / (double) n;
+}
+
+static int bench(const LADSPA_Descriptor *desc, unsigned long rate,
+		 unsigned long period, unsigned long n, result *r) {
+	LADSPA_Data ctl[MAX_PORTS];
+	LADSPA_Data *buf[MAX_PORTS];
+	LADSPA_Data *first_ctl = NULL, first_base = 0.0f;
+	LADSPA_Handle h;
+	unsigned long p, i;
+	unsigned int seed = 1;
+	int noise;
+	double t;
+
+	if (desc->PortCount > MAX_PORTS) {
+		fprintf(stderr, "rtbench: %s: too many ports\n", desc->Label);
+		return 1;
+	}
+	if ((h = desc->instantiate(desc, rate)) == NULL) {
+		fprintf(stderr, "rtbench: %s: instantiate() failed\n", desc->Label);
+		return 1;
+	}
+	for (p = 0; p < desc->PortCount; p++) {
+		buf[p] = NULL;
+		if (LADSPA_IS_PORT_CONTROL(desc->PortDescriptors[p])) {
+			ctl[p] = default_value(&desc->PortRangeHints[p], rate);
+			if (LADSPA_IS_PORT_INPUT(desc->PortDescriptors[p]) && first_ctl == NULL) {
+				first_ctl = &ctl[p];
+				first_base = ctl[p];
+			}
+			desc->connect_port(h, p, &ctl[p]);
+		}
+		else {
+			buf[p] = calloc(period, sizeof(LADSPA_Data));
+			if (LADSPA_IS_PORT_INPUT(desc->PortDescriptors[p]))
+				for (i = 0; i < period; i++) {
+					noise = rand_r(&seed);
+					buf[p][i] = (LADSPA_Data) noise / (LADSPA_Data) RAND_MAX - 0.5f;
+				}
+			desc->connect_port(h, p, buf[p]);
+		}
+	}
+	if (desc->activate)
+		desc->activate(h);
+
+	// warm up, then keep the best of a few rounds to filter out
+	// interruptions by the rest of the system
+	run_periods(desc, h, first_ctl, first_base, period, n / 10 + 1, 0);
+	r->still = r->changing = HUGE_VAL;
+	for (i = 0; i < ROUNDS; i++) {
+		t = run_periods(desc, h, first_ctl, first_base, period, n, 0);
+		r->still = (t < r->still) ? t : r->still;
+		t = run_periods(desc, h, first_ctl, first_base, period, n, 1);
+		r->changing = (t < r->changing) ? t : r->changing;
+	}
+
+	if (desc->deactivate)
+		desc->deactivate(h);
+	desc->cleanup(h);
+	for (p = 0; p < desc->PortCount; p++)
+		free(buf[p]);
+	return 0;
+}
+
+static void usage(void) {
+	fprintf(stderr, "usage: rtbench [-p period] [-n periods] [-r rate] plugin.so ...\n");
+}
+
+int main(int argc, char **argv) {
+	unsigned long period = 64, n = 20000, rate = 48000, i;
+	double total_still = 0.0, total_changing = 0.0;
+	const LADSPA_Descriptor *desc;
+	LADSPA_Descriptor_Function df;
+	void *lib;
+	result r;
+	int opt, k;
+
+	while ((opt = getopt(argc, argv, "p:n:r:")) != -1) {
+		switch (opt) {
+		case 'p':
+			period = strtoul(optarg, NULL, 10);
+			break;
+		case 'n':
+			n = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			rate = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+	if (optind >= argc || period == 0 || n == 0 || rate == 0) {
+		usage();
+		return 1;
+	}
+
+	printf("%lu frames per period at %lu Hz, %lu periods\n\n", period, rate, n);
+	printf("%-16s %12s %12s %8s\n", "plugin", "still (ns)", "moving (ns)", "saved");
+	for (k = optind; k < argc; k++) {
+		if ((lib = dlopen(argv[k], RTLD_NOW | RTLD_LOCAL)) == NULL) {
+			fprintf(stderr, "rtbench: %s\n", dlerror());
+			continue;
+		}
+		*(void **) (&df) = dlsym(lib, "ladspa_descriptor");
+		if (df == NULL) {
+			fprintf(stderr, "rtbench: %s: not a LADSPA plugin\n", argv[k]);
+			dlclose(lib);
+			continue;
+		}
+		for (i = 0; (desc = df(i)) != NULL; i++) {
+			if (bench(desc, rate, period, n, &r))
+				continue;
+			printf("%-16s %12.1f %12.1f %7.1f%%\n", desc->Label, r.still, r.changing,
+			       100.0 * (r.changing - r.still) / r.changing);
+			total_still += r.still;
+			total_changing += r.changing;
+		}
+		dlclose(lib);
+	}
+	if (total_changing > 0.0)
+		printf("%-16s %12.1f %12.1f %7.1f%%\n", "total", total_still, total_changing,
+		       100.0 * (total_changing - total_still) / total_changing);
+	return 0;
+}